@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A pool of worker threads with one job queue per worker. A worker pops
+// jobs from the back of its own queue and, when it runs dry, steals from
+// the front of the others. The thread that waits for a batch of jobs
+// helps executing them instead of sleeping.
+class job_system
+{
+public:
+	using job = std::function<void()>;
+
+	// Number of jobs of a batch that are not finished yet
+	struct counter
+	{
+		std::atomic<std::size_t> pending{0};
+	};
+
+	// `threads` counts the calling thread too, so job_system(1) runs everything inline
+	explicit job_system(std::size_t threads = std::thread::hardware_concurrency());
+	~job_system();
+
+	job_system(job_system const &) = delete;
+	job_system & operator = (job_system const &) = delete;
+
+	// Workers plus the calling thread
+	std::size_t thread_count() const { return workers_.size() + 1; }
+
+	void submit(job j, counter & c);
+
+	// Runs jobs until all jobs counted by `c` are done
+	void wait(counter & c);
+
+	// Calls f(chunk, begin, end) for consecutive chunks of [0, count) of at most `grain`
+	// elements and waits for all of them; chunk indices go from 0 to chunk_count(count, grain)
+	void parallel_for(std::size_t count, std::size_t grain, std::function<void(std::size_t chunk, std::size_t begin, std::size_t end)> const & f);
+
+	static std::size_t chunk_count(std::size_t count, std::size_t grain) { return (count + grain - 1) / grain; }
+
+private:
+	struct queue
+	{
+		std::mutex mutex;
+		std::deque<std::pair<job, counter *>> jobs;
+	};
+
+	std::vector<std::unique_ptr<queue>> queues_;
+	std::vector<std::thread> workers_;
+
+	std::mutex sleep_mutex_;
+	std::condition_variable wake_;
+	std::atomic<std::size_t> queued_{0};
+	std::atomic<std::size_t> next_queue_{0};
+	bool stop_ = false;
+
+	bool try_run(std::size_t home);
+	void worker_loop(std::size_t index);
+};
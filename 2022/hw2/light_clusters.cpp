@@ -0,0 +1,184 @@
+#include "light_clusters.hpp"
+
+#include <glm/vec4.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LIGHT_CLUSTERS_AVX2 1
+#define LIGHT_CLUSTERS_AVX2_TARGET __attribute__((target("avx2")))
+#elif defined(__AVX2__)
+#define LIGHT_CLUSTERS_AVX2 1
+#define LIGHT_CLUSTERS_AVX2_TARGET
+#endif
+
+#ifdef LIGHT_CLUSTERS_AVX2
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Lights per job of the first pass
+const std::size_t light_grain = 4096;
+
+bool has_avx2() {
+#if defined(LIGHT_CLUSTERS_AVX2) && defined(__GNUC__)
+  static const bool result = __builtin_cpu_supports("avx2");
+  return result;
+#elif defined(LIGHT_CLUSTERS_AVX2)
+  return true;
+#else
+  return false;
+#endif
+}
+
+int to_tile(float ndc, int tiles) {
+  return std::clamp((int) std::floor((ndc * 0.5f + 0.5f) * tiles), 0, tiles - 1);
+}
+
+}
+
+light_clusters::light_clusters(float near, job_system &jobs)
+    : near_(near), jobs_(jobs), lists_(cluster_count), grid_(cluster_count) {
+}
+
+int light_clusters::slice(float depth) const {
+  if (depth < near_)
+    return 0;
+  return std::min(slices - 1, 1 + (int) std::floor(std::log(depth / near_) * log_scale_));
+}
+
+float light_clusters::slice_begin(int slice) const {
+  if (slice <= 0)
+    return 0.f;
+  if (slice >= slices)
+    return far_;
+  return near_ * std::exp((slice - 1) / log_scale_);
+}
+
+void light_clusters::assign(const std::vector<point_light> &lights,
+                            const glm::mat4 &view,
+                            const glm::mat4 &projection,
+                            float far) {
+  far_ = far;
+  log_scale_ = (slices - 1) / std::log(far_ / near_);
+
+  const std::size_t count = lights.size();
+  const std::size_t padded = (count + 7) / 8 * 8;
+  depth_min_.assign(padded, std::numeric_limits<float>::max());
+  depth_max_.assign(padded, -std::numeric_limits<float>::max());
+  tiles_.resize(padded);
+
+  const float scale_x = projection[0][0];
+  const float scale_y = projection[1][1];
+
+  jobs_.parallel_for(count, light_grain, [&](std::size_t, std::size_t begin, std::size_t end) {
+    for (std::size_t i = begin; i < end; ++i) {
+      const auto &light = lights[i];
+      glm::vec4 center = view * glm::vec4(light.position, 1.f);
+      float depth = -center.z;
+      float r = light.radius;
+
+      if (depth + r <= 0.f || depth - r >= far_)
+        continue;
+
+      tile_range range{0, tiles_x - 1, 0, tiles_y - 1};
+
+      // A sphere that reaches the camera plane may cover any part of the screen
+      if (depth - r > 1e-3f) {
+        // x / depth is monotonic in both, so the extremes are at the corners of the sphere's box
+        float x_min = std::numeric_limits<float>::max(), x_max = -x_min;
+        float y_min = x_min, y_max = -x_min;
+        for (float d : {depth - r, depth + r}) {
+          for (float s : {-r, r}) {
+            x_min = std::min(x_min, scale_x * (center.x + s) / d);
+            x_max = std::max(x_max, scale_x * (center.x + s) / d);
+            y_min = std::min(y_min, scale_y * (center.y + s) / d);
+            y_max = std::max(y_max, scale_y * (center.y + s) / d);
+          }
+        }
+        if (x_max < -1.f || x_min > 1.f || y_max < -1.f || y_min > 1.f)
+          continue;
+        range = {to_tile(x_min, tiles_x), to_tile(x_max, tiles_x), to_tile(y_min, tiles_y), to_tile(y_max, tiles_y)};
+      }
+
+      depth_min_[i] = depth - r;
+      depth_max_[i] = depth + r;
+      tiles_[i] = range;
+    }
+  });
+
+  jobs_.parallel_for(slices, 1, [&](std::size_t, std::size_t begin, std::size_t end) {
+    for (std::size_t s = begin; s < end; ++s)
+      bin_slice((int) s, padded);
+  });
+
+  std::uint32_t offset = 0;
+  for (int c = 0; c < cluster_count; ++c) {
+    auto size = (std::uint32_t) lists_[c].size();
+    grid_[c] = {offset, size};
+    offset += size;
+  }
+  indices_.resize(offset);
+
+  jobs_.parallel_for(slices, 1, [&](std::size_t, std::size_t begin, std::size_t end) {
+    for (std::size_t c = begin * tiles_x * tiles_y; c < end * tiles_x * tiles_y; ++c)
+      std::copy(lists_[c].begin(), lists_[c].end(), indices_.begin() + grid_[c].x);
+  });
+}
+
+namespace {
+
+#ifdef LIGHT_CLUSTERS_AVX2
+
+// Bit i of the result is set if light begin + i overlaps [slice_begin, slice_end)
+LIGHT_CLUSTERS_AVX2_TARGET
+int overlap_mask_avx2(const float *depth_min, const float *depth_max, float slice_begin, float slice_end) {
+  __m256 lo = _mm256_loadu_ps(depth_min);
+  __m256 hi = _mm256_loadu_ps(depth_max);
+  __m256 overlap = _mm256_and_ps(_mm256_cmp_ps(lo, _mm256_set1_ps(slice_end), _CMP_LT_OQ),
+                                 _mm256_cmp_ps(hi, _mm256_set1_ps(slice_begin), _CMP_GT_OQ));
+  return _mm256_movemask_ps(overlap);
+}
+
+#endif
+
+int overlap_mask_scalar(const float *depth_min, const float *depth_max, float slice_begin, float slice_end) {
+  int mask = 0;
+  for (int i = 0; i < 8; ++i)
+    mask |= int(depth_min[i] < slice_end && depth_max[i] > slice_begin) << i;
+  return mask;
+}
+
+}
+
+void light_clusters::bin_slice(int slice, std::size_t light_count) {
+  const float begin = slice_begin(slice);
+  const float end = (slice + 1 == slices) ? std::numeric_limits<float>::max() : slice_begin(slice + 1);
+  auto *clusters = lists_.data() + slice * tiles_x * tiles_y;
+
+  for (int c = 0; c < tiles_x * tiles_y; ++c)
+    clusters[c].clear();
+
+  const bool avx2 = has_avx2();
+  for (std::size_t i = 0; i < light_count; i += 8) {
+#ifdef LIGHT_CLUSTERS_AVX2
+    int mask = avx2 ? overlap_mask_avx2(&depth_min_[i], &depth_max_[i], begin, end)
+                    : overlap_mask_scalar(&depth_min_[i], &depth_max_[i], begin, end);
+#else
+    int mask = overlap_mask_scalar(&depth_min_[i], &depth_max_[i], begin, end);
+#endif
+    for (int bit = 0; mask != 0; ++bit, mask >>= 1) {
+      if (!(mask & 1))
+        continue;
+
+      auto light = (std::uint32_t) (i + bit);
+      const auto &range = tiles_[light];
+      for (int y = range.y0; y <= range.y1; ++y)
+        for (int x = range.x0; x <= range.x1; ++x)
+          clusters[y * tiles_x + x].push_back(light);
+    }
+  }
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
+
+#include <cstdint>
+#include <vector>
+
+#include "job_system.hpp"
+
+// 32 bytes, so that a light is two RGBA32F texels of a texture buffer
+struct point_light {
+  glm::vec3 position;
+  float radius; // the light has no effect further than this
+  glm::vec3 color;
+  float intensity;
+};
+
+// Clustered light assignment. The view frustum is split into tiles_x * tiles_y
+// screen tiles and `slices` depth slices; slice 0 ends at `near`, the others are
+// spaced exponentially up to the far plane. Every cluster gets the list of
+// lights whose bounding sphere may reach it, so a fragment only loops over
+// the lights of its own cluster.
+//
+// Binning is done in two job passes: one over chunks of lights computes the
+// depth and tile range of every light, one over depth slices tests 8 lights at
+// a time against the slice (AVX2 when available) and fills the lists of the
+// slice's clusters. Lists are then concatenated into one index array.
+class light_clusters {
+ public:
+  static constexpr int tiles_x = 16;
+  static constexpr int tiles_y = 9;
+  static constexpr int slices = 24;
+  static constexpr int cluster_count = tiles_x * tiles_y * slices;
+
+  light_clusters(float near, job_system &jobs);
+
+  // `projection` must be a symmetric perspective projection, as glm::perspective makes
+  void assign(const std::vector<point_light> &lights, const glm::mat4 &view, const glm::mat4 &projection, float far);
+
+  // Depth slice of a view-space distance, and the distance where a slice starts
+  int slice(float depth) const;
+  float slice_begin(int slice) const;
+
+  float near() const { return near_; }
+  // slice = 1 + floor(log(depth / near) * log_scale()) for depth >= near
+  float log_scale() const { return log_scale_; }
+
+  // (offset into indices(), count) of every cluster, index (slice * tiles_y + y) * tiles_x + x
+  const std::vector<glm::uvec2> &grid() const { return grid_; }
+  const std::vector<std::uint32_t> &indices() const { return indices_; }
+
+ private:
+  struct tile_range {
+    int x0, x1, y0, y1;
+  };
+
+  float near_;
+  float far_ = 1.f;
+  float log_scale_ = 0.f;
+  job_system &jobs_;
+
+  // Per light, padded to a multiple of 8 with ranges that overlap nothing
+  std::vector<float> depth_min_;
+  std::vector<float> depth_max_;
+  std::vector<tile_range> tiles_;
+
+  std::vector<std::vector<std::uint32_t>> lists_;
+  std::vector<glm::uvec2> grid_;
+  std::vector<std::uint32_t> indices_;
+
+  void bin_slice(int slice, std::size_t light_count);
+};
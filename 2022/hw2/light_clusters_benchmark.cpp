@@ -0,0 +1,77 @@
+// Headless benchmark of the clustered light assignment: random lights in a
+// sponza-sized box, binned for a camera in the middle of it. Every thread count
+// must produce exactly the clusters of the single-threaded run.
+
+#include <glm/ext/matrix_transform.hpp>
+#include <glm/ext/matrix_clip_space.hpp>
+#include <glm/ext/scalar_constants.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "job_system.hpp"
+#include "light_clusters.hpp"
+
+int main() {
+  std::default_random_engine rng(42);
+  std::uniform_real_distribution<float> x(-1500.f, 1500.f), y(0.f, 1200.f), z(-700.f, 700.f);
+  std::uniform_real_distribution<float> radius(50.f, 200.f);
+
+  auto view = glm::lookAt(glm::vec3(-900, 150, 0), glm::vec3(0, 150, 0), glm::vec3(0, 1, 0));
+  auto projection = glm::perspective(glm::pi<float>() / 2.f, 16.f / 9.f, 0.01f, 5000.f);
+
+  // The same lights for every thread count, so that the results can be compared
+  const std::size_t counts[] = {1000, 4000, 16000};
+  std::vector<std::vector<point_light>> light_sets;
+  for (std::size_t count : counts) {
+    auto &lights = light_sets.emplace_back(count);
+    for (auto &light : lights)
+      light = {{x(rng), y(rng), z(rng)}, radius(rng), {1.f, 1.f, 1.f}, 1.f};
+  }
+
+  // What the single-threaded run produced for every light set
+  std::vector<std::vector<glm::uvec2>> expected_grid(light_sets.size());
+  std::vector<std::vector<std::uint32_t>> expected_indices(light_sets.size());
+  int failures = 0;
+
+  for (std::size_t threads : {std::size_t(1), std::size_t(4), std::size_t(std::thread::hardware_concurrency())}) {
+    job_system jobs(threads);
+    light_clusters clusters(10.f, jobs);
+
+    for (std::size_t set = 0; set < light_sets.size(); ++set) {
+      auto const &lights = light_sets[set];
+
+      const int frames = 50;
+      auto start = std::chrono::high_resolution_clock::now();
+      for (int i = 0; i < frames; ++i)
+        clusters.assign(lights, view, projection, 5000.f);
+      auto finish = std::chrono::high_resolution_clock::now();
+
+      std::size_t max_per_cluster = 0;
+      for (auto cell : clusters.grid())
+        max_per_cluster = std::max<std::size_t>(max_per_cluster, cell.y);
+
+      bool matches = true;
+      if (threads == 1) {
+        expected_grid[set] = clusters.grid();
+        expected_indices[set] = clusters.indices();
+      } else {
+        matches = clusters.grid() == expected_grid[set] && clusters.indices() == expected_indices[set];
+        failures += !matches;
+      }
+
+      std::cout << "threads " << jobs.thread_count()
+                << ", lights " << lights.size()
+                << ": " << std::chrono::duration<double, std::milli>(finish - start).count() / frames << " ms"
+                << ", indices " << clusters.indices().size()
+                << ", max per cluster " << max_per_cluster
+                << (matches ? "" : ", FAILED: differs from 1 thread")
+                << std::endl;
+    }
+  }
+
+  return failures == 0 ? 0 : 1;
+}
@@ -22,6 +22,9 @@
 #include <cmath>
 #include <fstream>
 #include <sstream>
+#include <algorithm>
+#include <numeric>
+#include <random>
 
 #include "shaders.hpp"
 #include "tiny_obj_loader.hpp"
@@ -32,11 +35,19 @@
 
 #include <glm/vec3.hpp>
 #include <glm/mat4x4.hpp>
+#include <glm/common.hpp>
 #include <glm/ext/matrix_transform.hpp>
 #include <glm/ext/matrix_clip_space.hpp>
 #include <glm/ext/scalar_constants.hpp>
 #include <glm/gtx/string_cast.hpp>
 
+#include "job_system.hpp"
+#include "occlusion_culler.hpp"
+#include "shadow_cascades.hpp"
+#include "point_shadow_cache.hpp"
+#include "light_clusters.hpp"
+#include "shadow_scheduler.hpp"
+
 const std::string log_path = "../log.txt";
 
 const auto pi = (float) acos(-1);
@@ -64,6 +75,11 @@ struct obj_data {
   std::vector<glm::vec3> bounding_box;
   glm::vec3 C; // центр bounding_box
   std::vector<size_t> alpha_ids;
+
+  // AABB of every shape, for occlusion culling
+  std::vector<glm::vec3> shape_min;
+  std::vector<glm::vec3> shape_max;
+  std::vector<bool> alpha_tested;
 };
 
 obj_data parse_scene(const tinyobj::attrib_t &attrib,
@@ -76,6 +92,9 @@ obj_data parse_scene(const tinyobj::attrib_t &attrib,
   std::vector<float> glossiness;
   std::vector<float> power;
   std::vector<size_t> alpha_ids;
+  std::vector<glm::vec3> shape_min;
+  std::vector<glm::vec3> shape_max;
+  std::vector<bool> alpha_tested;
 
   float x[2] = {std::numeric_limits<float>::max(), std::numeric_limits<float>::min()};
   float y[2] = {std::numeric_limits<float>::max(), std::numeric_limits<float>::min()};
@@ -90,6 +109,10 @@ obj_data parse_scene(const tinyobj::attrib_t &attrib,
     glossiness.push_back(materials[material_id].specular[0]);
     power.push_back(materials[material_id].shininess);
     alpha_ids.push_back(texture_keeper[materials[material_id].alpha_texname]);
+    alpha_tested.push_back(!materials[material_id].alpha_texname.empty());
+
+    glm::vec3 lo(std::numeric_limits<float>::max());
+    glm::vec3 hi(-std::numeric_limits<float>::max());
 
     for (size_t f = 0; f < shape.mesh.num_face_vertices.size(); ++f) {
       auto fv = size_t(shape.mesh.num_face_vertices[f]);
@@ -110,6 +133,9 @@ obj_data parse_scene(const tinyobj::attrib_t &attrib,
         z[0] = std::min(z[0], vz);
         z[1] = std::max(z[1], vz);
 
+        lo = glm::min(lo, glm::vec3(vx, vy, vz));
+        hi = glm::max(hi, glm::vec3(vx, vy, vz));
+
         assert(idx.normal_index >= 0);
         tinyobj::real_t nx = attrib.normals[3 * size_t(idx.normal_index) + 0];
         tinyobj::real_t ny = attrib.normals[3 * size_t(idx.normal_index) + 1];
@@ -135,6 +161,8 @@ obj_data parse_scene(const tinyobj::attrib_t &attrib,
         .l = start_index,
         .r = finish_index
     });
+    shape_min.push_back(lo);
+    shape_max.push_back(hi);
   }
 
   std::vector<glm::vec3> bounding_box;
@@ -153,8 +181,35 @@ obj_data parse_scene(const tinyobj::attrib_t &attrib,
       .power = power,
       .bounding_box = bounding_box,
       .C = C,
-      .alpha_ids = alpha_ids
+      .alpha_ids = alpha_ids,
+      .shape_min = shape_min,
+      .shape_max = shape_max,
+      .alpha_tested = alpha_tested
+  };
+}
+
+// Occluders are the opaque shapes with the largest bounding box faces (walls, floors, columns),
+// taken until the triangle budget runs out. Alpha-tested shapes have holes, so they never occlude.
+std::vector<bool> select_occluders(const obj_data &scene, size_t max_triangles) {
+  std::vector<size_t> order(scene.segments.size());
+  std::iota(order.begin(), order.end(), 0);
+
+  auto face_area = [&scene](size_t i) {
+    auto size = scene.shape_max[i] - scene.shape_min[i];
+    return std::max({size.x * size.y, size.y * size.z, size.z * size.x});
   };
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return face_area(a) > face_area(b); });
+
+  std::vector<bool> occluder(scene.segments.size(), false);
+  size_t triangles = 0;
+  for (auto i : order) {
+    size_t count = (scene.segments[i].r - scene.segments[i].l) / 3;
+    if (scene.alpha_tested[i] || triangles + count > max_triangles)
+      continue;
+    occluder[i] = true;
+    triangles += count;
+  }
+  return occluder;
 }
 
 struct Player {
@@ -242,10 +297,8 @@ int main(int argc, char **argv) try {
 
   /// *** Создаем шейдеры для тени от точечного источника
   auto point_shadow_vertex_shader = create_shader(GL_VERTEX_SHADER, point_shadow_vertex_shader_source.data());
-  auto point_shadow_geometry_shader = create_shader(GL_GEOMETRY_SHADER, point_shadow_geometry_shader_source.data());
   auto point_shadow_fragment_shader = create_shader(GL_FRAGMENT_SHADER, point_shadow_fragment_shader_source.data());
-  auto point_shadow_program =
-      create_program(point_shadow_vertex_shader, point_shadow_fragment_shader, point_shadow_geometry_shader);
+  auto point_shadow_program = create_program(point_shadow_vertex_shader, point_shadow_fragment_shader);
 
   /// *** Создаем шейдеры для тени от солнца
   auto shadow_vertex_shader = create_shader(GL_VERTEX_SHADER, shadow_vertex_shader_source.data());
@@ -266,6 +319,14 @@ int main(int argc, char **argv) try {
   GLuint point_light_attenuation_location = glGetUniformLocation(program, "point_light_attenuation");
   GLuint shadow_map_location = glGetUniformLocation(program, "shadow_map");
   GLuint transform_location = glGetUniformLocation(program, "transform");
+  GLuint cascade_far_location = glGetUniformLocation(program, "cascade_far");
+  GLuint clustered_location = glGetUniformLocation(program, "clustered");
+  GLuint viewport_size_location = glGetUniformLocation(program, "viewport_size");
+  GLuint cluster_near_location = glGetUniformLocation(program, "cluster_near");
+  GLuint cluster_log_scale_location = glGetUniformLocation(program, "cluster_log_scale");
+  GLuint cluster_lights_location = glGetUniformLocation(program, "cluster_lights");
+  GLuint cluster_grid_location = glGetUniformLocation(program, "cluster_grid");
+  GLuint cluster_indices_location = glGetUniformLocation(program, "cluster_indices");
   GLuint depthMap_location = glGetUniformLocation(program, "depthMap");
   GLuint far_plane_location = glGetUniformLocation(program, "far_plane");
 
@@ -327,22 +388,43 @@ int main(int argc, char **argv) try {
                                  (void *) 24); // текстурные координаты
   bindData(GL_ARRAY_BUFFER, vbo, vao, scene.vertices);
 
+  // *** Программный occlusion culling
+  job_system jobs;
+  occlusion_culler occlusion(320, 184, jobs);
+  auto is_occluder = select_occluders(scene, 20000);
+  {
+    std::vector<glm::vec3> occluder_triangles;
+    for (size_t j = 0; j < scene.segments.size(); ++j) {
+      if (!is_occluder[j]) continue;
+      for (auto v = scene.segments[j].l; v < scene.segments[j].r; ++v) {
+        const auto &p = scene.vertices[v].position;
+        occluder_triangles.emplace_back(p[0], p[1], p[2]);
+      }
+    }
+    Logger::log("[occluder_triangles] =", occluder_triangles.size() / 3);
+    occlusion.set_occluders(std::move(occluder_triangles));
+  }
+
   // *** Тень от солнца
   GLuint shadow_model_location = glGetUniformLocation(shadow_program, "model");
   GLuint shadow_transform_location = glGetUniformLocation(shadow_program, "transform");
   GLuint shadow_map_d_location = glGetUniformLocation(shadow_program, "map_d");
 
+  // Каскады: слой текстурного массива на каждый кусок фрустума камеры
   const int sun_texture_unit = 90; // переименовать, непонятное название
+  const int cascade_count = 3; // как CASCADE_COUNT в шейдере
+  const float cascade_lambda = 0.75f;
   GLsizei shadow_map_resolution = 1024;
   GLuint shadow_map;
   glGenTextures(1, &shadow_map);
   glActiveTexture(GL_TEXTURE0 + sun_texture_unit);
-  glBindTexture(GL_TEXTURE_2D, shadow_map);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, shadow_map_resolution, shadow_map_resolution, 0, GL_RGBA, GL_FLOAT, nullptr);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, shadow_map);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RG32F, shadow_map_resolution, shadow_map_resolution, cascade_count, 0,
+               GL_RGBA, GL_FLOAT, nullptr);
 
   GLuint rbo;
   glGenRenderbuffers(1, &rbo);
@@ -352,7 +434,7 @@ int main(int argc, char **argv) try {
   GLuint shadow_fbo;
   glGenFramebuffers(1, &shadow_fbo);
   glBindFramebuffer(GL_FRAMEBUFFER, shadow_fbo);
-  glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, shadow_map, 0);
+  glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, shadow_map, 0, 0);
   glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rbo);
 
   if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
@@ -371,7 +453,7 @@ int main(int argc, char **argv) try {
   const int point_shadow_texture_unit = 95;
   glUseProgram(point_shadow_program);
   GLuint point_shadow_model_location = glGetUniformLocation(point_shadow_program, "model");
-  GLuint point_shadow_shadow_matrices_location = glGetUniformLocation(point_shadow_program, "shadowMatrices");
+  GLuint point_shadow_shadow_matrix_location = glGetUniformLocation(point_shadow_program, "shadowMatrix");
   GLuint point_shadow_light_pos_location = glGetUniformLocation(point_shadow_program, "lightPos");
   GLuint point_shadow_far_plane_location = glGetUniformLocation(point_shadow_program, "far_plane");
 
@@ -399,11 +481,73 @@ int main(int argc, char **argv) try {
   glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
   // attach depth texture as FBO's depth buffer
   glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-  glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthCubemap, 0);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X, depthCubemap, 0);
   glDrawBuffer(GL_NONE);
   glReadBuffer(GL_NONE);
   if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
     throw std::runtime_error("Incomplete framebuffer!");
+
+  // Грани рисуются по одной и только когда устарели: ещё не нарисованы или источник сдвинулся.
+  // Сцена статична, так что больше их ничего не портит
+  float near2 = 0.01;
+  float far2 = 1000.f;
+  point_shadow_cache point_shadow(near2, far2);
+
+  // Не больше shadow_budget перерисовок теней (каскад или грань) за кадр, остальные берутся с прошлых кадров.
+  // Ближние каскады занимают больше экрана, поэтому важнее
+  const int shadow_budget = 3;
+  shadow_scheduler shadow_updates(shadow_budget);
+  std::vector<int> cascade_views(cascade_count), face_views(point_shadow_cache::face_count);
+  for (int c = 0; c < cascade_count; ++c)
+    cascade_views[c] = shadow_updates.add_view((float) (1 << (cascade_count - 1 - c)));
+  for (auto &v : face_views)
+    v = shadow_updates.add_view(1.f);
+  // Матрицы, с которыми каскады нарисованы на самом деле
+  std::vector<glm::mat4> rendered_transforms(cascade_count, glm::mat4(1.f));
+  // Граница каскада, с которой он нарисован: шейдер выбирает каскад по ней, а не по текущей
+  std::vector<float> rendered_cascade_far(cascade_count, 0.f);
+
+  /// *** Много точечных источников без теней, clustered forward; включается клавишей C
+  const int cluster_texture_unit = 96; // 96, 97, 98
+  const size_t cluster_light_count = 2048;
+  light_clusters clusters(10.f, jobs);
+  bool clustered = false;
+
+  std::vector<point_light> lights(cluster_light_count);
+  std::vector<glm::vec3> light_origins(cluster_light_count);
+  std::vector<float> light_phases(cluster_light_count);
+  {
+    std::default_random_engine rng;
+    auto lo = scene.bounding_box.front();
+    auto hi = scene.bounding_box.back();
+    std::uniform_real_distribution<float> unit(0.f, 1.f);
+    for (size_t i = 0; i < cluster_light_count; ++i) {
+      light_origins[i] = lo + (hi - lo) * glm::vec3(unit(rng), 0.4f * unit(rng), unit(rng));
+      light_phases[i] = 2 * pi * unit(rng);
+      lights[i].radius = 100.f + 100.f * unit(rng);
+      lights[i].color = glm::normalize(glm::vec3(unit(rng), unit(rng), unit(rng)));
+      lights[i].intensity = 1.f;
+    }
+  }
+
+  // Текстурные буферы: источники, (offset, count) кластеров и списки индексов
+  GLuint cluster_buffers[3], cluster_textures[3];
+  const GLenum cluster_formats[3] = {GL_RGBA32F, GL_RG32UI, GL_R32UI};
+  glGenBuffers(3, cluster_buffers);
+  glGenTextures(3, cluster_textures);
+  for (int k = 0; k < 3; ++k) {
+    glBindBuffer(GL_TEXTURE_BUFFER, cluster_buffers[k]);
+    glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_DYNAMIC_DRAW);
+    glActiveTexture(GL_TEXTURE0 + cluster_texture_unit + k);
+    glBindTexture(GL_TEXTURE_BUFFER, cluster_textures[k]);
+    glTexBuffer(GL_TEXTURE_BUFFER, cluster_formats[k], cluster_buffers[k]);
+  }
+
+  auto upload_cluster_buffer = [&](int k, const auto &data) {
+    glBindBuffer(GL_TEXTURE_BUFFER, cluster_buffers[k]);
+    glBufferData(GL_TEXTURE_BUFFER, std::max<size_t>(sizeof(data[0]) * data.size(), 16), nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, sizeof(data[0]) * data.size(), data.data());
+  };
   /////////////////////////////////////////////////////////////////////////
 
   float time = 0.f;
@@ -439,7 +583,6 @@ int main(int argc, char **argv) try {
     }
   };
 
-  int shift = 2;
   while (true) {
     poll_events();
     if (!running) break;
@@ -468,69 +611,42 @@ int main(int argc, char **argv) try {
     glm::vec3 camera_position = (glm::inverse(view) * glm::vec4(0.f, 0.f, 0.f, 1.f)).xyz();
     glm::vec3 light_direction = sun_direction;
 
-    auto light_z = -light_direction;
-    auto light_x = glm::normalize(glm::cross(light_z, {0.f, 1.f, 0.f}));
-    auto light_y = glm::cross(light_x, light_z);
-
-    float dz = 0;
-    float dx = 0;
-    float dy = 0;
-    auto C = scene.C;
-    for (auto V : scene.bounding_box) {
-      auto vec = V - C;
-      dz = std::max(dz, glm::dot(vec, light_z));
-      dx = std::max(dx, glm::dot(vec, light_x));
-      dy = std::max(dy, glm::dot(vec, light_y));
-    }
-
-    glm::mat4 transform = glm::inverse(glm::mat4({
-                                                     {dx * light_x.x, dx * light_x.y, dx * light_x.z, 0.f},
-                                                     {dy * light_y.x, dy * light_y.y, dy * light_y.z, 0.f},
-                                                     {dz * light_z.x, dz * light_z.y, dz * light_z.z, 0.f},
-                                                     {C.x, C.y, C.z, 1.f}
-                                                 }));
+    float fovy = glm::pi<float>() / 2.f;
+    float aspect = (1.f * width) / height;
+    // За самым дальним углом сцены теней нет, каскады туда не тянем
+    float shadow_far = near;
+    for (auto const &corner : scene.bounding_box)
+      shadow_far = std::max(shadow_far, glm::distance(camera_position, corner));
+    shadow_far = std::min(far, shadow_far);
+    auto splits = cascade_splits(near, shadow_far, cascade_count, cascade_lambda);
+    std::vector<glm::mat4> transforms(cascade_count);
+    for (int c = 0; c < cascade_count; ++c)
+      transforms[c] = fit_cascade(view, fovy, aspect, splits[c], splits[c + 1], light_direction,
+                                  scene.bounding_box, shadow_map_resolution);
 
     auto point_light_position = glm::vec3(std::sin(time * 0.5f) * 900, 100.f, std::cos(time * 0.5f) * 400);
 
-    // *** Точечный источник, тень
-    float near2 = 0.01;
-    float far2 = 1000.f;
-    glm::mat4
-        shadowProj = glm::perspective(glm::radians(90.0f), (float) SHADOW_WIDTH / (float) SHADOW_HEIGHT, near2, far2);
-    std::vector<glm::mat4> shadowTransforms;
-    shadowTransforms.push_back(shadowProj * glm::lookAt(point_light_position,
-                                                        point_light_position + glm::vec3(1.0f, 0.0f, 0.0f),
-                                                        glm::vec3(0.0f, -1.0f, 0.0f)));
-    shadowTransforms.push_back(shadowProj * glm::lookAt(point_light_position,
-                                                        point_light_position + glm::vec3(-1.0f, 0.0f, 0.0f),
-                                                        glm::vec3(0.0f, -1.0f, 0.0f)));
-    shadowTransforms.push_back(shadowProj * glm::lookAt(point_light_position,
-                                                        point_light_position + glm::vec3(0.0f, 1.0f, 0.0f),
-                                                        glm::vec3(0.0f, 0.0f, 1.0f)));
-    shadowTransforms.push_back(shadowProj * glm::lookAt(point_light_position,
-                                                        point_light_position + glm::vec3(0.0f, -1.0f, 0.0f),
-                                                        glm::vec3(0.0f, 0.0f, -1.0f)));
-    shadowTransforms.push_back(shadowProj * glm::lookAt(point_light_position,
-                                                        point_light_position + glm::vec3(0.0f, 0.0f, 1.0f),
-                                                        glm::vec3(0.0f, -1.0f, 0.0f)));
-    shadowTransforms.push_back(shadowProj * glm::lookAt(point_light_position,
-                                                        point_light_position + glm::vec3(0.0f, 0.0f, -1.0f),
-                                                        glm::vec3(0.0f, -1.0f, 0.0f)));
-
-    if (button_down[SDLK_v]) {
-      shift = (shift + 1) % 6;
-      Logger::log("shift =", shift);
+    // *** Выбираем, какие каскады и грани перерисовать в этом кадре
+    point_shadow.set_light(point_light_position);
+    for (int c = 0; c < cascade_count; ++c) {
+      float change = cascade_change(rendered_transforms[c], transforms[c], shadow_map_resolution);
+      // Граница сдвинулась вместе с камерой - старая матрица может не покрыть новый кусок фрустума
+      if (rendered_cascade_far[c] != splits[c + 1])
+        change = std::max(change, 1.f);
+      shadow_updates.set_change(cascade_views[c], change);
     }
+    for (int face = 0; face < point_shadow_cache::face_count; ++face)
+      shadow_updates.set_change(face_views[face], point_shadow.change(face));
 
-    //std::rotate(shadowTransforms.begin(), shadowTransforms.begin() + shift, shadowTransforms.end());
-    /////////////////////////////////////////////////////////////////////////
-    glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-    glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-    glClear(GL_DEPTH_BUFFER_BIT);
+    std::vector<bool> update_view(cascade_count + point_shadow_cache::face_count, false);
+    for (int v : shadow_updates.schedule())
+      update_view[v] = true;
 
-    glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    // *** Точечный источник, тень: каждая грань только со своими shape
 
+    glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
+    glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
+    glEnable(GL_DEPTH_TEST);
     glUseProgram(point_shadow_program);
     glUniformMatrix4fv(point_shadow_model_location, 1, GL_FALSE, reinterpret_cast<const GLfloat *>(&model));
     glUniform1f(point_shadow_far_plane_location, far2);
@@ -538,22 +654,29 @@ int main(int argc, char **argv) try {
                 point_light_position.x,
                 point_light_position.y,
                 point_light_position.z);
-    for (size_t i = 0; i < 6; ++i) {
-      std::string name = "shadowMatrices[" + std::to_string(i) + "]";
-      auto loc = glGetUniformLocation(point_shadow_program, name.data());
-      glUniformMatrix4fv(loc, 1, GL_FALSE,
-                         reinterpret_cast<GLfloat *>(&shadowTransforms[i]));
-    }
-    glUniformMatrix4fv(point_shadow_shadow_matrices_location, 6, GL_FALSE,
-                       reinterpret_cast<const GLfloat *>(shadowTransforms.data()));
     glBindVertexArray(vao);
-    glDrawArrays(GL_TRIANGLES, 0, scene.vertices.size());
 
+    for (int face = 0; face < point_shadow_cache::face_count; ++face) {
+      if (!update_view[face_views[face]])
+        continue;
+
+      glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, depthCubemap, 0);
+      glClear(GL_DEPTH_BUFFER_BIT);
+      glUniformMatrix4fv(point_shadow_shadow_matrix_location, 1, GL_FALSE,
+                         reinterpret_cast<const GLfloat *>(&point_shadow.transform(face)));
 
-    // Рисуем сцену в shadow_map солнца
+      for (int j = 0; const auto &i : scene.segments) {
+        if (point_shadow.touches(face, scene.shape_min[j], scene.shape_max[j]))
+          glDrawArrays(GL_TRIANGLES, i.l, i.r - i.l);
+        j++;
+      }
+      point_shadow.mark_rendered(face);
+      shadow_updates.mark_rendered(face_views[face]);
+    }
+
+    // Рисуем сцену в shadow_map солнца, в каждый каскад только то, что в него попадает
     glBindFramebuffer(GL_FRAMEBUFFER, shadow_fbo);
     glClearColor(1.f, 1.f, 0.f, 0.f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     glViewport(0, 0, shadow_map_resolution, shadow_map_resolution);
     glEnable(GL_DEPTH_TEST);
     glDepthFunc(GL_LEQUAL);
@@ -561,18 +684,68 @@ int main(int argc, char **argv) try {
     glCullFace(GL_BACK);
     glUseProgram(shadow_program);
     glUniformMatrix4fv(shadow_model_location, 1, GL_FALSE, reinterpret_cast<float *>(&model));
-    glUniformMatrix4fv(shadow_transform_location, 1, GL_FALSE, reinterpret_cast<float *>(&transform));
     glBindVertexArray(vao);
 
-    for (int j = 0; const auto &i : scene.segments) {
-      glUniform1i(shadow_map_d_location, scene.alpha_ids[j]);
-      glDrawArrays(GL_TRIANGLES, i.l, i.r - i.l);
-      j++;
+    bool sun_updated = false;
+    for (int c = 0; c < cascade_count; ++c) {
+      if (!update_view[cascade_views[c]])
+        continue;
+
+      glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, shadow_map, 0, c);
+      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+      glUniformMatrix4fv(shadow_transform_location, 1, GL_FALSE, reinterpret_cast<float *>(&transforms[c]));
+
+      for (int j = 0; const auto &i : scene.segments) {
+        if (box_in_cascade(transforms[c], scene.shape_min[j], scene.shape_max[j])) {
+          glUniform1i(shadow_map_d_location, scene.alpha_ids[j]);
+          glDrawArrays(GL_TRIANGLES, i.l, i.r - i.l);
+        }
+        j++;
+      }
+
+      rendered_transforms[c] = transforms[c];
+      rendered_cascade_far[c] = splits[c + 1];
+      shadow_updates.mark_rendered(cascade_views[c]);
+      sun_updated = true;
+    }
+
+    if (sun_updated) {
+      glBindTexture(GL_TEXTURE_2D_ARRAY, shadow_map);
+      glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    }
+
+    // Растеризуем окклюдеры, затем проверяем bounding box каждого shape
+    occlusion.render(projection * view);
+    std::vector<bool> shape_visible(scene.segments.size());
+    for (size_t j = 0; j < scene.segments.size(); ++j)
+      shape_visible[j] = is_occluder[j] || occlusion.visible(scene.shape_min[j], scene.shape_max[j]);
+
+    if (button_down[SDLK_o]) {
+      button_down[SDLK_o] = false;
+      const auto &stats = occlusion.statistics();
+      occlusion.dump("occlusion_depth.pgm");
+      Logger::log("[occlusion] triangles =", stats.occluder_triangles);
+      Logger::log("[occlusion] tested =", stats.tested);
+      Logger::log("[occlusion] culled =", stats.culled);
+      Logger::log("[occlusion] raster_ms =", stats.raster_ms);
+      Logger::log("[shadows] stale views =", shadow_updates.stale(), "budget =", shadow_updates.budget());
+    }
+
+    if (button_down[SDLK_c]) {
+      button_down[SDLK_c] = false;
+      clustered = !clustered;
+      Logger::log("[clustered] =", clustered);
     }
-    glDrawArrays(GL_TRIANGLES, 0, scene.vertices.size());
 
-    glBindTexture(GL_TEXTURE_2D, shadow_map);
-    glGenerateMipmap(GL_TEXTURE_2D);
+    if (clustered) {
+      for (size_t i = 0; i < cluster_light_count; ++i)
+        lights[i].position = light_origins[i] + glm::vec3(0.f, 50.f * std::sin(time + light_phases[i]), 0.f);
+
+      clusters.assign(lights, view, projection, far);
+      upload_cluster_buffer(0, lights);
+      upload_cluster_buffer(1, clusters.grid());
+      upload_cluster_buffer(2, clusters.indices());
+    }
 
     // Рисуем сцену на экран
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
@@ -591,7 +764,8 @@ int main(int argc, char **argv) try {
     glUniform1f(far_plane_location, far2);
 
     glUniform1i(shadow_map_location, sun_texture_unit);
-    glUniformMatrix4fv(transform_location, 1, GL_FALSE, reinterpret_cast<float *>(&transform));
+    glUniformMatrix4fv(transform_location, cascade_count, GL_FALSE, reinterpret_cast<float *>(rendered_transforms.data()));
+    glUniform1fv(cascade_far_location, cascade_count, rendered_cascade_far.data());
     glUniformMatrix4fv(model_location, 1, GL_FALSE, reinterpret_cast<float *>(&model));
     glUniformMatrix4fv(view_location, 1, GL_FALSE, reinterpret_cast<float *>(&view));
     glUniformMatrix4fv(projection_location, 1, GL_FALSE, reinterpret_cast<float *>(&projection));
@@ -601,9 +775,20 @@ int main(int argc, char **argv) try {
     glUniform3f(point_light_position_location, point_light_position.x, point_light_position.y, point_light_position.z);
     glUniform3f(point_light_color_location, 0.0f, 0.9f, 0.0f);
     glUniform3f(point_light_attenuation_location, 0.001f, 0.0001f, 0.00001f);
+    glUniform1i(clustered_location, clustered);
+    glUniform2f(viewport_size_location, (float) width, (float) height);
+    glUniform1f(cluster_near_location, clusters.near());
+    glUniform1f(cluster_log_scale_location, clusters.log_scale());
+    glUniform1i(cluster_lights_location, cluster_texture_unit);
+    glUniform1i(cluster_grid_location, cluster_texture_unit + 1);
+    glUniform1i(cluster_indices_location, cluster_texture_unit + 2);
     glBindVertexArray(vao);
 
     for (int j = 0; const auto &i : scene.segments) {
+      if (!shape_visible[j]) {
+        j++;
+        continue;
+      }
       glUniform1i(sampler_location, scene.texture_ids[j]);
       glUniform1f(power_location, scene.power[j]);
       glUniform1f(glossiness_location, scene.glossiness[j]);
@@ -0,0 +1,65 @@
+// Headless check of the software occlusion culler: a wall in front of the camera,
+// boxes behind it, in front of it and beside it. Prints the statistics and writes
+// the depth buffer to occlusion_depth.pgm.
+
+#include <glm/ext/matrix_transform.hpp>
+#include <glm/ext/matrix_clip_space.hpp>
+#include <glm/ext/scalar_constants.hpp>
+
+#include <chrono>
+#include <iostream>
+
+#include "job_system.hpp"
+#include "occlusion_culler.hpp"
+
+namespace {
+
+void add_quad(std::vector<glm::vec3> &out, glm::vec3 a, glm::vec3 b, glm::vec3 c, glm::vec3 d) {
+  out.insert(out.end(), {a, b, c, a, c, d});
+}
+
+int failures = 0;
+
+void expect(bool value, const char *what) {
+  std::cout << (value ? "ok      " : "FAILED  ") << what << std::endl;
+  if (!value) ++failures;
+}
+
+}
+
+int main() {
+  job_system jobs;
+  occlusion_culler culler(320, 180, jobs);
+
+  // Wall at z = -10, 20 wide and 10 high, plus a floor that reaches behind the camera
+  std::vector<glm::vec3> occluders;
+  add_quad(occluders, {-10, -5, -10}, {10, -5, -10}, {10, 5, -10}, {-10, 5, -10});
+  add_quad(occluders, {-50, -5, 10}, {50, -5, 10}, {50, -5, -100}, {-50, -5, -100});
+  culler.set_occluders(occluders);
+
+  auto view = glm::lookAt(glm::vec3(0, 0, 0), glm::vec3(0, 0, -1), glm::vec3(0, 1, 0));
+  auto projection = glm::perspective(glm::pi<float>() / 2.f, 16.f / 9.f, 0.1f, 1000.f);
+  culler.render(projection * view);
+
+  expect(!culler.visible({-1, -1, -30}, {1, 1, -20}), "box behind the wall is culled");
+  expect(culler.visible({-1, -1, -8}, {1, 1, -6}), "box in front of the wall is visible");
+  expect(culler.visible({-1, 8, -30}, {1, 12, -20}), "box sticking out above the wall is visible");
+  expect(culler.visible({30, -1, -30}, {32, 1, -20}), "box beside the wall is visible");
+  expect(!culler.visible({-1, -9, -30}, {1, -6, -20}), "box below the floor is culled");
+  expect(culler.visible({-1, -1, -1}, {1, 1, 1}), "box around the camera is visible");
+
+  const int frames = 100;
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < frames; ++i)
+    culler.render(projection * view);
+  auto finish = std::chrono::high_resolution_clock::now();
+
+  const auto &stats = culler.statistics();
+  std::cout << "threads " << jobs.thread_count()
+            << ", triangles " << stats.occluder_triangles
+            << ", render " << std::chrono::duration<double, std::milli>(finish - start).count() / frames << " ms"
+            << std::endl;
+
+  culler.dump("occlusion_depth.pgm");
+  return failures == 0 ? 0 : 1;
+}
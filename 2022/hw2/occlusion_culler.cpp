@@ -0,0 +1,384 @@
+#include "occlusion_culler.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OCCLUSION_AVX2 1
+#define OCCLUSION_AVX2_TARGET __attribute__((target("avx2,fma")))
+#elif defined(__AVX2__)
+#define OCCLUSION_AVX2 1
+#define OCCLUSION_AVX2_TARGET
+#endif
+
+#ifdef OCCLUSION_AVX2
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Triangles per setup job
+const std::size_t setup_grain = 1024;
+
+bool has_avx2() {
+#if defined(OCCLUSION_AVX2) && defined(__GNUC__)
+  static const bool result = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  return result;
+#elif defined(OCCLUSION_AVX2)
+  return true;
+#else
+  return false;
+#endif
+}
+
+int round_up(int value, int multiple) {
+  return (value + multiple - 1) / multiple * multiple;
+}
+
+}
+
+occlusion_culler::occlusion_culler(int width, int height, job_system &jobs)
+    : width_(round_up(std::max(width, 1), tile_size)),
+      height_(round_up(std::max(height, 1), tile_size)),
+      tiles_x_(width_ / tile_size),
+      tiles_y_(height_ / tile_size),
+      jobs_(jobs),
+      depth_(width_ * height_, 1.f),
+      tile_max_(tiles_x_ * tiles_y_, 1.f) {
+}
+
+void occlusion_culler::set_occluders(std::vector<glm::vec3> triangles) {
+  occluders_ = std::move(triangles);
+
+  // An edge that two occluder triangles share lies inside the occluder surface, not on its silhouette
+  struct edge {
+    std::array<float, 6> key;
+    std::size_t vertex; // the edge goes from this vertex to the next one of its triangle
+  };
+  std::vector<edge> edges(occluders_.size());
+  for (std::size_t i = 0; i < occluders_.size(); ++i) {
+    const glm::vec3 &p = occluders_[i];
+    const glm::vec3 &q = occluders_[i - i % 3 + (i + 1) % 3];
+    std::array<float, 3> a = {p.x, p.y, p.z}, b = {q.x, q.y, q.z};
+    if (b < a)
+      std::swap(a, b);
+    edges[i] = {{a[0], a[1], a[2], b[0], b[1], b[2]}, i};
+  }
+  std::sort(edges.begin(), edges.end(), [](const edge &l, const edge &r) { return l.key < r.key; });
+
+  occluder_interior_.assign(occluders_.size() / 3, 0);
+  for (std::size_t i = 0; i < edges.size(); ++i) {
+    bool shared = (i > 0 && edges[i - 1].key == edges[i].key) ||
+                  (i + 1 < edges.size() && edges[i + 1].key == edges[i].key);
+    if (shared)
+      occluder_interior_[edges[i].vertex / 3] |= 1 << (edges[i].vertex % 3);
+  }
+}
+
+void occlusion_culler::setup(const glm::vec4 &c0, const glm::vec4 &c1, const glm::vec4 &c2, unsigned interior,
+                             std::vector<triangle> &out) const {
+  std::array<glm::vec3, 3> v;
+  const glm::vec4 *clip[3] = {&c0, &c1, &c2};
+  for (int i = 0; i < 3; ++i) {
+    glm::vec3 ndc = glm::vec3(*clip[i]) / clip[i]->w;
+    v[i] = {(ndc.x * 0.5f + 0.5f) * width_, (ndc.y * 0.5f + 0.5f) * height_, ndc.z * 0.5f + 0.5f};
+  }
+
+  float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[2].x - v[0].x) * (v[1].y - v[0].y);
+  if (std::abs(area) < 1e-6f)
+    return;
+
+  // Occluders hide what is behind them from both sides, so clockwise triangles are flipped instead of culled
+  if (area < 0.f) {
+    std::swap(v[1], v[2]);
+    area = -area;
+    // Edges 0-1 and 2-0 swap places, 1-2 only changes direction
+    interior = ((interior & 1) << 2) | (interior & 2) | ((interior >> 2) & 1);
+  }
+
+  triangle t;
+  for (int i = 0; i < 3; ++i) {
+    const auto &p = v[i];
+    const auto &q = v[(i + 1) % 3];
+    t.edge_a[i] = p.y - q.y;
+    t.edge_b[i] = q.x - p.x;
+    t.edge_c[i] = -(t.edge_a[i] * p.x + t.edge_b[i] * p.y);
+    // Silhouette edges are tested at the pixel corner farthest inside them, so only pixels the triangle
+    // covers completely are written. Interior edges keep the centre test: a pixel straddling one is
+    // written by exactly one of its two triangles instead of leaving a crack between them
+    if (!(interior & (1u << i)))
+      t.edge_c[i] -= 0.5f * (std::abs(t.edge_a[i]) + std::abs(t.edge_b[i]));
+  }
+
+  t.depth_x = ((v[1].z - v[0].z) * (v[2].y - v[0].y) - (v[2].z - v[0].z) * (v[1].y - v[0].y)) / area;
+  t.depth_y = ((v[2].z - v[0].z) * (v[1].x - v[0].x) - (v[1].z - v[0].z) * (v[2].x - v[0].x)) / area;
+  t.depth_0 = v[0].z - t.depth_x * v[0].x - t.depth_y * v[0].y;
+  // The depth written at the centre is the farthest the plane gets over the whole pixel
+  t.depth_0 += 0.5f * (std::abs(t.depth_x) + std::abs(t.depth_y));
+
+  float min_x = std::min({v[0].x, v[1].x, v[2].x});
+  float max_x = std::max({v[0].x, v[1].x, v[2].x});
+  float min_y = std::min({v[0].y, v[1].y, v[2].y});
+  float max_y = std::max({v[0].y, v[1].y, v[2].y});
+
+  t.min_x = std::max(0, (int) std::floor(min_x));
+  t.max_x = std::min(width_ - 1, (int) std::ceil(max_x));
+  t.min_y = std::max(0, (int) std::floor(min_y));
+  t.max_y = std::min(height_ - 1, (int) std::ceil(max_y));
+
+  if (t.min_x > t.max_x || t.min_y > t.max_y)
+    return;
+
+  out.push_back(t);
+}
+
+namespace {
+
+void rasterize_rows_scalar(const float *edge_a, const float *edge_b, const float *edge_c,
+                           float depth_x, float depth_y, float depth_0,
+                           int x_begin, int x_end, int y_begin, int y_end,
+                           float *depth, int width) {
+  for (int y = y_begin; y <= y_end; ++y) {
+    float py = y + 0.5f;
+    float *row = depth + y * width;
+    for (int x = x_begin; x <= x_end; ++x) {
+      float px = x + 0.5f;
+      bool inside = true;
+      for (int i = 0; i < 3; ++i)
+        inside &= (edge_a[i] * px + edge_b[i] * py + edge_c[i] >= 0.f);
+      if (inside)
+        row[x] = std::min(row[x], depth_x * px + depth_y * py + depth_0);
+    }
+  }
+}
+
+#ifdef OCCLUSION_AVX2
+
+OCCLUSION_AVX2_TARGET
+void rasterize_rows_avx2(const float *edge_a, const float *edge_b, const float *edge_c,
+                         float depth_x, float depth_y, float depth_0,
+                         int x_begin, int x_end, int y_begin, int y_end,
+                         float *depth, int width) {
+  const __m256 lane = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 a0 = _mm256_set1_ps(edge_a[0]), a1 = _mm256_set1_ps(edge_a[1]), a2 = _mm256_set1_ps(edge_a[2]);
+  const __m256 dx = _mm256_set1_ps(depth_x);
+
+  // Rows are a multiple of 8 pixels wide, so an aligned start never runs past the row
+  x_begin &= ~7;
+
+  for (int y = y_begin; y <= y_end; ++y) {
+    float py = y + 0.5f;
+    const __m256 r0 = _mm256_set1_ps(edge_b[0] * py + edge_c[0]);
+    const __m256 r1 = _mm256_set1_ps(edge_b[1] * py + edge_c[1]);
+    const __m256 r2 = _mm256_set1_ps(edge_b[2] * py + edge_c[2]);
+    const __m256 rz = _mm256_set1_ps(depth_y * py + depth_0);
+    float *row = depth + y * width;
+
+    for (int x = x_begin; x <= x_end; x += 8) {
+      __m256 px = _mm256_add_ps(_mm256_set1_ps((float) x), lane);
+      __m256 inside = _mm256_cmp_ps(_mm256_fmadd_ps(a0, px, r0), zero, _CMP_GE_OQ);
+      inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_fmadd_ps(a1, px, r1), zero, _CMP_GE_OQ));
+      inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_fmadd_ps(a2, px, r2), zero, _CMP_GE_OQ));
+      if (_mm256_testz_ps(inside, inside))
+        continue;
+
+      __m256 old = _mm256_loadu_ps(row + x);
+      __m256 z = _mm256_fmadd_ps(dx, px, rz);
+      _mm256_storeu_ps(row + x, _mm256_blendv_ps(old, _mm256_min_ps(old, z), inside));
+    }
+  }
+}
+
+#endif
+
+}
+
+void occlusion_culler::rasterize_band(int tile_row) {
+  const int y0 = tile_row * tile_size;
+  const int y1 = y0 + tile_size - 1;
+
+  std::fill(depth_.begin() + y0 * width_, depth_.begin() + (y1 + 1) * width_, 1.f);
+
+  const bool avx2 = has_avx2();
+  for (const auto &t : triangles_) {
+    if (t.max_y < y0 || t.min_y > y1)
+      continue;
+
+    int y_begin = std::max(t.min_y, y0);
+    int y_end = std::min(t.max_y, y1);
+
+#ifdef OCCLUSION_AVX2
+    if (avx2) {
+      rasterize_rows_avx2(t.edge_a, t.edge_b, t.edge_c, t.depth_x, t.depth_y, t.depth_0,
+                          t.min_x, t.max_x, y_begin, y_end, depth_.data(), width_);
+      continue;
+    }
+#endif
+    rasterize_rows_scalar(t.edge_a, t.edge_b, t.edge_c, t.depth_x, t.depth_y, t.depth_0,
+                          t.min_x, t.max_x, y_begin, y_end, depth_.data(), width_);
+  }
+
+  for (int tx = 0; tx < tiles_x_; ++tx) {
+    float farthest = 0.f;
+    for (int y = y0; y <= y1; ++y) {
+      const float *row = depth_.data() + y * width_ + tx * tile_size;
+      farthest = std::max(farthest, *std::max_element(row, row + tile_size));
+    }
+    tile_max_[tile_row * tiles_x_ + tx] = farthest;
+  }
+}
+
+void occlusion_culler::render(const glm::mat4 &view_projection) {
+  auto start = std::chrono::high_resolution_clock::now();
+
+  view_projection_ = view_projection;
+  stats_ = {};
+
+  const std::size_t triangle_count = occluders_.size() / 3;
+  setup_chunks_.resize(job_system::chunk_count(triangle_count, setup_grain));
+
+  jobs_.parallel_for(triangle_count, setup_grain, [&](std::size_t chunk, std::size_t begin, std::size_t end) {
+    auto &out = setup_chunks_[chunk];
+    out.clear();
+
+    for (std::size_t i = begin; i < end; ++i) {
+      std::array<glm::vec4, 3> c;
+      for (int k = 0; k < 3; ++k)
+        c[k] = view_projection * glm::vec4(occluders_[3 * i + k], 1.f);
+
+      auto all_outside = [&](auto &&outside) {
+        return outside(c[0]) && outside(c[1]) && outside(c[2]);
+      };
+      if (all_outside([](const glm::vec4 &p) { return p.x < -p.w; }) ||
+          all_outside([](const glm::vec4 &p) { return p.x > p.w; }) ||
+          all_outside([](const glm::vec4 &p) { return p.y < -p.w; }) ||
+          all_outside([](const glm::vec4 &p) { return p.y > p.w; }) ||
+          all_outside([](const glm::vec4 &p) { return p.z > p.w; }) ||
+          all_outside([](const glm::vec4 &p) { return p.z < -p.w; }))
+        continue;
+
+      // Clip against the near plane z = -w, which leaves at most 4 vertices. polygon_interior[k] tells
+      // whether the edge from polygon[k] to the next vertex is interior; the edge along the near plane is not
+      glm::vec4 polygon[4];
+      bool polygon_interior[4];
+      int count = 0;
+      for (int k = 0; k < 3; ++k) {
+        const auto &p = c[k];
+        const auto &q = c[(k + 1) % 3];
+        float dp = p.z + p.w;
+        float dq = q.z + q.w;
+        bool interior = occluder_interior_[i] & (1 << k);
+        if (dp >= 0.f) {
+          polygon_interior[count] = interior;
+          polygon[count++] = p;
+        }
+        if ((dp >= 0.f) != (dq >= 0.f)) {
+          polygon_interior[count] = dp < 0.f && interior;
+          polygon[count++] = p + (q - p) * (dp / (dp - dq));
+        }
+      }
+
+      // Fan diagonals are shared by two of the triangles
+      for (int k = 1; k + 1 < count; ++k) {
+        unsigned interior = (k == 1 ? polygon_interior[0] : 1u) |
+                            (polygon_interior[k] ? 2u : 0u) |
+                            (k + 2 == count ? (polygon_interior[count - 1] ? 4u : 0u) : 4u);
+        setup(polygon[0], polygon[k], polygon[k + 1], interior, out);
+      }
+    }
+  });
+
+  triangles_.clear();
+  for (const auto &chunk : setup_chunks_)
+    triangles_.insert(triangles_.end(), chunk.begin(), chunk.end());
+  stats_.occluder_triangles = triangles_.size();
+
+  jobs_.parallel_for(tiles_y_, 1, [&](std::size_t, std::size_t begin, std::size_t end) {
+    for (std::size_t tile_row = begin; tile_row < end; ++tile_row)
+      rasterize_band((int) tile_row);
+  });
+
+  auto finish = std::chrono::high_resolution_clock::now();
+  stats_.raster_ms = std::chrono::duration<double, std::milli>(finish - start).count();
+}
+
+bool occlusion_culler::visible(const glm::vec3 &min, const glm::vec3 &max) {
+  ++stats_.tested;
+
+  float min_x = std::numeric_limits<float>::max(), max_x = -min_x;
+  float min_y = min_x, max_y = -min_x;
+  float nearest = min_x;
+
+  for (int i = 0; i < 8; ++i) {
+    glm::vec4 p = view_projection_ * glm::vec4((i & 1) ? max.x : min.x,
+                                               (i & 2) ? max.y : min.y,
+                                               (i & 4) ? max.z : min.z,
+                                               1.f);
+    // The box crosses the near plane, so it covers the camera
+    if (p.z < -p.w || p.w <= 0.f)
+      return true;
+
+    glm::vec3 ndc = glm::vec3(p) / p.w;
+    min_x = std::min(min_x, (ndc.x * 0.5f + 0.5f) * width_);
+    max_x = std::max(max_x, (ndc.x * 0.5f + 0.5f) * width_);
+    min_y = std::min(min_y, (ndc.y * 0.5f + 0.5f) * height_);
+    max_y = std::max(max_y, (ndc.y * 0.5f + 0.5f) * height_);
+    nearest = std::min(nearest, ndc.z * 0.5f + 0.5f);
+  }
+
+  int x_begin = std::max(0, (int) std::floor(min_x));
+  int x_end = std::min(width_ - 1, (int) std::ceil(max_x));
+  int y_begin = std::max(0, (int) std::floor(min_y));
+  int y_end = std::min(height_ - 1, (int) std::ceil(max_y));
+
+  // Off-screen boxes are left to frustum culling
+  if (x_begin > x_end || y_begin > y_end)
+    return true;
+
+  for (int ty = y_begin / tile_size; ty <= y_end / tile_size; ++ty) {
+    for (int tx = x_begin / tile_size; tx <= x_end / tile_size; ++tx) {
+      if (tile_max_[ty * tiles_x_ + tx] < nearest)
+        continue;
+
+      int px_begin = std::max(x_begin, tx * tile_size), px_end = std::min(x_end, tx * tile_size + tile_size - 1);
+      int py_begin = std::max(y_begin, ty * tile_size), py_end = std::min(y_end, ty * tile_size + tile_size - 1);
+      for (int y = py_begin; y <= py_end; ++y)
+        for (int x = px_begin; x <= px_end; ++x)
+          if (depth_[y * width_ + x] >= nearest)
+            return true;
+    }
+  }
+
+  ++stats_.culled;
+  return false;
+}
+
+void occlusion_culler::dump(const std::string &path) const {
+  float nearest = 1.f, farthest = 0.f;
+  for (float d : depth_) {
+    if (d >= 1.f) continue;
+    nearest = std::min(nearest, d);
+    farthest = std::max(farthest, d);
+  }
+
+  std::vector<std::uint8_t> pixels(depth_.size(), 0);
+  for (int y = 0; y < height_; ++y) {
+    for (int x = 0; x < width_; ++x) {
+      float d = depth(x, y);
+      if (d >= 1.f) continue;
+      float t = (farthest > nearest) ? (farthest - d) / (farthest - nearest) : 1.f;
+      // PGM rows go from top to bottom
+      pixels[(height_ - 1 - y) * width_ + x] = (std::uint8_t) (32 + t * 223);
+    }
+  }
+
+  std::ofstream out(path, std::ios::binary);
+  out << "P5\n" << width_ << " " << height_ << "\n255\n";
+  out.write(reinterpret_cast<const char *>(pixels.data()), (std::streamsize) pixels.size());
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "job_system.hpp"
+
+// Software occlusion culling. A few large occluders are rasterized on the CPU
+// into a low-resolution depth buffer (8 pixels at a time with AVX2, one job per
+// band of rows), and every 8x8 tile keeps the farthest depth it contains.
+// Rasterization is conservative: a pixel is written only if the occluders cover
+// all of it, with the farthest depth the triangle has over it. Edges shared by
+// two occluder triangles keep the centre test so the mesh does not crack apart.
+// A bounding box is hidden if its nearest point is behind every tile it covers;
+// tiles that are only partially in front are checked pixel by pixel.
+class occlusion_culler {
+ public:
+  struct stats {
+    std::size_t occluder_triangles = 0; // rasterized this frame, after clipping
+    std::size_t tested = 0;
+    std::size_t culled = 0;
+    double raster_ms = 0.0;
+  };
+
+  static constexpr int tile_size = 8;
+
+  // Width and height are rounded up to a multiple of tile_size
+  occlusion_culler(int width, int height, job_system &jobs);
+
+  // World-space triangle list, 3 vertices per triangle
+  void set_occluders(std::vector<glm::vec3> triangles);
+
+  // Rasterizes the occluders as seen through `view_projection` and resets the statistics
+  void render(const glm::mat4 &view_projection);
+
+  // False only if the box is certainly hidden behind the occluders
+  bool visible(const glm::vec3 &min, const glm::vec3 &max);
+
+  // Writes the depth buffer as a binary PGM; near is bright, empty is black
+  void dump(const std::string &path) const;
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+  // Window-space depth in [0, 1], 1 where nothing was rasterized; y goes up
+  float depth(int x, int y) const { return depth_[y * width_ + x]; }
+  const stats &statistics() const { return stats_; }
+
+ private:
+  // Edge functions and depth plane of a screen-space triangle, in pixels,
+  // biased so that evaluating them at a pixel centre is conservative
+  struct triangle {
+    float edge_a[3], edge_b[3], edge_c[3];
+    float depth_x, depth_y, depth_0;
+    int min_x, max_x, min_y, max_y;
+  };
+
+  int width_, height_;
+  int tiles_x_, tiles_y_;
+  job_system &jobs_;
+
+  glm::mat4 view_projection_{1.f};
+  std::vector<glm::vec3> occluders_;
+  // Per occluder triangle, bit k: the edge from vertex k to the next one is shared with another triangle
+  std::vector<std::uint8_t> occluder_interior_;
+  std::vector<std::vector<triangle>> setup_chunks_;
+  std::vector<triangle> triangles_;
+
+  std::vector<float> depth_;
+  std::vector<float> tile_max_;
+  stats stats_;
+
+  void setup(const glm::vec4 &c0, const glm::vec4 &c1, const glm::vec4 &c2, unsigned interior,
+             std::vector<triangle> &out) const;
+  void rasterize_band(int tile_row);
+};
@@ -0,0 +1,62 @@
+#include "point_shadow_cache.hpp"
+
+#include <glm/vec4.hpp>
+#include <glm/geometric.hpp>
+#include <glm/ext/matrix_transform.hpp>
+#include <glm/ext/matrix_clip_space.hpp>
+#include <glm/ext/scalar_constants.hpp>
+
+#include <limits>
+
+namespace {
+
+// Direction and up vector of every cube face, as the cubemap layout expects them
+const glm::vec3 face_direction[6] = {{1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}};
+const glm::vec3 face_up[6] = {{0, -1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}, {0, -1, 0}, {0, -1, 0}};
+
+}
+
+point_shadow_cache::point_shadow_cache(float near, float far)
+    : projection_(glm::perspective(glm::pi<float>() / 2.f, 1.f, near, far)) {
+  invalid_.fill(true);
+}
+
+void point_shadow_cache::set_light(const glm::vec3 &position) {
+  position_ = position;
+  for (int face = 0; face < face_count; ++face)
+    transforms_[face] = projection_ * glm::lookAt(position, position + face_direction[face], face_up[face]);
+}
+
+void point_shadow_cache::mark_rendered(int face) {
+  rendered_position_[face] = position_;
+  invalid_[face] = false;
+}
+
+float point_shadow_cache::change(int face) const {
+  if (invalid_[face])
+    return std::numeric_limits<float>::infinity();
+  // A 90 degree face is 2 * distance wide at that distance
+  float texel = 2.f * reference_distance / resolution;
+  return glm::length(position_ - rendered_position_[face]) / texel;
+}
+
+bool point_shadow_cache::touches(int face, const glm::vec3 &min, const glm::vec3 &max) const {
+  // Clip planes are linear in world space, so a box is outside if all corners are behind one of them
+  int outside[6] = {};
+  for (int i = 0; i < 8; ++i) {
+    glm::vec4 p = transforms_[face] * glm::vec4((i & 1) ? max.x : min.x,
+                                                (i & 2) ? max.y : min.y,
+                                                (i & 4) ? max.z : min.z,
+                                                1.f);
+    outside[0] += p.x < -p.w;
+    outside[1] += p.x > p.w;
+    outside[2] += p.y < -p.w;
+    outside[3] += p.y > p.w;
+    outside[4] += p.z < -p.w;
+    outside[5] += p.z > p.w;
+  }
+  for (int count : outside)
+    if (count == 8)
+      return false;
+  return true;
+}
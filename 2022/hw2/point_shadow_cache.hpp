@@ -0,0 +1,43 @@
+#pragma once
+
+#include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
+
+#include <array>
+
+// Faces of a point light shadow cubemap, rendered one at a time.
+// Every face has its own 90 degree frustum, so a shape is drawn only into the
+// faces it touches, and a face keeps its contents until it is out of date:
+// it was never rendered, or the light moved since it was. The scene is static, so nothing else
+// can make a face stale.
+class point_shadow_cache {
+ public:
+  static constexpr int face_count = 6;
+
+  point_shadow_cache(float near, float far);
+
+  void set_light(const glm::vec3 &position);
+
+  bool dirty(int face) const { return change(face) > 0.f; }
+  void mark_rendered(int face);
+
+  // How out of date the face is, in texels a surface `reference_distance` away from the light moved by;
+  // infinite for faces never rendered
+  float change(int face) const;
+
+  // World to clip space of a face, in GL_TEXTURE_CUBE_MAP_POSITIVE_X + face order
+  const glm::mat4 &transform(int face) const { return transforms_[face]; }
+
+  // False if the box is certainly outside of the face frustum
+  bool touches(int face, const glm::vec3 &min, const glm::vec3 &max) const;
+
+ private:
+  static constexpr float reference_distance = 100.f;
+  static constexpr int resolution = 1024;
+
+  glm::mat4 projection_;
+  glm::vec3 position_{0.f};
+  std::array<glm::mat4, face_count> transforms_;
+  std::array<glm::vec3, face_count> rendered_position_;
+  std::array<bool, face_count> invalid_;
+};
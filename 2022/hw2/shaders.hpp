@@ -46,7 +46,12 @@ const std::string fragment_shader_source = R"(
     uniform vec3 point_light_attenuation;
     uniform vec3 point_light_color;
     uniform vec3 point_light_position;
-    uniform mat4 transform;
+
+    // каскады тени от солнца, cascade_far - граница каскада в view space
+    const int CASCADE_COUNT = 3;
+    uniform mat4 view;
+    uniform mat4 transform[CASCADE_COUNT];
+    uniform float cascade_far[CASCADE_COUNT];
 
     uniform samplerCube depthMap;
     uniform float far_plane;
@@ -66,7 +71,7 @@ const std::string fragment_shader_source = R"(
     }
 
     uniform sampler2D sampler;
-    uniform sampler2D shadow_map;
+    uniform sampler2DArray shadow_map;
 
     layout (location = 0) out vec4 out_color;
 
@@ -80,6 +85,45 @@ const std::string fragment_shader_source = R"(
         return glossiness * albedo * pow(max(0.0, dot(reflected_direction, view_direction)), power);
     }
 
+    // кластеры точечных источников, см. light_clusters.hpp
+    const int CLUSTERS_X = 16;
+    const int CLUSTERS_Y = 9;
+    const int CLUSTER_SLICES = 24;
+    uniform int clustered;
+    uniform vec2 viewport_size;
+    uniform float cluster_near;
+    uniform float cluster_log_scale;
+    uniform samplerBuffer cluster_lights; // на источник 2 текселя: (position, radius), (color, intensity)
+    uniform usamplerBuffer cluster_grid; // (offset, count) в cluster_indices
+    uniform usamplerBuffer cluster_indices;
+
+    vec3 clustered_lights(vec3 albedo, float view_depth) {
+        ivec2 tile = clamp(ivec2(gl_FragCoord.xy / viewport_size * vec2(CLUSTERS_X, CLUSTERS_Y)),
+                           ivec2(0), ivec2(CLUSTERS_X - 1, CLUSTERS_Y - 1));
+        int slice = 0;
+        if (view_depth >= cluster_near)
+            slice = min(CLUSTER_SLICES - 1, 1 + int(floor(log(view_depth / cluster_near) * cluster_log_scale)));
+
+        uvec2 cell = texelFetch(cluster_grid, (slice * CLUSTERS_Y + tile.y) * CLUSTERS_X + tile.x).xy;
+        vec3 color = vec3(0.0);
+        for (uint k = 0u; k < cell.y; ++k) {
+            int light = int(texelFetch(cluster_indices, int(cell.x + k)).r);
+            vec4 sphere = texelFetch(cluster_lights, 2 * light);
+            vec4 emission = texelFetch(cluster_lights, 2 * light + 1);
+
+            vec3 direction = sphere.xyz - position;
+            float dist = length(direction);
+            if (dist >= sphere.w)
+                continue;
+            direction /= dist;
+
+            float window = 1.0 - pow(dist / sphere.w, 4.0);
+            float falloff = window * window * emission.a;
+            color += (diffuse(direction, albedo) + specular(direction, albedo)) * emission.rgb * falloff;
+        }
+        return color;
+    }
+
     float C = 0.005;
 
     void main() {
@@ -88,13 +132,20 @@ const std::string fragment_shader_source = R"(
          // return;
 
           // SUN SHADOW
-          vec4 shadow_pos = transform * vec4(position, 1.0);
+          float view_depth = -(view * vec4(position, 1.0)).z;
+          int cascade = CASCADE_COUNT - 1;
+          for (int i = CASCADE_COUNT - 1; i >= 0; --i)
+              if (view_depth < cascade_far[i])
+                  cascade = i;
+
+          vec4 shadow_pos = transform[cascade] * vec4(position, 1.0);
           shadow_pos /= shadow_pos.w;
           shadow_pos = shadow_pos * 0.5 + vec4(0.5);
 
           bool in_shadow_texture = (shadow_pos.x > 0) && (shadow_pos.x < 1) &&
                     (shadow_pos.y > 0) && (shadow_pos.y < 1) &&
-                    (shadow_pos.z > 0) && (shadow_pos.z < 1);
+                    (shadow_pos.z > 0) && (shadow_pos.z < 1) &&
+                    (view_depth < cascade_far[CASCADE_COUNT - 1]);
 
 
 
@@ -105,7 +156,7 @@ const std::string fragment_shader_source = R"(
           for (int x = -r; x <= r; ++x) {
               for (int y = -r; y <= r; ++y) {
                   float expo = exp(-(x*x+y*y)/8.);
-                  sum += expo * texture(shadow_map, shadow_pos.xy+vec2(x,y) / textureSize(shadow_map, 0).xy).rg;
+                  sum += expo * texture(shadow_map, vec3(shadow_pos.xy+vec2(x,y) / textureSize(shadow_map, 0).xy, cascade)).rg;
                   sum_weight += expo;
               }
           }
@@ -152,6 +203,9 @@ const std::string fragment_shader_source = R"(
           color += diffuse(point_light_direction, albedo) * point_light_color * attenuation * point_shadow;
           color += specular(point_light_direction, albedo) * point_light_color * attenuation * point_shadow;
 
+          if (clustered == 1)
+              color += clustered_lights(albedo, view_depth);
+
           out_color = vec4(color, 1.0);
     }
 )";
@@ -193,33 +247,14 @@ const std::string point_shadow_vertex_shader_source =
     layout (location = 0) in vec3 in_position;
 
     uniform mat4 model;
-
-    void main()
-    {
-        gl_Position = model * vec4(in_position, 1.0);
-    }
-
-    )";
-
-const std::string point_shadow_geometry_shader_source =
-    R"(
-    #version 330 core
-    layout (triangles) in;
-    layout (triangle_strip, max_vertices=18) out;
+    uniform mat4 shadowMatrix; // одна грань кубмапы
 
     out vec4 FragPos;
-    uniform mat4 shadowMatrices[6];
 
-    void main() {
-        for (int face = 0; face < 6; ++face) {
-            gl_Layer = face;
-            for (int i = 0; i < 3; ++i) {
-                FragPos = gl_in[i].gl_Position;
-                gl_Position = shadowMatrices[face] * FragPos;
-                EmitVertex();
-            }
-            EndPrimitive();
-        }
+    void main()
+    {
+        FragPos = model * vec4(in_position, 1.0);
+        gl_Position = shadowMatrix * FragPos;
     }
 
     )";
@@ -0,0 +1,103 @@
+#include "shadow_cascades.hpp"
+
+#include <glm/vec4.hpp>
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+#include <glm/matrix.hpp>
+#include <glm/ext/matrix_clip_space.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+
+std::vector<float> cascade_splits(float near, float far, int count, float lambda) {
+  std::vector<float> splits(count + 1);
+  for (int i = 0; i <= count; ++i) {
+    float t = (float) i / count;
+    float logarithmic = near * std::pow(far / near, t);
+    float uniform = near + (far - near) * t;
+    splits[i] = lambda * logarithmic + (1.f - lambda) * uniform;
+  }
+  splits.front() = near;
+  splits.back() = far;
+  return splits;
+}
+
+glm::mat4 fit_cascade(const glm::mat4 &view, float fovy, float aspect,
+                      float split_near, float split_far,
+                      glm::vec3 light_direction,
+                      const std::vector<glm::vec3> &scene_box,
+                      int resolution) {
+  auto inverse = glm::inverse(glm::perspective(fovy, aspect, split_near, split_far) * view);
+
+  std::array<glm::vec3, 8> corners;
+  glm::vec3 center(0.f);
+  for (int i = 0; i < 8; ++i) {
+    glm::vec4 p = inverse * glm::vec4((i & 1) ? 1.f : -1.f, (i & 2) ? 1.f : -1.f, (i & 4) ? 1.f : -1.f, 1.f);
+    corners[i] = glm::vec3(p) / p.w;
+    center += corners[i] / 8.f;
+  }
+
+  float radius = 0.f;
+  for (const auto &corner : corners)
+    radius = std::max(radius, glm::length(corner - center));
+  // Rounding keeps the radius, and so the texel size, from jittering with float error
+  radius = std::ceil(radius * 16.f) / 16.f;
+
+  auto light_z = -light_direction;
+  auto light_x = glm::normalize(glm::cross(light_z, {0.f, 1.f, 0.f}));
+  auto light_y = glm::cross(light_x, light_z);
+
+  float texel = 2.f * radius / resolution;
+  float x = std::floor(glm::dot(center, light_x) / texel) * texel;
+  float y = std::floor(glm::dot(center, light_y) / texel) * texel;
+
+  float z_min = std::numeric_limits<float>::max();
+  float z_max = -z_min;
+  for (const auto &corner : corners) {
+    z_min = std::min(z_min, glm::dot(corner, light_z));
+    z_max = std::max(z_max, glm::dot(corner, light_z));
+  }
+  for (const auto &V : scene_box) {
+    z_min = std::min(z_min, glm::dot(V, light_z));
+    z_max = std::max(z_max, glm::dot(V, light_z));
+  }
+  float z = (z_min + z_max) / 2;
+  float dz = std::max((z_max - z_min) / 2, 1e-3f);
+
+  glm::mat4 transform(1.f);
+  for (int i = 0; i < 3; ++i) {
+    transform[i][0] = light_x[i] / radius;
+    transform[i][1] = light_y[i] / radius;
+    transform[i][2] = light_z[i] / dz;
+  }
+  transform[3] = {-x / radius, -y / radius, -z / dz, 1.f};
+  return transform;
+}
+
+float cascade_change(const glm::mat4 &rendered, const glm::mat4 &fitted, int resolution) {
+  if (rendered == fitted)
+    return 0.f;
+
+  // Corners of the rendered cascade box, as the fitted cascade sees them
+  auto to_fitted = fitted * glm::inverse(rendered);
+  float change = 0.f;
+  for (int i = 0; i < 8; ++i) {
+    glm::vec4 corner((i & 1) ? 1.f : -1.f, (i & 2) ? 1.f : -1.f, (i & 4) ? 1.f : -1.f, 1.f);
+    glm::vec4 moved = to_fitted * corner;
+    change = std::max({change, std::abs(moved.x - corner.x), std::abs(moved.y - corner.y)});
+  }
+  return change * resolution / 2.f;
+}
+
+bool box_in_cascade(const glm::mat4 &transform, const glm::vec3 &min, const glm::vec3 &max) {
+  glm::vec3 lo(std::numeric_limits<float>::max());
+  glm::vec3 hi(-std::numeric_limits<float>::max());
+  for (int i = 0; i < 8; ++i) {
+    glm::vec3 p = transform * glm::vec4((i & 1) ? max.x : min.x, (i & 2) ? max.y : min.y, (i & 4) ? max.z : min.z, 1.f);
+    lo = glm::min(lo, p);
+    hi = glm::max(hi, p);
+  }
+  return lo.x <= 1.f && hi.x >= -1.f && lo.y <= 1.f && hi.y >= -1.f && lo.z <= 1.f && hi.z >= -1.f;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
+
+#include <vector>
+
+// Cascaded shadow maps for the sun. The view frustum is split along the view
+// direction and every slice gets its own orthographic shadow map, so shadows
+// close to the camera get most of the texels.
+
+// count + 1 view-space distances from near to far. lambda blends the
+// logarithmic split (1) with the uniform one (0).
+std::vector<float> cascade_splits(float near, float far, int count, float lambda);
+
+// World-to-light-clip transform of the slice [split_near, split_far] of the camera frustum.
+// The slice is bounded by a sphere, so the cascade doesn't change size when the camera turns,
+// and its center is snapped to whole texels, so shadow edges don't shimmer when the camera moves.
+// Depth covers `scene_box` as well, so casters outside of the slice still cast into it.
+glm::mat4 fit_cascade(const glm::mat4 &view, float fovy, float aspect,
+                      float split_near, float split_far,
+                      glm::vec3 light_direction,
+                      const std::vector<glm::vec3> &scene_box,
+                      int resolution);
+
+// How far, in shadow map texels, the contents of a cascade rendered with `rendered`
+// moved when the cascade is fitted to `fitted`; 0 when the two are the same
+float cascade_change(const glm::mat4 &rendered, const glm::mat4 &fitted, int resolution);
+
+// False if the box is certainly outside of the cascade and doesn't need to be drawn into it
+bool box_in_cascade(const glm::mat4 &transform, const glm::vec3 &min, const glm::vec3 &max);
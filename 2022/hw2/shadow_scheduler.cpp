@@ -0,0 +1,46 @@
+#include "shadow_scheduler.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+int shadow_scheduler::add_view(float importance) {
+  views_.push_back({importance});
+  return (int) views_.size() - 1;
+}
+
+void shadow_scheduler::set_change(int view, float change) {
+  views_[view].change = change;
+}
+
+const std::vector<int> &shadow_scheduler::schedule() {
+  std::vector<std::pair<float, int>> candidates;
+  for (int i = 0; i < (int) views_.size(); ++i) {
+    const auto &v = views_[i];
+    if (!v.rendered)
+      candidates.emplace_back(std::numeric_limits<float>::max(), i);
+    else if (v.change > 0.f)
+      candidates.emplace_back(v.importance * v.change * (1.f + v.age), i);
+  }
+  stale_ = (int) candidates.size();
+
+  std::sort(candidates.begin(), candidates.end(), [](const auto &a, const auto &b) {
+    return a.first > b.first || (a.first == b.first && a.second < b.second);
+  });
+
+  scheduled_.clear();
+  for (int k = 0; k < (int) candidates.size(); ++k) {
+    if (k < budget_ || !views_[candidates[k].second].rendered)
+      scheduled_.push_back(candidates[k].second);
+    else
+      ++views_[candidates[k].second].age;
+  }
+  return scheduled_;
+}
+
+void shadow_scheduler::mark_rendered(int view) {
+  auto &v = views_[view];
+  v.change = 0.f;
+  v.age = 0;
+  v.rendered = true;
+}
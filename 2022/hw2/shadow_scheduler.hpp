@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vector>
+
+// Time-sliced shadow updates. Every shadow view (a cascade, a cube face) reports
+// how much its contents changed since it was last rendered, and at most `budget`
+// views are re-rendered per frame; the others keep what they rendered before.
+//
+// priority = importance * change * (1 + age), where age is the number of frames
+// the view was out of date but not chosen, so that no view starves.
+// Views that were never rendered have nothing to keep, so they are all rendered
+// on their first frame, on top of the budget.
+class shadow_scheduler {
+ public:
+  explicit shadow_scheduler(int budget) : budget_(budget) {}
+
+  // Importance is relative, e.g. the share of the screen the view covers; returns the view id
+  int add_view(float importance);
+
+  // Change since the view was last rendered, in shadow map texels; 0 means up to date
+  void set_change(int view, float change);
+
+  // Views to render this frame, most important first
+  const std::vector<int> &schedule();
+  void mark_rendered(int view);
+
+  int budget() const { return budget_; }
+  void set_budget(int budget) { budget_ = budget; }
+
+  // Views that were out of date after the last schedule(), rendered or not
+  int stale() const { return stale_; }
+
+ private:
+  struct view {
+    float importance;
+    float change = 0.f;
+    int age = 0;
+    bool rendered = false;
+  };
+
+  int budget_;
+  int stale_ = 0;
+  std::vector<view> views_;
+  std::vector<int> scheduled_;
+};
@@ -1,67 +1,387 @@
 #include "gltf_loader.hpp"
+#include "meshopt_decoder.hpp"
 
 #include <rapidjson/document.h>
-#include <rapidjson/istreamwrapper.h>
+#include <glm/gtx/matrix_decompose.hpp>
 
+#include <cstdint>
 #include <fstream>
 #include <stdexcept>
 
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define GLTF_MMAP 1
+#endif
+
 static unsigned int attribute_type_to_size(std::string const & type)
 {
     if (type == "SCALAR") return 1;
     if (type == "VEC2") return 2;
     if (type == "VEC3") return 3;
     if (type == "VEC4") return 4;
-    return 0;
+    if (type == "MAT2") return 4;
+    if (type == "MAT3") return 9;
+    if (type == "MAT4") return 16;
     throw std::runtime_error("Unknown attribute type: " + type);
 }
 
-gltf_model load_gltf(std::filesystem::path const & path)
+namespace
 {
-    rapidjson::Document document;
 
+// The whole file, read-only; memory-mapped where possible, read into memory otherwise
+struct mapped_file
+{
+    char const * data = nullptr;
+    std::size_t size = 0;
+    std::vector<char> copy;
+
+    explicit mapped_file(std::filesystem::path const & path)
+        : size(std::filesystem::file_size(path))
     {
+        if (size == 0)
+            return;
+#ifdef GLTF_MMAP
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1)
+            throw std::runtime_error("Can't open " + path.string());
+        void * mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED)
+            throw std::runtime_error("Can't map " + path.string());
+        data = static_cast<char const *>(mapping);
+#else
+        copy.resize(size);
         std::ifstream input(path, std::ios::binary);
-        rapidjson::IStreamWrapper stream(input);
-        document.ParseStream(stream);
+        input.read(copy.data(), size);
+        if (!input)
+            throw std::runtime_error("Can't read " + path.string());
+        data = copy.data();
+#endif
+    }
+
+    ~mapped_file()
+    {
+#ifdef GLTF_MMAP
+        if (data)
+            munmap(const_cast<char *>(data), size);
+#endif
+    }
+
+    mapped_file(mapped_file const &) = delete;
+    mapped_file & operator = (mapped_file const &) = delete;
+};
+
+std::uint32_t read_u32(char const * data)
+{
+    std::uint32_t value;
+    std::memcpy(&value, data, 4);
+    return value;
+}
+
+// .glb: 12 byte header ("glTF", version, length), then chunks (length, type, data), JSON first, then optional BIN
+struct glb_chunks
+{
+    char const * json = nullptr;
+    std::size_t json_size = 0;
+    char const * bin = nullptr;
+    std::size_t bin_size = 0;
+};
+
+bool parse_glb(mapped_file const & file, glb_chunks & chunks)
+{
+    if (file.size < 12 || std::memcmp(file.data, "glTF", 4) != 0)
+        return false;
+    if (read_u32(file.data + 4) != 2)
+        throw std::runtime_error("Unsupported .glb version");
+    std::size_t length = std::min<std::size_t>(read_u32(file.data + 8), file.size);
+
+    for (std::size_t offset = 12; offset + 8 <= length;)
+    {
+        std::size_t chunk_size = read_u32(file.data + offset);
+        std::uint32_t chunk_type = read_u32(file.data + offset + 4);
+        offset += 8;
+        if (chunk_size > length - offset)
+            throw std::runtime_error("Truncated .glb chunk");
+
+        if (chunk_type == 0x4E4F534A && !chunks.json) // "JSON"
+        {
+            chunks.json = file.data + offset;
+            chunks.json_size = chunk_size;
+        }
+        else if (chunk_type == 0x004E4942 && !chunks.bin) // "BIN\0"
+        {
+            chunks.bin = file.data + offset;
+            chunks.bin_size = chunk_size;
+        }
+        offset += (chunk_size + 3) & ~std::size_t(3);
+    }
+
+    if (!chunks.json)
+        throw std::runtime_error("No JSON chunk in .glb");
+    return true;
+}
+
+}
+
+unsigned int gltf_model::accessor::component_size() const
+{
+    switch (type)
+    {
+    case 0x1400: // GL_BYTE
+    case 0x1401: // GL_UNSIGNED_BYTE
+        return 1;
+    case 0x1402: // GL_SHORT
+    case 0x1403: // GL_UNSIGNED_SHORT
+        return 2;
+    case 0x1405: // GL_UNSIGNED_INT
+    case 0x1406: // GL_FLOAT
+        return 4;
     }
+    throw std::runtime_error("Unknown component type: " + std::to_string(type));
+}
+
+glm::vec4 gltf_model::read(gltf_model::accessor const & accessor, std::size_t index, glm::vec4 fallback) const
+{
+    char const * element = buffer.data() + accessor.view.offset + index * accessor.stride();
+
+    auto component = [&](unsigned int i) -> float
+    {
+        switch (accessor.type)
+        {
+        case 0x1400:
+        {
+            float value = reinterpret_cast<std::int8_t const *>(element)[i];
+            return accessor.normalized ? std::max(value / 127.f, -1.f) : value;
+        }
+        case 0x1401:
+        {
+            float value = reinterpret_cast<std::uint8_t const *>(element)[i];
+            return accessor.normalized ? value / 255.f : value;
+        }
+        case 0x1402:
+        {
+            std::int16_t value;
+            std::memcpy(&value, element + 2 * i, 2);
+            return accessor.normalized ? std::max(value / 32767.f, -1.f) : value;
+        }
+        case 0x1403:
+        {
+            std::uint16_t value;
+            std::memcpy(&value, element + 2 * i, 2);
+            return accessor.normalized ? value / 65535.f : value;
+        }
+        case 0x1405:
+        {
+            std::uint32_t value;
+            std::memcpy(&value, element + 4 * i, 4);
+            return value;
+        }
+        default:
+        {
+            float value;
+            std::memcpy(&value, element + 4 * i, 4);
+            return value;
+        }
+        }
+    };
+
+    for (unsigned int i = 0; i < accessor.size && i < 4; ++i)
+        fallback[i] = component(i);
+    return fallback;
+}
+
+gltf_model load_gltf(std::filesystem::path const & path, float key_rate)
+{
+    auto file = std::make_shared<mapped_file>(path);
+
+    glb_chunks chunks;
+    bool const binary = parse_glb(*file, chunks);
+    if (!binary)
+    {
+        chunks.json = file->data;
+        chunks.json_size = file->size;
+    }
+
+    // In situ parsing writes the unescaped strings over the JSON text, so it needs a mutable null-terminated copy;
+    // the strings point into it, so it has to outlive the document
+    std::vector<char> json(chunks.json, chunks.json + chunks.json_size);
+    json.push_back('\0');
+
+    rapidjson::Document document;
+    document.ParseInsitu(json.data());
+    if (document.HasParseError())
+        throw std::runtime_error("Can't parse " + path.string());
 
     gltf_model result;
 
+    if (document.HasMember("extensionsRequired"))
+    {
+        for (auto const & extension : document["extensionsRequired"].GetArray())
+        {
+            std::string const name = extension.GetString();
+            if (name != "EXT_meshopt_compression" && name != "KHR_mesh_quantization")
+                throw std::runtime_error("Unsupported required extension " + name);
+        }
+    }
+
+    // Where every glTF buffer starts in result.buffer
+    std::vector<std::size_t> buffer_offsets;
+
     {
         auto buffers = document["buffers"].GetArray();
-        assert(buffers.Size() == 1);
+        auto views = document["bufferViews"].GetArray();
+
+        // The data of every buffer; fallback buffers of EXT_meshopt_compression have none,
+        // their views are decoded from the compressed ones
+        std::vector<gltf_model::binary_buffer> sources(buffers.Size());
+        for (unsigned int i = 0; i < buffers.Size(); ++i)
+        {
+            auto const & buffer = buffers[i];
+            std::size_t const length = buffer["byteLength"].GetUint();
+
+            if (buffer.HasMember("uri"))
+            {
+                std::string const buffer_uri = buffer["uri"].GetString();
+                if (buffer_uri.starts_with("data:"))
+                    throw std::runtime_error("Embedded base64 buffers are not supported");
+
+                auto buffer_file = std::make_shared<mapped_file>(path.parent_path() / buffer_uri);
+                sources[i].begin = buffer_file->data;
+                sources[i].length = std::min(length, buffer_file->size);
+                sources[i].owner = std::move(buffer_file);
+            }
+            else if (i == 0 && chunks.bin)
+            {
+                sources[i].begin = chunks.bin;
+                sources[i].length = std::min(length, chunks.bin_size);
+                sources[i].owner = file;
+            }
+        }
+
+        auto compression = [](auto const & view) -> rapidjson::Value const *
+        {
+            if (view.HasMember("extensions") && view["extensions"].HasMember("EXT_meshopt_compression"))
+                return &view["extensions"]["EXT_meshopt_compression"];
+            return nullptr;
+        };
+
+        std::vector<bool> used(buffers.Size(), false);
+        bool compressed = false;
+        for (auto const & view : views)
+        {
+            used.at(view["buffer"].GetUint()) = true;
+            compressed = compressed || compression(view);
+        }
+
+        buffer_offsets.assign(buffers.Size(), 0);
+        if (!compressed && std::count(used.begin(), used.end(), true) == 1)
+        {
+            // The usual case: the accessors point straight into the mapped file
+            auto const i = std::find(used.begin(), used.end(), true) - used.begin();
+            if (!sources[i].data())
+                throw std::runtime_error("Buffer has neither an uri nor a .glb BIN chunk");
+            result.buffer = sources[i];
+        }
+        else
+        {
+            // Otherwise all the buffers the views point to are put one after another into a single buffer for GL,
+            // and the compressed views are decoded into their place
+            std::size_t total = 0;
+            for (unsigned int i = 0; i < buffers.Size(); ++i)
+            {
+                if (!used[i]) continue;
+                buffer_offsets[i] = total;
+                total += (buffers[i]["byteLength"].GetUint() + 15) & ~15u;
+            }
 
-        auto const buffer_uri = buffers[0]["uri"].GetString();
+            auto storage = std::make_shared<std::vector<char>>(total);
+            for (unsigned int i = 0; i < buffers.Size(); ++i)
+                if (used[i])
+                    std::copy(sources[i].data(), sources[i].data() + sources[i].size(), storage->data() + buffer_offsets[i]);
 
-        auto const buffer_path = path.parent_path() / buffer_uri;
+            for (auto const & view : views)
+            {
+                auto const * extension = compression(view);
+                if (!extension) continue;
+                auto const & meshopt = *extension;
+
+                auto const & source = sources.at(meshopt["buffer"].GetUint());
+                std::size_t const source_offset = meshopt.HasMember("byteOffset") ? meshopt["byteOffset"].GetUint() : 0;
+                std::size_t const source_size = meshopt["byteLength"].GetUint();
+                std::size_t const count = meshopt["count"].GetUint();
+                std::size_t const stride = meshopt["byteStride"].GetUint();
+                if (!source.data() || source_offset + source_size > source.size())
+                    throw std::runtime_error("Compressed buffer view is out of its buffer");
+
+                std::size_t const offset = buffer_offsets[view["buffer"].GetUint()] + (view.HasMember("byteOffset") ? view["byteOffset"].GetUint() : 0);
+                if (offset + count * stride > total || count * stride > view["byteLength"].GetUint())
+                    throw std::runtime_error("Compressed buffer view doesn't fit its target");
+
+                auto const * data = reinterpret_cast<unsigned char const *>(source.data() + source_offset);
+                char * target = storage->data() + offset;
+
+                std::string const mode = meshopt["mode"].GetString();
+                if (mode == "ATTRIBUTES")
+                    meshopt_decode_attributes(target, count, stride, data, source_size);
+                else if (mode == "TRIANGLES")
+                    meshopt_decode_triangles(target, count, stride, data, source_size);
+                else if (mode == "INDICES")
+                    meshopt_decode_indices(target, count, stride, data, source_size);
+                else
+                    throw std::runtime_error("Unknown meshopt mode " + mode);
+
+                std::string const filter = meshopt.HasMember("filter") ? meshopt["filter"].GetString() : "NONE";
+                if (filter == "OCTAHEDRAL")
+                    meshopt_apply_filter(target, count, stride, meshopt_filter::octahedral);
+                else if (filter == "QUATERNION")
+                    meshopt_apply_filter(target, count, stride, meshopt_filter::quaternion);
+                else if (filter == "EXPONENTIAL")
+                    meshopt_apply_filter(target, count, stride, meshopt_filter::exponential);
+                else if (filter != "NONE")
+                    throw std::runtime_error("Unknown meshopt filter " + filter);
+            }
 
-        result.buffer.resize(std::filesystem::file_size(buffer_path));
-        std::ifstream buffer(buffer_path, std::ios::binary);
-        buffer.read(result.buffer.data(), result.buffer.size());
+            result.buffer.begin = storage->data();
+            result.buffer.length = storage->size();
+            result.buffer.owner = std::move(storage);
+        }
     }
 
     auto parse_buffer_view = [&](int index) -> gltf_model::buffer_view
     {
         auto view = document["bufferViews"].GetArray()[index].GetObject();
-        return {view["byteOffset"].GetUint(), view["byteLength"].GetUint()};
+        return {
+            unsigned(buffer_offsets.at(view["buffer"].GetUint())) + (view.HasMember("byteOffset") ? view["byteOffset"].GetUint() : 0),
+            view["byteLength"].GetUint(),
+            view.HasMember("byteStride") ? view["byteStride"].GetUint() : 0,
+        };
     };
 
     auto parse_accessor = [&](int index) -> gltf_model::accessor
     {
         auto accessor = document["accessors"].GetArray()[index].GetObject();
+        auto view = parse_buffer_view(accessor["bufferView"].GetInt());
+        if (accessor.HasMember("byteOffset"))
+            view.offset += accessor["byteOffset"].GetUint();
         return {
-            parse_buffer_view(accessor["bufferView"].GetInt()),
+            view,
             accessor["componentType"].GetUint(),
             attribute_type_to_size(accessor["type"].GetString()),
             accessor["count"].GetUint(),
+            accessor.HasMember("normalized") && accessor["normalized"].GetBool(),
         };
     };
 
-    auto parse_texture = [&](int index) -> std::string
+    // Images stored in the .glb buffer have no uri, such materials fall back to their color
+    auto parse_texture = [&](int index) -> std::optional<std::string>
     {
         auto const source_index = document["textures"].GetArray()[index]["source"].GetInt();
-        return document["images"].GetArray()[source_index]["uri"].GetString();
+        auto const & image = document["images"].GetArray()[source_index];
+        if (!image.HasMember("uri"))
+            return std::nullopt;
+        return image["uri"].GetString();
     };
 
     auto parse_color = [&](auto const & array)
@@ -74,10 +394,81 @@ gltf_model load_gltf(std::filesystem::path const & path)
         };
     };
 
+    std::vector<glm::mat4> mesh_transforms(document["meshes"].GetArray().Size(), glm::mat4(1.f));
+    if (document.HasMember("nodes"))
+    {
+        auto nodes = document["nodes"].GetArray();
+        result.nodes.resize(nodes.Size());
+
+        for (unsigned int i = 0; i < nodes.Size(); ++i)
+        {
+            auto const & node = nodes[i];
+            auto & result_node = result.nodes[i];
+
+            if (node.HasMember("name"))
+                result_node.name = node["name"].GetString();
+            if (node.HasMember("mesh"))
+                result_node.mesh = node["mesh"].GetInt();
+            if (node.HasMember("children"))
+                for (auto const & child : node["children"].GetArray())
+                    result.nodes.at(child.GetUint()).parent = i;
+
+            if (node.HasMember("matrix"))
+            {
+                auto matrix = node["matrix"].GetArray();
+                glm::mat4 transform;
+                for (int k = 0; k < 16; ++k)
+                    transform[k / 4][k % 4] = matrix[k].GetFloat();
+
+                // glTF requires the matrix to be decomposable to TRS
+                glm::vec3 skew;
+                glm::vec4 perspective;
+                glm::decompose(transform, result_node.scale, result_node.rotation, result_node.translation, skew, perspective);
+                continue;
+            }
+            if (node.HasMember("rotation"))
+            {
+                auto r = node["rotation"].GetArray();
+                result_node.rotation = glm::quat(r[3].GetFloat(), r[0].GetFloat(), r[1].GetFloat(), r[2].GetFloat());
+            }
+            if (node.HasMember("scale"))
+            {
+                auto s = node["scale"].GetArray();
+                result_node.scale = glm::vec3(s[0].GetFloat(), s[1].GetFloat(), s[2].GetFloat());
+            }
+            if (node.HasMember("translation"))
+            {
+                auto t = node["translation"].GetArray();
+                result_node.translation = glm::vec3(t[0].GetFloat(), t[1].GetFloat(), t[2].GetFloat());
+            }
+        }
+
+        auto local_transform = [&](int index)
+        {
+            auto const & node = result.nodes[index];
+            glm::mat4 transform = glm::mat4_cast(node.rotation);
+            for (int i = 0; i < 3; ++i)
+                transform[i] *= node.scale[i];
+            transform[3] = glm::vec4(node.translation, 1.f);
+            return transform;
+        };
+
+        for (int i = nodes.Size() - 1; i >= 0; --i)
+        {
+            if (result.nodes[i].mesh == -1 || nodes[i].HasMember("skin")) continue;
+
+            glm::mat4 transform = local_transform(i);
+            for (int parent = result.nodes[i].parent; parent != -1; parent = result.nodes[parent].parent)
+                transform = local_transform(parent) * transform;
+            mesh_transforms.at(result.nodes[i].mesh) = transform;
+        }
+    }
+
     for (auto const & mesh : document["meshes"].GetArray())
     {
         auto & result_mesh = result.meshes.emplace_back();
         result_mesh.name = mesh["name"].GetString();
+        result_mesh.transform = mesh_transforms[result.meshes.size() - 1];
 
         auto primitives = mesh["primitives"].GetArray();
         assert(primitives.Size() == 1);
@@ -99,7 +490,7 @@ gltf_model load_gltf(std::filesystem::path const & path)
         auto const & pbr = material["pbrMetallicRoughness"];
         if (pbr.HasMember("baseColorTexture"))
             result_mesh.material.texture_path = parse_texture(pbr["baseColorTexture"]["index"].GetInt());
-        else if (pbr.HasMember("baseColorFactor"))
+        if (!result_mesh.material.texture_path && pbr.HasMember("baseColorFactor"))
             result_mesh.material.color = parse_color(pbr["baseColorFactor"].GetArray());
     }
 
@@ -109,16 +500,32 @@ gltf_model load_gltf(std::filesystem::path const & path)
     {
         auto fill_buffer = [&](auto & vector, gltf_model::accessor const & accessor)
         {
-            assert(accessor.type == 0x1406); // GL_FLOAT
             using value_type = std::decay_t<decltype(vector[0])>;
-            auto begin = reinterpret_cast<value_type const *>(result.buffer.data() + accessor.view.offset);
-            vector.assign(begin, begin + accessor.count);
+            vector.resize(accessor.count);
+            if (accessor.type == 0x1406) // GL_FLOAT
+            {
+                auto view = result.view<value_type>(accessor);
+                for (std::size_t i = 0; i < view.size(); ++i)
+                    vector[i] = view[i];
+            }
+            else if constexpr (sizeof(value_type) <= sizeof(glm::vec4))
+            {
+                // KHR_mesh_quantization: normalized integer rotations, scales and translations
+                for (std::size_t i = 0; i < vector.size(); ++i)
+                {
+                    glm::vec4 value = result.read(accessor, i);
+                    std::memcpy(&vector[i], &value, sizeof(value_type));
+                }
+            }
+            else
+                throw std::runtime_error("Only float matrices are supported");
         };
 
         auto fix_rotations = [](std::vector<glm::quat> & rotations)
         {
+            // quantized rotations are a little off the unit length
             for (auto & r : rotations)
-                r = glm::quat(r.z, r.w, r.x, r.y);
+                r = glm::normalize(glm::quat(r.z, r.w, r.x, r.y));
         };
 
         auto joints = skins[0]["joints"].GetArray();
@@ -205,11 +612,18 @@ gltf_model load_gltf(std::filesystem::path const & path)
                     result_animation.max_time = std::max(result_animation.max_time, t);
             };
 
-            for (auto const & bone : result_animation.bones)
+            for (auto & bone : result_animation.bones)
             {
                 update_max_time(bone.translation.timestamps);
                 update_max_time(bone.rotation.timestamps);
                 update_max_time(bone.scale.timestamps);
+
+                if (key_rate > 0.f)
+                {
+                    bone.translation.resample(key_rate);
+                    bone.rotation.resample(key_rate);
+                    bone.scale.resample(key_rate);
+                }
             }
 
             result.animations[std::move(name)] = std::move(result_animation);
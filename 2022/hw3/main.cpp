@@ -15,16 +15,23 @@
 
 #include "stb_image.h"
 #include "utils/utils.h"
+#include "utils/pose.h"
+#include "utils/skinning_palette.h"
+#include "utils/cpu_skinning.h"
+#include "utils/transform_hierarchy.h"
 #include "obj_parser.h"
 #include "gltf_loader.hpp"
 
 #include <rapiragl/rapiragl.h>
 #include <iostream>
 #include <random>
+#include <algorithm>
 
 using Shader = rapiragl::components::Shader;
 using TextureLoader = rapiragl::components::TextureLoader;
 
+const auto wolf_key_rate = 60.f; // ключей анимации в секунду после загрузки
+const auto wolf_max_error = 0.0005f; // допустимое смещение суставов волка при сжатии анимации
 const auto wolf_len = 0.2f;
 bool DEBUG = false;
 
@@ -137,20 +144,22 @@ int main() try {
     glEnableVertexAttribArray(2);
     glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(obj_data::vertex), (void *) (sizeof(float) * 6));
 
-    /// *** Fbo для тени от солнца
+    /// *** Fbo для тени от солнца: слой текстурного массива на каждый каскад
     const int sun_texture_unit = 100; // переименовать, непонятное название
     assert(sun_texture_unit < TextureLoader_.GetMaxTextureUnits());
+    const int cascade_count = 3; // как CASCADE_COUNT в шейдерах
+    const float cascade_lambda = 0.75f;
     GLsizei shadow_map_resolution = 1024;
     GLuint shadow_map;
     glGenTextures(1, &shadow_map);
     glActiveTexture(GL_TEXTURE0 + sun_texture_unit);
-    glBindTexture(GL_TEXTURE_2D, shadow_map);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, shadow_map_resolution, shadow_map_resolution, 0, GL_RGBA, GL_FLOAT,
-                 nullptr);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, shadow_map);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RG32F, shadow_map_resolution, shadow_map_resolution, cascade_count, 0,
+                 GL_RGBA, GL_FLOAT, nullptr);
 
     GLuint rbo;
     glGenRenderbuffers(1, &rbo);
@@ -160,7 +169,7 @@ int main() try {
     GLuint shadow_fbo;
     glGenFramebuffers(1, &shadow_fbo);
     glBindFramebuffer(GL_FRAMEBUFFER, shadow_fbo);
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, shadow_map, 0);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, shadow_map, 0, 0);
     glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rbo);
 
     if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
@@ -175,6 +184,10 @@ int main() try {
 
     /// *** считаем bbox
     auto bbox = CalcBoundingBox(std::vector<std::vector<obj_data::vertex>>{cow.vertices, floor});
+    auto cow_bbox = CalcBoundingBox(std::vector<std::vector<obj_data::vertex>>{cow.vertices});
+    float scene_radius = 0.f;
+    for (auto V: bbox.vertices)
+        scene_radius = std::max(scene_radius, glm::length(V - bbox.C));
 
     /// *** Дебажный шейдер
     auto debug_shader = Shader::GenShader(Shader::ShaderPaths{
@@ -194,7 +207,7 @@ int main() try {
     GLuint debug_vao;
     glGenVertexArrays(1, &debug_vao);
 
-    auto const wolf_model = load_gltf(root + "/wolf/Wolf-Blender-2.82a.gltf");
+    auto const wolf_model = load_gltf(root + "/wolf/Wolf-Blender-2.82a.gltf", wolf_key_rate);
     GLuint wolf_vbo;
     glGenBuffers(1, &wolf_vbo);
     glBindBuffer(GL_ARRAY_BUFFER, wolf_vbo);
@@ -202,6 +215,8 @@ int main() try {
 
     struct mesh {
         GLuint vao;
+        // позиции и нормали из буфера скиннинга на CPU
+        GLuint cpu_skinned_vao;
         gltf_model::accessor indices;
         gltf_model::material material;
     };
@@ -209,14 +224,14 @@ int main() try {
     auto setup_attribute = [](int index, gltf_model::accessor const &accessor, bool integer = false) {
         glEnableVertexAttribArray(index);
         if (integer)
-            glVertexAttribIPointer(index, accessor.size, accessor.type, 0,
+            glVertexAttribIPointer(index, accessor.size, accessor.type, accessor.stride(),
                                    reinterpret_cast<void *>(accessor.view.offset));
         else
             glVertexAttribPointer(index,
                                   accessor.size,
                                   accessor.type,
-                                  GL_FALSE,
-                                  0,
+                                  accessor.normalized ? GL_TRUE : GL_FALSE,
+                                  accessor.stride(),
                                   reinterpret_cast<void *>(accessor.view.offset));
     };
 
@@ -238,6 +253,33 @@ int main() try {
         result.material = mesh.material;
     }
 
+    CpuSkinning cpu_skinning(wolf_model);
+    // Скиннинг пишет прямо в кадр буфера
+    StreamingBuffer cpu_skinned_buffer(GL_ARRAY_BUFFER, sizeof(CpuSkinning::Vertex), cpu_skinning.VertexCount());
+    // Позиции и нормали смотрят в кадр, начинающийся с вершины first, текстурные координаты - всегда в wolf_vbo
+    auto point_cpu_skinned_attributes = [&](int first) {
+        glBindBuffer(GL_ARRAY_BUFFER, cpu_skinned_buffer.Buffer());
+        for (int i = 0; i < (int) meshes.size(); ++i) {
+            glBindVertexArray(meshes[i].cpu_skinned_vao);
+            auto base = sizeof(CpuSkinning::Vertex) * (first + cpu_skinning.BaseVertex(i));
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(CpuSkinning::Vertex),
+                                  reinterpret_cast<void *>(base + offsetof(CpuSkinning::Vertex, position)));
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(CpuSkinning::Vertex),
+                                  reinterpret_cast<void *>(base + offsetof(CpuSkinning::Vertex, normal)));
+        }
+    };
+    for (int i = 0; i < (int) meshes.size(); ++i) {
+        glGenVertexArrays(1, &meshes[i].cpu_skinned_vao);
+        glBindVertexArray(meshes[i].cpu_skinned_vao);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, wolf_vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, wolf_vbo);
+        setup_attribute(2, wolf_model.meshes[i].texcoord);
+    }
+    int cpu_skinned_first = 0;
+    point_cpu_skinned_attributes(cpu_skinned_first);
+
     for (const auto &mesh: meshes) {
         if (!mesh.material.texture_path) continue;
 
@@ -249,7 +291,16 @@ int main() try {
                 });
     }
 
-    const auto &run_animation = wolf_model.animations.at("01_Run");
+    // Ключи, которые восстанавливаются интерполяцией, выкинуты, остальные квантованы
+    const CompressedClip run_animation(wolf_model, wolf_model.animations.at("01_Run"), wolf_max_error);
+    const Skeleton wolf_skeleton(wolf_model);
+    auto wolf_pose = wolf_skeleton.MakePose();
+    std::vector<glm::mat4x3> bones(wolf_skeleton.BoneCount());
+
+    // Кости пишутся раз за кадр, тени и основной проход читают их по смещению
+    const int skinning_texture_unit = 101;
+    assert(skinning_texture_unit < TextureLoader_.GetMaxTextureUnits());
+    SkinningPalette skinning_palette(wolf_skeleton.BoneCount(), 3, skinning_texture_unit);
 
     /// *** Снежинки
     auto snowflake_shader = Shader::GenShader(Shader::ShaderPaths{
@@ -258,18 +309,27 @@ int main() try {
             .geometry = FilePath{root + "/shaders/snowflake_geometry_shader_source.geom"}
     });
 
-    GLuint snowflake_vao, snowflake_vbo;
-    std::tie(snowflake_vao, snowflake_vbo) = GenSnowflakeBuffers();
+    // Step пишет потоки для рисования прямо в кадр буфера, first - его начало в float'ах
+    StreamingBuffer snowflake_buffer(GL_ARRAY_BUFFER, sizeof(float),
+                                     ParticleSystem::RenderedStreams * State.particles.Stride());
+    GLuint snowflake_vao = GenSnowflakeVao(State.particles, snowflake_buffer);
+    int snowflake_first = 0;
 
     /// ***********************************  END OF PREDGEN  *************************************************
-    auto cow_model = glm::translate(glm::scale(glm::mat4(1.f), {0.4, 0.4, 0.4}), {0.f, 0.5f, 0.f});
-
-    auto get_wolf_model_mat = [&](float time) {
-        auto wolf_model_mat = glm::scale(glm::mat4(1.f), {0.7, 0.7, 0.7});
-        wolf_model_mat = glm::translate(wolf_model_mat, {0.f, 0.f, wolf_len / 2.f});
-        wolf_model_mat = glm::rotate(wolf_model_mat, time, {0.f, 1.f, 0.f});
-        wolf_model_mat = glm::translate(glm::mat4(1.f), {-cos(time) * 0.7, 0.f, sin(time) * 0.7}) * wolf_model_mat;
-        return wolf_model_mat;
+    /// *** Граф сцены: сугроб подпрыгивает вместе со всем, что на нём стоит
+    TransformHierarchy scene;
+    const auto splash_node = scene.Add(TransformHierarchy::NoParent);
+    const auto cow_node = scene.Add(splash_node, {0.f, 0.2f, 0.f}, glm::quat(1.f, 0.f, 0.f, 0.f), glm::vec3(0.4f));
+    // волк бежит по кругу и поворачивается вокруг своей оси
+    const auto wolf_orbit_node = scene.Add(splash_node);
+    const auto wolf_node = scene.Add(wolf_orbit_node, {0.f, 0.f, 0.7f * wolf_len / 2.f}, glm::quat(1.f, 0.f, 0.f, 0.f),
+                                     glm::vec3(0.7f));
+
+    auto update_scene = [&](float time) {
+        scene.SetTranslation(splash_node, {0.f, State.getYhalfSphere(), 0.f});
+        scene.SetTranslation(wolf_orbit_node, {-std::cos(time) * 0.7f, 0.f, std::sin(time) * 0.7f});
+        scene.SetRotation(wolf_node, glm::angleAxis(time, glm::vec3(0.f, 1.f, 0.f)));
+        scene.Update();
     };
 
 
@@ -281,10 +341,11 @@ int main() try {
             glm::mat4x4 model,
             glm::mat4x4 view,
             glm::mat4x4 projection,
-            glm::mat4x4 shadow_transform,
+            const std::vector<glm::mat4x4> &shadow_transforms,
+            const std::vector<float> &cascade_far,
             glm::vec3 light_direction,
             glm::vec3 camera_position,
-            const std::vector<glm::mat4x3> &bones
+            int wolf_bone_offset
     ) {
         /// *** Рисуем корову
         glBindVertexArray(cow_vao);
@@ -293,7 +354,7 @@ int main() try {
         main_shader.Use();
         main_shader.Set("is_wolf", (int) 0);
         main_shader.Set("far_plane", far);
-        main_shader.Set("model", State.GetSplashModel() * cow_model);
+        main_shader.Set("model", scene.World(cow_node));
         main_shader.Set("view", view);
         main_shader.Set("projection", projection);
         main_shader.Set("sun_color", {.7f, .7f, .7f});
@@ -303,21 +364,24 @@ int main() try {
         main_shader.Set("power", 0.5f);
         main_shader.Set("glossiness", 0.3f);
         main_shader.Set("ambient_light", State.ambient_light);
-        main_shader.Set("transform", shadow_transform);
+        main_shader.Set("transform", cascade_count, shadow_transforms.data());
+        main_shader.Set("cascade_far", cascade_count, cascade_far.data());
         main_shader.Set("shadow_map", (int) sun_texture_unit);
 
         glDrawElements(GL_TRIANGLES, cow.indices.size(), GL_UNSIGNED_INT, (void *) nullptr);
 
         // *** Рисуем пол
         main_shader.Set("sampler", (int) snow_texture.texture_unit);
-        main_shader.Set("model", State.GetSplashModel() * glm::mat4(1.f));
+        main_shader.Set("model", scene.World(splash_node));
         glBindVertexArray(floor_vao);
         glDrawArrays(GL_TRIANGLE_FAN, 0, floor.size());
 
         // WOLF
         main_shader.Set("is_wolf", (int) 1);
-        main_shader.Set("model", State.GetSplashModel() * get_wolf_model_mat(State.time));
-        main_shader.Set("bones", bones.size(), bones.data());
+        main_shader.Set("model", scene.World(wolf_node));
+        main_shader.Set("bones", skinning_palette.TextureUnit());
+        main_shader.Set("bone_offset", wolf_bone_offset);
+        main_shader.Set("skinned_on_cpu", (int) State.cpu_skinning);
 
         auto draw_meshes = [&](bool transparent) {
             for (auto const &mesh: meshes) {
@@ -344,7 +408,7 @@ int main() try {
                 } else
                     continue;
 
-                glBindVertexArray(mesh.vao);
+                glBindVertexArray(State.cpu_skinning ? mesh.cpu_skinned_vao : mesh.vao);
                 glDrawElements(GL_TRIANGLES,
                                mesh.indices.count,
                                mesh.indices.type,
@@ -362,20 +426,18 @@ int main() try {
         //glBlendFunc(GL_SRC_ALPHA, GL_ONE);
         //glDisable(GL_DEPTH_TEST);
         glBindVertexArray(snowflake_vao);
-        glBindBuffer(GL_ARRAY_BUFFER, snowflake_vbo);
-        glBufferData(GL_ARRAY_BUFFER, State.particles.size() * sizeof(particle), State.particles.data(),
-                     GL_STATIC_DRAW);
         snowflake_shader.Use();
         snowflake_shader.Set("col", 1);
-        snowflake_shader.Set("model", State.GetSplashModel());
+        snowflake_shader.Set("model", scene.World(splash_node));
         snowflake_shader.Set("view", view);
         snowflake_shader.Set("projection", projection);
         snowflake_shader.Set("camera_position", camera_position);
         snowflake_shader.Set("sampler", (int) particle_texture.texture_unit);
         snowflake_shader.Set("snow", (int) snow_texture.texture_unit);
         snowflake_shader.Set("shadow_map", (int) sun_texture_unit);
-        snowflake_shader.Set("transform", shadow_transform);
-        glDrawArrays(GL_POINTS, 0, 4 * State.particles.size());
+        snowflake_shader.Set("transform", cascade_count, shadow_transforms.data());
+        snowflake_shader.Set("cascade_far", cascade_count, cascade_far.data());
+        glDrawArrays(GL_POINTS, snowflake_first, State.particles.Count());
 
         // *** Рисуем туман
         glEnable(GL_DEPTH_TEST);
@@ -390,9 +452,10 @@ int main() try {
         fog_shader.Set("bbox_max", cloud_bbox_max);
         fog_shader.Set("camera_position", camera_position);
         fog_shader.Set("light_direction", light_direction);
-        fog_shader.Set("model", State.GetSplashModel() * glm::mat4(1.f));
+        fog_shader.Set("model", scene.World(splash_node));
         fog_shader.Set("shadow_map", sun_texture_unit);
-        fog_shader.Set("transform", shadow_transform);
+        fog_shader.Set("transform", cascade_count, shadow_transforms.data());
+        fog_shader.Set("cascade_far", cascade_count, cascade_far.data());
         fog_shader.Set("sphere_y_mid", State.getYhalfSphere());
 
         glBindVertexArray(sphere_vao);
@@ -406,7 +469,7 @@ int main() try {
         glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
         glEnable(GL_DEPTH_TEST);
         sphere_shader.Use();
-        sphere_shader.Set("model", State.GetSplashModel() * model);
+        sphere_shader.Set("model", scene.World(splash_node) * model);
         sphere_shader.Set("view", view);
         sphere_shader.Set("projection", projection);
         sphere_shader.Set("light_direction", light_direction);
@@ -421,30 +484,48 @@ int main() try {
         glDisable(GL_BLEND);
     };
 
-    auto GetBones = [&]() {
-        std::vector<glm::mat4x3> bones(wolf_model.bones.size());
-        float frame_run = std::fmod(State.time, run_animation.max_time);
-
-        for (int i = 0; i < wolf_model.bones.size(); ++i) {
-            auto cur_translation = glm::translate(glm::mat4(1.f), run_animation.bones[i].translation(frame_run));
-            auto cur_scale = glm::scale(glm::mat4(1.f), run_animation.bones[i].scale(frame_run));
-            auto cur_rotation = glm::toMat4(run_animation.bones[i].rotation(frame_run));
-            auto cur_transform = cur_translation * cur_rotation * cur_scale;
-            if (wolf_model.bones[i].parent != -1) {
-                cur_transform = bones[wolf_model.bones[i].parent] * cur_transform;
-            }
-            bones[i] = cur_transform;
-        }
-        for (int i = 0; i < wolf_model.bones.size(); ++i) {
-            bones[i] = bones[i] * wolf_model.bones[i].inverse_bind_matrix;
+    auto UpdateBones = [&]() {
+        wolf_skeleton.Sample(run_animation, std::fmod(State.time, run_animation.Duration()), wolf_pose);
+        wolf_skeleton.Evaluate(wolf_pose, bones.data());
+
+        // Скиннинг один раз за кадр, все проходы рисуют готовые вершины
+        if (State.cpu_skinning) {
+            cpu_skinning.Skin(bones.data(), (int) bones.size(),
+                              State.dual_quaternion_skinning ? CpuSkinning::Blend::DualQuaternion
+                                                             : CpuSkinning::Blend::Linear,
+                              static_cast<CpuSkinning::Vertex *>(cpu_skinned_buffer.Map()));
+            if (int first = cpu_skinned_buffer.Unmap(); first != cpu_skinned_first)
+                point_cpu_skinned_attributes(cpu_skinned_first = first);
         }
-        return bones;
+
+        skinning_palette.BeginFrame();
+        int offset = skinning_palette.Add(bones.data(), (int) bones.size());
+        skinning_palette.Upload();
+        return offset;
     };
 
+    // Каскады перерисовываются по бюджету, остальные берутся с прошлых кадров
+    const int shadow_budget = 2;
+    const float wolf_shadow_radius = 0.5f; // грубая оценка размера волка для инвалидации каскадов
+    ShadowScheduler shadow_updates(shadow_budget);
+    std::vector<int> cascade_views(cascade_count);
+    for (int c = 0; c < cascade_count; ++c)
+        cascade_views[c] = shadow_updates.AddView((float) (1 << (cascade_count - 1 - c)));
+    // с чем каскады нарисованы на самом деле
+    std::vector<glm::mat4x4> rendered_transforms(cascade_count, glm::mat4(1.f));
+    std::vector<float> rendered_cascade_far(cascade_count, 0.f);
+
     while (State.running) {
         if (!State.tick()) break;
 
-        auto bones = GetBones();
+        /// *** Снежинки: шаг пишет сразу в буфер для рисования, на паузе рисуется прошлый кадр буфера
+        if (!State.paused) {
+            State.update_particles(State.dt, static_cast<float *>(snowflake_buffer.Map()));
+            snowflake_first = snowflake_buffer.Unmap();
+        }
+
+        update_scene(State.time);
+        int wolf_bone_offset = UpdateBones();
         float near = 0.1f;
         float far = 100.f;
         float top = near;
@@ -460,51 +541,84 @@ int main() try {
                 glm::vec3(std::sin(State.time * 0.5f) * 3, 2.f, std::cos(State.time * 0.5f) * 3));
         glm::vec3 camera_position = (glm::inverse(view) * glm::vec4(0.f, 0.f, 0.f, 1.f)).xyz();
 
-        /// *** в начале нарисуем все в shadow_map
-        glm::mat4x4 transform; // ай-ай-ай, как плохо...
+        /// *** в начале нарисуем все в shadow_map, по каскаду на кусок фрустума камеры
+        // дальше камеры плюс радиус сцены ничего нет, каскады туда не тянем
+        float shadow_far = std::min(far, State.camera_distance + scene_radius);
+        auto splits = GetCascadeSplits(near, shadow_far, cascade_count, cascade_lambda);
+        std::vector<glm::mat4x4> transforms(cascade_count);
         {
+            auto wolf_center = glm::vec3(scene.World(wolf_node) * glm::vec4(0.f, 0.f, 0.f, 1.f));
+            for (int c = 0; c < cascade_count; ++c) {
+                transforms[c] = GetCascadeShadowTransform(view, glm::pi<float>() / 2.f,
+                                                          (1.f * State.width) / State.height,
+                                                          splits[c], splits[c + 1],
+                                                          bbox.vertices, light_direction, shadow_map_resolution);
+
+                // волк бежит каждый кадр, так что каскад с ним всегда устарел хотя бы на тексель
+                float change = CascadeChange(rendered_transforms[c], transforms[c], shadow_map_resolution);
+                if (BoxInCascade(rendered_transforms[c], wolf_center - wolf_shadow_radius, wolf_center + wolf_shadow_radius))
+                    change = std::max(change, 1.f);
+                if (rendered_cascade_far[c] != splits[c + 1])
+                    change = std::max(change, 1.f);
+                shadow_updates.SetChange(cascade_views[c], change);
+            }
+
             glBindFramebuffer(GL_FRAMEBUFFER, shadow_fbo);
             glViewport(0, 0, shadow_map_resolution, shadow_map_resolution);
             glClearColor(1.f, 1.f, 0.f, 0.f);
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
             glEnable(GL_DEPTH_TEST);
             glDepthFunc(GL_LEQUAL);
-            glEnable(GL_CULL_FACE);
-            glCullFace(GL_BACK);
-
-            transform = GetSunShadowTransform(bbox.vertices, bbox.C, light_direction);
-            shadow_shader.Use();
-            shadow_shader.Set("is_wolf", 0);
-            shadow_shader.Set("transform", transform);
-            shadow_shader.Set("model", State.GetSplashModel() * cow_model);
-            glBindVertexArray(cow_vao);
-            glDrawElements(GL_TRIANGLES, cow.indices.size(), GL_UNSIGNED_INT, (void *) nullptr);
 
-            shadow_shader.Set("model", State.GetSplashModel() * model);
-            glBindVertexArray(floor_vao);
-            glDrawArrays(GL_TRIANGLE_FAN, 0, floor.size());
-
-            shadow_shader.Set("is_wolf", 1);
-            shadow_shader.Set("bones", bones.size(), bones.data());
-            shadow_shader.Set("model", State.GetSplashModel() * get_wolf_model_mat(State.time));
-
-            for (auto const &mesh: meshes) {
-                glBindVertexArray(mesh.vao);
-
-                if (mesh.material.two_sided)
-                    glDisable(GL_CULL_FACE);
-                else
-                    glEnable(GL_CULL_FACE);
-
-                glDrawElements(GL_TRIANGLES,
-                               mesh.indices.count,
-                               mesh.indices.type,
-                               reinterpret_cast<void *>(mesh.indices.view.offset));
+            auto cow_world = scene.World(cow_node);
+            for (int view_id: shadow_updates.Schedule()) {
+                int c = (int) (std::find(cascade_views.begin(), cascade_views.end(), view_id) - cascade_views.begin());
+
+                glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, shadow_map, 0, c);
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                glEnable(GL_CULL_FACE);
+                glCullFace(GL_BACK);
+
+                shadow_shader.Use();
+                shadow_shader.Set("is_wolf", 0);
+                shadow_shader.Set("transform", transforms[c]);
+                if (BoxInCascade(transforms[c] * cow_world, cow_bbox.vertices.front(), cow_bbox.vertices.back())) {
+                    shadow_shader.Set("model", cow_world);
+                    glBindVertexArray(cow_vao);
+                    glDrawElements(GL_TRIANGLES, cow.indices.size(), GL_UNSIGNED_INT, (void *) nullptr);
+                }
+
+                shadow_shader.Set("model", scene.World(splash_node) * model);
+                glBindVertexArray(floor_vao);
+                glDrawArrays(GL_TRIANGLE_FAN, 0, floor.size());
+
+                shadow_shader.Set("is_wolf", 1);
+                shadow_shader.Set("bones", skinning_palette.TextureUnit());
+                shadow_shader.Set("bone_offset", wolf_bone_offset);
+                shadow_shader.Set("skinned_on_cpu", (int) State.cpu_skinning);
+                shadow_shader.Set("model", scene.World(wolf_node));
+
+                for (auto const &mesh: meshes) {
+                    glBindVertexArray(State.cpu_skinning ? mesh.cpu_skinned_vao : mesh.vao);
+
+                    if (mesh.material.two_sided)
+                        glDisable(GL_CULL_FACE);
+                    else
+                        glEnable(GL_CULL_FACE);
+
+                    glDrawElements(GL_TRIANGLES,
+                                   mesh.indices.count,
+                                   mesh.indices.type,
+                                   reinterpret_cast<void *>(mesh.indices.view.offset));
+                }
+
+                rendered_transforms[c] = transforms[c];
+                rendered_cascade_far[c] = splits[c + 1];
+                shadow_updates.MarkRendered(view_id);
             }
 
             glDisable(GL_CULL_FACE);
-            glBindTexture(GL_TEXTURE_2D, shadow_map);
-            glGenerateMipmap(GL_TEXTURE_2D);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, shadow_map);
+            glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
         }
 
         glViewport(0, 0, State.width, State.height);
@@ -524,19 +638,30 @@ int main() try {
         glDrawArrays(GL_TRIANGLES, 0, 6);
 
         /// *** Рисуем сцену
-        draw_scene(far, model, view, projection, transform, light_direction, camera_position, bones);
+        draw_scene(far, model, view, projection, rendered_transforms, rendered_cascade_far, light_direction, camera_position,
+                   wolf_bone_offset);
 
         /// *** Рисуем дебажный прямоугольник
         if (DEBUG) {
             debug_shader.Use();
             debug_shader.Set("sampler", sun_texture_unit);
+            debug_shader.Set("layer", 0);
             glBindVertexArray(debug_vao);
             glDrawArrays(GL_TRIANGLES, 0, 6);
         }
 
+        // Всё, что читает кадры потоковых буферов, отправлено
+        snowflake_buffer.Fence();
+        cpu_skinned_buffer.Fence();
+
         SDL_GL_SwapWindow(window);
     }
 
+    // Объекты ниже живут до конца main, а удалять их можно только при живом контексте
+    snowflake_buffer.Destroy();
+    cpu_skinned_buffer.Destroy();
+    skinning_palette.Destroy();
+
     SDL_GL_DeleteContext(gl_context);
     SDL_DestroyWindow(window);
 }
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+
+// Decoders for buffer views compressed with EXT_meshopt_compression.
+// Each one decodes `count` elements of `stride` bytes from `size` bytes of `source` into `target`
+// and throws std::runtime_error if the data is malformed
+
+// mode "ATTRIBUTES": vertex data, stride is a multiple of 4 and at most 256
+void meshopt_decode_attributes(void * target, std::size_t count, std::size_t stride, unsigned char const * source, std::size_t size);
+
+// mode "TRIANGLES": triangle list indices, stride is 2 or 4
+void meshopt_decode_triangles(void * target, std::size_t count, std::size_t stride, unsigned char const * source, std::size_t size);
+
+// mode "INDICES": any other index sequence, stride is 2 or 4
+void meshopt_decode_indices(void * target, std::size_t count, std::size_t stride, unsigned char const * source, std::size_t size);
+
+enum class meshopt_filter
+{
+    none,
+    // normals and tangents: 4 signed normalized 8 or 16 bit components, xy are octahedral coordinates
+    octahedral,
+    // rotations: 4 signed normalized 16 bit components, the largest one is reconstructed
+    quaternion,
+    // floats as 24 bit mantissa and 8 bit exponent
+    exponential,
+};
+
+// Applied in place after decoding ATTRIBUTES
+void meshopt_apply_filter(void * data, std::size_t count, std::size_t stride, meshopt_filter filter);
@@ -0,0 +1,211 @@
+// Headless check and benchmark of ParticleSystem: a million particles are simulated by it and by the
+// old per-particle loop (AoS, a new vector per frame, exp per particle), the survivors are compared,
+// and single-threaded frames are checked to allocate nothing. Then runs with respawning on different
+// thread counts are checked to be bit-identical and allocation-free, and 1M-10M particles are timed on 1-8 threads. Finally, writing
+// the rendered streams from Step itself is compared with copying them after it.
+
+#include "utils/particle_system.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Считают и рабочие потоки ParticleSystem
+std::atomic<long long> allocation_count{0};
+
+template<typename F>
+double MeasureMicroseconds(int iterations, F &&f) {
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < iterations; ++i)
+        f(i);
+    auto finish = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::micro>(finish - start).count() / iterations;
+}
+
+// Как было в PState::update_particles
+void ReferenceUpdate(std::vector<particle> &particles, float dt, float floor) {
+    float A = 0.5;
+    float C = 2;
+    float D = 0.2;
+    std::vector<particle> new_particles;
+
+    for (auto &p: particles) {
+        p.speed.y -= dt * A;
+        p.position += p.speed * dt;
+        p.speed *= std::exp(-C * dt);
+        p.size *= std::exp(-D * dt);
+        p.angle += p.angular_speed * dt;
+
+        if (p.position.y >= floor)
+            new_particles.push_back(p);
+    }
+
+    particles.swap(new_particles);
+}
+
+// Хеш всех потоков, для сравнения прогонов
+std::uint64_t Hash(const ParticleSystem &particles) {
+    std::uint64_t result = 1469598103934665603ull;
+    for (int s = 0; s < ParticleSystem::StreamCount; ++s)
+        for (int i = 0; i < particles.Count(); ++i) {
+            std::uint32_t bits;
+            std::memcpy(&bits, particles.Data((ParticleSystem::Stream) s) + i, sizeof(bits));
+            result = (result ^ bits) * 1099511628211ull;
+        }
+    return result;
+}
+
+particle Snowflake(ParticleRandom &random) {
+    particle p{};
+    p.position = {random.Uniform(-1.f, 1.f), random.Uniform(0.f, 1.f), random.Uniform(-1.f, 1.f)};
+    p.size = random.Uniform(0.02f, 0.04f);
+    p.speed = {random.Uniform(0.f, 0.01f), -random.Uniform(0.f, 0.1f), random.Uniform(0.f, 0.01f)};
+    p.angular_speed = random.Uniform(0.f, 1.f);
+    return p;
+}
+
+particle Nothing(ParticleRandom &) {
+    return {};
+}
+
+}
+
+void *operator new(std::size_t size) {
+    ++allocation_count;
+    if (void *result = std::malloc(size))
+        return result;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, std::size_t) noexcept {
+    std::free(pointer);
+}
+
+int main() {
+    const int particle_count = 1000000;
+    const int frames = 100;
+    const float dt = 1.f / 60.f;
+    const float floor = 0.01f;
+    bool failed = false;
+
+    std::mt19937 random(42);
+    std::uniform_real_distribution<float> uniform(0.f, 1.f);
+    std::vector<particle> reference(particle_count);
+    for (auto &p: reference) {
+        p.position = {uniform(random) * 2.f - 1.f, uniform(random), uniform(random) * 2.f - 1.f};
+        p.size = 0.02f + 0.02f * uniform(random);
+        p.speed = {0.01f * uniform(random), -0.1f * uniform(random), 0.01f * uniform(random)};
+        p.angle = 0.f;
+        p.angular_speed = uniform(random);
+    }
+
+    // Без новых частиц выжившие должны совпасть со старым циклом, в том же порядке
+    {
+        ParticleSystem loaded(particle_count, 1);
+        for (const auto &p: reference)
+            loaded.Spawn(p);
+
+        double old_loop = MeasureMicroseconds(frames, [&](int) { ReferenceUpdate(reference, dt, floor); });
+
+        long long allocations_before = allocation_count;
+        double soa = MeasureMicroseconds(frames, [&](int) { loaded.Step(dt, floor, 0, Nothing); });
+        long long allocations = allocation_count - allocations_before;
+
+        std::cout << particle_count << " particles, " << frames << " frames, " << loaded.Count() << " left: "
+                  << "old loop " << old_loop << " us, ParticleSystem " << soa << " us per frame, "
+                  << allocations << " allocations" << std::endl;
+
+        float max_error = (int) reference.size() == loaded.Count() ? 0.f : INFINITY;
+        for (int i = 0; i < std::min((int) reference.size(), loaded.Count()); ++i) {
+            const auto &p = reference[i];
+            const float expected[] = {p.position.x, p.position.y, p.position.z, p.size, p.angle};
+            for (int s = 0; s < ParticleSystem::RenderedStreams; ++s)
+                max_error = std::max(max_error, std::abs(expected[s] - loaded.Data((ParticleSystem::Stream) s)[i]));
+        }
+        std::cout << "max error " << max_error << std::endl;
+        failed |= max_error > 1e-5f || allocations != 0;
+    }
+
+    // С рождением новых вместо упавших: результат не должен зависеть от числа потоков
+    {
+        std::uint64_t expected = 0;
+        for (int threads: {1, 2, 3, 4, 8}) {
+            ParticleSystem particles(particle_count, threads, 7);
+            std::vector<float> vertices(ParticleSystem::RenderedStreams * particles.Stride());
+            particles.Spawn(particle_count / 2, Snowflake);
+            int respawned = 0;
+            long long allocations_before = allocation_count;
+            for (int frame = 0; frame < 60; ++frame) {
+                particles.Spawn(particle_count / 100, Snowflake);
+                respawned += particles.Step(dt * 4.f, floor, particle_count / 200, Snowflake, vertices.data());
+            }
+            long long allocations = allocation_count - allocations_before;
+            std::uint64_t hash = Hash(particles);
+            std::cout << particles.ThreadCount() << " threads: " << particles.Count() << " particles, " << respawned
+                      << " respawned, hash " << std::hex << hash << std::dec << ", " << allocations << " allocations"
+                      << std::endl;
+            if (threads == 1)
+                expected = hash;
+            failed |= hash != expected || allocations != 0;
+
+            // То, что Step пишет для рисования, - то же, что в самой системе
+            for (int s = 0; s < ParticleSystem::RenderedStreams; ++s)
+                failed |= std::memcmp(vertices.data() + s * particles.Stride(),
+                                      particles.Data((ParticleSystem::Stream) s),
+                                      particles.Count() * sizeof(float)) != 0;
+        }
+    }
+
+    // Масштабирование: кадр со всеми частицами живыми и небольшим числом упавших
+    std::cout << "us per frame (hardware threads: " << std::thread::hardware_concurrency() << ")" << std::endl;
+    for (int count: {1000000, 4000000, 10000000}) {
+        std::cout << count << " particles:";
+        for (int threads: {1, 2, 4, 8}) {
+            ParticleSystem particles(count, threads, 7);
+            particles.Spawn(count, Snowflake);
+            double time = MeasureMicroseconds(10, [&](int) {
+                particles.Step(dt, floor, count, Snowflake);
+            });
+            std::cout << " " << threads << "t " << time;
+        }
+        std::cout << std::endl;
+    }
+
+    // Запись вершин прямо из Step против отдельного копирования потоков после него (как glBufferSubData)
+    {
+        ParticleSystem particles(particle_count, 1, 7);
+        particles.Spawn(particle_count, Snowflake);
+        std::vector<float> vertices(ParticleSystem::RenderedStreams * particles.Stride());
+        double copied = MeasureMicroseconds(20, [&](int) {
+            particles.Step(dt, floor, particle_count, Snowflake);
+            for (int s = 0; s < ParticleSystem::RenderedStreams; ++s)
+                std::memcpy(vertices.data() + s * particles.Stride(), particles.Data((ParticleSystem::Stream) s),
+                            particles.Count() * sizeof(float));
+        });
+        double direct = MeasureMicroseconds(20, [&](int) {
+            particles.Step(dt, floor, particle_count, Snowflake, vertices.data());
+        });
+        std::cout << particle_count << " particles with vertices: Step + copy " << copied << " us, Step writing them "
+                  << direct << " us per frame" << std::endl;
+    }
+
+    if (failed) {
+        std::cout << "FAILED" << std::endl;
+        return 1;
+    }
+}
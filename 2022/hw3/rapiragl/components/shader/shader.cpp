@@ -137,4 +137,12 @@ void Shader::Set(const std::string &name, int cnt, const glm::mat4x3 *m) {
     glUniformMatrix4x3fv(GetLocation(name), cnt, GL_FALSE, reinterpret_cast<const GLfloat *>(m));
 }
 
+void Shader::Set(const std::string &name, int cnt, const glm::mat4x4 *m) {
+    glUniformMatrix4fv(GetLocation(name), cnt, GL_FALSE, reinterpret_cast<const GLfloat *>(m));
+}
+
+void Shader::Set(const std::string &name, int cnt, const float *v) {
+    glUniform1fv(GetLocation(name), cnt, v);
+}
+
 }
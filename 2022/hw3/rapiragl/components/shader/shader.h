@@ -42,6 +42,10 @@ public:
 
     void Set(const std::string &name, int cnt, const glm::mat4x3 *m);
 
+    void Set(const std::string &name, int cnt, const glm::mat4x4 *m);
+
+    void Set(const std::string &name, int cnt, const float *v);
+
     void Set1f(const std::string &name, float value);
 
     void SetMat4x4(const std::string &name, const glm::mat4x4 &m);
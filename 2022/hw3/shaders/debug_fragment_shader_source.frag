@@ -1,8 +1,9 @@
 #version 330 core
-uniform sampler2D sampler;
+uniform sampler2DArray sampler;
+uniform int layer;
 in vec2 texcoord;
 layout (location = 0) out vec4 out_color;
 void main()
 {
-    out_color = vec4(texture(sampler, texcoord).rgb, 1.0);
+    out_color = vec4(texture(sampler, vec3(texcoord, layer)).rgb, 1.0);
 }
\ No newline at end of file
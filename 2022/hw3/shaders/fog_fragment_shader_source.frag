@@ -9,8 +9,21 @@ uniform float sphere_y_mid;
 
 in vec3 position;
 
-uniform sampler2D shadow_map;
-uniform mat4 transform;
+uniform sampler2DArray shadow_map;
+
+// каскады тени от солнца, cascade_far - граница каскада в view space
+const int CASCADE_COUNT = 3;
+uniform mat4 view;
+uniform mat4 transform[CASCADE_COUNT];
+uniform float cascade_far[CASCADE_COUNT];
+
+int GetCascade(vec3 p) {
+    float view_depth = -(view * vec4(p, 1.0)).z;
+    for (int i = 0; i < CASCADE_COUNT; ++i)
+        if (view_depth < cascade_far[i])
+            return i;
+    return -1;
+}
 
 layout (location = 0) out vec4 out_color;
 
@@ -59,7 +72,10 @@ vec3 get_texture_pos(vec3 p) {
 const float PI = 3.1415926535;
 
 int InShadow(vec3 position) {
-    vec4 shadow_pos = transform * vec4(position, 1.0);
+    int cascade = GetCascade(position);
+    if (cascade < 0) return 0;
+
+    vec4 shadow_pos = transform[cascade] * vec4(position, 1.0);
     shadow_pos /= shadow_pos.w;
     shadow_pos = shadow_pos * 0.5 + vec4(0.5);
 
@@ -68,7 +84,7 @@ int InShadow(vec3 position) {
     (shadow_pos.z > 0) && (shadow_pos.z < 1);
 
     if (in_shadow_texture) {
-        float real_z = texture(shadow_map, shadow_pos.xy).r;
+        float real_z = texture(shadow_map, vec3(shadow_pos.xy, cascade)).r;
         return int(real_z < shadow_pos.z);
     }
 
@@ -12,7 +12,6 @@ uniform float power;
 uniform vec3 point_light_attenuation;
 uniform vec3 point_light_color;
 uniform vec3 point_light_position;
-uniform mat4 transform;
 uniform samplerCube depthMap;
 uniform float far_plane;
 uniform float ambient_light;
@@ -23,7 +22,22 @@ uniform vec4 color;
 uniform sampler2D albedo;
 
 uniform sampler2D sampler;
-uniform sampler2D shadow_map;
+uniform sampler2DArray shadow_map;
+
+// каскады тени от солнца, cascade_far - граница каскада в view space
+const int CASCADE_COUNT = 3;
+uniform mat4 view;
+uniform mat4 transform[CASCADE_COUNT];
+uniform float cascade_far[CASCADE_COUNT];
+
+int GetCascade(vec3 p) {
+    float view_depth = -(view * vec4(p, 1.0)).z;
+    for (int i = 0; i < CASCADE_COUNT; ++i)
+        if (view_depth < cascade_far[i])
+            return i;
+    return -1;
+}
+
 layout (location = 0) out vec4 out_color;
 
 vec3 diffuse(vec3 direction, vec3 albedo) {
@@ -34,7 +48,10 @@ float GetShadowFactor() {
     float C = 0.005;
     float shadow_factor = 1.0;
 
-    vec4 shadow_pos = transform * vec4(position, 1.0);
+    int cascade = GetCascade(position);
+    if (cascade < 0) return shadow_factor;
+
+    vec4 shadow_pos = transform[cascade] * vec4(position, 1.0);
     shadow_pos /= shadow_pos.w;
     shadow_pos = shadow_pos * 0.5 + vec4(0.5);
     bool in_shadow_texture = (shadow_pos.x > 0) && (shadow_pos.x < 1) &&
@@ -49,7 +66,7 @@ float GetShadowFactor() {
         for (int x = -r; x <= r; ++x) {
             for (int y = -r; y <= r; ++y) {
                 float expo = exp(-(x * x + y * y) / 8.);
-                sum += expo * texture(shadow_map, shadow_pos.xy + vec2(x, y) / textureSize(shadow_map, 0).xy).rg;
+                sum += expo * texture(shadow_map, vec3(shadow_pos.xy + vec2(x, y) / textureSize(shadow_map, 0).xy, cascade)).rg;
                 sum_weight += expo;
             }
         }
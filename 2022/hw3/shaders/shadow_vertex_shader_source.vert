@@ -7,18 +7,30 @@ layout (location = 2) in vec2 in_texcoord;
 layout (location = 3) in ivec4 in_joints;
 layout (location = 4) in vec4 in_weights;
 
-uniform mat4x3 bones[64];
+// Палитра скиннинга: mat4x3 - 3 текселя, матрицы этого объекта начинаются с bone_offset
+uniform samplerBuffer bones;
+uniform int bone_offset;
 uniform int is_wolf;
+// 1 - позиции и нормали уже скиннингованы на CPU
+uniform int skinned_on_cpu;
+
+mat4x3 GetBone(int index) {
+    int texel = 3 * (bone_offset + index);
+    vec4 a = texelFetch(bones, texel);
+    vec4 b = texelFetch(bones, texel + 1);
+    vec4 c = texelFetch(bones, texel + 2);
+    return mat4x3(a.xyz, vec3(a.w, b.xy), vec3(b.zw, c.x), c.yzw);
+}
 
 mat4x3 GetMean() {
-    return in_weights.x * bones[in_joints.x] +
-    in_weights.y * bones[in_joints.y] +
-    in_weights.z * bones[in_joints.z] +
-    in_weights.w * bones[in_joints.w];
+    return in_weights.x * GetBone(in_joints.x) +
+    in_weights.y * GetBone(in_joints.y) +
+    in_weights.z * GetBone(in_joints.z) +
+    in_weights.w * GetBone(in_joints.w);
 }
 
 void main() {
-    mat4x3 average = GetMean();
+    mat4x3 average = skinned_on_cpu == 1 ? mat4x3(1.0) : GetMean();
     if (is_wolf == 0) {
         gl_Position = transform * model * vec4(in_position, 1.0);
     } else {
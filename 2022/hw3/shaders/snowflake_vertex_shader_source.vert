@@ -1,13 +1,16 @@
 #version 330 core
 
-layout (location = 0) in vec3 in_position;
-layout (location = 1) in float size;
-layout (location = 2) in float angle;
+// Потоки ParticleSystem
+layout (location = 0) in float in_x;
+layout (location = 1) in float in_y;
+layout (location = 2) in float in_z;
+layout (location = 3) in float size;
+layout (location = 4) in float angle;
 
 out float in_angle;
 
 void main() {
-    gl_Position = vec4(in_position, 1.0);
+    gl_Position = vec4(in_x, in_y, in_z, 1.0);
     gl_PointSize = size;
     in_angle = angle;
 }
\ No newline at end of file
@@ -0,0 +1,94 @@
+// Headless check and benchmark of the CPU skinning: the wolf's run animation is skinned on the CPU
+// and compared against the same math the vertex shaders do (GetMean() and mat4(average) * position).
+
+#include "gltf_loader.hpp"
+#include "utils/pose.h"
+#include "utils/cpu_skinning.h"
+
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+namespace {
+
+// Что делает main_vertex_shader_source.vert, на glm
+std::vector<CpuSkinning::Vertex> SkinLikeShader(const gltf_model &model, const std::vector<glm::mat4x3> &bones) {
+    std::vector<CpuSkinning::Vertex> result;
+    for (const auto &mesh: model.meshes) {
+        auto position = model.view<glm::vec3>(mesh.position);
+        auto normal = model.view<glm::vec3>(mesh.normal);
+        auto joints = model.view<std::array<std::uint8_t, 4>>(mesh.joints);
+        auto weights = model.view<glm::vec4>(mesh.weights);
+        for (unsigned int v = 0; v < mesh.position.count; ++v) {
+            auto j = joints[v];
+            glm::vec4 w = weights[v];
+            glm::mat4x3 average = w.x * bones[j[0]] + w.y * bones[j[1]] + w.z * bones[j[2]] + w.w * bones[j[3]];
+            result.push_back({glm::vec3(glm::mat4(average) * glm::vec4(position[v], 1.f)),
+                              glm::mat3(average) * normal[v]});
+        }
+    }
+    return result;
+}
+
+template<typename F>
+double MeasureMicroseconds(int iterations, F &&f) {
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < iterations; ++i)
+        f(i);
+    auto finish = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::micro>(finish - start).count() / iterations;
+}
+
+}
+
+int main() {
+    const std::string root = PROJECT_ROOT;
+    auto const model = load_gltf(root + "/wolf/Wolf-Blender-2.82a.gltf");
+    const auto &run = model.animations.at("01_Run");
+
+    Skeleton skeleton(model);
+    auto pose = skeleton.MakePose();
+    std::vector<glm::mat4x3> bones(skeleton.BoneCount());
+
+    CpuSkinning skinning(model);
+    std::vector<CpuSkinning::Vertex> linear(skinning.VertexCount()), dual_quaternion(skinning.VertexCount());
+
+    // Сверка с шейдером по всему клипу
+    float max_error = 0.f, max_dual_quaternion_difference = 0.f;
+    for (float time = 0.f; time < run.max_time; time += 1.f / 30.f) {
+        skeleton.Sample(run, time, pose);
+        skeleton.Evaluate(pose, bones.data());
+
+        auto expected = SkinLikeShader(model, bones);
+        skinning.Skin(bones.data(), (int) bones.size(), CpuSkinning::Blend::Linear, linear.data());
+        skinning.Skin(bones.data(), (int) bones.size(), CpuSkinning::Blend::DualQuaternion, dual_quaternion.data());
+        for (int v = 0; v < skinning.VertexCount(); ++v) {
+            max_error = std::max(max_error, glm::length(linear[v].position - expected[v].position));
+            max_error = std::max(max_error, glm::length(linear[v].normal - expected[v].normal));
+            max_dual_quaternion_difference = std::max(max_dual_quaternion_difference,
+                                                      glm::length(dual_quaternion[v].position - expected[v].position));
+        }
+    }
+
+    std::cout << skinning.VertexCount() << " vertices, " << bones.size() << " bones" << std::endl;
+    std::cout << "linear blend vs shader: max error " << max_error << std::endl;
+    std::cout << "dual quaternion vs linear blend: max position difference " << max_dual_quaternion_difference
+              << std::endl;
+
+    const int iterations = 2000;
+    double reference = MeasureMicroseconds(iterations, [&](int) { SkinLikeShader(model, bones); });
+    double simd = MeasureMicroseconds(iterations, [&](int) {
+        skinning.Skin(bones.data(), (int) bones.size(), CpuSkinning::Blend::Linear, linear.data());
+    });
+    double dq = MeasureMicroseconds(iterations, [&](int) {
+        skinning.Skin(bones.data(), (int) bones.size(), CpuSkinning::Blend::DualQuaternion, dual_quaternion.data());
+    });
+    std::cout << "per frame: scalar " << reference << " us, linear blend " << simd << " us, dual quaternion " << dq
+              << " us" << std::endl;
+
+    if (max_error > 1e-4f) {
+        std::cout << "FAILED: CPU skinning doesn't match the shader" << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,122 @@
+// Headless check and benchmark of TransformHierarchy: world matrices are compared against
+// multiplying the local transforms up the parent chain, and a large scene where only a few nodes
+// move per frame is timed against recomputing everything.
+
+#include "gltf_loader.hpp"
+#include "utils/transform_hierarchy.h"
+
+#include <chrono>
+#include <iostream>
+#include <random>
+
+namespace {
+
+struct Local {
+    int parent;
+    glm::vec3 translation;
+    glm::quat rotation;
+    glm::vec3 scale;
+};
+
+glm::mat4 LocalMatrix(const Local &node) {
+    return glm::translate(glm::mat4(1.f), node.translation) * glm::mat4_cast(node.rotation) *
+           glm::scale(glm::mat4(1.f), node.scale);
+}
+
+// Честный пересчёт всей сцены, родитель раньше ребёнка
+std::vector<glm::mat4> Reference(const std::vector<Local> &nodes) {
+    std::vector<glm::mat4> world(nodes.size());
+    for (std::size_t i = 0; i < nodes.size(); ++i)
+        world[i] = nodes[i].parent == -1 ? LocalMatrix(nodes[i]) : world[nodes[i].parent] * LocalMatrix(nodes[i]);
+    return world;
+}
+
+float MaxDifference(const TransformHierarchy &hierarchy, TransformHierarchy::Node first,
+                    const std::vector<glm::mat4> &expected) {
+    float result = 0.f;
+    for (std::size_t i = 0; i < expected.size(); ++i)
+        for (int c = 0; c < 4; ++c)
+            result = std::max(result, glm::length(hierarchy.World(first + (int) i)[c] - expected[i][c]));
+    return result;
+}
+
+template<typename F>
+double MeasureMicroseconds(int iterations, F &&f) {
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < iterations; ++i)
+        f(i);
+    auto finish = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::micro>(finish - start).count() / iterations;
+}
+
+}
+
+int main() {
+    const std::string root = PROJECT_ROOT;
+    float max_error = 0.f;
+
+    // Узлы волка: в glTF ребёнок может идти раньше родителя, так что эталон считается рекурсивно
+    {
+        auto const model = load_gltf(root + "/wolf/Wolf-Blender-2.82a.gltf");
+        TransformHierarchy hierarchy;
+        auto first = hierarchy.AddModel(TransformHierarchy::NoParent, model);
+        hierarchy.Update();
+
+        std::vector<glm::mat4> expected(model.nodes.size());
+        for (std::size_t i = 0; i < model.nodes.size(); ++i) {
+            const auto &node = model.nodes[i];
+            expected[i] = LocalMatrix({node.parent, node.translation, node.rotation, node.scale});
+            for (int parent = node.parent; parent != -1; parent = model.nodes[parent].parent) {
+                const auto &p = model.nodes[parent];
+                expected[i] = LocalMatrix({p.parent, p.translation, p.rotation, p.scale}) * expected[i];
+            }
+        }
+        max_error = std::max(max_error, MaxDifference(hierarchy, first, expected));
+        std::cout << "wolf: " << hierarchy.NodeCount() << " nodes, " << hierarchy.LevelCount() << " levels"
+                  << std::endl;
+    }
+
+    // Большая сцена: дерево с ветвлением 4, за кадр двигается несколько узлов
+    const int node_count = 100000;
+    const int moved_per_frame = 16;
+    std::mt19937 random(42);
+    std::uniform_real_distribution<float> uniform(-1.f, 1.f);
+    auto random_local = [&](int parent) {
+        glm::quat rotation = glm::angleAxis(uniform(random) * 3.f, glm::normalize(glm::vec3(uniform(random), uniform(random), 1.f)));
+        return Local{parent, glm::vec3(uniform(random), uniform(random), uniform(random)), rotation, glm::vec3(1.f)};
+    };
+
+    std::vector<Local> nodes;
+    TransformHierarchy hierarchy;
+    for (int i = 0; i < node_count; ++i) {
+        nodes.push_back(random_local(i == 0 ? -1 : (i - 1) / 4));
+        hierarchy.Add(nodes[i].parent, nodes[i].translation, nodes[i].rotation, nodes[i].scale);
+    }
+
+    double build = MeasureMicroseconds(1, [&](int) { hierarchy.Update(); });
+    std::cout << node_count << " nodes, " << hierarchy.LevelCount() << " levels: first update " << build << " us"
+              << std::endl;
+
+    const int frames = 200;
+    long long updated = 0;
+    double sparse = MeasureMicroseconds(frames, [&](int) {
+        for (int k = 0; k < moved_per_frame; ++k) {
+            int node = std::uniform_int_distribution<int>(0, node_count - 1)(random);
+            nodes[node].translation += glm::vec3(0.01f);
+            hierarchy.SetTranslation(node, nodes[node].translation);
+        }
+        hierarchy.Update();
+        updated += hierarchy.UpdatedCount();
+    });
+    max_error = std::max(max_error, MaxDifference(hierarchy, 0, Reference(nodes)));
+
+    double full = MeasureMicroseconds(20, [&](int) { Reference(nodes); });
+    std::cout << "per frame, " << moved_per_frame << " nodes moved: " << sparse << " us, "
+              << updated / frames << " matrices recomputed; everything recomputed: " << full << " us" << std::endl;
+    std::cout << "max error " << max_error << std::endl;
+
+    if (max_error > 1e-4f) {
+        std::cout << "FAILED: world matrices don't match the parent chain" << std::endl;
+        return 1;
+    }
+}
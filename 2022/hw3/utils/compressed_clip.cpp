@@ -0,0 +1,266 @@
+#include "compressed_clip.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace {
+
+const float quat_range = 0.70710678f; // 3 наименьшие компоненты единичного кватерниона по модулю не больше 1/sqrt(2)
+
+using Key = std::array<std::uint16_t, 3>;
+
+std::uint16_t Quantize(float value, float min, float extent, int bits) {
+    float max = (float) ((1 << bits) - 1);
+    float q = extent > 0.f ? (value - min) / extent * max : 0.f;
+    return (std::uint16_t) std::clamp(std::round(q), 0.f, max);
+}
+
+float Dequantize(std::uint16_t q, float min, float extent, int bits) {
+    // умножение вместо деления, оно на каждом ключе
+    return min + extent * (float) q * (1.f / (float) ((1 << bits) - 1));
+}
+
+Key EncodeQuat(glm::quat q) {
+    float c[4] = {q.x, q.y, q.z, q.w};
+    int largest = 0;
+    for (int i = 1; i < 4; ++i)
+        if (std::abs(c[i]) > std::abs(c[largest]))
+            largest = i;
+    // q и -q - один поворот, так что наибольшая компонента всегда положительная и не хранится
+    float sign = c[largest] < 0.f ? -1.f : 1.f;
+
+    Key key;
+    for (int i = 0, k = 0; i < 4; ++i)
+        if (i != largest)
+            key[k++] = Quantize(sign * c[i], -quat_range, 2.f * quat_range, 15);
+    key[0] |= (largest & 1) << 15;
+    key[1] |= (largest >> 1) << 15;
+    return key;
+}
+
+glm::quat DecodeQuat(const std::uint16_t *key) {
+    int largest = (key[0] >> 15) | ((key[1] >> 15) << 1);
+    float a = Dequantize(key[0] & 0x7fff, -quat_range, 2.f * quat_range, 15);
+    float b = Dequantize(key[1] & 0x7fff, -quat_range, 2.f * quat_range, 15);
+    float c = Dequantize(key[2] & 0x7fff, -quat_range, 2.f * quat_range, 15);
+    float d = std::sqrt(std::max(0.f, 1.f - a * a - b * b - c * c));
+    // glm::quat(w, x, y, z), d встаёт на место наибольшей компоненты
+    switch (largest) {
+        case 0:
+            return glm::quat(c, d, a, b);
+        case 1:
+            return glm::quat(c, a, d, b);
+        case 2:
+            return glm::quat(c, a, b, d);
+        default:
+            return glm::quat(d, a, b, c);
+    }
+}
+
+Key EncodeVector(glm::vec3 v, glm::vec3 min, glm::vec3 extent) {
+    return {Quantize(v.x, min.x, extent.x, 16), Quantize(v.y, min.y, extent.y, 16), Quantize(v.z, min.z, extent.z, 16)};
+}
+
+glm::vec3 DecodeVector(const std::uint16_t *key, glm::vec3 min, glm::vec3 extent) {
+    return {Dequantize(key[0], min.x, extent.x, 16),
+            Dequantize(key[1], min.y, extent.y, 16),
+            Dequantize(key[2], min.z, extent.z, 16)};
+}
+
+// nlerp вместо slerp: на соседних ключах разница мала, а считать дешевле
+glm::quat Interpolate(glm::quat a, glm::quat b, float t) {
+    float u = a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w < 0.f ? -t : t;
+    float s = 1.f - t;
+    float x = a.x * s + b.x * u, y = a.y * s + b.y * u, z = a.z * s + b.z * u, w = a.w * s + b.w * u;
+    float inverse_length = 1.f / std::sqrt(x * x + y * y + z * z + w * w);
+    return glm::quat(w * inverse_length, x * inverse_length, y * inverse_length, z * inverse_length);
+}
+
+glm::vec3 Interpolate(glm::vec3 a, glm::vec3 b, float t) {
+    return glm::mix(a, b, t);
+}
+
+float Distance(glm::quat a, glm::quat b) {
+    return 2.f * std::acos(std::min(1.f, std::abs(glm::dot(a, b))));
+}
+
+float Distance(glm::vec3 a, glm::vec3 b) {
+    return glm::length(a - b);
+}
+
+// Индексы ключей, которые надо оставить: отрезок от последнего оставленного ключа тянется,
+// пока интерполяция (уже квантованных значений) проходит через все выкинутые ключи с ошибкой <= tolerance
+template<typename T>
+std::vector<int> ReduceKeys(const std::vector<std::uint16_t> &times, const std::vector<T> &original,
+                            const std::vector<T> &decoded, float tolerance) {
+    int count = (int) original.size();
+    std::vector<int> kept{0};
+    int anchor = 0;
+    for (int end = 2; end < count; ++end) {
+        bool fits = true;
+        for (int k = anchor + 1; k < end && fits; ++k) {
+            float span = (float) times[end] - times[anchor];
+            float t = span > 0.f ? (times[k] - times[anchor]) / span : 0.f;
+            fits = Distance(Interpolate(decoded[anchor], decoded[end], t), original[k]) <= tolerance;
+        }
+        if (!fits) {
+            anchor = end - 1;
+            kept.push_back(anchor);
+        }
+    }
+    if (count > 1)
+        kept.push_back(count - 1);
+    return kept;
+}
+
+}
+
+CompressedClip::CompressedClip(const gltf_model &model, const gltf_model::animation &animation, float max_error)
+        : duration(animation.max_time), time_scale(65535.f / animation.max_time) {
+    int bone_count = (int) model.bones.size();
+
+    // Допуск каждой кости: длина самой длинной цепочки через кость и расстояние до самого дальнего потомка
+    std::vector<int> depth(bone_count, 1), height(bone_count, 1);
+    std::vector<glm::vec3> joint(bone_count);
+    std::vector<float> reach(bone_count, 0.f);
+    for (int i = 0; i < bone_count; ++i) {
+        joint[i] = glm::vec3(glm::inverse(model.bones[i].inverse_bind_matrix)[3]);
+        if (model.bones[i].parent != -1u)
+            depth[i] = depth[model.bones[i].parent] + 1;
+    }
+    for (int i = bone_count - 1; i >= 0; --i) {
+        unsigned int p = model.bones[i].parent;
+        if (p == -1u)
+            continue;
+        height[p] = std::max(height[p], height[i] + 1);
+        reach[p] = std::max(reach[p], reach[i] + glm::distance(joint[p], joint[i]));
+    }
+    // Вокруг концевых костей ещё есть кожа, так что расстояние не меньше доли размера скелета
+    float min_reach = 0.1f * *std::max_element(reach.begin(), reach.end());
+
+    auto quantize_time = [&](float time) {
+        return Quantize(time, 0.f, duration, 16);
+    };
+
+    auto add_vector_track = [&](const gltf_model::spline<glm::vec3> &spline, float tolerance) {
+        Track track{(std::uint32_t) times.size(), 0, glm::vec3(0.f), glm::vec3(0.f)};
+        if (!spline.values.empty()) {
+            track.min = spline.values[0];
+            glm::vec3 max = spline.values[0];
+            for (auto v: spline.values) {
+                track.min = glm::min(track.min, v);
+                max = glm::max(max, v);
+            }
+            track.extent = max - track.min;
+
+            std::vector<std::uint16_t> key_times;
+            std::vector<glm::vec3> decoded;
+            for (int k = 0; k < (int) spline.values.size(); ++k) {
+                key_times.push_back(quantize_time(spline.timestamps[k]));
+                Key key = EncodeVector(spline.values[k], track.min, track.extent);
+                decoded.push_back(DecodeVector(key.data(), track.min, track.extent));
+            }
+            for (int k: ReduceKeys(key_times, spline.values, decoded, tolerance)) {
+                Key key = EncodeVector(spline.values[k], track.min, track.extent);
+                times.push_back(key_times[k]);
+                values.insert(values.end(), key.begin(), key.end());
+            }
+        }
+        track.key_count = (std::uint32_t) times.size() - track.first_key;
+        tracks.push_back(track);
+    };
+
+    auto add_rotation_track = [&](const gltf_model::spline<glm::quat> &spline, float tolerance) {
+        Track track{(std::uint32_t) times.size(), 0, glm::vec3(0.f), glm::vec3(0.f)};
+        std::vector<std::uint16_t> key_times;
+        std::vector<glm::quat> decoded;
+        for (int k = 0; k < (int) spline.values.size(); ++k) {
+            key_times.push_back(quantize_time(spline.timestamps[k]));
+            decoded.push_back(DecodeQuat(EncodeQuat(spline.values[k]).data()));
+        }
+        if (!spline.values.empty())
+            for (int k: ReduceKeys(key_times, spline.values, decoded, tolerance)) {
+                Key key = EncodeQuat(spline.values[k]);
+                times.push_back(key_times[k]);
+                values.insert(values.end(), key.begin(), key.end());
+            }
+        track.key_count = (std::uint32_t) times.size() - track.first_key;
+        tracks.push_back(track);
+    };
+
+    for (int i = 0; i < bone_count; ++i) {
+        float budget = max_error / (float) (depth[i] + height[i] - 1);
+        float lever = std::max(reach[i], min_reach);
+        const auto &bone = animation.bones[i];
+        add_vector_track(bone.translation, budget);
+        add_rotation_track(bone.rotation, budget / lever);
+        add_vector_track(bone.scale, budget / lever);
+    }
+}
+
+std::size_t CompressedClip::SizeBytes() const {
+    return tracks.size() * sizeof(Track) + times.size() * sizeof(times[0]) + values.size() * sizeof(values[0]);
+}
+
+std::uint32_t CompressedClip::Find(const Track &track, float time, unsigned int &cursor, float &t) const {
+    const std::uint16_t *key_times = times.data() + track.first_key;
+    unsigned int count = track.key_count;
+    float q = time * time_scale;
+
+    // Как в gltf_model::spline: сначала несколько шагов вперёд от прошлого ключа, потом бинпоиск
+    const unsigned int max_steps = 4;
+    bool found = false;
+    if (cursor > 0 && cursor <= count && key_times[cursor - 1] < q) {
+        for (unsigned int steps = 0; steps < max_steps && !found; ++steps) {
+            found = cursor == count || q <= key_times[cursor];
+            if (!found)
+                ++cursor;
+        }
+    }
+    if (!found)
+        cursor = std::lower_bound(key_times, key_times + count, q,
+                                  [](std::uint16_t key, float value) { return key < value; }) - key_times;
+    unsigned int i = cursor;
+
+    if (i == 0 || i == count) {
+        t = 0.f;
+        return i == 0 ? 0 : count - 1;
+    }
+    t = (q - key_times[i - 1]) / (float) (key_times[i] - key_times[i - 1]);
+    return i;
+}
+
+glm::vec3 CompressedClip::Vector(const Track &track, float time, unsigned int &cursor) const {
+    float t;
+    std::uint32_t i = Find(track, time, cursor, t);
+    const std::uint16_t *key = values.data() + 3 * (track.first_key + i);
+    glm::vec3 b = DecodeVector(key, track.min, track.extent);
+    if (t == 0.f)
+        return b;
+    glm::vec3 a = DecodeVector(key - 3, track.min, track.extent);
+    return glm::mix(a, b, t);
+}
+
+glm::vec3 CompressedClip::Translation(int bone, float time, unsigned int &cursor) const {
+    const Track &track = tracks[3 * bone];
+    return track.key_count == 0 ? glm::vec3(0.f) : Vector(track, time, cursor);
+}
+
+glm::vec3 CompressedClip::Scale(int bone, float time, unsigned int &cursor) const {
+    const Track &track = tracks[3 * bone + 2];
+    return track.key_count == 0 ? glm::vec3(1.f) : Vector(track, time, cursor);
+}
+
+glm::quat CompressedClip::Rotation(int bone, float time, unsigned int &cursor) const {
+    const Track &track = tracks[3 * bone + 1];
+    if (track.key_count == 0)
+        return glm::quat(1.f, 0.f, 0.f, 0.f);
+    float t;
+    std::uint32_t i = Find(track, time, cursor, t);
+    const std::uint16_t *key = values.data() + 3 * (track.first_key + i);
+    glm::quat b = DecodeQuat(key);
+    if (t == 0.f)
+        return b;
+    return Interpolate(DecodeQuat(key - 3), b, t);
+}
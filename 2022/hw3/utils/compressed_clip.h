@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "gltf_loader.hpp"
+
+/// *** Сжатая анимация
+// Из каждого трека выкидываются ключи, которые восстанавливаются интерполяцией соседних
+// с ошибкой меньше допустимой, а оставшиеся квантуются:
+// повороты - smallest three в 48 бит, сдвиги и масштабы - по 16 бит на компоненту в диапазоне трека,
+// время ключа - 16 бит от длины клипа.
+// Ошибка считается в смещении вершин: ошибка поворота кости умножается на расстояние
+// до самого дальнего потомка, а допуск делится между всеми костями самой длинной цепочки через кость,
+// чтобы ошибки вдоль цепочки в сумме не превышали max_error.
+class CompressedClip {
+public:
+    CompressedClip(const gltf_model &model, const gltf_model::animation &animation, float max_error);
+
+    float Duration() const { return duration; }
+    int BoneCount() const { return (int) tracks.size() / 3; }
+
+    // Значения костей в момент time; cursor - как у gltf_model::spline, один на трек
+    glm::vec3 Translation(int bone, float time, unsigned int &cursor) const;
+    glm::quat Rotation(int bone, float time, unsigned int &cursor) const;
+    glm::vec3 Scale(int bone, float time, unsigned int &cursor) const;
+
+    std::size_t KeyCount() const { return times.size(); }
+    std::size_t SizeBytes() const;
+
+private:
+    struct Track {
+        std::uint32_t first_key;
+        std::uint32_t key_count;
+        // для сдвига и масштаба: значение = min + extent * q / 65535
+        glm::vec3 min;
+        glm::vec3 extent;
+    };
+
+    // Ключ i трека на отрезке (i - 1, i], t - доля между ними
+    std::uint32_t Find(const Track &track, float time, unsigned int &cursor, float &t) const;
+    glm::vec3 Vector(const Track &track, float time, unsigned int &cursor) const;
+
+    float duration;
+    // секунды в единицы времени ключей
+    float time_scale;
+    // 3 трека на кость: сдвиг, поворот, масштаб
+    std::vector<Track> tracks;
+    std::vector<std::uint16_t> times;
+    // 3 числа на ключ
+    std::vector<std::uint16_t> values;
+};
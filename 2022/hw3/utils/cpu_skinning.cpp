@@ -0,0 +1,117 @@
+#include "cpu_skinning.h"
+
+#include <cmath>
+#include "glm/gtc/quaternion.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define CPU_SKINNING_SSE 1
+#include <xmmintrin.h>
+#endif
+
+CpuSkinning::CpuSkinning(const gltf_model &model) {
+    for (const auto &mesh: model.meshes) {
+        base_vertex.push_back(VertexCount());
+        for (unsigned int v = 0; v < mesh.position.count; ++v) {
+            positions.push_back(model.read(mesh.position, v, glm::vec4(0.f, 0.f, 0.f, 1.f)));
+            normals.push_back(model.read(mesh.normal, v, glm::vec4(0.f)));
+            glm::vec4 j = model.read(mesh.joints, v, glm::vec4(0.f));
+            glm::vec4 w = model.read(mesh.weights, v, glm::vec4(0.f));
+            for (int k = 0; k < 4; ++k) {
+                joints.push_back((std::uint16_t) j[k]);
+                weights.push_back(w[k]);
+            }
+        }
+    }
+}
+
+void CpuSkinning::Skin(const glm::mat4x3 *palette, int bone_count, Blend blend, Vertex *out) {
+    if (blend == Blend::DualQuaternion) {
+        SkinDualQuaternion(palette, bone_count, out);
+        return;
+    }
+
+    palette4.resize(4 * bone_count);
+    for (int b = 0; b < bone_count; ++b)
+        for (int c = 0; c < 4; ++c)
+            palette4[4 * b + c] = glm::vec4(palette[b][c], 0.f);
+    SkinLinear(out);
+}
+
+void CpuSkinning::SkinLinear(Vertex *out) const {
+    const std::uint16_t *j = joints.data();
+    const float *w = weights.data();
+#ifdef CPU_SKINNING_SSE
+    // Вершина за итерацию: 4 столбца смешанной матрицы считаются сразу по xyz
+    for (int v = 0; v < VertexCount(); ++v, j += 4, w += 4) {
+        __m128 column[4];
+        for (int c = 0; c < 4; ++c) {
+            __m128 sum = _mm_mul_ps(_mm_set1_ps(w[0]), _mm_loadu_ps(&palette4[4 * j[0] + c].x));
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(w[1]), _mm_loadu_ps(&palette4[4 * j[1] + c].x)));
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(w[2]), _mm_loadu_ps(&palette4[4 * j[2] + c].x)));
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(w[3]), _mm_loadu_ps(&palette4[4 * j[3] + c].x)));
+            column[c] = sum;
+        }
+
+        const glm::vec4 &p = positions[v];
+        const glm::vec4 &n = normals[v];
+        __m128 position = _mm_add_ps(_mm_add_ps(_mm_mul_ps(column[0], _mm_set1_ps(p.x)),
+                                                _mm_mul_ps(column[1], _mm_set1_ps(p.y))),
+                                     _mm_add_ps(_mm_mul_ps(column[2], _mm_set1_ps(p.z)), column[3]));
+        __m128 normal = _mm_add_ps(_mm_add_ps(_mm_mul_ps(column[0], _mm_set1_ps(n.x)),
+                                              _mm_mul_ps(column[1], _mm_set1_ps(n.y))),
+                                   _mm_mul_ps(column[2], _mm_set1_ps(n.z)));
+
+        // Vertex - 6 float подряд: позиция пишется 4 числами (лишнее перезапишет нормаль), нормаль - 2 + 1
+        float *o = &out[v].position.x;
+        _mm_storeu_ps(o, position);
+        _mm_storel_pi(reinterpret_cast<__m64 *>(o + 3), normal);
+        _mm_store_ss(o + 5, _mm_movehl_ps(normal, normal));
+    }
+#else
+    for (int v = 0; v < VertexCount(); ++v, j += 4, w += 4) {
+        glm::vec4 column[4];
+        for (int c = 0; c < 4; ++c)
+            column[c] = w[0] * palette4[4 * j[0] + c] + w[1] * palette4[4 * j[1] + c] +
+                        w[2] * palette4[4 * j[2] + c] + w[3] * palette4[4 * j[3] + c];
+        const glm::vec4 &p = positions[v];
+        const glm::vec4 &n = normals[v];
+        out[v].position = glm::vec3(column[0] * p.x + column[1] * p.y + column[2] * p.z + column[3]);
+        out[v].normal = glm::vec3(column[0] * n.x + column[1] * n.y + column[2] * n.z);
+    }
+#endif
+}
+
+void CpuSkinning::SkinDualQuaternion(const glm::mat4x3 *palette, int bone_count, Vertex *out) {
+    // Кость -> (поворот r, дуальная часть d = t * r / 2)
+    real.resize(bone_count);
+    dual.resize(bone_count);
+    for (int b = 0; b < bone_count; ++b) {
+        glm::mat3 rotation(glm::normalize(palette[b][0]), glm::normalize(palette[b][1]), glm::normalize(palette[b][2]));
+        glm::quat r = glm::quat_cast(rotation);
+        glm::vec3 t = palette[b][3];
+        glm::vec3 rv(r.x, r.y, r.z);
+        real[b] = glm::vec4(rv, r.w);
+        dual[b] = glm::vec4(0.5f * (t * r.w + glm::cross(t, rv)), -0.5f * glm::dot(t, rv));
+    }
+
+    const std::uint16_t *j = joints.data();
+    const float *w = weights.data();
+    for (int v = 0; v < VertexCount(); ++v, j += 4, w += 4) {
+        // q и -q - один поворот: все слагаемые разворачиваются к первому
+        glm::vec4 r(0.f), d(0.f);
+        for (int k = 0; k < 4; ++k) {
+            float weight = glm::dot(real[j[k]], real[j[0]]) < 0.f ? -w[k] : w[k];
+            r += weight * real[j[k]];
+            d += weight * dual[j[k]];
+        }
+        float inverse_length = 1.f / glm::length(r);
+        r *= inverse_length;
+        d *= inverse_length;
+
+        glm::vec3 rv(r), dv(d);
+        glm::vec3 p(positions[v]), n(normals[v]);
+        glm::vec3 translation = 2.f * (r.w * dv - d.w * rv + glm::cross(rv, dv));
+        out[v].position = p + 2.f * glm::cross(rv, glm::cross(rv, p) + r.w * p) + translation;
+        out[v].normal = n + 2.f * glm::cross(rv, glm::cross(rv, n) + r.w * n);
+    }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "gltf_loader.hpp"
+#include "glm/vec4.hpp"
+#include "glm/mat4x3.hpp"
+
+/// *** Скиннинг на CPU
+// Позиции и нормали всех мешей модели скиннингуются раз за кадр в один буфер,
+// который потом читают все проходы (тени, основной) как обычную геометрию,
+// и цена скиннинга не растёт с числом каскадов.
+class CpuSkinning {
+public:
+    enum class Blend {
+        Linear,         // как GetMean() в шейдерах
+        DualQuaternion, // без "конфетной обёртки" на скрученных суставах, масштаб костей игнорируется
+    };
+
+    struct Vertex {
+        glm::vec3 position;
+        glm::vec3 normal;
+    };
+
+    explicit CpuSkinning(const gltf_model &model);
+
+    int VertexCount() const { return (int) joints.size() / 4; }
+
+    // Номер первой вершины меша в выходном буфере
+    int BaseVertex(int mesh) const { return base_vertex[mesh]; }
+
+    // palette - матрицы костей (world * inverse_bind), out - VertexCount() вершин
+    void Skin(const glm::mat4x3 *palette, int bone_count, Blend blend, Vertex *out);
+
+private:
+    void SkinLinear(Vertex *out) const;
+    void SkinDualQuaternion(const glm::mat4x3 *palette, int bone_count, Vertex *out);
+
+    std::vector<int> base_vertex;
+    // по 4 на вершину
+    std::vector<glm::vec4> positions, normals;
+    std::vector<std::uint16_t> joints;
+    std::vector<float> weights;
+
+    // Палитра в 4 столбцах по vec4 на кость, чтобы читать её SSE без перепаковки
+    std::vector<glm::vec4> palette4;
+    // Для dual quaternion: вещественная и дуальная части на кость
+    std::vector<glm::vec4> real, dual;
+};
@@ -0,0 +1,346 @@
+#include "particle_system.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__AVX__)
+#define PARTICLES_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#define PARTICLES_SSE
+#include <xmmintrin.h>
+#endif
+
+namespace {
+
+// Частиц за шаг цикла Fall; потоки и куски кратны, так что хвоста нет
+#if defined(PARTICLES_AVX)
+constexpr int Lanes = 8;
+#elif defined(PARTICLES_SSE)
+constexpr int Lanes = 4;
+#else
+constexpr int Lanes = 1;
+#endif
+
+static_assert(ParticleSystem::ChunkSize % Lanes == 0);
+
+// splitmix64
+std::uint64_t Mix(std::uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
+}
+
+// Перенос n частиц из from в to с интегрированием всего, кроме y и скорости по y - их уже посчитал Fall.
+// Если to и from - один массив, эти два поля и угловая скорость не трогаются.
+// rendered, если не nullptr, - куда ещё записать RenderedStreams полей для рисования
+void Advance(float *const *to, const float *const *from, float *const *rendered, int n, float dt, float speed_decay,
+             float size_decay) {
+    using S = ParticleSystem;
+    if (to[S::Y] != from[S::Y])
+        for (auto stream: {S::Y, S::SpeedY, S::AngularSpeed})
+            std::memcpy(to[stream], from[stream], n * sizeof(float));
+    if (rendered)
+        std::memcpy(rendered[S::Y], from[S::Y], n * sizeof(float));
+
+    int i = 0;
+#if defined(PARTICLES_AVX)
+    const __m256 dt8 = _mm256_set1_ps(dt), speed_decay8 = _mm256_set1_ps(speed_decay);
+    const __m256 size_decay8 = _mm256_set1_ps(size_decay);
+    for (; i + 8 <= n; i += 8) {
+        const __m256 sx = _mm256_loadu_ps(from[S::SpeedX] + i), sz = _mm256_loadu_ps(from[S::SpeedZ] + i);
+        const __m256 x = _mm256_add_ps(_mm256_loadu_ps(from[S::X] + i), _mm256_mul_ps(sx, dt8));
+        const __m256 z = _mm256_add_ps(_mm256_loadu_ps(from[S::Z] + i), _mm256_mul_ps(sz, dt8));
+        const __m256 size = _mm256_mul_ps(_mm256_loadu_ps(from[S::Size] + i), size_decay8);
+        const __m256 angle = _mm256_add_ps(_mm256_loadu_ps(from[S::Angle] + i),
+                                           _mm256_mul_ps(_mm256_loadu_ps(from[S::AngularSpeed] + i), dt8));
+        _mm256_storeu_ps(to[S::X] + i, x);
+        _mm256_storeu_ps(to[S::Z] + i, z);
+        _mm256_storeu_ps(to[S::SpeedX] + i, _mm256_mul_ps(sx, speed_decay8));
+        _mm256_storeu_ps(to[S::SpeedZ] + i, _mm256_mul_ps(sz, speed_decay8));
+        _mm256_storeu_ps(to[S::Size] + i, size);
+        _mm256_storeu_ps(to[S::Angle] + i, angle);
+        if (rendered) {
+            _mm256_storeu_ps(rendered[S::X] + i, x);
+            _mm256_storeu_ps(rendered[S::Z] + i, z);
+            _mm256_storeu_ps(rendered[S::Size] + i, size);
+            _mm256_storeu_ps(rendered[S::Angle] + i, angle);
+        }
+    }
+#elif defined(PARTICLES_SSE)
+    const __m128 dt4 = _mm_set1_ps(dt), speed_decay4 = _mm_set1_ps(speed_decay), size_decay4 = _mm_set1_ps(size_decay);
+    for (; i + 4 <= n; i += 4) {
+        const __m128 sx = _mm_loadu_ps(from[S::SpeedX] + i), sz = _mm_loadu_ps(from[S::SpeedZ] + i);
+        const __m128 x = _mm_add_ps(_mm_loadu_ps(from[S::X] + i), _mm_mul_ps(sx, dt4));
+        const __m128 z = _mm_add_ps(_mm_loadu_ps(from[S::Z] + i), _mm_mul_ps(sz, dt4));
+        const __m128 size = _mm_mul_ps(_mm_loadu_ps(from[S::Size] + i), size_decay4);
+        const __m128 angle = _mm_add_ps(_mm_loadu_ps(from[S::Angle] + i),
+                                        _mm_mul_ps(_mm_loadu_ps(from[S::AngularSpeed] + i), dt4));
+        _mm_storeu_ps(to[S::X] + i, x);
+        _mm_storeu_ps(to[S::Z] + i, z);
+        _mm_storeu_ps(to[S::SpeedX] + i, _mm_mul_ps(sx, speed_decay4));
+        _mm_storeu_ps(to[S::SpeedZ] + i, _mm_mul_ps(sz, speed_decay4));
+        _mm_storeu_ps(to[S::Size] + i, size);
+        _mm_storeu_ps(to[S::Angle] + i, angle);
+        if (rendered) {
+            _mm_storeu_ps(rendered[S::X] + i, x);
+            _mm_storeu_ps(rendered[S::Z] + i, z);
+            _mm_storeu_ps(rendered[S::Size] + i, size);
+            _mm_storeu_ps(rendered[S::Angle] + i, angle);
+        }
+    }
+#endif
+    for (; i < n; ++i) {
+        to[S::X][i] = from[S::X][i] + from[S::SpeedX][i] * dt;
+        to[S::Z][i] = from[S::Z][i] + from[S::SpeedZ][i] * dt;
+        to[S::SpeedX][i] = from[S::SpeedX][i] * speed_decay;
+        to[S::SpeedZ][i] = from[S::SpeedZ][i] * speed_decay;
+        to[S::Size][i] = from[S::Size][i] * size_decay;
+        to[S::Angle][i] = from[S::Angle][i] + from[S::AngularSpeed][i] * dt;
+        if (rendered)
+            for (auto stream: {S::X, S::Z, S::Size, S::Angle})
+                rendered[stream][i] = to[stream][i];
+    }
+}
+
+// Номера частиц из Spawn, чтобы не пересекаться с номерами упавших в Step
+constexpr std::uint64_t SpawnIndex = 1ull << 63;
+
+}
+
+float ParticleRandom::Uniform(float l, float r) {
+    std::uint64_t bits = Mix(key + ++counter * 0x9e3779b97f4a7c15ull);
+    return l + (r - l) * (float) (bits >> 40) * 0x1p-24f;
+}
+
+namespace {
+
+int UsefulThreads(int capacity, int requested) {
+    if (requested <= 0)
+        requested = std::max(1, (int) std::thread::hardware_concurrency());
+    // Лишним потокам не достанется ни одного куска
+    return std::clamp((capacity + ParticleSystem::ChunkSize - 1) / ParticleSystem::ChunkSize, 1, requested);
+}
+
+}
+
+ParticleSystem::ParticleSystem(int capacity, int thread_count, std::uint64_t seed)
+        : capacity(capacity), stride((capacity + Lanes - 1) / Lanes * Lanes),
+          thread_count(UsefulThreads(capacity, thread_count)), seed(seed),
+          start(this->thread_count), finish(this->thread_count), phase(this->thread_count, PrefixStep{this}) {
+    for (auto &buffer: data)
+        buffer.assign((std::size_t) StreamCount * stride, 0.f);
+    chunks.resize((capacity + ChunkSize - 1) / ChunkSize);
+    // Каждый упавший даёт не больше двух отрезков: выживших перед ним и новую частицу
+    runs.resize(this->thread_count);
+    for (auto &thread_runs: runs)
+        thread_runs.reserve(2 * std::min(ChunkSize, capacity));
+
+    workers.reserve(this->thread_count - 1);
+    for (int thread = 1; thread < this->thread_count; ++thread)
+        workers.emplace_back(&ParticleSystem::WorkerLoop, this, thread);
+}
+
+ParticleSystem::~ParticleSystem() {
+    if (workers.empty())
+        return;
+    stopping = true;
+    start.arrive_and_wait();
+    for (auto &thread: workers)
+        thread.join();
+}
+
+ParticleRandom ParticleSystem::Random(std::uint64_t index) const {
+    return ParticleRandom(Mix(Mix(seed + Mix(frame)) + index));
+}
+
+bool ParticleSystem::Spawn(const particle &p) {
+    if (count == capacity) return false;
+    Set(current, count++, p);
+    return true;
+}
+
+int ParticleSystem::Spawn(int n, Spawner spawner) {
+    int spawned = 0;
+    for (; spawned < n && count < capacity; ++spawned) {
+        auto random = Random(SpawnIndex + spawned);
+        Set(current, count++, spawner(random));
+    }
+    return spawned;
+}
+
+void ParticleSystem::Set(int buffer, int index, const particle &p) {
+    const float values[StreamCount] = {
+            p.position.x, p.position.y, p.position.z, p.size, p.angle,
+            p.speed.x, p.speed.y, p.speed.z, p.angular_speed
+    };
+    for (int s = 0; s < StreamCount; ++s)
+        Mutable(buffer, (Stream) s)[index] = values[s];
+}
+
+int ParticleSystem::Fall(int begin, int end, float dt) {
+    const float fall = gravity * dt;
+    const float speed_decay = std::exp(-drag * dt);
+    float *y = Mutable(current, Y), *vy = Mutable(current, SpeedY);
+
+    // Частицы за count в пределах stride - мусор, который никто не читает и не считает
+    const int count_end = end;
+    end = (end + Lanes - 1) / Lanes * Lanes;
+    int dead = 0;
+    int i = begin;
+
+#if defined(PARTICLES_AVX)
+    const __m256 fall8 = _mm256_set1_ps(fall), dt8 = _mm256_set1_ps(dt), speed_decay8 = _mm256_set1_ps(speed_decay);
+    const __m256 floor8 = _mm256_set1_ps(floor);
+    for (; i < end; i += 8) {
+        const __m256 sy = _mm256_sub_ps(_mm256_loadu_ps(vy + i), fall8);
+        const __m256 py = _mm256_add_ps(_mm256_loadu_ps(y + i), _mm256_mul_ps(sy, dt8));
+        _mm256_storeu_ps(y + i, py);
+        _mm256_storeu_ps(vy + i, _mm256_mul_ps(sy, speed_decay8));
+        if (i + 8 <= count_end)
+            dead += __builtin_popcount(_mm256_movemask_ps(_mm256_cmp_ps(py, floor8, _CMP_LT_OQ)));
+    }
+    i = std::min(i, count_end) / 8 * 8;
+#elif defined(PARTICLES_SSE)
+    const __m128 fall4 = _mm_set1_ps(fall), dt4 = _mm_set1_ps(dt), speed_decay4 = _mm_set1_ps(speed_decay);
+    const __m128 floor4 = _mm_set1_ps(floor);
+    static const int bit_count[16] = {0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4};
+    for (; i < end; i += 4) {
+        const __m128 sy = _mm_sub_ps(_mm_loadu_ps(vy + i), fall4);
+        const __m128 py = _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(sy, dt4));
+        _mm_storeu_ps(y + i, py);
+        _mm_storeu_ps(vy + i, _mm_mul_ps(sy, speed_decay4));
+        if (i + 4 <= count_end)
+            dead += bit_count[_mm_movemask_ps(_mm_cmplt_ps(py, floor4))];
+    }
+    i = std::min(i, count_end) / 4 * 4;
+#else
+    for (; i < end; ++i) {
+        vy[i] -= fall;
+        y[i] += vy[i] * dt;
+        vy[i] *= speed_decay;
+    }
+    i = begin;
+#endif
+    // Неполный последний вектор
+    for (i = std::max(i, begin); i < count_end; ++i)
+        dead += y[i] < floor;
+    return dead;
+}
+
+void ParticleSystem::Compact(int chunk, float dt, int respawn_count, Spawner spawner, std::vector<Run> &runs) {
+    const int begin = chunk * ChunkSize;
+    const int end = std::min(begin + ChunkSize, count);
+    const int next = in_place ? current : current ^ 1;
+    const int output = chunks[chunk].output;
+
+    // Отрезки подряд идущих выживших и рождённые между ними; упавших мало, так что отрезки длинные
+    runs.clear();
+    const float *y = Mutable(current, Y);
+    int dead = chunks[chunk].dead_before;
+    int run_begin = begin;
+    for (int i = chunks[chunk].dead ? begin : end; i < end; ++i) {
+        if (y[i] >= floor) continue;
+        if (i > run_begin)
+            runs.push_back({run_begin, i - run_begin});
+        if (dead < respawn_count)
+            runs.push_back({-1 - dead, 1});
+        ++dead;
+        run_begin = i + 1;
+    }
+    if (end > run_begin)
+        runs.push_back({run_begin, end - run_begin});
+
+    const float speed_decay = std::exp(-drag * dt);
+    const float size_decay = std::exp(-shrink * dt);
+
+    int offset = 0;
+    for (const auto &run: runs) {
+        if (run.source >= 0) {
+            const float *from[StreamCount];
+            float *to[StreamCount], *rendered[RenderedStreams];
+            for (int s = 0; s < StreamCount; ++s) {
+                from[s] = Mutable(current, (Stream) s) + run.source;
+                to[s] = Mutable(next, (Stream) s) + output + offset;
+            }
+            if (vertices)
+                for (int s = 0; s < RenderedStreams; ++s)
+                    rendered[s] = vertices + (std::size_t) s * stride + output + offset;
+            Advance(to, from, vertices ? rendered : nullptr, run.length, dt, speed_decay, size_decay);
+        } else {
+            auto random = Random(-1 - run.source);
+            Set(next, output + offset, spawner(random));
+            if (vertices)
+                for (int s = 0; s < RenderedStreams; ++s)
+                    vertices[(std::size_t) s * stride + output + offset] = Mutable(next, (Stream) s)[output + offset];
+        }
+        offset += run.length;
+    }
+}
+
+int ParticleSystem::Step(float dt, float floor, int respawn_count, Spawner spawner, float *vertices) {
+    ++frame;
+    this->floor = floor;
+    this->vertices = vertices;
+
+    step.dt = dt;
+    step.respawn_count = respawn_count;
+    step.spawner = spawner;
+    step.chunk_count = (count + ChunkSize - 1) / ChunkSize;
+    step.next_fall = 0;
+    step.next_compact = 0;
+
+    // Барьеры упорядочивают запись параметров выше и чтение итогов ниже с потоками
+    if (!workers.empty())
+        start.arrive_and_wait();
+    Work(0);
+    if (!workers.empty())
+        finish.arrive_and_wait();
+
+    if (!in_place)
+        current ^= 1;
+    count = step.new_count;
+    return step.respawned;
+}
+
+void ParticleSystem::Prefix() {
+    int dead = 0, output = 0;
+    for (int c = 0; c < step.chunk_count; ++c) {
+        auto &chunk = chunks[c];
+        chunk.dead_before = dead;
+        chunk.output = output;
+        const int size = std::min(ChunkSize, count - c * ChunkSize);
+        output += size - chunk.dead + std::clamp(step.respawn_count - dead, 0, chunk.dead);
+        dead += chunk.dead;
+    }
+    step.respawned = std::clamp(step.respawn_count, 0, dead);
+    step.new_count = output;
+    // Никто не удаляется - никто и не сдвигается, второй массив не нужен
+    in_place = step.respawned == dead;
+}
+
+void ParticleSystem::Work(int thread) {
+    for (int c; (c = step.next_fall++) < step.chunk_count;) {
+        const int begin = c * ChunkSize;
+        const int end = std::min(begin + ChunkSize, count);
+        chunks[c].dead = Fall(begin, end, step.dt);
+    }
+    phase.arrive_and_wait();
+
+    for (int c; (c = step.next_compact++) < step.chunk_count;)
+        Compact(c, step.dt, step.respawn_count, step.spawner, runs[thread]);
+}
+
+void ParticleSystem::WorkerLoop(int thread) {
+    for (;;) {
+        start.arrive_and_wait();
+        if (stopping)
+            return;
+        Work(thread);
+        finish.arrive_and_wait();
+    }
+}
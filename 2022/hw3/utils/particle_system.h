@@ -0,0 +1,156 @@
+#pragma once
+
+#include <atomic>
+#include <barrier>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include "glm/vec3.hpp"
+
+struct particle {
+    glm::vec3 position;
+    float size;
+    glm::vec3 speed;
+    float angle;
+    float angular_speed;
+};
+
+// Счётчиковый генератор: i-е число - хеш (ключ, i), так что результат зависит только от ключа,
+// а не от того, какой поток и в каком порядке рождает частицу
+class ParticleRandom {
+public:
+    explicit ParticleRandom(std::uint64_t key) : key(key) {}
+
+    float Uniform(float l, float r);
+
+private:
+    std::uint64_t key;
+    std::uint64_t counter = 0;
+};
+
+/// *** Частицы
+// Хранятся по полям (SoA): каждое поле - свой поток из Stride() float'ов в одном массиве,
+// потоки идут в порядке Stream. Первые RenderedStreams потоков - то, что читает шейдер:
+// Step() с vertices пишет их в той же раскладке прямо в отображённый StreamingBuffer, без копии в VBO.
+//
+// Step() делит частицы на куски по ChunkSize и раздаёт куски потокам: сначала в каждом куске
+// считаются y и скорость по y и число упавших, затем по префиксным суммам каждый кусок знает,
+// куда писать, и переносит во второй массив выживших (отрезками между упавшими, интегрируя
+// остальные поля по дороге) и рождённых вместо упавших, сохраняя порядок. Если никто не удаляется
+// (все упавшие заменяются), всё то же делается на месте.
+// Куски не зависят от числа потоков, а случайность новой частицы - только от (seed, кадр, её номер
+// среди упавших), так что результат побитово одинаков при любом числе потоков.
+// Память выделяется и потоки запускаются один раз в конструкторе, кадры ничего не выделяют.
+class ParticleSystem {
+public:
+    enum Stream {
+        X, Y, Z, Size, Angle,
+        SpeedX, SpeedY, SpeedZ, AngularSpeed,
+        StreamCount
+    };
+    static constexpr int RenderedStreams = Angle + 1;
+    static constexpr int ChunkSize = 16384;
+
+    using Spawner = particle (*)(ParticleRandom &random);
+
+    // thread_count = 0 - по числу ядер, но не больше числа кусков в capacity.
+    // Потоки запускаются здесь и между кадрами ждут на барьере
+    explicit ParticleSystem(int capacity, int thread_count = 0, std::uint64_t seed = 0);
+    ~ParticleSystem();
+
+    ParticleSystem(const ParticleSystem &) = delete;
+    ParticleSystem &operator=(const ParticleSystem &) = delete;
+
+    int Count() const { return count; }
+    int Capacity() const { return capacity; }
+    // Длина потока: Capacity(), округлённая вверх до ширины SIMD
+    int Stride() const { return stride; }
+    int ThreadCount() const { return thread_count; }
+
+    const float *Data(Stream stream) const { return data[current].data() + (std::size_t) stream * stride; }
+
+    // Частица в конец, false - если места нет
+    bool Spawn(const particle &p);
+    // До n новых частиц в конец, возвращает сколько влезло
+    int Spawn(int n, Spawner spawner);
+
+    // Гравитация, затухание скорости и размера, вращение за dt; затем частицы ниже floor:
+    // первые respawn_count из них (по порядку) заменяются на spawner(), остальные удаляются.
+    // Если vertices не nullptr, туда же, в той же раскладке, что Data(), пишутся первые RenderedStreams
+    // потоков нового кадра (RenderedStreams * Stride() float'ов) - например, прямо в отображённый VBO.
+    // Возвращает, сколько заменено
+    int Step(float dt, float floor, int respawn_count, Spawner spawner, float *vertices = nullptr);
+
+    float gravity = 0.5f;
+    float drag = 2.f;
+    float shrink = 0.2f;
+
+private:
+    struct Chunk {
+        int dead = 0;
+        // Сколько упало в кусках до этого и где кусок начинается в новом массиве
+        int dead_before = 0;
+        int output = 0;
+    };
+
+    // Частицы [source, source + length) текущего массива или, при source < 0, одна новая
+    // с номером -1 - source среди упавших
+    struct Run {
+        int source, length;
+    };
+
+    // Параметры и итоги текущего Step() для всех потоков
+    struct StepState {
+        float dt = 0.f;
+        int respawn_count = 0;
+        Spawner spawner = nullptr;
+        int chunk_count = 0;
+        int respawned = 0, new_count = 0;
+        std::atomic<int> next_fall{0}, next_compact{0};
+    };
+
+    // Между фазами Step(), один раз: кто сколько рождает и куда пишет
+    struct PrefixStep {
+        ParticleSystem *system;
+        void operator()() noexcept { system->Prefix(); }
+    };
+
+    float *Mutable(int buffer, Stream stream) { return data[buffer].data() + (std::size_t) stream * stride; }
+    void Set(int buffer, int index, const particle &p);
+    ParticleRandom Random(std::uint64_t index) const;
+
+    // Падение по y на месте, по нему и решается, кто упал. Возвращает, сколько упало
+    int Fall(int begin, int end, float dt);
+    // Остальное интегрирование вместе с копированием во второй массив
+    void Compact(int chunk, float dt, int respawn_count, Spawner spawner, std::vector<Run> &runs);
+    void Prefix();
+    // Доля потока thread в текущем Step()
+    void Work(int thread);
+    void WorkerLoop(int thread);
+
+    int capacity, stride;
+    int count = 0;
+    int thread_count;
+    std::uint64_t seed;
+    std::uint64_t frame = 0;
+    float floor = 0.f;
+    float *vertices = nullptr;
+
+    // Текущий массив и второй, куда Step() пишет следующий кадр
+    std::vector<float> data[2];
+    int current = 0;
+    // Step() без удалений пишет в текущий массив
+    bool in_place = false;
+
+    std::vector<Chunk> chunks;
+    // Для Compact, по массиву на поток
+    std::vector<std::vector<Run>> runs;
+
+    StepState step;
+    bool stopping = false;
+    // Начало и конец кадра для потоков и граница между фазами
+    std::barrier<> start, finish;
+    std::barrier<PrefixStep> phase;
+    std::vector<std::thread> workers;
+};
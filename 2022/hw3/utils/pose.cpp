@@ -0,0 +1,179 @@
+#include "pose.h"
+
+#include <cassert>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define POSE_SSE 1
+#include <xmmintrin.h>
+#endif
+
+Skeleton::Skeleton(const gltf_model &model) {
+    int count = (int) model.bones.size();
+    padded_count = (count + 3) / 4 * 4;
+
+    parent.resize(count);
+    inverse_bind.resize(4 * count);
+    for (int i = 0; i < count; ++i) {
+        parent[i] = model.bones[i].parent == -1u ? -1 : (int) model.bones[i].parent;
+        assert(parent[i] < i);
+        for (int c = 0; c < 4; ++c)
+            inverse_bind[4 * i + c] = model.bones[i].inverse_bind_matrix[c];
+    }
+}
+
+Skeleton::Pose Skeleton::MakePose() const {
+    Pose pose;
+    // Лишние кости до кратного 4 - единичные, чтобы SIMD проход не считал мусор
+    for (auto *v: {&pose.tx, &pose.ty, &pose.tz, &pose.rx, &pose.ry, &pose.rz})
+        v->assign(padded_count, 0.f);
+    pose.rw.assign(padded_count, 1.f);
+    for (auto *v: {&pose.sx, &pose.sy, &pose.sz})
+        v->assign(padded_count, 1.f);
+    pose.local.resize(4 * padded_count);
+    pose.world.resize(4 * BoneCount());
+    pose.cursors.resize(BoneCount());
+    return pose;
+}
+
+void Skeleton::Sample(const gltf_model::animation &animation, float time, Pose &pose) const {
+    for (int i = 0; i < BoneCount(); ++i) {
+        const auto &bone = animation.bones[i];
+        auto &cursor = pose.cursors[i];
+
+        glm::vec3 t = bone.translation(time, cursor.translation);
+        glm::quat r = bone.rotation(time, cursor.rotation);
+        glm::vec3 s = bone.scale(time, cursor.scale);
+
+        pose.tx[i] = t.x;
+        pose.ty[i] = t.y;
+        pose.tz[i] = t.z;
+        pose.rx[i] = r.x;
+        pose.ry[i] = r.y;
+        pose.rz[i] = r.z;
+        pose.rw[i] = r.w;
+        pose.sx[i] = s.x;
+        pose.sy[i] = s.y;
+        pose.sz[i] = s.z;
+    }
+}
+
+void Skeleton::Sample(const CompressedClip &clip, float time, Pose &pose) const {
+    for (int i = 0; i < BoneCount(); ++i) {
+        auto &cursor = pose.cursors[i];
+
+        glm::vec3 t = clip.Translation(i, time, cursor.translation);
+        glm::quat r = clip.Rotation(i, time, cursor.rotation);
+        glm::vec3 s = clip.Scale(i, time, cursor.scale);
+
+        pose.tx[i] = t.x;
+        pose.ty[i] = t.y;
+        pose.tz[i] = t.z;
+        pose.rx[i] = r.x;
+        pose.ry[i] = r.y;
+        pose.rz[i] = r.z;
+        pose.rw[i] = r.w;
+        pose.sx[i] = s.x;
+        pose.sy[i] = s.y;
+        pose.sz[i] = s.z;
+    }
+}
+
+namespace {
+
+#ifdef POSE_SSE
+
+// a * b для аффинных матриц из 4 столбцов (w = 0, 0, 0, 1)
+inline void MultiplyAffine(const glm::vec4 *a, const glm::vec4 *b, glm::vec4 *out) {
+    __m128 a0 = _mm_loadu_ps(&a[0].x);
+    __m128 a1 = _mm_loadu_ps(&a[1].x);
+    __m128 a2 = _mm_loadu_ps(&a[2].x);
+    __m128 a3 = _mm_loadu_ps(&a[3].x);
+    for (int c = 0; c < 4; ++c) {
+        __m128 r = _mm_mul_ps(a0, _mm_set1_ps(b[c].x));
+        r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_set1_ps(b[c].y)));
+        r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_set1_ps(b[c].z)));
+        r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_set1_ps(b[c].w)));
+        _mm_storeu_ps(&out[c].x, r);
+    }
+}
+
+#else
+
+inline void MultiplyAffine(const glm::vec4 *a, const glm::vec4 *b, glm::vec4 *out) {
+    for (int c = 0; c < 4; ++c)
+        out[c] = a[0] * b[c].x + a[1] * b[c].y + a[2] * b[c].z + a[3] * b[c].w;
+}
+
+#endif
+
+}
+
+void Skeleton::Evaluate(Pose &pose, glm::mat4x3 *out) const {
+    // T * R * S сразу в столбцы: столбец j = (столбец j поворота) * s_j, последний - сдвиг
+#ifdef POSE_SSE
+    const __m128 one = _mm_set1_ps(1.f);
+    const __m128 two = _mm_set1_ps(2.f);
+    const __m128 zero = _mm_setzero_ps();
+    for (int i = 0; i < padded_count; i += 4) {
+        __m128 x = _mm_loadu_ps(&pose.rx[i]);
+        __m128 y = _mm_loadu_ps(&pose.ry[i]);
+        __m128 z = _mm_loadu_ps(&pose.rz[i]);
+        __m128 w = _mm_loadu_ps(&pose.rw[i]);
+        __m128 sx = _mm_loadu_ps(&pose.sx[i]);
+        __m128 sy = _mm_loadu_ps(&pose.sy[i]);
+        __m128 sz = _mm_loadu_ps(&pose.sz[i]);
+
+        __m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+        __m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+        __m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+
+        // columns[столбец][строка], по 4 кости в каждом регистре
+        __m128 columns[4][4];
+        columns[0][0] = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), sx);
+        columns[0][1] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), sx);
+        columns[0][2] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), sx);
+        columns[1][0] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), sy);
+        columns[1][1] = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), sy);
+        columns[1][2] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)), sy);
+        columns[2][0] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, wy)), sz);
+        columns[2][1] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), sz);
+        columns[2][2] = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), sz);
+        columns[3][0] = _mm_loadu_ps(&pose.tx[i]);
+        columns[3][1] = _mm_loadu_ps(&pose.ty[i]);
+        columns[3][2] = _mm_loadu_ps(&pose.tz[i]);
+        columns[0][3] = columns[1][3] = columns[2][3] = zero;
+        columns[3][3] = one;
+
+        // Транспонируем: из "строка по 4 костям" в "столбец одной кости"
+        for (int c = 0; c < 4; ++c) {
+            _MM_TRANSPOSE4_PS(columns[c][0], columns[c][1], columns[c][2], columns[c][3]);
+            for (int b = 0; b < 4; ++b)
+                _mm_storeu_ps(&pose.local[4 * (i + b) + c].x, columns[c][b]);
+        }
+    }
+#else
+    for (int i = 0; i < padded_count; ++i) {
+        float x = pose.rx[i], y = pose.ry[i], z = pose.rz[i], w = pose.rw[i];
+        glm::vec4 *local = &pose.local[4 * i];
+        local[0] = glm::vec4(1.f - 2.f * (y * y + z * z), 2.f * (x * y + w * z), 2.f * (x * z - w * y), 0.f) * pose.sx[i];
+        local[1] = glm::vec4(2.f * (x * y - w * z), 1.f - 2.f * (x * x + z * z), 2.f * (y * z + w * x), 0.f) * pose.sy[i];
+        local[2] = glm::vec4(2.f * (x * z + w * y), 2.f * (y * z - w * x), 1.f - 2.f * (x * x + y * y), 0.f) * pose.sz[i];
+        local[3] = glm::vec4(pose.tx[i], pose.ty[i], pose.tz[i], 1.f);
+    }
+#endif
+
+    // Иерархия: родитель уже посчитан, так что один проход
+    for (int i = 0; i < BoneCount(); ++i) {
+        glm::vec4 *world = &pose.world[4 * i];
+        if (parent[i] < 0)
+            std::memcpy(world, &pose.local[4 * i], 4 * sizeof(glm::vec4));
+        else
+            MultiplyAffine(&pose.world[4 * parent[i]], &pose.local[4 * i], world);
+
+        glm::vec4 skin[4];
+        MultiplyAffine(world, &inverse_bind[4 * i], skin);
+        for (int c = 0; c < 4; ++c)
+            out[i][c] = glm::vec3(skin[c]);
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vector>
+#include "gltf_loader.hpp"
+#include "compressed_clip.h"
+#include "glm/vec4.hpp"
+#include "glm/mat4x3.hpp"
+
+/// *** Поза скелета
+// Скелет хранится плоскими массивами, кости отсортированы так, что родитель идёт раньше ребёнка
+// (load_gltf это уже гарантирует), поэтому иерархия считается одним проходом.
+// Локальные TRS лежат структурой массивов и собираются в матрицы по 4 кости за раз (SSE).
+class Skeleton {
+public:
+    explicit Skeleton(const gltf_model &model);
+
+    // Состояние одного экземпляра: локальные TRS и промежуточные матрицы.
+    // Живёт между кадрами, чтобы ничего не выделять на каждый кадр.
+    struct Pose {
+        std::vector<float> tx, ty, tz;
+        std::vector<float> rx, ry, rz, rw;
+        std::vector<float> sx, sy, sz;
+
+        // 4 столбца на кость, w = 0 у первых трёх и 1 у сдвига
+        std::vector<glm::vec4> local, world;
+
+        std::vector<gltf_model::bone_animation::cursor> cursors;
+    };
+
+    int BoneCount() const { return (int) parent.size(); }
+
+    Pose MakePose() const;
+
+    // Локальные TRS всех костей из анимации в момент time
+    void Sample(const gltf_model::animation &animation, float time, Pose &pose) const;
+    void Sample(const CompressedClip &clip, float time, Pose &pose) const;
+
+    // Матрицы для скиннинга (world * inverse_bind) в out, BoneCount() штук
+    void Evaluate(Pose &pose, glm::mat4x3 *out) const;
+
+private:
+    // Число костей, округлённое вверх до 4
+    int padded_count;
+    std::vector<int> parent;
+    std::vector<glm::vec4> inverse_bind;
+};
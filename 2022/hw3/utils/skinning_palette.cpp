@@ -0,0 +1,56 @@
+#include "skinning_palette.h"
+
+#include <stdexcept>
+
+SkinningPalette::SkinningPalette(int capacity, int frame_count, int texture_unit)
+        : capacity(capacity), frame_count(frame_count), texture_unit(texture_unit) {
+    GLint max_texels;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels);
+    // mat4x3 - 3 текселя RGBA32F
+    if (3 * capacity * frame_count > max_texels)
+        throw std::runtime_error("Skinning palette doesn't fit into a texture buffer");
+
+    staging.reserve(capacity);
+
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::mat4x3) * capacity * frame_count, nullptr, GL_DYNAMIC_DRAW);
+
+    glGenTextures(1, &texture);
+    glActiveTexture(GL_TEXTURE0 + texture_unit);
+    glBindTexture(GL_TEXTURE_BUFFER, texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer);
+}
+
+SkinningPalette::~SkinningPalette() {
+    Destroy();
+}
+
+void SkinningPalette::Destroy() {
+    if (!buffer)
+        return;
+    glDeleteTextures(1, &texture);
+    glDeleteBuffers(1, &buffer);
+    texture = buffer = 0;
+}
+
+void SkinningPalette::BeginFrame() {
+    frame = (frame + 1) % frame_count;
+    staging.clear();
+}
+
+int SkinningPalette::Add(const glm::mat4x3 *matrices, int count) {
+    if ((int) staging.size() + count > capacity)
+        throw std::runtime_error("Skinning palette overflow");
+    int offset = frame * capacity + (int) staging.size();
+    staging.insert(staging.end(), matrices, matrices + count);
+    return offset;
+}
+
+void SkinningPalette::Upload() {
+    if (staging.empty())
+        return;
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+    glBufferSubData(GL_TEXTURE_BUFFER, sizeof(glm::mat4x3) * frame * capacity,
+                    sizeof(glm::mat4x3) * staging.size(), staging.data());
+}
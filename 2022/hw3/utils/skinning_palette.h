@@ -0,0 +1,41 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <vector>
+#include "glm/mat4x3.hpp"
+
+/// *** Палитра матриц скиннинга
+// Матрицы костей всех скиннингованных экземпляров за кадр лежат в одном texture buffer,
+// загружаются одним вызовом и читаются во всех проходах (тени, основной) по смещению.
+// Буфер поделён на frame_count частей по кругу, чтобы не писать в часть,
+// которую, возможно, ещё рисуют прошлые кадры. Число костей ограничено только capacity.
+class SkinningPalette {
+public:
+    // capacity - матриц на кадр
+    SkinningPalette(int capacity, int frame_count, int texture_unit);
+    ~SkinningPalette();
+
+    SkinningPalette(const SkinningPalette &) = delete;
+    SkinningPalette &operator=(const SkinningPalette &) = delete;
+
+    void BeginFrame();
+
+    // Смещение (в матрицах) для uniform bone_offset
+    int Add(const glm::mat4x3 *matrices, int count);
+
+    void Upload();
+
+    int TextureUnit() const { return texture_unit; }
+
+    // Освобождает буфер и текстуру, пока контекст ещё жив; деструктор после этого ничего не делает
+    void Destroy();
+
+private:
+    int capacity;
+    int frame_count;
+    int texture_unit;
+    int frame = 0;
+    std::vector<glm::mat4x3> staging;
+    GLuint buffer;
+    GLuint texture;
+};
@@ -0,0 +1,81 @@
+#include "streaming_buffer.h"
+
+#include <stdexcept>
+
+StreamingBuffer::StreamingBuffer(GLenum target, GLsizeiptr element_size, int capacity)
+        : target(target), frame_size(element_size * capacity), capacity(capacity) {
+    glGenBuffers(1, &buffer);
+    glBindBuffer(target, buffer);
+
+    if (GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage) {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(target, frame_size * FrameCount, nullptr, flags);
+        mapping = static_cast<char *>(glMapBufferRange(target, 0, frame_size * FrameCount, flags));
+        if (!mapping)
+            throw std::runtime_error("Failed to map a streaming buffer");
+        // Первый Map() начнёт с нулевой части
+        frame = FrameCount - 1;
+    } else {
+        glBufferData(target, frame_size, nullptr, GL_STREAM_DRAW);
+    }
+}
+
+StreamingBuffer::~StreamingBuffer() {
+    Destroy();
+}
+
+void StreamingBuffer::Destroy() {
+    if (!buffer)
+        return;
+    for (auto &fence: fences)
+        if (fence) {
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+    if (mapping) {
+        glBindBuffer(target, buffer);
+        glUnmapBuffer(target);
+        mapping = nullptr;
+    }
+    glDeleteBuffers(1, &buffer);
+    buffer = 0;
+}
+
+void *StreamingBuffer::Map() {
+    if (!mapping) {
+        glBindBuffer(target, buffer);
+        glBufferData(target, frame_size, nullptr, GL_STREAM_DRAW);
+        void *result = glMapBufferRange(target, 0, frame_size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (!result)
+            throw std::runtime_error("Failed to map a streaming buffer");
+        return result;
+    }
+
+    frame = (frame + 1) % FrameCount;
+    if (GLsync &fence = fences[frame]) {
+        // Обычно GPU давно дочитал: кадр, который рисовал эту часть, был FrameCount кадров назад
+        while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED);
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+    return mapping + frame * frame_size;
+}
+
+int StreamingBuffer::Unmap() {
+    if (!mapping) {
+        glBindBuffer(target, buffer);
+        if (!glUnmapBuffer(target))
+            throw std::runtime_error("Streaming buffer contents were lost");
+        return 0;
+    }
+    // Coherent: записанное видно GPU без glFlushMappedBufferRange
+    return frame * capacity;
+}
+
+void StreamingBuffer::Fence() {
+    if (!mapping)
+        return;
+    if (fences[frame])
+        glDeleteSync(fences[frame]);
+    fences[frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
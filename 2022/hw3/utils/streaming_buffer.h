@@ -0,0 +1,48 @@
+#pragma once
+
+#include <GL/glew.h>
+
+/// *** Буфер для данных, которые пишутся каждый кадр
+// Кадр пишет прямо в память буфера, без своей копии и glBufferData/glBufferSubData.
+// Если есть ARB_buffer_storage, буфер из FrameCount частей отображён в память один раз на всё время
+// (persistent + coherent), кадры пишут в части по кругу, а перед записью в часть ждут fence
+// последнего кадра, который её читал. Иначе каждый Map() сиротит буфер (orphaning): драйвер отдаёт
+// новую память, а старую освобождает, когда GPU её дочитает.
+//
+// Кадр: Map(), запись, Unmap() - номер первого элемента записанного (first для glDrawArrays
+// или смещение атрибутов в элементах), рисование, Fence() после последней команды, читающей буфер.
+// Кадр без Map() может рисовать то, что записано раньше; Fence() тогда продлевает ожидание той же части.
+class StreamingBuffer {
+public:
+    static constexpr int FrameCount = 3;
+
+    // capacity элементов по element_size байт на кадр
+    StreamingBuffer(GLenum target, GLsizeiptr element_size, int capacity);
+    ~StreamingBuffer();
+
+    StreamingBuffer(const StreamingBuffer &) = delete;
+    StreamingBuffer &operator=(const StreamingBuffer &) = delete;
+
+    GLuint Buffer() const { return buffer; }
+    int Capacity() const { return capacity; }
+    bool Persistent() const { return mapping != nullptr; }
+
+    // Освобождает буфер, пока контекст ещё жив; деструктор после этого ничего не делает
+    void Destroy();
+
+    // Память под Capacity() элементов кадра, только для записи
+    void *Map();
+    int Unmap();
+    void Fence();
+
+private:
+    GLenum target;
+    GLsizeiptr frame_size;
+    int capacity;
+    GLuint buffer;
+
+    // Persistent: вся память буфера и fence на каждую часть
+    char *mapping = nullptr;
+    GLsync fences[FrameCount] = {};
+    int frame = 0;
+};
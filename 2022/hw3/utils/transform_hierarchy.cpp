@@ -0,0 +1,211 @@
+#include "transform_hierarchy.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+
+namespace {
+
+// Уровень меньше стольких узлов на поток считается в одном потоке: запуск потока дороже
+const int MinNodesPerThread = 4096;
+
+template<typename F>
+void ParallelFor(int count, const F &f) {
+    static const int hardware_threads = std::max(1, (int) std::thread::hardware_concurrency());
+    int thread_count = std::min(hardware_threads, count / MinNodesPerThread);
+    if (thread_count <= 1) {
+        f(0, count);
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    for (int t = 1; t < thread_count; ++t)
+        threads.emplace_back(f, count * t / thread_count, count * (t + 1) / thread_count);
+    f(0, count / thread_count);
+    for (auto &thread: threads)
+        thread.join();
+}
+
+template<typename T>
+void Permute(std::vector<T> &values, const std::vector<int> &order) {
+    std::vector<T> result(order.size());
+    for (std::size_t k = 0; k < order.size(); ++k)
+        result[k] = values[order[k]];
+    values = std::move(result);
+}
+
+}
+
+TransformHierarchy::Node TransformHierarchy::Add(Node parent_node, glm::vec3 t, glm::quat r, glm::vec3 s) {
+    int index = NodeCount();
+    Node node = (Node) slot.size();
+    slot.push_back(index);
+    id.push_back(node);
+    parent.push_back(parent_node == NoParent ? -1 : slot.at(parent_node));
+    // Уровень и дети посчитает Rebuild()
+    level.push_back(0);
+    first_child.push_back(0);
+    child_count.push_back(0);
+    translation.push_back(t);
+    rotation.push_back(r);
+    scale.push_back(s);
+    world.emplace_back(1.f);
+    dirty.push_back(0);
+
+    needs_rebuild = true;
+    MarkDirty(index);
+    return node;
+}
+
+TransformHierarchy::Node TransformHierarchy::AddModel(Node parent_node, const gltf_model &model) {
+    Node first = (Node) slot.size();
+    for (const auto &node: model.nodes)
+        Add(parent_node, node.translation, node.rotation, node.scale);
+
+    // В glTF ребёнок может идти раньше родителя, поэтому родители проставляются отдельно
+    for (std::size_t i = 0; i < model.nodes.size(); ++i)
+        if (model.nodes[i].parent != -1)
+            parent[slot[first + i]] = slot[first + model.nodes[i].parent];
+    return first;
+}
+
+void TransformHierarchy::SetTranslation(Node node, glm::vec3 t) {
+    translation[slot[node]] = t;
+    MarkDirty(slot[node]);
+}
+
+void TransformHierarchy::SetRotation(Node node, glm::quat r) {
+    rotation[slot[node]] = r;
+    MarkDirty(slot[node]);
+}
+
+void TransformHierarchy::SetScale(Node node, glm::vec3 s) {
+    scale[slot[node]] = s;
+    MarkDirty(slot[node]);
+}
+
+void TransformHierarchy::SetLocal(Node node, glm::vec3 t, glm::quat r, glm::vec3 s) {
+    int index = slot[node];
+    translation[index] = t;
+    rotation[index] = r;
+    scale[index] = s;
+    MarkDirty(index);
+}
+
+void TransformHierarchy::MarkDirty(int index) {
+    if (dirty[index]) return;
+    dirty[index] = 1;
+    pending.push_back(index);
+}
+
+void TransformHierarchy::Rebuild() {
+    const int n = NodeCount();
+
+    // Дети каждого узла подряд (по старым индексам)
+    std::vector<int> child_begin(n + 1, 0);
+    for (int i = 0; i < n; ++i)
+        if (parent[i] != -1)
+            ++child_begin[parent[i] + 1];
+    for (int i = 0; i < n; ++i)
+        child_begin[i + 1] += child_begin[i];
+    std::vector<int> children(child_begin[n]);
+    std::vector<int> cursor(child_begin.begin(), child_begin.end() - 1);
+    for (int i = 0; i < n; ++i)
+        if (parent[i] != -1)
+            children[cursor[parent[i]]++] = i;
+
+    // Обход в ширину: корни, затем дети узлов каждого уровня в порядке самих узлов
+    std::vector<int> order;
+    order.reserve(n);
+    for (int i = 0; i < n; ++i)
+        if (parent[i] == -1)
+            order.push_back(i);
+    for (std::size_t k = 0; k < order.size(); ++k)
+        for (int c = child_begin[order[k]]; c < child_begin[order[k] + 1]; ++c)
+            order.push_back(children[c]);
+    if ((int) order.size() != n)
+        throw std::runtime_error("Transform hierarchy has a cycle");
+
+    std::vector<int> new_index(n);
+    for (int k = 0; k < n; ++k)
+        new_index[order[k]] = k;
+
+    std::vector<int> new_parent(n), new_first_child(n), new_child_count(n);
+    for (int k = 0; k < n; ++k) {
+        int old = order[k];
+        new_parent[k] = parent[old] == -1 ? -1 : new_index[parent[old]];
+        new_child_count[k] = child_begin[old + 1] - child_begin[old];
+        new_first_child[k] = new_child_count[k] > 0 ? new_index[children[child_begin[old]]] : 0;
+    }
+    parent = std::move(new_parent);
+    first_child = std::move(new_first_child);
+    child_count = std::move(new_child_count);
+    Permute(id, order);
+    Permute(translation, order);
+    Permute(rotation, order);
+    Permute(scale, order);
+    Permute(world, order);
+    Permute(dirty, order);
+    for (int k = 0; k < n; ++k)
+        slot[id[k]] = k;
+
+    level_begin.clear();
+    for (int k = 0; k < n; ++k) {
+        level[k] = parent[k] == -1 ? 0 : level[parent[k]] + 1;
+        if (k == 0 || level[k] != level[k - 1])
+            level_begin.push_back(k);
+    }
+    level_begin.push_back(n);
+
+    // Индексы в pending устарели
+    pending.clear();
+    for (int k = 0; k < n; ++k)
+        if (dirty[k])
+            pending.push_back(k);
+
+    dirty_by_level.resize(LevelCount() + 1);
+    needs_rebuild = false;
+}
+
+void TransformHierarchy::Update() {
+    if (needs_rebuild)
+        Rebuild();
+
+    updated_count = 0;
+    for (int index: pending)
+        dirty_by_level[level[index]].push_back(index);
+    pending.clear();
+
+    for (int l = 0; l < LevelCount(); ++l)
+        if (!dirty_by_level[l].empty())
+            UpdateLevel(l);
+}
+
+void TransformHierarchy::UpdateLevel(int l) {
+    auto &nodes = dirty_by_level[l];
+
+    // Родители уже посчитаны на прошлом уровне, узлы уровня друг от друга не зависят
+    ParallelFor((int) nodes.size(), [&](int begin, int end) {
+        for (int k = begin; k < end; ++k) {
+            int i = nodes[k];
+            glm::mat4 local = glm::mat4_cast(rotation[i]);
+            local[0] *= scale[i].x;
+            local[1] *= scale[i].y;
+            local[2] *= scale[i].z;
+            local[3] = glm::vec4(translation[i], 1.f);
+            world[i] = parent[i] == -1 ? local : world[parent[i]] * local;
+        }
+    });
+
+    // Поддеревья пересчитанных узлов тоже грязные
+    for (int i: nodes) {
+        dirty[i] = 0;
+        for (int c = first_child[i]; c < first_child[i] + child_count[i]; ++c) {
+            if (dirty[c]) continue;
+            dirty[c] = 1;
+            dirty_by_level[l + 1].push_back(c);
+        }
+    }
+    updated_count += (int) nodes.size();
+    nodes.clear();
+}
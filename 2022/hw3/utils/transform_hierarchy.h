@@ -0,0 +1,75 @@
+#pragma once
+
+#include <vector>
+#include "gltf_loader.hpp"
+#include "glm/vec3.hpp"
+#include "glm/mat4x4.hpp"
+#include "glm/gtc/quaternion.hpp"
+
+/// *** Иерархия трансформаций
+// Узлы лежат плоскими массивами в порядке обхода в ширину: уровни идут подряд,
+// дети одного родителя - подряд внутри уровня, родитель всегда раньше ребёнка.
+// Set* меняют локальный TRS и помечают узел грязным; Update() идёт по уровням сверху вниз
+// и пересчитывает мировые матрицы только у грязных узлов и их поддеревьев,
+// так что кадр стоит пропорционально тому, что сдвинулось, а не размеру сцены.
+// Узлы одного уровня независимы, большие уровни делятся между потоками.
+class TransformHierarchy {
+public:
+    // Стабильный номер узла, не меняется при перестройке массивов
+    using Node = int;
+    static constexpr Node NoParent = -1;
+
+    Node Add(Node parent, glm::vec3 translation = glm::vec3(0.f),
+             glm::quat rotation = glm::quat(1.f, 0.f, 0.f, 0.f), glm::vec3 scale = glm::vec3(1.f));
+
+    // Все узлы модели под parent (корни модели становятся его детьми).
+    // Возвращает номер первого, i-й узел model.nodes - это first + i
+    Node AddModel(Node parent, const gltf_model &model);
+
+    void SetTranslation(Node node, glm::vec3 translation);
+    void SetRotation(Node node, glm::quat rotation);
+    void SetScale(Node node, glm::vec3 scale);
+    void SetLocal(Node node, glm::vec3 translation, glm::quat rotation, glm::vec3 scale);
+
+    // Мировая матрица на момент последнего Update()
+    const glm::mat4 &World(Node node) const { return world[slot[node]]; }
+
+    void Update();
+
+    int NodeCount() const { return (int) id.size(); }
+    int LevelCount() const { return (int) level_begin.size() - 1; }
+
+    // Сколько матриц пересчитал последний Update()
+    int UpdatedCount() const { return updated_count; }
+
+private:
+    void MarkDirty(int index);
+    // Восстанавливает порядок обхода в ширину после Add
+    void Rebuild();
+    // Мировые матрицы узлов из dirty_by_level[level]
+    void UpdateLevel(int level);
+
+    // Node -> индекс в массивах ниже
+    std::vector<int> slot;
+
+    // По индексу, в порядке обхода в ширину
+    std::vector<Node> id;
+    std::vector<int> parent;
+    std::vector<int> level;
+    std::vector<int> first_child, child_count;
+    std::vector<glm::vec3> translation, scale;
+    std::vector<glm::quat> rotation;
+    std::vector<glm::mat4> world;
+    std::vector<char> dirty;
+
+    // Индексы уровня: [level_begin[l], level_begin[l + 1])
+    std::vector<int> level_begin = {0};
+
+    // Узлы, помеченные с прошлого Update(), и они же по уровням во время Update()
+    std::vector<int> pending;
+    std::vector<std::vector<int>> dirty_by_level;
+
+    // Добавленные узлы лежат в конце массивов, порядок обхода в ширину надо восстановить
+    bool needs_rebuild = false;
+    int updated_count = 0;
+};
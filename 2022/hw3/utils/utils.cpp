@@ -3,21 +3,19 @@
 #include <SDL2/SDL_video.h>
 #include <SDL2/SDL.h>
 #include <complex>
-#include <random>
 #include <fstream>
+#include <algorithm>
+#include <limits>
+#include <utility>
 #include "utils.h"
 #include "stb_image.h"
 #include "glm/ext/scalar_constants.hpp"
 #include "glm/ext/matrix_transform.hpp"
+#include "glm/ext/matrix_clip_space.hpp"
+#include "glm/common.hpp"
 
 namespace {
 
-std::default_random_engine rng;
-
-float get_rnd(float l, float r) {
-    return std::uniform_real_distribution{l, r}(rng);
-};
-
 const float eps = 0.01;
 const int MAX_PARTICLES = 400;
 
@@ -130,30 +128,133 @@ std::vector<obj_data::vertex> generate_floor(float radius, int quality) {
     return vertices;
 }
 
-glm::mat4 GetSunShadowTransform(const std::vector<glm::vec3> &bounding_box, const glm::vec3 &C,
-                                glm::vec3 light_direction) {
+std::vector<float> GetCascadeSplits(float near, float far, int count, float lambda) {
+    std::vector<float> splits(count + 1);
+    for (int i = 0; i <= count; ++i) {
+        float t = (float) i / count;
+        float logarithmic = near * std::pow(far / near, t);
+        float uniform = near + (far - near) * t;
+        splits[i] = lambda * logarithmic + (1.f - lambda) * uniform;
+    }
+    splits.front() = near;
+    splits.back() = far;
+    return splits;
+}
+
+glm::mat4 GetCascadeShadowTransform(const glm::mat4 &view, float fovy, float aspect,
+                                    float split_near, float split_far,
+                                    const std::vector<glm::vec3> &bounding_box,
+                                    glm::vec3 light_direction, int resolution) {
+    auto inverse = glm::inverse(glm::perspective(fovy, aspect, split_near, split_far) * view);
+
+    std::vector<glm::vec3> corners;
+    glm::vec3 center(0.f);
+    for (int i = 0; i < 8; ++i) {
+        glm::vec4 p = inverse * glm::vec4((i & 1) ? 1.f : -1.f, (i & 2) ? 1.f : -1.f, (i & 4) ? 1.f : -1.f, 1.f);
+        corners.emplace_back(glm::vec3(p) / p.w);
+        center += corners.back() / 8.f;
+    }
+
+    auto radius = 0.f;
+    for (auto V: corners)
+        radius = std::max(radius, glm::length(V - center));
+    // округление, чтобы размер текселя не дрожал из-за ошибок float
+    radius = std::ceil(radius * 64.f) / 64.f;
+
     auto light_z = -light_direction;
     auto light_x = glm::normalize(glm::cross(light_z, {0.f, 1.f, 0.f}));
     auto light_y = glm::cross(light_x, light_z);
 
-    auto dz = 0.f;
-    auto dx = 0.f;
-    auto dy = 0.f;
-    for (auto V: bounding_box) {
-        auto vec = V - C;
-        dz = std::max(dz, glm::dot(vec, light_z));
-        dx = std::max(dx, glm::dot(vec, light_x));
-        dy = std::max(dy, glm::dot(vec, light_y));
+    auto texel = 2.f * radius / resolution;
+    auto x = std::floor(glm::dot(center, light_x) / texel) * texel;
+    auto y = std::floor(glm::dot(center, light_y) / texel) * texel;
+
+    auto z_min = std::numeric_limits<float>::max();
+    auto z_max = -z_min;
+    for (const auto &points: {corners, bounding_box}) {
+        for (auto V: points) {
+            z_min = std::min(z_min, glm::dot(V, light_z));
+            z_max = std::max(z_max, glm::dot(V, light_z));
+        }
+    }
+    auto z = (z_min + z_max) / 2.f;
+    auto dz = std::max((z_max - z_min) / 2.f, 1e-3f);
+
+    glm::mat4 transform(1.f);
+    for (int i = 0; i < 3; ++i) {
+        transform[i][0] = light_x[i] / radius;
+        transform[i][1] = light_y[i] / radius;
+        transform[i][2] = light_z[i] / dz;
     }
+    transform[3] = {-x / radius, -y / radius, -z / dz, 1.f};
+    return transform;
+}
 
-    return glm::inverse(glm::mat4({
-                                          {dx * light_x.x, dx * light_x.y, dx * light_x.z, 0.f},
-                                          {dy * light_y.x, dy * light_y.y, dy * light_y.z, 0.f},
-                                          {dz * light_z.x, dz * light_z.y, dz * light_z.z, 0.f},
-                                          {C.x,            C.y,            C.z,            1.f}
-                                  }));
+bool BoxInCascade(const glm::mat4 &transform, const glm::vec3 &min, const glm::vec3 &max) {
+    glm::vec3 lo(std::numeric_limits<float>::max());
+    glm::vec3 hi(-std::numeric_limits<float>::max());
+    for (int i = 0; i < 8; ++i) {
+        glm::vec3 p = transform * glm::vec4((i & 1) ? max.x : min.x, (i & 2) ? max.y : min.y, (i & 4) ? max.z : min.z, 1.f);
+        lo = glm::min(lo, p);
+        hi = glm::max(hi, p);
+    }
+    return lo.x <= 1.f && hi.x >= -1.f && lo.y <= 1.f && hi.y >= -1.f && lo.z <= 1.f && hi.z >= -1.f;
+}
+
+float CascadeChange(const glm::mat4 &rendered, const glm::mat4 &fitted, int resolution) {
+    if (rendered == fitted)
+        return 0.f;
+
+    // углы куба каскада, нарисованного с rendered, глазами fitted
+    auto to_fitted = fitted * glm::inverse(rendered);
+    auto change = 0.f;
+    for (int i = 0; i < 8; ++i) {
+        glm::vec4 corner((i & 1) ? 1.f : -1.f, (i & 2) ? 1.f : -1.f, (i & 4) ? 1.f : -1.f, 1.f);
+        glm::vec4 moved = to_fitted * corner;
+        change = std::max({change, std::abs(moved.x - corner.x), std::abs(moved.y - corner.y)});
+    }
+    return change * resolution / 2.f;
 }
 
+int ShadowScheduler::AddView(float importance) {
+    views.push_back(View{.importance = importance});
+    return (int) views.size() - 1;
+}
+
+void ShadowScheduler::SetChange(int view, float change) {
+    views[view].change = change;
+}
+
+const std::vector<int> &ShadowScheduler::Schedule() {
+    std::vector<std::pair<float, int>> candidates;
+    for (int i = 0; i < (int) views.size(); ++i) {
+        const auto &v = views[i];
+        if (!v.rendered)
+            candidates.emplace_back(std::numeric_limits<float>::max(), i);
+        else if (v.change > 0.f)
+            candidates.emplace_back(v.importance * v.change * (1.f + v.age), i);
+    }
+
+    std::sort(candidates.begin(), candidates.end(), [](const auto &a, const auto &b) {
+        return a.first > b.first || (a.first == b.first && a.second < b.second);
+    });
+
+    scheduled.clear();
+    for (int k = 0; k < (int) candidates.size(); ++k) {
+        if (k < budget || !views[candidates[k].second].rendered)
+            scheduled.push_back(candidates[k].second);
+        else
+            ++views[candidates[k].second].age;
+    }
+    return scheduled;
+}
+
+void ShadowScheduler::MarkRendered(int view) {
+    auto &v = views[view];
+    v.change = 0.f;
+    v.age = 0;
+    v.rendered = true;
+}
 
 BoundingBox CalcBoundingBox(const std::vector<std::vector<obj_data::vertex>> &dats) {
     const auto INF = std::numeric_limits<float>::max();
@@ -211,6 +312,10 @@ bool PState::tick() {
                     paused = !paused;
                 if (event.key.keysym.sym == SDLK_m)
                     startAnimation();
+                if (event.key.keysym.sym == SDLK_k)
+                    cpu_skinning = !cpu_skinning;
+                if (event.key.keysym.sym == SDLK_j)
+                    dual_quaternion_skinning = !dual_quaternion_skinning;
                 break;
             case SDL_KEYUP:
                 button_down[event.key.keysym.sym] = false;
@@ -222,7 +327,7 @@ bool PState::tick() {
     auto now = std::chrono::high_resolution_clock::now();
     float dt = std::chrono::duration_cast<std::chrono::duration<float>>(now - last_frame).count();
 
-    update_particles(dt);
+    this->dt = dt;
     last_frame = now;
 
     if (!paused) time += dt;
@@ -250,59 +355,28 @@ bool PState::tick() {
     return true;
 }
 
-PState::PState(int width, int height) : width(width), height(height) {
+PState::PState(int width, int height) : width(width), height(height), particles(MAX_PARTICLES) {
 }
 
-void PState::update_particles(float dt) {
-    if (paused) return;
-
-    if (particles.size() < MAX_PARTICLES && potential) {
-        --potential;
-        particles.push_back(new_particle());
-    }
-
-    float A = 0.5;
-    float C = 2;
-    float D = 0.2;
-    float maxY = 0.3f;
-    std::vector<particle> new_particles;
-
-    for (auto &p: particles) {
-        p.speed.y -= dt * A;
-        p.position += p.speed * dt;
-        p.speed *= exp(-C * dt);
-        p.size *= exp(-D * dt);
-        p.angle += p.angular_speed * dt;
-
-        if (p.position.y < eps) {
-            if (potential > 0) {
-                --potential;
-                new_particles.push_back(new_particle());
-            }
-        } else {
-            new_particles.push_back(p);
-        }
-    }
+void PState::update_particles(float dt, float *vertices) {
+    if (potential)
+        potential -= particles.Spawn(1, new_particle);
 
-    particles.swap(new_particles);
+    potential -= particles.Step(dt, eps, potential, new_particle, vertices);
 }
 
-particle PState::new_particle() {
+particle PState::new_particle(ParticleRandom &random) {
     particle p{};
-    p.position.x = get_rnd(-0.8f, 0.8f);
-    p.position.z = get_rnd(-sqrt(1 - p.position.x * p.position.x), sqrt(1 - p.position.x * p.position.x));
+    p.position.x = random.Uniform(-0.8f, 0.8f);
+    p.position.z = random.Uniform(-sqrt(1 - p.position.x * p.position.x), sqrt(1 - p.position.x * p.position.x));
     p.position.y = sqrt(1 - p.position.x * p.position.x - p.position.z * p.position.z) - eps;
-    p.size = get_rnd(0.02, 0.04);
-    p.speed = glm::vec3(get_rnd(0.01, 0.02), -get_rnd(0.1, 0.2), get_rnd(0.01, 0.02));
+    p.size = random.Uniform(0.02, 0.04);
+    p.speed = glm::vec3(random.Uniform(0.01, 0.02), -random.Uniform(0.1, 0.2), random.Uniform(0.01, 0.02));
     p.angle = 0;
-    p.angular_speed = get_rnd(0.1, 0.9);
+    p.angular_speed = random.Uniform(0.1, 0.9);
     return p;
 }
 
-glm::mat4 PState::GetSplashModel() {
-    return glm::translate(glm::mat4(1.f), {0.f, getYhalfSphere(), 0.f});
-}
-
 float PState::getYhalfSphere() {
     if (splashState == SplashState::READY_TO_SPLASH) {
         lastAnimationStartTime = time;
@@ -359,22 +433,20 @@ std::tuple<GLuint, GLuint, GLuint, int> GenSphereBuffers() {
     return std::tuple(sphere_vao, sphere_vbo, sphere_ebo, sphere_index_count);
 }
 
-std::tuple<GLuint, GLuint> GenSnowflakeBuffers() {
-    GLuint vao, vbo;
+GLuint GenSnowflakeVao(const ParticleSystem &particles, const StreamingBuffer &buffer) {
+    GLuint vao;
     glGenVertexArrays(1, &vao);
     glBindVertexArray(vao);
 
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(particle), (void *) (0));
-
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, sizeof(particle), (void *) 12);
-
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(particle), (void *) 28);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer.Buffer());
+    // Потоки ParticleSystem как есть: x, y, z, size, angle, каждый по Stride() float'ов. Атрибуты смотрят
+    // в начало буфера, кадр выбирается first в glDrawArrays: все атрибуты - по одному float подряд,
+    // так что first = номер первого float кадра сдвигает их все ровно на начало кадра
+    const GLsizeiptr stream_bytes = particles.Stride() * sizeof(float);
+    for (int s = 0; s < ParticleSystem::RenderedStreams; ++s) {
+        glEnableVertexAttribArray(s);
+        glVertexAttribPointer(s, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void *) (s * stream_bytes));
+    }
 
-    return {vao, vbo};
+    return vao;
 }
@@ -7,6 +7,8 @@
 #include "glm/vec3.hpp"
 #include "glm/vec2.hpp"
 #include "obj_parser.h"
+#include "particle_system.h"
+#include "streaming_buffer.h"
 #include "glm/fwd.hpp"
 #include "glm/geometric.hpp"
 #include "glm/matrix.hpp"
@@ -53,15 +55,56 @@ void bindArgument(GLuint array_type,
     glVertexAttribPointer(arg, size, type, norm, sizeof(T), pointer);
 }
 
-glm::mat4 GetSunShadowTransform(const std::vector<glm::vec3> &bounding_box, const glm::vec3 &C,
-                                glm::vec3 light_direction);
+/// *** Каскады тени от солнца
 
-struct particle {
-    glm::vec3 position;
-    float size;
-    glm::vec3 speed;
-    float angle;
-    float angular_speed;
+// count + 1 расстояний от near до far; lambda смешивает логарифмическое (1) и равномерное (0) разбиение
+std::vector<float> GetCascadeSplits(float near, float far, int count, float lambda);
+
+// Ортографическая проекция солнца на кусок [split_near, split_far] фрустума камеры.
+// Кусок обводится сферой, чтобы размер каскада не менялся при поворотах камеры,
+// а центр округляется до целых текселей, чтобы тени не мерцали при движении.
+// По глубине покрывается весь bounding_box, чтобы тень бросало и то, что вне куска.
+glm::mat4 GetCascadeShadowTransform(const glm::mat4 &view, float fovy, float aspect,
+                                    float split_near, float split_far,
+                                    const std::vector<glm::vec3> &bounding_box,
+                                    glm::vec3 light_direction, int resolution);
+
+// false, если box (в координатах, которые transform переводит в каскад) точно вне каскада
+bool BoxInCascade(const glm::mat4 &transform, const glm::vec3 &min, const glm::vec3 &max);
+
+// На сколько текселей сдвинулось содержимое каскада, нарисованного с rendered, если подогнать его под fitted
+float CascadeChange(const glm::mat4 &rendered, const glm::mat4 &fitted, int resolution);
+
+/// *** Перерисовка теней по бюджету
+// Каждый view (каскад) сообщает, насколько он устарел, и за кадр перерисовывается
+// не больше budget из них, остальные берутся с прошлых кадров.
+// Приоритет = importance * change * (1 + age), age - сколько кадров view устарел, но не был выбран.
+// Ещё ни разу не нарисованные view рисуются первыми и сверх бюджета:
+// брать с прошлых кадров им нечего, в первый кадр рисуются все.
+class ShadowScheduler {
+public:
+    explicit ShadowScheduler(int budget) : budget(budget) {}
+
+    int AddView(float importance);
+
+    // change - в текселях теневой карты, 0 - view актуален
+    void SetChange(int view, float change);
+
+    const std::vector<int> &Schedule();
+
+    void MarkRendered(int view);
+
+private:
+    struct View {
+        float importance;
+        float change = 0.f;
+        int age = 0;
+        bool rendered = false;
+    };
+
+    int budget;
+    std::vector<View> views;
+    std::vector<int> scheduled;
 };
 
 enum class SplashState {
@@ -87,15 +130,21 @@ struct PState {
     float ambient_light = 0.2f;
     float env_lightness = 1.f;
     float time = 0.f;
+    // Длительность последнего кадра
+    float dt = 0.f;
+
+    // Скиннинг волка на CPU (k) и, в нём, dual quaternion вместо линейного смешивания (j)
+    bool cpu_skinning = false;
+    bool dual_quaternion_skinning = false;
 
     std::map<SDL_Keycode, bool> button_down;
 
-    std::vector<particle> particles;
-    std::vector<int> rem_particles;
+    ParticleSystem particles;
 
     bool tick();
 
-    glm::mat4 GetSplashModel();
+    // Шаг снежинок вне паузы; vertices - RenderedStreams * Stride() float'ов, куда пишется то, что рисуется
+    void update_particles(float dt, float *vertices);
 
     float getYhalfSphere();
 
@@ -108,9 +157,7 @@ private:
 
     SplashState splashState = SplashState::WAIT;
 
-    void update_particles(float dt);
-
-    static particle new_particle();
+    static particle new_particle(ParticleRandom &random);
 };
 
 struct BoundingBox {
@@ -122,7 +169,8 @@ BoundingBox CalcBoundingBox(const std::vector<std::vector<obj_data::vertex>> &da
 
 std::tuple<GLuint, GLuint, GLuint, int> GenSphereBuffers();
 
-std::tuple<GLuint, GLuint> GenSnowflakeBuffers();
+// VAO снежинок над кадрами buffer, которые пишет ParticleSystem::Step
+GLuint GenSnowflakeVao(const ParticleSystem &particles, const StreamingBuffer &buffer);
 
 GLuint Load3dTexture(const std::string &path);
 
@@ -27,6 +27,7 @@
 #include <glm/gtx/string_cast.hpp>
 
 #include "obj_parser.hpp"
+#include "streaming_buffer.hpp"
 #include "stb_image.h"
 
 std::string to_string(std::string_view str) {
@@ -172,6 +173,15 @@ struct particle {
   float angular_speed;
 };
 
+// What the shaders read of a particle
+struct particle_vertex {
+  glm::vec3 position;
+  float size;
+  float angle;
+};
+
+const int max_particles = 256;
+
 int main() try {
   if (SDL_Init(SDL_INIT_VIDEO) != 0)
     sdl2_fail("SDL_Init: ");
@@ -226,21 +236,24 @@ int main() try {
     return std::uniform_real_distribution{l, r}(rng);
   };
 
-  GLuint vao, vbo;
+  // The simulation writes the vertices of a frame straight into it, first_vertex is where they start
+  streaming_buffer vertices(GL_ARRAY_BUFFER, sizeof(particle_vertex), max_particles);
+  int first_vertex = 0;
+
+  GLuint vao;
   glGenVertexArrays(1, &vao);
   glBindVertexArray(vao);
 
-  glGenBuffers(1, &vbo);
-  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, vertices.buffer());
 
   glEnableVertexAttribArray(0);
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(particle), (void *) (0));
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(particle_vertex), (void *) offsetof(particle_vertex, position));
 
   glEnableVertexAttribArray(1);
-  glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, sizeof(particle), (void *) 12);
+  glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, sizeof(particle_vertex), (void *) offsetof(particle_vertex, size));
 
   glEnableVertexAttribArray(2);
-  glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(particle), (void *) 28);
+  glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(particle_vertex), (void *) offsetof(particle_vertex, angle));
 
   const std::string project_root = PROJECT_ROOT;
   const std::string particle_texture_path = project_root + "/particle.png";
@@ -316,9 +329,9 @@ int main() try {
     return p;
   };
 
-  auto update = [&](float dt, bool paused) {
-    if (paused) return;
-    if (particles.size() < 256) {
+  // Also writes every particle to vertices, in the same order
+  auto update = [&](float dt, particle_vertex *vertices) {
+    if (particles.size() < max_particles) {
       particles.push_back(new_point());
     }
 
@@ -326,16 +339,21 @@ int main() try {
     float C = 2;
     float D = 0.2;
     float maxY = 3.f;
-    for (auto &p : particles) {
+    // the same for every particle
+    const float speed_decay = exp(-C * dt);
+    const float size_decay = exp(-D * dt);
+    for (std::size_t i = 0; i < particles.size(); ++i) {
+      auto &p = particles[i];
       p.speed.y += dt * A;
       p.position += p.speed * dt;
-      p.speed *= exp(-C * dt);
-      p.size *= exp(-D * dt);
+      p.speed *= speed_decay;
+      p.size *= size_decay;
       p.angle += p.angular_speed * dt;
 
       if (p.position.y > maxY) {
         p = new_point();
       }
+      vertices[i] = {p.position, p.size, p.angle};
     }
   };
 
@@ -368,7 +386,11 @@ int main() try {
     last_frame_start = now;
     time += dt;
 
-    update(dt, paused);
+    // On pause the last written vertices are drawn again
+    if (!paused) {
+      update(dt, static_cast<particle_vertex *>(vertices.map()));
+      first_vertex = vertices.unmap();
+    }
 
     if (button_down[SDLK_UP])
       camera_distance -= 3.f * dt;
@@ -400,9 +422,6 @@ int main() try {
 
     glm::vec3 camera_position = (glm::inverse(view) * glm::vec4(0.f, 0.f, 0.f, 1.f)).xyz();
 
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, particles.size() * sizeof(particle), particles.data(), GL_STATIC_DRAW);
-
     glUseProgram(program);
 
     glUniform1i(col_location, 1);
@@ -411,30 +430,16 @@ int main() try {
     glUniformMatrix4fv(projection_location, 1, GL_FALSE, reinterpret_cast<float *>(&projection));
     glUniform3fv(camera_position_location, 1, reinterpret_cast<float *>(&camera_position));
 
-        glm::mat4 model(1.f);
-
-        glm::mat4 view(1.f);
-        view = glm::translate(view, {0.f, -camera_height, -camera_distance});
-        view = glm::rotate(view, view_angle, {1.f, 0.f, 0.f});
-        view = glm::rotate(view, camera_rotation, {0.f, 1.f, 0.f});
-
-        glm::mat4 projection = glm::perspective(glm::pi<float>() / 2.f, (1.f * width) / height, near, far);
-
-        glm::vec3 camera_position = (glm::inverse(view) * glm::vec4(0.f, 0.f, 0.f, 1.f)).xyz();
-
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glBufferData(GL_ARRAY_BUFFER, particles.size() * sizeof(particle), particles.data(), GL_STATIC_DRAW);
-
-        glUseProgram(program);
-
-        glUniformMatrix4fv(model_location, 1, GL_FALSE, reinterpret_cast<float *>(&model));
-        glUniformMatrix4fv(view_location, 1, GL_FALSE, reinterpret_cast<float *>(&view));
-        glUniformMatrix4fv(projection_location, 1, GL_FALSE, reinterpret_cast<float *>(&projection));
-        glUniform3fv(camera_position_location, 1, reinterpret_cast<float *>(&camera_position));
+    glBindVertexArray(vao);
+    glDrawArrays(GL_POINTS, first_vertex, particles.size());
+    vertices.fence();
 
     SDL_GL_SwapWindow(window);
   }
 
+  // It lives until the end of main, but has to go while the context is alive
+  vertices.destroy();
+
   SDL_GL_DeleteContext(gl_context);
   SDL_DestroyWindow(window);
 }
@@ -0,0 +1,95 @@
+#include "streaming_buffer.hpp"
+
+#include <stdexcept>
+
+streaming_buffer::streaming_buffer(GLenum target, GLsizeiptr element_size, int capacity)
+    : target(target)
+    , frame_size(element_size * capacity)
+    , frame_capacity(capacity)
+{
+    glGenBuffers(1, &id);
+    glBindBuffer(target, id);
+
+    if (GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage)
+    {
+        GLbitfield const flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(target, frame_size * frame_count, nullptr, flags);
+        mapping = static_cast<char *>(glMapBufferRange(target, 0, frame_size * frame_count, flags));
+        if (!mapping)
+            throw std::runtime_error("Failed to map a streaming buffer");
+        // The first map() starts with frame 0
+        frame = frame_count - 1;
+    }
+    else
+        glBufferData(target, frame_size, nullptr, GL_STREAM_DRAW);
+}
+
+streaming_buffer::~streaming_buffer()
+{
+    destroy();
+}
+
+void streaming_buffer::destroy()
+{
+    if (!id)
+        return;
+    for (auto & fence : fences)
+        if (fence)
+        {
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+    if (mapping)
+    {
+        glBindBuffer(target, id);
+        glUnmapBuffer(target);
+        mapping = nullptr;
+    }
+    glDeleteBuffers(1, &id);
+    id = 0;
+}
+
+void * streaming_buffer::map()
+{
+    if (!mapping)
+    {
+        glBindBuffer(target, id);
+        glBufferData(target, frame_size, nullptr, GL_STREAM_DRAW);
+        void * result = glMapBufferRange(target, 0, frame_size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (!result)
+            throw std::runtime_error("Failed to map a streaming buffer");
+        return result;
+    }
+
+    frame = (frame + 1) % frame_count;
+    if (GLsync & fence = fences[frame])
+    {
+        // Usually long done: the frame that drew from here was frame_count frames ago
+        while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED);
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+    return mapping + frame * frame_size;
+}
+
+int streaming_buffer::unmap()
+{
+    if (!mapping)
+    {
+        glBindBuffer(target, id);
+        if (!glUnmapBuffer(target))
+            throw std::runtime_error("Streaming buffer contents were lost");
+        return 0;
+    }
+    // Coherent: the writes are visible to the GPU without glFlushMappedBufferRange
+    return frame * frame_capacity;
+}
+
+void streaming_buffer::fence()
+{
+    if (!mapping)
+        return;
+    if (fences[frame])
+        glDeleteSync(fences[frame]);
+    fences[frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <GL/glew.h>
+
+// Buffer for data written every frame, straight into its memory: no copy and no glBufferData per frame.
+// With ARB_buffer_storage the buffer holds frame_count frames and stays mapped (persistent and coherent);
+// frames are written round robin, and before writing a frame waits for the fence of the last draw that read it.
+// Otherwise every map() orphans the buffer: the driver hands out fresh storage and frees the old one
+// once the GPU is done with it.
+//
+// A frame is map(), write, unmap() - the first element of what was written (first of glDrawArrays,
+// or an attribute offset in elements), draws, then fence() after the last command that reads the buffer.
+// A frame without map() may draw what was written before; its fence() then protects the same frame longer
+struct streaming_buffer
+{
+    static constexpr int frame_count = 3;
+
+    // capacity elements of element_size bytes per frame
+    streaming_buffer(GLenum target, GLsizeiptr element_size, int capacity);
+    ~streaming_buffer();
+
+    streaming_buffer(streaming_buffer const &) = delete;
+    streaming_buffer & operator = (streaming_buffer const &) = delete;
+
+    GLuint buffer() const { return id; }
+    int capacity() const { return frame_capacity; }
+    bool persistent() const { return mapping != nullptr; }
+
+    // Releases the buffer while the context is still alive; the destructor does nothing after it
+    void destroy();
+
+    // Write-only memory for capacity() elements
+    void * map();
+    int unmap();
+    void fence();
+
+private:
+    GLenum target;
+    GLsizeiptr frame_size;
+    int frame_capacity;
+    GLuint id;
+
+    // Persistent: the whole buffer and a fence per frame
+    char * mapping = nullptr;
+    GLsync fences[frame_count] = {};
+    int frame = 0;
+};
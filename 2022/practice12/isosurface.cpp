@@ -0,0 +1,277 @@
+#include "isosurface.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+
+#include <glm/geometric.hpp>
+
+namespace
+{
+
+    // Runs task(0) ... task(count - 1) on all hardware threads
+    template <typename Task>
+    void parallel_for(int count, Task const & task)
+    {
+        int const thread_count = std::clamp((int) std::thread::hardware_concurrency(), 1, std::max(count, 1));
+        std::atomic<int> next{0};
+
+        auto worker = [&]
+        {
+            for (int i; (i = next++) < count;)
+                task(i);
+        };
+
+        std::vector<std::thread> threads;
+        for (int thread = 1; thread < thread_count; ++thread)
+            threads.emplace_back(worker);
+        worker();
+        for (auto & thread : threads)
+            thread.join();
+    }
+
+}
+
+isosurface_extractor::isosurface_extractor(density_volume const & volume, float isovalue, int block_size)
+    : volume(volume)
+    , current_isovalue(isovalue)
+    , block_size(block_size)
+{
+    if (block_size <= 0)
+        throw std::runtime_error("Block size must be positive");
+
+    cells = glm::max(volume.size - 1, glm::ivec3(0));
+    grid_size = (cells + block_size - 1) / block_size;
+    blocks.resize(std::size_t(grid_size.x) * grid_size.y * grid_size.z);
+
+    parallel_for(block_count(), [&](int index){ compute_range(index); });
+}
+
+void isosurface_extractor::set_isovalue(float isovalue)
+{
+    // Vertices move along with the isovalue, so every block that has a surface before or after changes
+    for (auto & b : blocks)
+        if (active(b, current_isovalue) || active(b, isovalue))
+            b.dirty = true;
+    current_isovalue = isovalue;
+}
+
+void isosurface_extractor::volume_changed(glm::ivec3 begin, glm::ivec3 end)
+{
+    // Normals read one voxel around the cells, and block b has the voxels [b * block_size, (b + 1) * block_size]
+    glm::ivec3 const first = glm::max((begin - 2) / block_size, glm::ivec3(0));
+    glm::ivec3 const last = glm::min((end + 1) / block_size, grid_size - 1);
+
+    std::vector<int> changed;
+    for (int z = first.z; z <= last.z; ++z)
+        for (int y = first.y; y <= last.y; ++y)
+            for (int x = first.x; x <= last.x; ++x)
+                changed.push_back((z * grid_size.y + y) * grid_size.x + x);
+
+    parallel_for(int(changed.size()), [&](int i){ compute_range(changed[i]); });
+    for (int index : changed)
+        blocks[index].dirty = true;
+}
+
+int isosurface_extractor::active_block_count() const
+{
+    return int(std::count_if(blocks.begin(), blocks.end(), [&](block const & b){ return active(b, current_isovalue); }));
+}
+
+void isosurface_extractor::compute_range(int index)
+{
+    glm::ivec3 const position{index % grid_size.x, index / grid_size.x % grid_size.y, index / (grid_size.x * grid_size.y)};
+    glm::ivec3 const begin = position * block_size;
+    glm::ivec3 const end = glm::min(begin + block_size + 1, volume.size);
+
+    auto & b = blocks[index];
+    b.min_density = 255;
+    b.max_density = 0;
+    for (int z = begin.z; z < end.z; ++z)
+        for (int y = begin.y; y < end.y; ++y)
+        {
+            auto row = volume.density.begin() + (std::size_t(z) * volume.size.y + y) * volume.size.x;
+            auto [min, max] = std::minmax_element(row + begin.x, row + end.x);
+            b.min_density = std::min(b.min_density, *min);
+            b.max_density = std::max(b.max_density, *max);
+        }
+}
+
+void isosurface_extractor::extract(int index)
+{
+    auto & b = blocks[index];
+    b.dirty = false;
+    b.vertices.clear();
+    b.quads.clear();
+
+    if (!active(b, current_isovalue))
+    {
+        b.cell_vertex.clear();
+        b.cell_vertex.shrink_to_fit();
+        return;
+    }
+
+    glm::ivec3 const position{index % grid_size.x, index / grid_size.x % grid_size.y, index / (grid_size.x * grid_size.y)};
+    glm::ivec3 const begin = position * block_size;
+    glm::ivec3 const end = glm::min(begin + block_size, cells);
+    int const block_cells = block_size * block_size * block_size;
+    float const isovalue = current_isovalue;
+
+    auto density = [&](glm::ivec3 v) -> float { return volume.at(v.x, v.y, v.z); };
+
+    // Central differences, one-sided at the boundary
+    auto gradient = [&](glm::ivec3 v)
+    {
+        glm::vec3 result;
+        for (int a = 0; a < 3; ++a)
+        {
+            glm::ivec3 lo = v, hi = v;
+            lo[a] = std::max(v[a] - 1, 0);
+            hi[a] = std::min(v[a] + 1, volume.size[a] - 1);
+            result[a] = hi[a] > lo[a] ? (density(hi) - density(lo)) / float(hi[a] - lo[a]) : 0.f;
+        }
+        return result;
+    };
+
+    // Cell c of the block grid as block * block_size^3 + cell in block
+    auto cell_id = [&](glm::ivec3 c)
+    {
+        glm::ivec3 const block = c / block_size;
+        glm::ivec3 const local = c - block * block_size;
+        return std::uint32_t((block.z * grid_size.y + block.y) * grid_size.x + block.x) * block_cells +
+            (local.z * block_size + local.y) * block_size + local.x;
+    };
+
+    b.cell_vertex.assign(block_cells, -1);
+
+    for (int z = begin.z; z < end.z; ++z)
+        for (int y = begin.y; y < end.y; ++y)
+            for (int x = begin.x; x < end.x; ++x)
+            {
+                glm::ivec3 const c{x, y, z};
+
+                // Corner i is c + (i & 1, (i >> 1) & 1, (i >> 2) & 1)
+                float corner[8];
+                int inside = 0;
+                for (int i = 0; i < 8; ++i)
+                {
+                    corner[i] = density(c + glm::ivec3(i & 1, (i >> 1) & 1, (i >> 2) & 1));
+                    inside |= (corner[i] >= isovalue) << i;
+                }
+
+                if (inside != 0 && inside != 255)
+                {
+                    glm::vec3 sum{0.f};
+                    int crossings = 0;
+                    for (int i = 0; i < 8; ++i)
+                        for (int bit = 1; bit < 8; bit <<= 1)
+                        {
+                            if ((i & bit) || ((inside >> i) & 1) == ((inside >> (i | bit)) & 1)) continue;
+                            float const t = (isovalue - corner[i]) / (corner[i | bit] - corner[i]);
+                            glm::vec3 p(i & 1, (i >> 1) & 1, (i >> 2) & 1);
+                            p[bit >> 1] += t;
+                            sum += p;
+                            ++crossings;
+                        }
+                    glm::vec3 const p = sum / float(crossings);
+
+                    glm::vec3 g{0.f};
+                    for (int i = 0; i < 8; ++i)
+                    {
+                        glm::vec3 const w = glm::mix(1.f - p, p, glm::vec3(i & 1, (i >> 1) & 1, (i >> 2) & 1));
+                        g += w.x * w.y * w.z * gradient(c + glm::ivec3(i & 1, (i >> 1) & 1, (i >> 2) & 1));
+                    }
+                    float const length = glm::length(g);
+
+                    b.cell_vertex[cell_id(c) % block_cells] = std::int32_t(b.vertices.size());
+                    b.vertices.push_back({(glm::vec3(c) + p + 0.5f) / glm::vec3(volume.size),
+                        length > 0.f ? -g / length : glm::vec3(0.f, 1.f, 0.f)});
+                }
+
+                // Edges from the voxel c to c + e_a whose 4 cells all exist, quads face away from the inside end
+                for (int a = 0; a < 3; ++a)
+                {
+                    int const u = (a + 1) % 3, v = (a + 2) % 3;
+                    if (c[u] == 0 || c[v] == 0) continue;
+
+                    bool const inside0 = (inside >> 0) & 1;
+                    bool const inside1 = (inside >> (1 << a)) & 1;
+                    if (inside0 == inside1) continue;
+
+                    glm::ivec3 du{0}, dv{0};
+                    du[u] = 1;
+                    dv[v] = 1;
+                    std::uint32_t const quad[4]{cell_id(c), cell_id(c - du), cell_id(c - du - dv), cell_id(c - dv)};
+                    // In this order the quad faces +e_a
+                    if (inside0)
+                        b.quads.insert(b.quads.end(), quad, quad + 4);
+                    else
+                        b.quads.insert(b.quads.end(), {quad[3], quad[2], quad[1], quad[0]});
+                }
+            }
+}
+
+int isosurface_extractor::update()
+{
+    std::vector<int> dirty;
+    for (int i = 0; i < block_count(); ++i)
+        if (blocks[i].dirty)
+            dirty.push_back(i);
+
+    if (dirty.empty())
+        return 0;
+
+    parallel_for(int(dirty.size()), [&](int i){ extract(dirty[i]); });
+
+    // Every quad refers to vertices of its block and the neighbours below, through their cell_vertex
+    std::vector<std::uint32_t> vertex_offset(blocks.size() + 1, 0), index_offset(blocks.size() + 1, 0);
+    for (std::size_t i = 0; i < blocks.size(); ++i)
+    {
+        vertex_offset[i + 1] = vertex_offset[i] + std::uint32_t(blocks[i].vertices.size());
+        index_offset[i + 1] = index_offset[i] + std::uint32_t(blocks[i].quads.size() / 4 * 6);
+    }
+
+    result.vertices.resize(vertex_offset.back());
+    result.indices.resize(index_offset.back());
+
+    parallel_for(block_count(), [&](int index)
+    {
+        std::copy(blocks[index].vertices.begin(), blocks[index].vertices.end(), result.vertices.begin() + vertex_offset[index]);
+    });
+
+    std::uint32_t const block_cells = block_size * block_size * block_size;
+    parallel_for(block_count(), [&](int index)
+    {
+        auto const & b = blocks[index];
+
+        auto vertex = [&](std::uint32_t cell)
+        {
+            std::uint32_t const owner = cell / block_cells;
+            return vertex_offset[owner] + std::uint32_t(blocks[owner].cell_vertex[cell % block_cells]);
+        };
+
+        auto target = result.indices.begin() + index_offset[index];
+        for (std::size_t q = 0; q < b.quads.size(); q += 4)
+        {
+            std::uint32_t const v0 = vertex(b.quads[q]), v1 = vertex(b.quads[q + 1]);
+            std::uint32_t const v2 = vertex(b.quads[q + 2]), v3 = vertex(b.quads[q + 3]);
+
+            // Split along the shorter diagonal: fewer thin triangles folding over each other
+            auto const & p = result.vertices;
+            auto distance2 = [&](std::uint32_t i, std::uint32_t j)
+            {
+                glm::vec3 const d = (p[i].position - p[j].position) * glm::vec3(volume.size);
+                return glm::dot(d, d);
+            };
+            auto const triangles = distance2(v0, v2) <= distance2(v1, v3)
+                ? std::array{v0, v1, v2, v0, v2, v3}
+                : std::array{v0, v1, v3, v1, v2, v3};
+            for (std::uint32_t i : triangles)
+                *target++ = i;
+        }
+    });
+
+    return int(dirty.size());
+}
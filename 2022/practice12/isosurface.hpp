@@ -0,0 +1,80 @@
+#pragma once
+
+#include "volume.hpp"
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/vec3.hpp>
+
+struct isosurface_vertex
+{
+    // Texture coordinates of the volume, [0, 1]^3 like the cube of the raymarcher
+    glm::vec3 position;
+    // Minus the density gradient, in voxel space (the same as world space while voxels are cubes)
+    glm::vec3 normal;
+};
+
+struct isosurface_mesh
+{
+    std::vector<isosurface_vertex> vertices;
+    std::vector<std::uint32_t> indices;
+};
+
+// Isosurface density == isovalue of a volume as a welded indexed triangle mesh, by surface nets:
+// every cell (the cube between 8 voxel centers) that the surface crosses gets one vertex, the average of
+// the crossings on its edges, and every crossed voxel edge gets a quad joining the vertices of its 4 cells.
+// The mesh faces towards lower density and is open where the surface leaves the volume.
+//
+// Cells are grouped into blocks of block_size^3, each with the density range of its voxels: only blocks
+// that the isosurface passes through are extracted, and after set_isovalue or volume_changed only the
+// blocks whose result can differ are. Dirty blocks are extracted in parallel; the mesh is then
+// reassembled from the per-block results, which is a copy of the output
+struct isosurface_extractor
+{
+    explicit isosurface_extractor(density_volume const & volume, float isovalue = 128.f, int block_size = 8);
+
+    void set_isovalue(float isovalue);
+    float isovalue() const { return current_isovalue; }
+
+    // The density of voxels [begin, end) has changed
+    void volume_changed(glm::ivec3 begin, glm::ivec3 end);
+
+    // Extracts the dirty blocks and rebuilds the mesh if any, returns the number of blocks extracted
+    int update();
+
+    isosurface_mesh const & mesh() const { return result; }
+
+    int block_count() const { return int(blocks.size()); }
+    // Blocks with a part of the isosurface
+    int active_block_count() const;
+
+private:
+    struct block
+    {
+        std::uint8_t min_density = 0, max_density = 0;
+        bool dirty = true;
+
+        std::vector<isosurface_vertex> vertices;
+        // Index in vertices for every cell of the block, -1 if none
+        std::vector<std::int32_t> cell_vertex;
+        // 4 cells per quad, as block * block_size^3 + cell in block
+        std::vector<std::uint32_t> quads;
+    };
+
+    bool active(block const & b, float isovalue) const
+    {
+        return b.max_density >= isovalue && b.min_density < isovalue;
+    }
+
+    void compute_range(int index);
+    void extract(int index);
+
+    density_volume const & volume;
+    float current_isovalue;
+    int block_size;
+    glm::ivec3 cells;
+    glm::ivec3 grid_size;
+    std::vector<block> blocks;
+    isosurface_mesh result;
+};
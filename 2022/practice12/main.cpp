@@ -16,6 +16,9 @@
 #include <random>
 #include <map>
 #include <cmath>
+#include <optional>
+#include <algorithm>
+#include <cstddef>
 
 #define GLM_FORCE_SWIZZLE
 #define GLM_ENABLE_EXPERIMENTAL
@@ -28,6 +31,9 @@
 #include <glm/gtx/string_cast.hpp>
 
 #include "obj_parser.hpp"
+#include "volume.hpp"
+#include "volume_bricks.hpp"
+#include "isosurface.hpp"
 #include "stb_image.h"
 
 std::string to_string(std::string_view str) {
@@ -70,6 +76,18 @@ uniform vec3 light_direction;
 uniform vec3 bbox_min;
 uniform vec3 bbox_max;
 uniform sampler3D sampler;
+// max density per macrocell, see build_macrocells
+uniform sampler3D macrocells;
+// see compute_light_depth
+uniform sampler3D light_depth;
+
+// Streamed volume (see brick_pool): brick_table holds (pool slot, resident) for every brick,
+// brick_pool holds the resident bricks with their one voxel borders
+uniform bool bricked;
+uniform usampler3D brick_table;
+uniform sampler3D brick_pool;
+uniform vec3 volume_size;
+uniform float brick_size;
 
 in vec3 position;
 
@@ -113,6 +131,22 @@ vec3 get_texture_pos(vec3 p) {
 
 const float PI = 3.1415926535;
 
+float density_at(vec3 texture_pos)
+{
+    if (!bricked)
+        return texture(sampler, texture_pos).r;
+
+    vec3 voxel = texture_pos * volume_size;
+    ivec3 brick = clamp(ivec3(floor(voxel / brick_size)), ivec3(0), textureSize(brick_table, 0) - 1);
+    uvec4 entry = texelFetch(brick_table, brick, 0);
+    // empty, or not streamed in yet
+    if (entry.a == 0u)
+        return 0.0;
+
+    vec3 pool_voxel = vec3(entry.xyz) * (brick_size + 2.0) + 1.0 + (voxel - vec3(brick) * brick_size);
+    return texture(brick_pool, pool_voxel / vec3(textureSize(brick_pool, 0))).r;
+}
+
 void main()
 {
     vec3 from_camera = normalize(position - camera_position);
@@ -122,7 +156,7 @@ void main()
     tmin = max(tmin, 0.0);
 
     const int ITER = 64;
-    const int JTER = 8;
+    const float SATURATED_OPTICAL_DEPTH = 8.0;
 
     vec3 optical_depth = vec3(0.0);
     float absorption = 3.0;
@@ -134,25 +168,36 @@ void main()
     vec3 scattering = vec3(7.f, 1.f, 4.f);
     vec3 extinction = absorption + scattering;
 
+    // Samples stay at tmin + (i + 0.5) * dt, but those in empty macrocells are jumped over:
+    // their density is 0, so they add nothing and the image is the same
+    vec3 grid_size = vec3(textureSize(macrocells, 0));
+    vec3 grid_direction = from_camera / (bbox_max - bbox_min) * grid_size;
+    vec3 grid_step = step(0.0, grid_direction);
+    vec3 grid_inverse_direction = 1.0 / max(abs(grid_direction), vec3(1e-6)) * sign(grid_direction + 1e-12);
+
     for (int i = 0; i < ITER; ++i) {
         float t = tmin + (i + 0.5) * dt;
         vec3 p = camera_position + t * from_camera;
-        float density = texture(sampler, get_texture_pos(p)).r;
+
+        vec3 grid_p = get_texture_pos(p) * grid_size;
+        vec3 cell = clamp(floor(grid_p), vec3(0.0), grid_size - 1.0);
+        if (texelFetch(macrocells, ivec3(cell), 0).r == 0.0) {
+            float t_exit = t + vmin((cell + grid_step - grid_p) * grid_inverse_direction);
+            i = max(i, int(ceil((t_exit - tmin) / dt - 0.5)) - 1);
+            continue;
+        }
+
+        float density = density_at(get_texture_pos(p));
         optical_depth += extinction * density * dt;
 
-        vec3 light_optical_depth = vec3(0.0);
-        vec2 light_seg = intersect_bbox(p, light_direction);
-        float tmin_l = max(light_seg.x, 0.0);
-        float tmin_r = light_seg.y;
+        // density integrated towards the light, precomputed on the CPU for the current light_direction
+        vec3 light_optical_depth = extinction * texture(light_depth, get_texture_pos(p)).r;
 
-        float dx_light = (tmin_r - tmin_l) / JTER;
-        for (int j = 0; j < JTER; ++j) {
-            float l = tmin_l + (j + 0.5) * dx_light;
-            vec3 l_p = p + l * light_direction;
-            light_optical_depth += extinction * texture(sampler, get_texture_pos(l_p)).r * dx_light;
-        }
+        color += light_color * exp(-light_optical_depth) * exp(-optical_depth) * dt * density * scattering / 4.0 / PI;
 
-        color += light_color * exp(-light_optical_depth) * exp(-optical_depth) * dt * texture(sampler, get_texture_pos(p)).r * scattering / 4.0 / PI;
+        // Nothing behind is visible any more: the rest would add less than the 8-bit output can show
+        if (vmin(optical_depth) > SATURATED_OPTICAL_DEPTH)
+            break;
     }
 
     vec3 opacity = 1.0 - exp(-optical_depth);
@@ -160,6 +205,47 @@ void main()
 }
 )";
 
+// The extracted isosurface, rasterized instead of raymarched
+const char surface_vertex_shader_source[] =
+    R"(#version 330 core
+
+uniform mat4 view;
+uniform mat4 projection;
+
+uniform vec3 bbox_min;
+uniform vec3 bbox_max;
+
+layout (location = 0) in vec3 in_position;
+layout (location = 1) in vec3 in_normal;
+
+out vec3 normal;
+
+void main()
+{
+    vec3 position = bbox_min + in_position * (bbox_max - bbox_min);
+    gl_Position = projection * view * vec4(position, 1.0);
+    normal = in_normal;
+}
+)";
+
+const char surface_fragment_shader_source[] =
+    R"(#version 330 core
+
+uniform vec3 light_direction;
+
+in vec3 normal;
+
+layout (location = 0) out vec4 out_color;
+
+void main()
+{
+    // the surface is open at the volume boundary, its back faces are visible
+    vec3 n = normalize(gl_FrontFacing ? normal : -normal);
+    vec3 albedo = vec3(0.8, 0.7, 0.6);
+    out_color = vec4(albedo * (0.2 + 0.8 * max(0.0, dot(n, light_direction))), 1.0);
+}
+)";
+
 GLuint create_shader(GLenum type, const char *source) {
   GLuint result = glCreateShader(type);
   glShaderSource(result, 1, &source, nullptr);
@@ -229,33 +315,207 @@ static std::uint32_t cube_indices[]
         5, 3, 7,
     };
 
-GLuint load_texture(const std::string &path) {
-  int width = 128;
-  int height = 64;
-  int depth = 64;
+GLuint load_texture(const density_volume &volume) {
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_3D, texture);
 
-  std::vector<char> pixels(width * height * depth);
+  glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 
+  glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexImage3D(GL_TEXTURE_3D, 0, GL_R8, volume.size.x, volume.size.y, volume.size.z, 0, GL_RED, GL_UNSIGNED_BYTE,
+               volume.density.data());
+  glGenerateMipmap(GL_TEXTURE_3D);
+  return texture;
+}
+
+GLuint load_macrocell_texture(const macrocell_grid &grid) {
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_3D, texture);
+
+  glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, 0);
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexImage3D(GL_TEXTURE_3D, 0, GL_R8, grid.size.x, grid.size.y, grid.size.z, 0, GL_RED, GL_UNSIGNED_BYTE,
+               grid.max_density.data());
+  return texture;
+}
+
+GLuint create_light_depth_texture(glm::ivec3 size) {
   GLuint texture;
   glGenTextures(1, &texture);
   glBindTexture(GL_TEXTURE_3D, texture);
 
   glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
   glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, 0);
 
   glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
   glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
   glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 
-  std::ifstream input(path, std::ios::binary);
-  input.read(pixels.data(), pixels.size());
-
-  glTexImage3D(GL_TEXTURE_3D, 0, GL_R8, width, height, depth, 0, GL_RED, GL_UNSIGNED_BYTE, pixels.data());
-  glGenerateMipmap(GL_TEXTURE_3D);
+  glTexImage3D(GL_TEXTURE_3D, 0, GL_R32F, size.x, size.y, size.z, 0, GL_RED, GL_FLOAT, nullptr);
   return texture;
 }
 
-int main() try {
+// Bricks of a brick_file streamed into a pool texture of a fixed size. The brick table maps every brick
+// of the volume to its slot in the pool; each frame the bricks inside the view frustum are wanted,
+// the nearest ones are read from the file a few per frame, and the least recently wanted ones make room
+struct brick_pool {
+  brick_file &file;
+  int slot_count;
+  glm::ivec3 slots;
+  GLuint pool_texture, table_texture;
+  int pool_unit, table_unit;
+
+  std::vector<int> slot_brick;      // brick in the slot, -1 if free
+  std::vector<int> slot_last_wanted;
+  std::vector<int> brick_slot;      // -1 if not resident
+  std::vector<std::uint8_t> staging;
+  std::vector<std::pair<float, int>> wanted;
+  int frame = 0;
+
+  brick_pool(brick_file &file, std::size_t budget_bytes, int pool_unit, int table_unit)
+      : file(file), pool_unit(pool_unit), table_unit(table_unit) {
+    const int stored = file.brick_size + 2;
+    GLint max_size;
+    glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &max_size);
+    const int max_slots_per_axis = std::min<int>(max_size / stored, 255);
+
+    slot_count = (int) std::min<std::size_t>(budget_bytes / file.brick_bytes(), file.brick_count);
+    slot_count = std::max(1, std::min(slot_count, max_slots_per_axis * max_slots_per_axis * max_slots_per_axis));
+    slots.x = slots.y = std::min(max_slots_per_axis, (int) std::ceil(std::cbrt((double) slot_count)));
+    slots.z = (slot_count + slots.x * slots.y - 1) / (slots.x * slots.y);
+
+    slot_brick.assign(slot_count, -1);
+    slot_last_wanted.assign(slot_count, -1);
+    brick_slot.assign(file.index.size(), -1);
+    staging.resize(file.brick_bytes());
+
+    glActiveTexture(GL_TEXTURE0 + pool_unit);
+    glGenTextures(1, &pool_texture);
+    glBindTexture(GL_TEXTURE_3D, pool_texture);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_R8, slots.x * stored, slots.y * stored, slots.z * stored, 0, GL_RED,
+                 GL_UNSIGNED_BYTE, nullptr);
+
+    glActiveTexture(GL_TEXTURE0 + table_unit);
+    glGenTextures(1, &table_texture);
+    glBindTexture(GL_TEXTURE_3D, table_texture);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, 0);
+    std::vector<std::uint8_t> table(4 * file.index.size(), 0);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA8UI, file.grid_size.x, file.grid_size.y, file.grid_size.z, 0,
+                 GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, table.data());
+
+    glActiveTexture(GL_TEXTURE0);
+  }
+
+  void set_table_entry(int brick, glm::ivec3 slot, bool resident) {
+    const glm::ivec3 grid = file.grid_size;
+    const glm::ivec3 position{brick % grid.x, brick / grid.x % grid.y, brick / (grid.x * grid.y)};
+    const std::uint8_t entry[4]{(std::uint8_t) slot.x, (std::uint8_t) slot.y, (std::uint8_t) slot.z,
+                                (std::uint8_t) resident};
+    glActiveTexture(GL_TEXTURE0 + table_unit);
+    glTexSubImage3D(GL_TEXTURE_3D, 0, position.x, position.y, position.z, 1, 1, 1, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE,
+                    entry);
+  }
+
+  glm::ivec3 slot_position(int slot) const {
+    return {slot % slots.x, slot / slots.x % slots.y, slot / (slots.x * slots.y)};
+  }
+
+  // Returns the number of bricks read this frame
+  int update(const glm::mat4 &view_projection, glm::vec3 camera_position, glm::vec3 bbox_min, glm::vec3 bbox_max,
+             int max_uploads) {
+    ++frame;
+    const glm::ivec3 grid = file.grid_size;
+    const glm::vec3 voxel_size = (bbox_max - bbox_min) / glm::vec3(file.size);
+
+    // Stored bricks inside the frustum, nearest first
+    wanted.clear();
+    for (int z = 0; z < grid.z; ++z)
+      for (int y = 0; y < grid.y; ++y)
+        for (int x = 0; x < grid.x; ++x) {
+          if (file.stored_index({x, y, z}) < 0) continue;
+          glm::vec3 lo = bbox_min + glm::vec3(glm::ivec3(x, y, z) * file.brick_size) * voxel_size;
+          glm::vec3 hi = bbox_min + glm::vec3(glm::min(glm::ivec3(x + 1, y + 1, z + 1) * file.brick_size, file.size)) *
+                                    voxel_size;
+          if (!box_in_frustum(view_projection, lo, hi)) continue;
+          wanted.push_back({glm::length(glm::clamp(camera_position, lo, hi) - camera_position), (z * grid.y + y) * grid.x + x});
+        }
+    std::sort(wanted.begin(), wanted.end());
+    // the farthest ones don't fit
+    if ((int) wanted.size() > slot_count)
+      wanted.resize(slot_count);
+
+    for (auto [distance, brick]: wanted)
+      if (brick_slot[brick] >= 0)
+        slot_last_wanted[brick_slot[brick]] = frame;
+
+    int uploads = 0;
+    for (auto [distance, brick]: wanted) {
+      if (brick_slot[brick] >= 0) continue;
+      if (uploads == max_uploads) break;
+
+      // A free slot, or the one wanted longest ago but not this frame
+      int slot = -1;
+      for (int i = 0; i < slot_count; ++i)
+        if (slot_last_wanted[i] < frame && (slot == -1 || slot_last_wanted[i] < slot_last_wanted[slot]))
+          slot = i;
+      if (slot == -1) break;
+
+      if (slot_brick[slot] >= 0) {
+        brick_slot[slot_brick[slot]] = -1;
+        set_table_entry(slot_brick[slot], {0, 0, 0}, false);
+      }
+
+      glm::ivec3 position{brick % grid.x, brick / grid.x % grid.y, brick / (grid.x * grid.y)};
+      file.read_brick(file.stored_index(position), staging.data());
+      const int stored = file.brick_size + 2;
+      const glm::ivec3 origin = slot_position(slot) * stored;
+      glActiveTexture(GL_TEXTURE0 + pool_unit);
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+      glTexSubImage3D(GL_TEXTURE_3D, 0, origin.x, origin.y, origin.z, stored, stored, stored, GL_RED,
+                      GL_UNSIGNED_BYTE, staging.data());
+
+      brick_slot[brick] = slot;
+      slot_brick[slot] = brick;
+      slot_last_wanted[slot] = frame;
+      set_table_entry(brick, slot_position(slot), true);
+      ++uploads;
+    }
+
+    glActiveTexture(GL_TEXTURE0);
+    return uploads;
+  }
+
+  static bool box_in_frustum(const glm::mat4 &view_projection, glm::vec3 lo, glm::vec3 hi) {
+    glm::vec4 corners[8];
+    for (int i = 0; i < 8; ++i)
+      corners[i] = view_projection * glm::vec4(i & 1 ? hi.x : lo.x, i & 2 ? hi.y : lo.y, i & 4 ? hi.z : lo.z, 1.f);
+    // outside if all corners are beyond the same clip plane
+    for (int axis = 0; axis < 3; ++axis)
+      for (float sign: {-1.f, 1.f})
+        if (std::all_of(corners, corners + 8, [&](const glm::vec4 &c) { return sign * c[axis] > c.w; }))
+          return false;
+    return true;
+  }
+};
+
+int main(int argc, char **argv) try {
   if (SDL_Init(SDL_INIT_VIDEO) != 0)
     sdl2_fail("SDL_Init: ");
 
@@ -300,6 +560,14 @@ int main() try {
   GLuint bbox_max_location = glGetUniformLocation(program, "bbox_max");
   GLuint camera_position_location = glGetUniformLocation(program, "camera_position");
   GLuint light_direction_location = glGetUniformLocation(program, "light_direction");
+  GLuint sampler_location = glGetUniformLocation(program, "sampler");
+  GLuint macrocells_location = glGetUniformLocation(program, "macrocells");
+  GLuint light_depth_location = glGetUniformLocation(program, "light_depth");
+  GLuint bricked_location = glGetUniformLocation(program, "bricked");
+  GLuint brick_table_location = glGetUniformLocation(program, "brick_table");
+  GLuint brick_pool_location = glGetUniformLocation(program, "brick_pool");
+  GLuint volume_size_location = glGetUniformLocation(program, "volume_size");
+  GLuint brick_size_location = glGetUniformLocation(program, "brick_size");
 
   GLuint vao, vbo, ebo;
   glGenVertexArrays(1, &vao);
@@ -320,10 +588,75 @@ int main() try {
   const std::string cloud_data_path = project_root + "/cloud.data";
 
   // Task 3
-  GLuint texture = load_texture(cloud_data_path);
+  // A .bricks file made by volume_convert is streamed from disk, otherwise the cloud is loaded whole
+  std::optional<brick_file> bricks;
+  density_volume cloud;
+  if (argc > 1)
+    bricks.emplace(argv[1]);
+  else
+    cloud = load_volume(cloud_data_path, {128, 64, 64});
+
+  const glm::ivec3 volume_size = bricks ? bricks->size : cloud.size;
+  // the light depth of a streamed volume comes from its coarse copy
+  const density_volume &lighting = bricks ? bricks->coarse : cloud;
+
+  GLuint texture = bricks ? 0 : load_texture(cloud);
+
+  // 4^3 voxels per cell: 32x16x16 cells for the cloud, small enough to stay in the texture cache
+  glActiveTexture(GL_TEXTURE1);
+  GLuint macrocell_texture = load_macrocell_texture(bricks ? bricks->macrocells : build_macrocells(cloud, 4));
+
+  glActiveTexture(GL_TEXTURE2);
+  GLuint light_depth_texture = create_light_depth_texture(lighting.size);
+  glActiveTexture(GL_TEXTURE0);
+
+  // Bricks beyond the budget are not drawn; reading is spread over frames
+  const std::size_t brick_pool_budget = 64 << 20;
+  const int brick_uploads_per_frame = 16;
+  std::optional<brick_pool> pool;
+  if (bricks)
+    pool.emplace(*bricks, brick_pool_budget, 3, 4);
+
+  // The smallest side of the box is 2, voxels are cubes: [-2, 2] x [-1, 1] x [-1, 1] for the cloud
+  const glm::vec3 cloud_bbox_max = glm::vec3(volume_size) / (float) std::min({volume_size.x, volume_size.y, volume_size.z});
+  const glm::vec3 cloud_bbox_min = -cloud_bbox_max;
+
+  // I toggles the isosurface of the loaded volume, [ and ] change its density
+  auto surface_vertex_shader = create_shader(GL_VERTEX_SHADER, surface_vertex_shader_source);
+  auto surface_fragment_shader = create_shader(GL_FRAGMENT_SHADER, surface_fragment_shader_source);
+  auto surface_program = create_program(surface_vertex_shader, surface_fragment_shader);
+
+  GLuint surface_view_location = glGetUniformLocation(surface_program, "view");
+  GLuint surface_projection_location = glGetUniformLocation(surface_program, "projection");
+  GLuint surface_bbox_min_location = glGetUniformLocation(surface_program, "bbox_min");
+  GLuint surface_bbox_max_location = glGetUniformLocation(surface_program, "bbox_max");
+  GLuint surface_light_direction_location = glGetUniformLocation(surface_program, "light_direction");
+
+  GLuint surface_vao, surface_vbo, surface_ebo;
+  glGenVertexArrays(1, &surface_vao);
+  glBindVertexArray(surface_vao);
+
+  glGenBuffers(1, &surface_vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, surface_vbo);
+
+  glGenBuffers(1, &surface_ebo);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, surface_ebo);
+
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(isosurface_vertex), (void *) offsetof(isosurface_vertex, position));
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(isosurface_vertex), (void *) offsetof(isosurface_vertex, normal));
+
+  // a streamed volume is never whole in memory
+  std::optional<isosurface_extractor> isosurface;
+  if (!bricks)
+    isosurface.emplace(cloud, 32.f);
+  bool show_isosurface = false;
 
-  const glm::vec3 cloud_bbox_min{-2.f, -1.f, -1.f};
-  const glm::vec3 cloud_bbox_max{2.f, 1.f, 1.f};
+  // The light depth is recomputed only once the light turns by more than this (radians)
+  const float light_depth_tolerance = glm::radians(1.f);
+  glm::vec3 light_depth_direction{0.f};
+  std::vector<float> light_depth;
 
   auto last_frame_start = std::chrono::high_resolution_clock::now();
 
@@ -355,6 +688,8 @@ int main() try {
         case SDL_KEYDOWN:button_down[event.key.keysym.sym] = true;
           if (event.key.keysym.sym == SDLK_SPACE)
             paused = !paused;
+          if (event.key.keysym.sym == SDLK_i)
+            show_isosurface = !show_isosurface && isosurface;
           break;
         case SDL_KEYUP:button_down[event.key.keysym.sym] = false;
           break;
@@ -385,6 +720,28 @@ int main() try {
     if (button_down[SDLK_s])
       view_angle += 2.f * dt;
 
+    if (show_isosurface) {
+      float isovalue = isosurface->isovalue();
+      if (button_down[SDLK_LEFTBRACKET])
+        isovalue -= 32.f * dt;
+      if (button_down[SDLK_RIGHTBRACKET])
+        isovalue += 32.f * dt;
+      isovalue = glm::clamp(isovalue, 0.5f, 254.5f);
+      if (isovalue != isosurface->isovalue())
+        isosurface->set_isovalue(isovalue);
+
+      // only the blocks the surface passes through are extracted again
+      if (isosurface->update() > 0) {
+        const auto &mesh = isosurface->mesh();
+        glBindBuffer(GL_ARRAY_BUFFER, surface_vbo);
+        glBufferData(GL_ARRAY_BUFFER, mesh.vertices.size() * sizeof(mesh.vertices[0]), mesh.vertices.data(),
+                     GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, surface_ebo);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.indices.size() * sizeof(mesh.indices[0]), mesh.indices.data(),
+                     GL_DYNAMIC_DRAW);
+      }
+    }
+
     glClearColor(0.0f, 0.0f, 0.0f, 0.f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -412,6 +769,36 @@ int main() try {
 
     glm::vec3 light_direction = glm::normalize(glm::vec3(std::cos(time), 1.f, std::sin(time)));
 
+    if (glm::dot(light_direction, light_depth_direction) < std::cos(light_depth_tolerance)) {
+      compute_light_depth(lighting, cloud_bbox_max - cloud_bbox_min, light_direction, light_depth);
+      glActiveTexture(GL_TEXTURE2);
+      glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, lighting.size.x, lighting.size.y, lighting.size.z, GL_RED, GL_FLOAT,
+                      light_depth.data());
+      glActiveTexture(GL_TEXTURE0);
+      light_depth_direction = light_direction;
+    }
+
+    if (show_isosurface) {
+      glDisable(GL_BLEND);
+      glDisable(GL_CULL_FACE);
+
+      glUseProgram(surface_program);
+      glUniformMatrix4fv(surface_view_location, 1, GL_FALSE, reinterpret_cast<float *>(&view));
+      glUniformMatrix4fv(surface_projection_location, 1, GL_FALSE, reinterpret_cast<float *>(&projection));
+      glUniform3fv(surface_bbox_min_location, 1, reinterpret_cast<const float *>(&cloud_bbox_min));
+      glUniform3fv(surface_bbox_max_location, 1, reinterpret_cast<const float *>(&cloud_bbox_max));
+      glUniform3fv(surface_light_direction_location, 1, reinterpret_cast<float *>(&light_direction));
+
+      glBindVertexArray(surface_vao);
+      glDrawElements(GL_TRIANGLES, isosurface->mesh().indices.size(), GL_UNSIGNED_INT, nullptr);
+
+      SDL_GL_SwapWindow(window);
+      continue;
+    }
+
+    if (pool)
+      pool->update(projection * view * model, camera_position, cloud_bbox_min, cloud_bbox_max, brick_uploads_per_frame);
+
     glUseProgram(program);
     glUniformMatrix4fv(view_location, 1, GL_FALSE, reinterpret_cast<float *>(&view));
     glUniformMatrix4fv(projection_location, 1, GL_FALSE, reinterpret_cast<float *>(&projection));
@@ -419,6 +806,15 @@ int main() try {
     glUniform3fv(bbox_max_location, 1, reinterpret_cast<const float *>(&cloud_bbox_max));
     glUniform3fv(camera_position_location, 1, reinterpret_cast<float *>(&camera_position));
     glUniform3fv(light_direction_location, 1, reinterpret_cast<float *>(&light_direction));
+    glUniform1i(sampler_location, 0);
+    glUniform1i(macrocells_location, 1);
+    glUniform1i(light_depth_location, 2);
+    // units of different sampler types must differ even when unused
+    glUniform1i(brick_pool_location, 3);
+    glUniform1i(brick_table_location, 4);
+    glUniform1i(bricked_location, (bool) pool);
+    glUniform3f(volume_size_location, volume_size.x, volume_size.y, volume_size.z);
+    glUniform1f(brick_size_location, bricks ? bricks->brick_size : 0.f);
 
     glBindVertexArray(vao);
     glDrawElements(GL_TRIANGLES, std::size(cube_indices), GL_UNSIGNED_INT, nullptr);
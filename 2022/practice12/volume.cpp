@@ -0,0 +1,288 @@
+#include "volume.hpp"
+
+#include <algorithm>
+#include <barrier>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+
+#include <glm/geometric.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define VOLUME_SSE 1
+#include <xmmintrin.h>
+#endif
+
+density_volume load_volume(std::filesystem::path const & path, glm::ivec3 size)
+{
+    density_volume result;
+    result.size = size;
+    result.density.resize(std::size_t(size.x) * size.y * size.z);
+
+    std::ifstream input(path, std::ios::binary);
+    input.read(reinterpret_cast<char *>(result.density.data()), result.density.size());
+    if (input.gcount() != std::streamsize(result.density.size()))
+        throw std::runtime_error("Volume " + path.string() + " is smaller than expected");
+
+    return result;
+}
+
+macrocell_grid build_macrocells(density_volume const & volume, int cell_size)
+{
+    macrocell_grid result;
+    result.cell_size = cell_size;
+    result.size = (volume.size + cell_size - 1) / cell_size;
+    result.max_density.resize(std::size_t(result.size.x) * result.size.y * result.size.z);
+
+    // A linearly filtered sample inside the cell reads the voxels [begin - 1, end]
+    auto range = [&](int cell, int axis)
+    {
+        int begin = std::max(cell * cell_size - 1, 0);
+        int end = std::min((cell + 1) * cell_size + 1, volume.size[axis]);
+        return std::pair{begin, end};
+    };
+
+    for (int cz = 0; cz < result.size.z; ++cz)
+    {
+        auto [z0, z1] = range(cz, 2);
+        for (int cy = 0; cy < result.size.y; ++cy)
+        {
+            auto [y0, y1] = range(cy, 1);
+            for (int cx = 0; cx < result.size.x; ++cx)
+            {
+                auto [x0, x1] = range(cx, 0);
+
+                std::uint8_t max_density = 0;
+                for (int z = z0; z < z1; ++z)
+                    for (int y = y0; y < y1; ++y)
+                    {
+                        auto row = volume.density.begin() + (std::size_t(z) * volume.size.y + y) * volume.size.x;
+                        max_density = std::max(max_density, *std::max_element(row + x0, row + x1));
+                    }
+
+                result.max_density[(std::size_t(cz) * result.size.y + cy) * result.size.x + cx] = max_density;
+            }
+        }
+    }
+
+    return result;
+}
+
+void compute_light_depth(density_volume const & volume, glm::vec3 bbox_size, glm::vec3 light_direction,
+    std::vector<float> & depth)
+{
+    // Light direction in voxels per world unit, a is its dominant axis, u and v span the slices
+    glm::vec3 const direction = glm::normalize(light_direction) * glm::vec3(volume.size) / bbox_size;
+    int a = 0;
+    for (int i = 1; i < 3; ++i)
+        if (std::abs(direction[i]) > std::abs(direction[a]))
+            a = i;
+    int const u_axis = a == 0 ? 1 : 0;
+    int const v_axis = a == 2 ? 1 : 2;
+
+    // One slice towards the light, and its length in world units
+    glm::vec3 const step = direction / std::abs(direction[a]);
+    float const step_length = 1.f / std::abs(direction[a]);
+
+    glm::ivec3 const strides{1, volume.size.x, volume.size.x * volume.size.y};
+    int const nu = volume.size[u_axis], nv = volume.size[v_axis], na = volume.size[a];
+    int const su = strides[u_axis], sv = strides[v_axis], sa = strides[a];
+
+    // The depth is continued from SPAN slices closer to the light and the density in between is
+    // integrated directly: every interpolation of the depth blurs it, so fewer of them keep shadows sharper
+    constexpr int SPAN = 4;
+
+    // The point j slices closer to the light is (u + j * step_u, v + j * step_v) in its slice:
+    // the same integer offset and bilinear weights for every voxel
+    struct tap
+    {
+        int du, dv;
+        float w00, w01, w10, w11;
+    };
+    tap taps[SPAN + 1];
+    int du_min = 0, du_max = 0, dv_min = 0, dv_max = 0;
+    for (int j = 0; j <= SPAN; ++j)
+    {
+        float const u = j * step[u_axis], v = j * step[v_axis];
+        auto & t = taps[j];
+        t.du = (int) std::floor(u);
+        t.dv = (int) std::floor(v);
+        float const wu = u - t.du, wv = v - t.dv;
+        t.w00 = (1.f - wu) * (1.f - wv);
+        t.w01 = wu * (1.f - wv);
+        t.w10 = (1.f - wu) * wv;
+        t.w11 = wu * wv;
+        du_min = std::min(du_min, t.du);
+        du_max = std::max(du_max, t.du);
+        dv_min = std::min(dv_min, t.dv);
+        dv_max = std::max(dv_max, t.dv);
+    }
+
+    // Slices until the ray from a voxel center leaves the volume
+    auto exit_steps = [](int index, float s, int size)
+    {
+        if (s > 0.f) return (size - index - 0.5f) / s;
+        if (s < 0.f) return (index + 0.5f) / -s;
+        return std::numeric_limits<float>::infinity();
+    };
+
+    depth.resize(volume.density.size());
+
+    // The last SPAN + 1 slices of the sweep, by sweep step modulo SPAN + 1
+    std::vector<float> slice_density[SPAN + 1], slice_depth[SPAN + 1];
+    for (int i = 0; i <= SPAN; ++i)
+    {
+        slice_density[i].resize(std::size_t(nu) * nv);
+        slice_depth[i].resize(std::size_t(nu) * nv);
+    }
+
+    int const thread_count = std::clamp((int) std::thread::hardware_concurrency(), 1, std::max(1, nv / 8));
+    std::barrier sync(thread_count);
+
+    auto worker = [&](int thread)
+    {
+        int const v_begin = nv * thread / thread_count;
+        int const v_end = nv * (thread + 1) / thread_count;
+
+        for (int n = 0; n < na; ++n)
+        {
+            int const k = step[a] > 0.f ? na - 1 - n : n;
+            float const exit_a = exit_steps(k, step[a], na);
+
+            // j slices closer to the light
+            auto density_slice = [&](int j) -> std::vector<float> const & { return slice_density[(n - j + SPAN + 1) % (SPAN + 1)]; };
+            auto depth_slice = [&](int j) -> std::vector<float> const & { return slice_depth[(n - j + SPAN + 1) % (SPAN + 1)]; };
+
+            for (int v = v_begin; v < v_end; ++v)
+            {
+                std::uint8_t const * source = volume.density.data() + std::size_t(k) * sa + std::size_t(v) * sv;
+                float * d = slice_density[n % (SPAN + 1)].data() + std::size_t(v) * nu;
+                for (int u = 0; u < nu; ++u)
+                    d[u] = source[std::size_t(u) * su] / 255.f;
+
+                float * r = slice_depth[n % (SPAN + 1)].data() + std::size_t(v) * nu;
+                float const exit_v = exit_steps(v, step[v_axis], nv);
+
+                // Border voxels: clamp to edge like GL_LINEAR, and integrate only up to the boundary
+                // if the ray leaves the volume within SPAN slices
+                auto voxel = [&](int u)
+                {
+                    auto sample = [&](std::vector<float> const & slice, tap const & t)
+                    {
+                        int const u0 = std::clamp(u + t.du, 0, nu - 1), u1 = std::clamp(u + t.du + 1, 0, nu - 1);
+                        int const v0 = std::clamp(v + t.dv, 0, nv - 1), v1 = std::clamp(v + t.dv + 1, 0, nv - 1);
+                        return t.w00 * slice[v0 * nu + u0] + t.w01 * slice[v0 * nu + u1] +
+                            t.w10 * slice[v1 * nu + u0] + t.w11 * slice[v1 * nu + u1];
+                    };
+
+                    float const exit = std::min({exit_a, exit_v, exit_steps(u, step[u_axis], nu)});
+                    int const whole = std::min((int) exit, SPAN);
+
+                    // Trapezoids over the whole steps, then the part of a step left to the boundary
+                    float sum = 0.5f * d[u];
+                    float last = d[u];
+                    for (int j = 1; j <= whole; ++j)
+                    {
+                        last = sample(density_slice(j), taps[j]);
+                        sum += last;
+                    }
+                    if (whole == SPAN)
+                        return sample(depth_slice(SPAN), taps[SPAN]) + (sum - 0.5f * last) * step_length;
+                    return (sum - 0.5f * last + last * (exit - whole)) * step_length;
+                };
+
+                // Interior voxels need neither, and are done 4 at a time
+                int u_begin = nu, u_end = nu;
+                if (exit_a >= SPAN && exit_v >= SPAN && v + dv_min >= 0 && v + dv_max + 1 < nv)
+                {
+                    u_begin = std::max(0, -du_min);
+                    while (u_begin < nu && exit_steps(u_begin, step[u_axis], nu) < SPAN)
+                        ++u_begin;
+                    u_end = std::min(nu, nu - 1 - du_max);
+                    while (u_end > u_begin && exit_steps(u_end - 1, step[u_axis], nu) < SPAN)
+                        --u_end;
+                    u_begin = std::min(u_begin, u_end);
+                }
+
+                for (int u = 0; u < u_begin; ++u)
+                    r[u] = voxel(u);
+
+                // Rows of the taps, shifted by the taps' u offsets
+                float const * rows[SPAN + 2][2];
+                for (int j = 1; j <= SPAN; ++j)
+                    for (int i = 0; i < 2; ++i)
+                        rows[j][i] = density_slice(j).data() + std::size_t(v + taps[j].dv + i) * nu + taps[j].du;
+                for (int i = 0; i < 2; ++i)
+                    rows[SPAN + 1][i] = depth_slice(SPAN).data() + std::size_t(v + taps[SPAN].dv + i) * nu + taps[SPAN].du;
+
+                auto weights = [&](int j) -> tap const & { return taps[std::min(j, SPAN)]; };
+
+                int u = u_begin;
+#ifdef VOLUME_SSE
+                for (; u + 4 <= u_end; u += 4)
+                {
+                    // sum over the span: d / 2 + density(1) + ... + density(SPAN - 1) + density(SPAN) / 2
+                    __m128 sum = _mm_mul_ps(_mm_set1_ps(0.5f), _mm_loadu_ps(d + u));
+                    __m128 result;
+                    for (int j = 1; j <= SPAN + 1; ++j)
+                    {
+                        tap const & t = weights(j);
+                        float const * row0 = rows[j][0] + u;
+                        float const * row1 = rows[j][1] + u;
+                        __m128 value = _mm_add_ps(
+                            _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.w00), _mm_loadu_ps(row0)),
+                                _mm_mul_ps(_mm_set1_ps(t.w01), _mm_loadu_ps(row0 + 1))),
+                            _mm_add_ps(_mm_mul_ps(_mm_set1_ps(t.w10), _mm_loadu_ps(row1)),
+                                _mm_mul_ps(_mm_set1_ps(t.w11), _mm_loadu_ps(row1 + 1))));
+                        if (j < SPAN)
+                            sum = _mm_add_ps(sum, value);
+                        else if (j == SPAN)
+                            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(0.5f), value));
+                        else
+                            result = _mm_add_ps(value, _mm_mul_ps(sum, _mm_set1_ps(step_length)));
+                    }
+                    _mm_storeu_ps(r + u, result);
+                }
+#endif
+                for (; u < u_end; ++u)
+                {
+                    float sum = 0.5f * d[u];
+                    float result = 0.f;
+                    for (int j = 1; j <= SPAN + 1; ++j)
+                    {
+                        tap const & t = weights(j);
+                        float const * row0 = rows[j][0] + u;
+                        float const * row1 = rows[j][1] + u;
+                        float value = t.w00 * row0[0] + t.w01 * row0[1] + t.w10 * row1[0] + t.w11 * row1[1];
+                        if (j < SPAN)
+                            sum += value;
+                        else if (j == SPAN)
+                            sum += 0.5f * value;
+                        else
+                            result = value + sum * step_length;
+                    }
+                    r[u] = result;
+                }
+
+                for (u = u_end; u < nu; ++u)
+                    r[u] = voxel(u);
+
+                float * target = depth.data() + std::size_t(k) * sa + std::size_t(v) * sv;
+                for (u = 0; u < nu; ++u)
+                    target[std::size_t(u) * su] = r[u];
+            }
+
+            // The next slices read neighbouring rows of this one
+            sync.arrive_and_wait();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int thread = 1; thread < thread_count; ++thread)
+        threads.emplace_back(worker, thread);
+    worker(0);
+    for (auto & thread : threads)
+        thread.join();
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <filesystem>
+
+#include <glm/vec3.hpp>
+
+// Dense 8-bit density volume, x is the fastest axis (the layout of the .data files and of glTexImage3D)
+struct density_volume
+{
+    glm::ivec3 size{0};
+    std::vector<std::uint8_t> density;
+
+    std::uint8_t at(int x, int y, int z) const
+    {
+        return density[(std::size_t(z) * size.y + y) * size.x + x];
+    }
+};
+
+density_volume load_volume(std::filesystem::path const & path, glm::ivec3 size);
+
+// Coarse grid over the volume for empty-space skipping: each macrocell stores the maximum density
+// that linear filtering can return anywhere inside it, i.e. the voxels of the cell plus a one voxel border
+struct macrocell_grid
+{
+    int cell_size = 0;
+    glm::ivec3 size{0};
+    std::vector<std::uint8_t> max_density;
+
+    std::uint8_t at(int x, int y, int z) const
+    {
+        return max_density[(std::size_t(z) * size.y + y) * size.x + x];
+    }
+};
+
+macrocell_grid build_macrocells(density_volume const & volume, int cell_size);
+
+// Optical depth towards a directional light: for every voxel center, the integral of density from it
+// along light_direction to the volume boundary, in world units (the volume spans bbox_size).
+// Slices across the light's dominant axis are swept starting from the light, and each voxel continues
+// the depth of the point one slice closer to the light, so it costs O(voxels) instead of a march per voxel
+void compute_light_depth(density_volume const & volume, glm::vec3 bbox_size, glm::vec3 light_direction,
+    std::vector<float> & depth);
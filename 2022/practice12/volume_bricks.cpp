@@ -0,0 +1,184 @@
+#include "volume_bricks.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+
+    char const brick_magic[4] = {'B', 'R', 'K', '1'};
+
+    // Macrocells and the coarse volume use the same cells as the 4^3 macrocells of the dense path
+    int const coarse_factor = 4;
+
+    template <typename T>
+    void write_array(std::ofstream & output, std::vector<T> const & values)
+    {
+        output.write(reinterpret_cast<char const *>(values.data()), values.size() * sizeof(T));
+    }
+
+    template <typename T>
+    void read_array(std::ifstream & input, std::vector<T> & values)
+    {
+        input.read(reinterpret_cast<char *>(values.data()), values.size() * sizeof(T));
+        if (input.gcount() != std::streamsize(values.size() * sizeof(T)))
+            throw std::runtime_error("Brick file is truncated");
+    }
+
+    std::size_t volume_count(glm::ivec3 size)
+    {
+        return std::size_t(size.x) * size.y * size.z;
+    }
+
+}
+
+void convert_to_bricks(std::filesystem::path const & input_path, glm::ivec3 size, std::filesystem::path const & output_path,
+    int brick_size)
+{
+    if (brick_size <= 0 || brick_size % coarse_factor != 0)
+        throw std::runtime_error("Brick size must be a multiple of " + std::to_string(coarse_factor));
+
+    std::ifstream input(input_path, std::ios::binary);
+    if (!input)
+        throw std::runtime_error("Can't open " + input_path.string());
+
+    glm::ivec3 const grid_size = (size + brick_size - 1) / brick_size;
+    glm::ivec3 const coarse_size = (size + coarse_factor - 1) / coarse_factor;
+
+    std::vector<std::uint32_t> index(volume_count(grid_size), 0);
+    macrocell_grid macrocells{coarse_factor, coarse_size, std::vector<std::uint8_t>(volume_count(coarse_size))};
+    density_volume coarse{coarse_size, std::vector<std::uint8_t>(volume_count(coarse_size))};
+
+    std::ofstream output(output_path, std::ios::binary);
+    if (!output)
+        throw std::runtime_error("Can't create " + output_path.string());
+
+    // Everything before the brick data is known only at the end, its place is kept with zeros
+    std::size_t const data_offset = sizeof(brick_header) + index.size() * sizeof(std::uint32_t) +
+        macrocells.max_density.size() + coarse.density.size();
+    output.write(std::vector<char>(data_offset).data(), data_offset);
+
+    // Slices [layer * brick_size - 1, (layer + 1) * brick_size + 1), clamped to the volume
+    std::size_t const slice_bytes = std::size_t(size.x) * size.y;
+    std::vector<std::uint8_t> slab((brick_size + 2) * slice_bytes);
+    auto slab_voxel = [&](int x, int y, int slab_z)
+    {
+        x = std::clamp(x, 0, size.x - 1);
+        y = std::clamp(y, 0, size.y - 1);
+        return slab[slab_z * slice_bytes + std::size_t(y) * size.x + x];
+    };
+
+    int const stored = brick_size + 2;
+    std::vector<std::uint8_t> brick(std::size_t(stored) * stored * stored);
+    std::uint32_t brick_count = 0;
+
+    for (int bz = 0; bz < grid_size.z; ++bz)
+    {
+        int const z_first = bz * brick_size - 1;
+        for (int s = 0; s < brick_size + 2; ++s)
+        {
+            int const z = std::clamp(z_first + s, 0, size.z - 1);
+            input.seekg(std::streamoff(z) * slice_bytes);
+            input.read(reinterpret_cast<char *>(slab.data() + s * slice_bytes), slice_bytes);
+            if (input.gcount() != std::streamsize(slice_bytes))
+                throw std::runtime_error("Volume " + input_path.string() + " is smaller than expected");
+        }
+
+        for (int by = 0; by < grid_size.y; ++by)
+            for (int bx = 0; bx < grid_size.x; ++bx)
+            {
+                std::uint8_t max_density = 0;
+                auto target = brick.begin();
+                for (int z = 0; z < stored; ++z)
+                    for (int y = 0; y < stored; ++y)
+                        for (int x = 0; x < stored; ++x)
+                        {
+                            *target = slab_voxel(bx * brick_size - 1 + x, by * brick_size - 1 + y, z);
+                            max_density = std::max(max_density, *target++);
+                        }
+
+                if (max_density == 0) continue;
+                index[(std::size_t(bz) * grid_size.y + by) * grid_size.x + bx] = ++brick_count;
+                write_array(output, brick);
+            }
+
+        // Macrocells of this layer: the cell with a one voxel border, as build_macrocells does
+        for (int cz = bz * brick_size / coarse_factor; cz < std::min((bz + 1) * brick_size / coarse_factor, coarse_size.z); ++cz)
+            for (int cy = 0; cy < coarse_size.y; ++cy)
+                for (int cx = 0; cx < coarse_size.x; ++cx)
+                {
+                    std::uint8_t max_density = 0;
+                    unsigned int sum = 0, count = 0;
+                    for (int z = std::max(cz * coarse_factor - 1, 0); z < std::min((cz + 1) * coarse_factor + 1, size.z); ++z)
+                        for (int y = std::max(cy * coarse_factor - 1, 0); y < std::min((cy + 1) * coarse_factor + 1, size.y); ++y)
+                            for (int x = std::max(cx * coarse_factor - 1, 0); x < std::min((cx + 1) * coarse_factor + 1, size.x); ++x)
+                            {
+                                std::uint8_t const density = slab_voxel(x, y, z - z_first);
+                                max_density = std::max(max_density, density);
+
+                                bool const inside = z >= cz * coarse_factor && z < (cz + 1) * coarse_factor &&
+                                    y >= cy * coarse_factor && y < (cy + 1) * coarse_factor &&
+                                    x >= cx * coarse_factor && x < (cx + 1) * coarse_factor;
+                                sum += inside ? density : 0;
+                                count += inside;
+                            }
+
+                    std::size_t const cell = (std::size_t(cz) * coarse_size.y + cy) * coarse_size.x + cx;
+                    macrocells.max_density[cell] = max_density;
+                    coarse.density[cell] = std::uint8_t((sum + count / 2) / count);
+                }
+    }
+
+    brick_header header;
+    std::memcpy(header.magic, brick_magic, sizeof(brick_magic));
+    for (int i = 0; i < 3; ++i)
+        header.size[i] = size[i];
+    header.brick_size = brick_size;
+    header.coarse_factor = coarse_factor;
+    header.brick_count = brick_count;
+
+    output.seekp(0);
+    output.write(reinterpret_cast<char const *>(&header), sizeof(header));
+    write_array(output, index);
+    write_array(output, macrocells.max_density);
+    write_array(output, coarse.density);
+    if (!output)
+        throw std::runtime_error("Failed to write " + output_path.string());
+}
+
+brick_file::brick_file(std::filesystem::path const & path)
+    : input(path, std::ios::binary)
+{
+    if (!input)
+        throw std::runtime_error("Can't open " + path.string());
+
+    brick_header header;
+    input.read(reinterpret_cast<char *>(&header), sizeof(header));
+    if (input.gcount() != sizeof(header) || std::memcmp(header.magic, brick_magic, sizeof(brick_magic)) != 0)
+        throw std::runtime_error(path.string() + " is not a brick file");
+
+    size = glm::ivec3(int(header.size[0]), int(header.size[1]), int(header.size[2]));
+    brick_size = int(header.brick_size);
+    coarse_factor = int(header.coarse_factor);
+    grid_size = (size + brick_size - 1) / brick_size;
+    brick_count = int(header.brick_count);
+
+    glm::ivec3 const coarse_size = (size + coarse_factor - 1) / coarse_factor;
+    index.resize(volume_count(grid_size));
+    macrocells = {coarse_factor, coarse_size, std::vector<std::uint8_t>(volume_count(coarse_size))};
+    coarse = {coarse_size, std::vector<std::uint8_t>(volume_count(coarse_size))};
+
+    read_array(input, index);
+    read_array(input, macrocells.max_density);
+    read_array(input, coarse.density);
+    data_offset = input.tellg();
+}
+
+void brick_file::read_brick(int stored_index, std::uint8_t * target)
+{
+    input.seekg(data_offset + std::streamoff(stored_index) * brick_bytes());
+    input.read(reinterpret_cast<char *>(target), brick_bytes());
+    if (input.gcount() != std::streamsize(brick_bytes()))
+        throw std::runtime_error("Brick file is truncated");
+}
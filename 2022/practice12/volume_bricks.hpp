@@ -0,0 +1,70 @@
+#pragma once
+
+#include "volume.hpp"
+
+#include <cstdint>
+#include <fstream>
+#include <vector>
+#include <filesystem>
+
+#include <glm/vec3.hpp>
+
+// Sparse bricked volume: the volume is cut into brick_size^3 bricks and only the bricks that can return
+// a non-zero density are stored, each with a one voxel border copied from its neighbours (clamped at the
+// volume boundary), so that any brick placed alone in a texture filters linearly the same as the whole volume.
+//
+// File layout, little endian:
+//   header
+//   brick index: one u32 per brick of the grid, x fastest, 0 for empty bricks, otherwise 1 + the brick's
+//     position in the brick data
+//   macrocells: the build_macrocells(volume, coarse_factor) grid
+//   coarse volume: the average of every coarse_factor^3 voxels, for lighting
+//   brick data: (brick_size + 2)^3 bytes per stored brick
+//
+// Everything but the brick data is a small fraction of the volume and is read at once, bricks are read on demand.
+struct brick_header
+{
+    char magic[4];
+    std::uint32_t size[3];
+    std::uint32_t brick_size;
+    std::uint32_t coarse_factor;
+    std::uint32_t brick_count;
+};
+
+// Converts a raw .data volume (as read by load_volume) without loading it whole:
+// only brick_size + 2 slices of it are in memory at a time. brick_size must be a multiple of 4
+void convert_to_bricks(std::filesystem::path const & input, glm::ivec3 size, std::filesystem::path const & output,
+    int brick_size = 32);
+
+struct brick_file
+{
+    explicit brick_file(std::filesystem::path const & path);
+
+    glm::ivec3 size;
+    int brick_size;
+    int coarse_factor;
+    glm::ivec3 grid_size;
+    int brick_count;
+
+    std::vector<std::uint32_t> index;
+    macrocell_grid macrocells;
+    density_volume coarse;
+
+    // Position in the brick data, -1 for empty bricks
+    int stored_index(glm::ivec3 brick) const
+    {
+        return int(index[(std::size_t(brick.z) * grid_size.y + brick.y) * grid_size.x + brick.x]) - 1;
+    }
+
+    // Voxels per stored brick, border included
+    std::size_t brick_bytes() const
+    {
+        return std::size_t(brick_size + 2) * (brick_size + 2) * (brick_size + 2);
+    }
+
+    void read_brick(int stored_index, std::uint8_t * target);
+
+private:
+    std::ifstream input;
+    std::streamoff data_offset;
+};
@@ -0,0 +1,33 @@
+// Converts a raw .data volume into the sparse bricked format of volume_bricks.hpp
+//
+// usage: volume_convert input.data width height depth output.bricks [brick_size]
+
+#include "volume_bricks.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+int main(int argc, char **argv) try {
+  if (argc != 6 && argc != 7) {
+    std::cerr << "usage: " << argv[0] << " input.data width height depth output.bricks [brick_size]" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  const glm::ivec3 size{std::stoi(argv[2]), std::stoi(argv[3]), std::stoi(argv[4])};
+  const int brick_size = argc == 7 ? std::stoi(argv[6]) : 32;
+
+  auto start = std::chrono::high_resolution_clock::now();
+  convert_to_bricks(argv[1], size, argv[5], brick_size);
+  auto finish = std::chrono::high_resolution_clock::now();
+
+  brick_file bricks(argv[5]);
+  const auto total = bricks.grid_size.x * bricks.grid_size.y * bricks.grid_size.z;
+  std::cout << bricks.brick_count << " of " << total << " bricks stored, "
+            << std::filesystem::file_size(argv[5]) << " bytes, "
+            << std::chrono::duration<double, std::milli>(finish - start).count() << " ms" << std::endl;
+}
+catch (std::exception const &e) {
+  std::cerr << e.what() << std::endl;
+  return EXIT_FAILURE;
+}
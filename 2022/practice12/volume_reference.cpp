@@ -0,0 +1,431 @@
+// Headless CPU reference for the practice12 cloud: the same absorption / scattering model as
+// the fragment shader in main.cpp, with trilinear sampling that matches GL_LINEAR.
+// Renders the scene twice - brute force (the full march towards the light at every sample, as
+// the shader originally did) and accelerated (macrocell skipping, saturation and the precomputed
+// light depth, as the shader does now) - writes both images and prints the timings and the difference.
+// Fails if the accelerated image is further from the brute force one than the tolerance: the approximations
+// (saturation, interpolated light depth) leave isolated pixels off by a few dozen levels at silhouettes,
+// so the bound on the maximum is loose and PSNR is what catches a broken accelerated path.
+//
+// usage: volume_reference [--data cloud|bunny] [--size W H] [--steps N] [--light-steps N] [--time T]
+//                         [--max-difference N] [--min-psnr DB]
+
+#include "volume.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/ext/matrix_transform.hpp>
+#include <glm/ext/matrix_clip_space.hpp>
+#include <glm/ext/scalar_constants.hpp>
+
+namespace {
+
+// Same as in the fragment shader
+const float absorption = 3.f;
+const glm::vec3 scattering{7.f, 1.f, 4.f};
+const glm::vec3 light_color{16.f};
+const float saturated_optical_depth = 8.f;
+const int macrocell_size = 4;
+
+struct settings {
+  std::string data = "cloud";
+  int width = 800;
+  int height = 600;
+  int steps = 64;
+  int light_steps = 8;
+  float time = 0.f;
+  // Tolerance of the accelerated image
+  int max_difference = 64;
+  double min_psnr = 40.0;
+};
+
+struct scene {
+  density_volume volume;
+  macrocell_grid macrocells;
+  std::vector<float> light_depth;
+  glm::vec3 bbox_min, bbox_max;
+  glm::vec3 light_direction;
+  glm::vec3 camera_position;
+  glm::mat4 inverse_view_projection;
+};
+
+// Four rays side by side; the fixed-size loops below compile to one SSE instruction each
+constexpr int W = 4;
+
+struct lanes {
+  float v[W];
+
+  lanes() = default;
+  lanes(float x) { for (float &f: v) f = x; }
+
+  float &operator[](int i) { return v[i]; }
+  float operator[](int i) const { return v[i]; }
+};
+
+#define LANES_OPERATOR(op) \
+  inline lanes operator op(lanes a, lanes b) { lanes r; for (int i = 0; i < W; ++i) r[i] = a[i] op b[i]; return r; }
+LANES_OPERATOR(+)
+LANES_OPERATOR(-)
+LANES_OPERATOR(*)
+LANES_OPERATOR(/)
+#undef LANES_OPERATOR
+
+inline lanes min(lanes a, lanes b) { lanes r; for (int i = 0; i < W; ++i) r[i] = a[i] < b[i] ? a[i] : b[i]; return r; }
+inline lanes max(lanes a, lanes b) { lanes r; for (int i = 0; i < W; ++i) r[i] = a[i] > b[i] ? a[i] : b[i]; return r; }
+
+// exp(x) for x <= 0 to about 2 ulp: x = n ln2 + r, exp(r) by a polynomial, 2^n through the exponent bits
+inline lanes exp_negative(lanes x) {
+  lanes r;
+  for (int i = 0; i < W; ++i) {
+    float a = std::max(x[i], -87.f);
+    int n = (int) (a * 1.44269504f - 0.5f);
+    float f = a - n * 0.693359375f + n * 2.12194440e-4f;
+    float p = 1.9875691500e-4f;
+    p = p * f + 1.3981999507e-3f;
+    p = p * f + 8.3334519073e-3f;
+    p = p * f + 4.1665795894e-2f;
+    p = p * f + 1.6666665459e-1f;
+    p = p * f + 5.0000001201e-1f;
+    p = p * f * f + f + 1.f;
+    std::int32_t bits = (n + 127) << 23;
+    float scale;
+    std::memcpy(&scale, &bits, sizeof(scale));
+    r[i] = p * scale;
+  }
+  return r;
+}
+
+struct lanes3 {
+  lanes x, y, z;
+
+  lanes3() = default;
+  lanes3(lanes x, lanes y, lanes z) : x(x), y(y), z(z) {}
+  lanes3(glm::vec3 v) : x(v.x), y(v.y), z(v.z) {}
+
+  glm::vec3 get(int i) const { return {x[i], y[i], z[i]}; }
+  void set(int i, glm::vec3 v) { x[i] = v.x; y[i] = v.y; z[i] = v.z; }
+};
+
+inline lanes3 operator+(lanes3 a, lanes3 b) { return {a.x + b.x, a.y + b.y, a.z + b.z}; }
+inline lanes3 operator*(lanes3 a, lanes3 b) { return {a.x * b.x, a.y * b.y, a.z * b.z}; }
+inline lanes3 operator*(lanes3 a, lanes b) { return {a.x * b, a.y * b, a.z * b}; }
+inline lanes3 exp_negative(lanes3 a) { return {exp_negative(a.x), exp_negative(a.y), exp_negative(a.z)}; }
+
+// GL_LINEAR with GL_CLAMP_TO_EDGE at texture coordinates p in [0, 1]^3, per lane
+template<typename T>
+lanes sample(const T *data, glm::ivec3 size, float scale, const lanes3 &p, const bool *active) {
+  lanes result(0.f);
+  for (int i = 0; i < W; ++i) {
+    if (!active[i]) continue;
+    glm::vec3 x = p.get(i) * glm::vec3(size) - 0.5f;
+    glm::vec3 base = glm::floor(x);
+    glm::vec3 f = x - base;
+    glm::ivec3 c0 = glm::clamp(glm::ivec3(base), glm::ivec3(0), size - 1);
+    glm::ivec3 c1 = glm::clamp(glm::ivec3(base) + 1, glm::ivec3(0), size - 1);
+    auto at = [&](int x, int y, int z) { return (float) data[(std::size_t(z) * size.y + y) * size.x + x]; };
+    float x00 = at(c0.x, c0.y, c0.z) + f.x * (at(c1.x, c0.y, c0.z) - at(c0.x, c0.y, c0.z));
+    float x10 = at(c0.x, c1.y, c0.z) + f.x * (at(c1.x, c1.y, c0.z) - at(c0.x, c1.y, c0.z));
+    float x01 = at(c0.x, c0.y, c1.z) + f.x * (at(c1.x, c0.y, c1.z) - at(c0.x, c0.y, c1.z));
+    float x11 = at(c0.x, c1.y, c1.z) + f.x * (at(c1.x, c1.y, c1.z) - at(c0.x, c1.y, c1.z));
+    float y0 = x00 + f.y * (x10 - x00);
+    float y1 = x01 + f.y * (x11 - x01);
+    result[i] = (y0 + f.z * (y1 - y0)) * scale;
+  }
+  return result;
+}
+
+// intersect_bbox from the shader, (tmin, tmax)
+std::pair<float, float> intersect_bbox(const scene &s, glm::vec3 origin, glm::vec3 direction) {
+  glm::vec3 t0 = (s.bbox_min - origin) / direction;
+  glm::vec3 t1 = (s.bbox_max - origin) / direction;
+  glm::vec3 tmin = glm::min(t0, t1), tmax = glm::max(t0, t1);
+  return {std::max(tmin.x, std::max(tmin.y, tmin.z)), std::min(tmax.x, std::min(tmax.y, tmax.z))};
+}
+
+struct packet {
+  lanes3 origin, direction;
+  lanes tmin, tmax;
+  bool hit[W];
+};
+
+lanes3 texture_position(const scene &s, const lanes3 &p) {
+  glm::vec3 inverse_size = 1.f / (s.bbox_max - s.bbox_min);
+  return {(p.x - s.bbox_min.x) * inverse_size.x, (p.y - s.bbox_min.y) * inverse_size.y,
+          (p.z - s.bbox_min.z) * inverse_size.z};
+}
+
+// The shader before the acceleration structures: every view sample marches light_steps towards the light
+lanes3 march_brute_force(const scene &s, const settings &config, const packet &r, long long &samples) {
+  const lanes3 extinction = scattering + glm::vec3(absorption);
+  lanes dt = (r.tmax - r.tmin) / (float) config.steps;
+  lanes3 optical_depth(glm::vec3(0.f)), color(glm::vec3(0.f));
+
+  for (int i = 0; i < config.steps; ++i) {
+    lanes t = r.tmin + dt * (i + 0.5f);
+    lanes3 p = r.origin + r.direction * t;
+    lanes density = sample(s.volume.density.data(), s.volume.size, 1.f / 255.f, texture_position(s, p), r.hit);
+    optical_depth = optical_depth + extinction * (density * dt);
+
+    lanes light_density(0.f), light_dt;
+    lanes tmin_light, tmax_light;
+    for (int k = 0; k < W; ++k) {
+      auto [t0, t1] = intersect_bbox(s, p.get(k), s.light_direction);
+      tmin_light[k] = std::max(t0, 0.f);
+      tmax_light[k] = t1;
+    }
+    light_dt = (tmax_light - tmin_light) / (float) config.light_steps;
+    for (int j = 0; j < config.light_steps; ++j) {
+      lanes l = tmin_light + light_dt * (j + 0.5f);
+      lanes3 light_p = p + lanes3(s.light_direction) * l;
+      light_density = light_density +
+                      sample(s.volume.density.data(), s.volume.size, 1.f / 255.f, texture_position(s, light_p), r.hit) *
+                      light_dt;
+    }
+    lanes3 light_optical_depth = extinction * light_density;
+
+    color = color + exp_negative(light_optical_depth * -1.f) * exp_negative(optical_depth * -1.f) *
+                    lanes3(light_color * scattering / 4.f / glm::pi<float>()) * (dt * density);
+    samples += (config.light_steps + 1) * std::count(r.hit, r.hit + W, true);
+  }
+
+  lanes3 opacity = lanes3(glm::vec3(1.f)) + exp_negative(optical_depth * -1.f) * lanes(-1.f);
+  return color * opacity;
+}
+
+// The shader as it is: macrocell skipping, early exit on saturation, one fetch of the light depth
+lanes3 march_accelerated(const scene &s, const settings &config, const packet &r, long long &samples) {
+  const lanes3 extinction = scattering + glm::vec3(absorption);
+  const glm::vec3 grid_size(s.macrocells.size);
+  lanes dt = (r.tmax - r.tmin) / (float) config.steps;
+  lanes3 optical_depth(glm::vec3(0.f)), color(glm::vec3(0.f));
+
+  // Rays step on their own: each lane has its own sample index
+  int index[W];
+  bool active[W];
+  glm::vec3 grid_direction[W], grid_step[W], grid_inverse_direction[W];
+  for (int k = 0; k < W; ++k) {
+    index[k] = 0;
+    active[k] = r.hit[k];
+    grid_direction[k] = r.direction.get(k) / (s.bbox_max - s.bbox_min) * grid_size;
+    grid_step[k] = glm::step(glm::vec3(0.f), grid_direction[k]);
+    grid_inverse_direction[k] = 1.f / glm::max(glm::abs(grid_direction[k]), glm::vec3(1e-6f)) *
+                                glm::sign(grid_direction[k] + 1e-12f);
+  }
+
+  while (std::any_of(active, active + W, [](bool a) { return a; })) {
+    lanes t;
+    for (int k = 0; k < W; ++k)
+      t[k] = r.tmin[k] + (index[k] + 0.5f) * dt[k];
+    lanes3 p = r.origin + r.direction * t;
+    lanes3 texture_p = texture_position(s, p);
+
+    bool occupied[W];
+    for (int k = 0; k < W; ++k) {
+      occupied[k] = active[k];
+      if (!active[k]) continue;
+      glm::vec3 grid_p = texture_p.get(k) * grid_size;
+      glm::vec3 cell = glm::clamp(glm::floor(grid_p), glm::vec3(0.f), grid_size - 1.f);
+      if (s.macrocells.at((int) cell.x, (int) cell.y, (int) cell.z) != 0) continue;
+
+      occupied[k] = false;
+      glm::vec3 exit = (cell + grid_step[k] - grid_p) * grid_inverse_direction[k];
+      float t_exit = t[k] + std::min(exit.x, std::min(exit.y, exit.z));
+      index[k] = std::max(index[k], (int) std::ceil((t_exit - r.tmin[k]) / dt[k] - 0.5f) - 1);
+    }
+
+    lanes density = sample(s.volume.density.data(), s.volume.size, 1.f / 255.f, texture_p, occupied);
+    lanes light_depth = sample(s.light_depth.data(), s.volume.size, 1.f, texture_p, occupied);
+    optical_depth = optical_depth + extinction * (density * dt);
+    color = color + exp_negative(extinction * (light_depth * -1.f)) * exp_negative(optical_depth * -1.f) *
+                    lanes3(light_color * scattering / 4.f / glm::pi<float>()) * (dt * density);
+
+    for (int k = 0; k < W; ++k) {
+      samples += occupied[k];
+      if (!active[k]) continue;
+      float smallest = std::min(optical_depth.x[k], std::min(optical_depth.y[k], optical_depth.z[k]));
+      if (occupied[k] && smallest > saturated_optical_depth)
+        active[k] = false;
+      if (++index[k] >= config.steps)
+        active[k] = false;
+    }
+  }
+
+  lanes3 opacity = lanes3(glm::vec3(1.f)) + exp_negative(optical_depth * -1.f) * lanes(-1.f);
+  return color * opacity;
+}
+
+struct image {
+  int width, height;
+  std::vector<std::uint8_t> pixels;
+  double milliseconds;
+  long long density_samples;
+};
+
+// Tiles of 16x16 pixels go to threads through a shared counter; inside a tile, rows of W pixels are packets
+template<typename March>
+image render(const scene &s, const settings &config, March march) {
+  image result{config.width, config.height, std::vector<std::uint8_t>(3 * config.width * config.height), 0.0, 0};
+
+  const int tile = 16;
+  const int tiles_x = (config.width + tile - 1) / tile, tiles_y = (config.height + tile - 1) / tile;
+  std::atomic<int> next_tile{0};
+  std::atomic<long long> total_samples{0};
+
+  auto worker = [&] {
+    long long samples = 0;
+    for (int tile_index; (tile_index = next_tile++) < tiles_x * tiles_y;) {
+      int x0 = tile_index % tiles_x * tile, y0 = tile_index / tiles_x * tile;
+      for (int y = y0; y < std::min(y0 + tile, config.height); ++y)
+        for (int x = x0; x < std::min(x0 + tile, config.width); x += W) {
+          packet r;
+          for (int k = 0; k < W; ++k) {
+            // Pixel centers, y up as in OpenGL
+            glm::vec2 ndc{2.f * (std::min(x + k, config.width - 1) + 0.5f) / config.width - 1.f,
+                          2.f * (config.height - 1 - y + 0.5f) / config.height - 1.f};
+            glm::vec4 far = s.inverse_view_projection * glm::vec4(ndc, 1.f, 1.f);
+            glm::vec3 direction = glm::normalize(glm::vec3(far) / far.w - s.camera_position);
+            auto [tmin, tmax] = intersect_bbox(s, s.camera_position, direction);
+            r.origin.set(k, s.camera_position);
+            r.direction.set(k, direction);
+            r.tmin[k] = std::max(tmin, 0.f);
+            r.tmax[k] = tmax;
+            // The shader runs on the back faces of the box
+            r.hit[k] = tmax > std::max(tmin, 0.f);
+          }
+
+          lanes3 color = march(s, config, r, samples);
+          for (int k = 0; k < W && x + k < config.width; ++k) {
+            glm::vec3 c = r.hit[k] ? glm::clamp(color.get(k), 0.f, 1.f) : glm::vec3(0.f);
+            std::uint8_t *pixel = &result.pixels[3 * (y * config.width + x + k)];
+            for (int channel = 0; channel < 3; ++channel)
+              pixel[channel] = (std::uint8_t) std::lround(c[channel] * 255.f);
+          }
+        }
+    }
+    total_samples += samples;
+  };
+
+  auto start = std::chrono::high_resolution_clock::now();
+  std::vector<std::thread> threads;
+  for (int i = 1; i < (int) std::max(1u, std::thread::hardware_concurrency()); ++i)
+    threads.emplace_back(worker);
+  worker();
+  for (auto &thread: threads)
+    thread.join();
+  auto finish = std::chrono::high_resolution_clock::now();
+
+  result.milliseconds = std::chrono::duration<double, std::milli>(finish - start).count();
+  result.density_samples = total_samples;
+  return result;
+}
+
+void write_ppm(const std::string &path, const image &image) {
+  std::ofstream output(path, std::ios::binary);
+  output << "P6\n" << image.width << " " << image.height << "\n255\n";
+  output.write(reinterpret_cast<const char *>(image.pixels.data()), image.pixels.size());
+}
+
+void report(const std::string &name, const image &image) {
+  double rays = (double) image.width * image.height;
+  std::cout << name << ": " << image.milliseconds << " ms, " << rays / image.milliseconds / 1000.0
+            << " Mrays/s, " << image.density_samples / rays << " density samples per ray" << std::endl;
+}
+
+}
+
+int main(int argc, char **argv) try {
+  settings config;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    auto next = [&] {
+      if (i + 1 >= argc) throw std::runtime_error("Missing value for " + arg);
+      return std::string(argv[++i]);
+    };
+    if (arg == "--data") config.data = next();
+    else if (arg == "--size") {
+      config.width = std::stoi(next());
+      config.height = std::stoi(next());
+    } else if (arg == "--steps") config.steps = std::stoi(next());
+    else if (arg == "--light-steps") config.light_steps = std::stoi(next());
+    else if (arg == "--time") config.time = std::stof(next());
+    else if (arg == "--max-difference") config.max_difference = std::stoi(next());
+    else if (arg == "--min-psnr") config.min_psnr = std::stod(next());
+    else throw std::runtime_error("Unknown argument " + arg);
+  }
+
+  const std::string project_root = PROJECT_ROOT;
+  scene s;
+  if (config.data == "cloud") {
+    s.volume = load_volume(project_root + "/cloud.data", {128, 64, 64});
+    s.bbox_min = {-2.f, -1.f, -1.f};
+    s.bbox_max = {2.f, 1.f, 1.f};
+  } else if (config.data == "bunny") {
+    s.volume = load_volume(project_root + "/bunny.data", {64, 64, 64});
+    s.bbox_min = {-1.f, -1.f, -1.f};
+    s.bbox_max = {1.f, 1.f, 1.f};
+  } else
+    throw std::runtime_error("Unknown data " + config.data);
+
+  // The initial camera and light of main.cpp
+  float view_angle = glm::pi<float>() / 6.f;
+  float camera_distance = 3.5f;
+  float camera_rotation = glm::pi<float>() / 6.f;
+
+  glm::mat4 view(1.f);
+  view = glm::translate(view, {0.f, 0.f, -camera_distance});
+  view = glm::rotate(view, view_angle, {1.f, 0.f, 0.f});
+  view = glm::rotate(view, camera_rotation, {0.f, 1.f, 0.f});
+  glm::mat4 projection = glm::perspective(glm::pi<float>() / 2.f, (1.f * config.width) / config.height, 0.1f, 100.f);
+
+  s.camera_position = glm::vec3(glm::inverse(view) * glm::vec4(0.f, 0.f, 0.f, 1.f));
+  s.inverse_view_projection = glm::inverse(projection * view);
+  s.light_direction = glm::normalize(glm::vec3(std::cos(config.time), 1.f, std::sin(config.time)));
+
+  auto start = std::chrono::high_resolution_clock::now();
+  s.macrocells = build_macrocells(s.volume, macrocell_size);
+  compute_light_depth(s.volume, s.bbox_max - s.bbox_min, s.light_direction, s.light_depth);
+  auto finish = std::chrono::high_resolution_clock::now();
+  std::cout << config.data << " " << s.volume.size.x << "x" << s.volume.size.y << "x" << s.volume.size.z << ", "
+            << config.width << "x" << config.height << ", " << config.steps << " steps, " << config.light_steps
+            << " light steps; macrocells and light depth: "
+            << std::chrono::duration<double, std::milli>(finish - start).count() << " ms" << std::endl;
+
+  auto brute_force = render(s, config, march_brute_force);
+  auto accelerated = render(s, config, march_accelerated);
+  report("brute force", brute_force);
+  report("accelerated", accelerated);
+  write_ppm(config.data + "_brute_force.ppm", brute_force);
+  write_ppm(config.data + "_accelerated.ppm", accelerated);
+
+  int max_difference = 0;
+  double squared = 0.0;
+  for (std::size_t i = 0; i < brute_force.pixels.size(); ++i) {
+    int d = std::abs(brute_force.pixels[i] - accelerated.pixels[i]);
+    max_difference = std::max(max_difference, d);
+    squared += d * d;
+  }
+  double mse = squared / brute_force.pixels.size();
+  double psnr = mse == 0.0 ? INFINITY : 10.0 * std::log10(255.0 * 255.0 / mse);
+  std::cout << "difference: max " << max_difference << "/255, PSNR " << psnr << " dB" << std::endl;
+
+  if (max_difference > config.max_difference || psnr < config.min_psnr) {
+    std::cout << "FAILED: tolerance is max " << config.max_difference << "/255, PSNR " << config.min_psnr << " dB"
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+}
+catch (std::exception const &e) {
+  std::cerr << e.what() << std::endl;
+  return EXIT_FAILURE;
+}
@@ -0,0 +1,41 @@
+#include "animation_bake.hpp"
+
+#include <glm/ext/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+baked_animations bake_animations(gltf_model const &model, std::vector<std::string> const &names, float frame_rate) {
+  baked_animations result;
+  result.frame_rate = frame_rate;
+  result.bone_count = model.bones.size();
+
+  std::vector<glm::mat4> bones(model.bones.size());
+  for (auto const &name : names) {
+    auto const &animation = model.animations.at(name);
+    auto &clip = result.clips.emplace_back();
+    clip.name = name;
+    clip.first_frame = result.matrices.size() / result.bone_count;
+    clip.frame_count = std::max(1, (int) std::ceil(animation.max_time * frame_rate));
+    clip.duration = animation.max_time;
+
+    std::vector<gltf_model::bone_animation::cursor> cursors(model.bones.size());
+    for (int frame = 0; frame < clip.frame_count; ++frame) {
+      float time = frame / frame_rate;
+      for (int i = 0; i < (int) model.bones.size(); ++i) {
+        auto const &bone = animation.bones[i];
+        auto &cursor = cursors[i];
+        auto transform = glm::translate(glm::mat4(1.f), bone.translation(time, cursor.translation))
+            * glm::toMat4(bone.rotation(time, cursor.rotation))
+            * glm::scale(glm::mat4(1.f), bone.scale(time, cursor.scale));
+        if (model.bones[i].parent != -1)
+          transform = bones[model.bones[i].parent] * transform;
+        bones[i] = transform;
+      }
+      for (int i = 0; i < (int) model.bones.size(); ++i)
+        result.matrices.push_back(bones[i] * model.bones[i].inverse_bind_matrix);
+    }
+  }
+
+  return result;
+}
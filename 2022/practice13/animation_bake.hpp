@@ -0,0 +1,32 @@
+#pragma once
+
+#include "gltf_loader.hpp"
+
+#include <glm/mat4x3.hpp>
+
+#include <string>
+#include <vector>
+
+// All animations of a model sampled at a fixed frame rate into skinning matrices
+// (bone transform * inverse bind matrix), so that the vertex shader can look them up
+// by (clip, time) and no pose is computed on the CPU per instance.
+struct baked_animations {
+  struct clip {
+    std::string name;
+    int first_frame;
+    int frame_count;
+    float duration;
+  };
+
+  float frame_rate;
+  int bone_count;
+  std::vector<clip> clips;
+
+  // matrices[frame * bone_count + bone], frames of all clips one after another
+  std::vector<glm::mat4x3> matrices;
+};
+
+// Bakes the animations listed in `names`, in that order.
+// A clip of duration d gets ceil(d * frame_rate) frames in [0, d);
+// the last frame blends into the first one, since the clips loop
+baked_animations bake_animations(gltf_model const &model, std::vector<std::string> const &names, float frame_rate);
@@ -1,11 +1,16 @@
 #pragma once
 
 #include <filesystem>
+#include <memory>
 #include <vector>
 #include <string>
 #include <optional>
 #include <unordered_map>
 #include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
 
 #define GLM_FORCE_SWIZZLE
 #define GLM_ENABLE_EXPERIMENTAL
@@ -20,14 +25,54 @@ struct gltf_model
     {
         unsigned int offset;
         unsigned int size;
+        // Bytes between consecutive elements, 0 if they are tightly packed
+        unsigned int stride = 0;
     };
 
     struct accessor
     {
+        // The accessor's own byteOffset is already added to view.offset
         buffer_view view;
         unsigned int type;
         unsigned int size;
         unsigned int count;
+        bool normalized = false;
+
+        unsigned int component_size() const;
+        // Bytes between consecutive elements, also the right value for glVertexAttribPointer
+        unsigned int stride() const { return view.stride ? view.stride : size * component_size(); }
+    };
+
+    // The binary data of the model: a range of the memory-mapped .bin or .glb file,
+    // the mapping lives as long as any copy of the buffer
+    struct binary_buffer
+    {
+        std::shared_ptr<void const> owner;
+        char const * begin = nullptr;
+        std::size_t length = 0;
+
+        char const * data() const { return begin; }
+        std::size_t size() const { return length; }
+    };
+
+    // Elements of an accessor read in place from the buffer, one stride apart.
+    // std::span can't skip bytes between elements and the elements aren't necessarily aligned,
+    // so they are copied out one at a time
+    template <typename T>
+    struct strided_view
+    {
+        char const * begin = nullptr;
+        std::size_t stride = sizeof(T);
+        std::size_t count = 0;
+
+        std::size_t size() const { return count; }
+
+        T operator[](std::size_t i) const
+        {
+            T value;
+            std::memcpy(&value, begin + i * stride, sizeof(T));
+            return value;
+        }
     };
 
     struct material
@@ -51,7 +96,23 @@ struct gltf_model
         std::vector<float> timestamps;
         std::vector<T> values;
 
+        // Keys per second if the keys were resampled to a uniform rate, 0 otherwise
+        float key_rate = 0.f;
+
         T operator()(float time) const;
+
+        // Same, but starts the search from the key found by the previous call with this cursor:
+        // during playback time moves forward a little every frame, so this is O(1),
+        // and only seeks (e.g. the animation looping) fall back to the binary search
+        T operator()(float time, unsigned int & cursor) const;
+
+        // Replaces the keys with keys evenly spaced at no less than `rate` keys per second,
+        // so that finding the key is a single division
+        void resample(float rate);
+
+        // Index i of the first key not earlier than time (so time is in (timestamps[i - 1], timestamps[i]]),
+        // 0 if time is before the first key, timestamps.size() if it is after the last one
+        unsigned int find(float time, unsigned int & cursor) const;
     };
 
     struct bone_animation
@@ -59,6 +120,14 @@ struct gltf_model
         spline<glm::vec3> translation;
         spline<glm::quat> rotation;
         spline<glm::vec3> scale;
+
+        // Per-instance playback state, one per bone_animation
+        struct cursor
+        {
+            unsigned int translation = 0;
+            unsigned int rotation = 0;
+            unsigned int scale = 0;
+        };
     };
 
     struct animation
@@ -79,46 +148,130 @@ struct gltf_model
         accessor texcoord;
         accessor joints;
         accessor weights;
+
+        // World transform of the mesh's node, identity for skinned meshes (glTF ignores it for them);
+        // with KHR_mesh_quantization it usually dequantizes the positions
+        glm::mat4 transform = glm::mat4(1.f);
     };
 
-    std::vector<char> buffer;
+    binary_buffer buffer;
     std::vector<mesh> meshes;
     std::vector<bone> bones;
     std::unordered_map<std::string, animation> animations;
+
+    // The accessor's elements as T, which must have exactly their layout (e.g. glm::vec3 for a float VEC3)
+    template <typename T>
+    strided_view<T> view(accessor const & accessor) const;
+
+    // Element `index` of any accessor as floats: normalized integers are mapped to [0, 1] ([-1, 1] if signed),
+    // the components the accessor doesn't have are taken from `fallback`
+    glm::vec4 read(accessor const & accessor, std::size_t index, glm::vec4 fallback = glm::vec4(0.f, 0.f, 0.f, 1.f)) const;
 };
 
-gltf_model load_gltf(std::filesystem::path const & path);
+// Loads both .gltf with a single external .bin buffer and binary .glb;
+// the buffer is memory-mapped and accessed in place, the JSON is parsed in situ.
+// key_rate > 0 resamples all animations to at least that many keys per second
+gltf_model load_gltf(std::filesystem::path const & path, float key_rate = 0.f);
+
+template <typename T>
+gltf_model::strided_view<T> gltf_model::view(gltf_model::accessor const & accessor) const
+{
+    if (sizeof(T) != accessor.size * accessor.component_size())
+        throw std::runtime_error("Accessor element doesn't match the requested type");
+    if (accessor.count > 0 && accessor.view.offset + (accessor.count - 1) * std::size_t(accessor.stride()) + sizeof(T) > buffer.size())
+        throw std::runtime_error("Accessor is out of the buffer");
+    return {buffer.data() + accessor.view.offset, accessor.stride(), accessor.count};
+}
+
+template <typename T>
+unsigned int gltf_model::spline<T>::find(float time, unsigned int & cursor) const
+{
+    unsigned int count = timestamps.size();
+
+    if (key_rate > 0.f)
+    {
+        float x = (time - timestamps.front()) * key_rate;
+        if (!(x > 0.f))
+            return 0;
+        if (x >= count)
+            return count;
+        unsigned int k = x;
+        return k < x ? k + 1 : k;
+    }
+
+    // Walk forward a few keys from the previous position, that's all normal playback needs
+    const unsigned int max_steps = 4;
+    if (cursor > 0 && cursor <= count && timestamps[cursor - 1] < time)
+    {
+        for (unsigned int steps = 0; steps < max_steps; ++steps, ++cursor)
+            if (cursor == count || time <= timestamps[cursor])
+                return cursor;
+    }
+
+    cursor = std::lower_bound(timestamps.begin(), timestamps.end(), time) - timestamps.begin();
+    return cursor;
+}
+
+template <typename T>
+void gltf_model::spline<T>::resample(float rate)
+{
+    if (timestamps.size() < 2 || timestamps.back() <= timestamps.front())
+        return;
+
+    float start = timestamps.front();
+    float duration = timestamps.back() - start;
+    unsigned int count = std::ceil(duration * rate) + 1;
+
+    std::vector<float> uniform_timestamps(count);
+    std::vector<T> uniform_values(count);
+    unsigned int cursor = 0;
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        uniform_timestamps[i] = start + duration * i / (count - 1);
+        uniform_values[i] = (*this)(uniform_timestamps[i], cursor);
+    }
+    // The ends are exact, the first key is sampled outside of the spline otherwise
+    uniform_values.front() = values.front();
+    uniform_values.back() = values.back();
+
+    timestamps = std::move(uniform_timestamps);
+    values = std::move(uniform_values);
+    key_rate = (count - 1) / duration;
+}
+
+template <typename T>
+T gltf_model::spline<T>::operator()(float time) const
+{
+    unsigned int cursor = 0;
+    return (*this)(time, cursor);
+}
 
 template <>
-inline glm::vec3 gltf_model::spline<glm::vec3>::operator()(float time) const
+inline glm::vec3 gltf_model::spline<glm::vec3>::operator()(float time, unsigned int & cursor) const
 {
     assert(!values.empty());
 
-    auto it = std::lower_bound(timestamps.begin(), timestamps.end(), time);
-    if (it == timestamps.begin())
+    unsigned int i = find(time, cursor);
+    if (i == 0)
         return values.back();
-    if (it == timestamps.end())
+    if (i == timestamps.size())
         return values.back();
 
-    int i = it - timestamps.begin();
-
     float t = (time - timestamps[i - 1]) / (timestamps[i] - timestamps[i - 1]);
     return glm::lerp(values[i - 1], values[i], t);
 }
 
 template <>
-inline glm::quat gltf_model::spline<glm::quat>::operator()(float time) const
+inline glm::quat gltf_model::spline<glm::quat>::operator()(float time, unsigned int & cursor) const
 {
     assert(!values.empty());
 
-    auto it = std::lower_bound(timestamps.begin(), timestamps.end(), time);
-    if (it == timestamps.begin())
+    unsigned int i = find(time, cursor);
+    if (i == 0)
         return values.back();
-    if (it == timestamps.end())
+    if (i == timestamps.size())
         return values.back();
 
-    int i = it - timestamps.begin();
-
     float t = (time - timestamps[i - 1]) / (timestamps[i] - timestamps[i - 1]);
     return glm::slerp(values[i - 1], values[i], t);
 }
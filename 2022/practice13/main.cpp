@@ -28,6 +28,7 @@
 #include <glm/gtx/string_cast.hpp>
 
 #include "gltf_loader.hpp"
+#include "animation_bake.hpp"
 #include "stb_image.h"
 
 std::string to_string(std::string_view str) {
@@ -78,6 +79,75 @@ void main()
 }
 )";
 
+// Same skinning, but the matrices come from the baked animations and every instance
+// picks its own clip and time, so the whole herd is one instanced draw per mesh
+const char herd_vertex_shader_source[] =
+    R"(#version 330 core
+
+uniform mat4 view;
+uniform mat4 projection;
+
+uniform samplerBuffer baked_bones;
+uniform int bone_count;
+uniform float frame_rate;
+uniform float time;
+// first frame, frame count of every clip
+uniform ivec2 clips[8];
+uniform float clip_duration[8];
+
+layout (location = 0) in vec3 in_position;
+layout (location = 1) in vec3 in_normal;
+layout (location = 2) in vec2 in_texcoord;
+layout (location = 3) in ivec4 in_joints;
+layout (location = 4) in vec4 in_weights;
+
+layout (location = 5) in vec4 in_instance_transform; // xyz - position, w - rotation around y
+layout (location = 6) in int in_instance_clip;
+layout (location = 7) in float in_instance_time_offset;
+
+out vec3 normal;
+out vec2 texcoord;
+out vec4 weights;
+
+// A mat4x3 takes 3 texels, its columns packed one after another
+mat4x3 bone(int frame, int index) {
+  int texel = 3 * (frame * bone_count + index);
+  vec4 a = texelFetch(baked_bones, texel);
+  vec4 b = texelFetch(baked_bones, texel + 1);
+  vec4 c = texelFetch(baked_bones, texel + 2);
+  return mat4x3(a.xyz, vec3(a.w, b.xy), vec3(b.zw, c.x), c.yzw);
+}
+
+mat4x3 pose(int frame, ivec4 joints, vec4 w) {
+  return w.x * bone(frame, joints.x) +
+         w.y * bone(frame, joints.y) +
+         w.z * bone(frame, joints.z) +
+         w.w * bone(frame, joints.w);
+}
+
+void main()
+{
+    ivec2 clip = clips[in_instance_clip];
+    float frame = mod(time + in_instance_time_offset, clip_duration[in_instance_clip]) * frame_rate;
+    int frame0 = min(int(frame), clip.y - 1);
+    int frame1 = (frame0 + 1) % clip.y;
+
+    mat4x3 average = mix(pose(clip.x + frame0, in_joints, in_weights),
+                         pose(clip.x + frame1, in_joints, in_weights),
+                         fract(frame));
+
+    float s = sin(in_instance_transform.w);
+    float c = cos(in_instance_transform.w);
+    mat3 rotation = mat3(c, 0.0, -s, 0.0, 1.0, 0.0, s, 0.0, c);
+
+    vec3 position = rotation * (mat4(average) * vec4(in_position, 1.0)).xyz + in_instance_transform.xyz;
+    gl_Position = projection * view * vec4(position, 1.0);
+    normal = rotation * mat3(average) * in_normal;
+    texcoord = in_texcoord;
+    weights = in_weights;
+}
+)";
+
 const char fragment_shader_source[] =
     R"(#version 330 core
 
@@ -198,6 +268,16 @@ int main() try {
   GLuint light_direction_location = glGetUniformLocation(program, "light_direction");
   GLuint bones_location = glGetUniformLocation(program, "bones");
 
+  auto herd_vertex_shader = create_shader(GL_VERTEX_SHADER, herd_vertex_shader_source);
+  auto herd_program = create_program(herd_vertex_shader, fragment_shader);
+
+  GLuint herd_view_location = glGetUniformLocation(herd_program, "view");
+  GLuint herd_projection_location = glGetUniformLocation(herd_program, "projection");
+  GLuint herd_color_location = glGetUniformLocation(herd_program, "color");
+  GLuint herd_use_texture_location = glGetUniformLocation(herd_program, "use_texture");
+  GLuint herd_light_direction_location = glGetUniformLocation(herd_program, "light_direction");
+  GLuint herd_time_location = glGetUniformLocation(herd_program, "time");
+
   const std::string project_root = PROJECT_ROOT;
   const std::string model_path = project_root + "/wolf/Wolf-Blender-2.82a.gltf";
 
@@ -216,13 +296,14 @@ int main() try {
   auto setup_attribute = [](int index, gltf_model::accessor const &accessor, bool integer = false) {
     glEnableVertexAttribArray(index);
     if (integer)
-      glVertexAttribIPointer(index, accessor.size, accessor.type, 0, reinterpret_cast<void *>(accessor.view.offset));
+      glVertexAttribIPointer(index, accessor.size, accessor.type, accessor.stride(),
+                             reinterpret_cast<void *>(accessor.view.offset));
     else
       glVertexAttribPointer(index,
                             accessor.size,
                             accessor.type,
-                            GL_FALSE,
-                            0,
+                            accessor.normalized ? GL_TRUE : GL_FALSE,
+                            accessor.stride(),
                             reinterpret_cast<void *>(accessor.view.offset));
   };
 
@@ -244,6 +325,89 @@ int main() try {
     result.material = mesh.material;
   }
 
+  // The herd: a grid of wolves, each running or walking with its own phase
+  struct herd_instance {
+    glm::vec4 transform;
+    std::int32_t clip;
+    float time_offset;
+  };
+
+  const int herd_side = 64;
+  const float herd_spacing = 1.f;
+
+  // Only the looping gaits: the idle clip alone is 40 seconds long
+  auto const baked = bake_animations(input_model, {"01_Run", "02_walk", "03_creep"}, 30.f);
+
+  GLint max_texture_buffer_size;
+  glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texture_buffer_size);
+  if ((GLint) baked.matrices.size() * 3 > max_texture_buffer_size)
+    throw std::runtime_error("Baked animations don't fit into a texture buffer");
+  if (baked.clips.size() > 8)
+    throw std::runtime_error("The herd shader takes at most 8 clips");
+
+  std::vector<herd_instance> herd;
+  {
+    std::default_random_engine rng;
+    std::uniform_real_distribution<float> jitter(-0.25f, 0.25f);
+    std::uniform_real_distribution<float> angle(0.f, 2.f * glm::pi<float>());
+    std::uniform_real_distribution<float> phase(0.f, 10.f);
+    std::uniform_int_distribution<std::int32_t> clip(0, baked.clips.size() - 1);
+    for (int z = 0; z < herd_side; ++z)
+      for (int x = 0; x < herd_side; ++x) {
+        glm::vec3 position{(x - herd_side / 2) * herd_spacing + jitter(rng), 0.f,
+                           (z - herd_side / 2) * herd_spacing + jitter(rng)};
+        herd.push_back({glm::vec4(position, angle(rng)), clip(rng), phase(rng)});
+      }
+  }
+
+  GLuint herd_vbo;
+  glGenBuffers(1, &herd_vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, herd_vbo);
+  glBufferData(GL_ARRAY_BUFFER, herd.size() * sizeof(herd_instance), herd.data(), GL_STATIC_DRAW);
+
+  for (auto const &mesh : meshes) {
+    glBindVertexArray(mesh.vao);
+    glEnableVertexAttribArray(5);
+    glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(herd_instance),
+                          reinterpret_cast<void *>(offsetof(herd_instance, transform)));
+    glVertexAttribDivisor(5, 1);
+    glEnableVertexAttribArray(6);
+    glVertexAttribIPointer(6, 1, GL_INT, sizeof(herd_instance),
+                           reinterpret_cast<void *>(offsetof(herd_instance, clip)));
+    glVertexAttribDivisor(6, 1);
+    glEnableVertexAttribArray(7);
+    glVertexAttribPointer(7, 1, GL_FLOAT, GL_FALSE, sizeof(herd_instance),
+                          reinterpret_cast<void *>(offsetof(herd_instance, time_offset)));
+    glVertexAttribDivisor(7, 1);
+  }
+
+  GLuint baked_buffer;
+  glGenBuffers(1, &baked_buffer);
+  glBindBuffer(GL_TEXTURE_BUFFER, baked_buffer);
+  glBufferData(GL_TEXTURE_BUFFER, baked.matrices.size() * sizeof(glm::mat4x3), baked.matrices.data(), GL_STATIC_DRAW);
+
+  GLuint baked_texture;
+  glGenTextures(1, &baked_texture);
+  glBindTexture(GL_TEXTURE_BUFFER, baked_texture);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, baked_buffer);
+
+  {
+    std::vector<glm::ivec2> clips(8, glm::ivec2(0, 1));
+    std::vector<float> clip_duration(8, 1.f);
+    for (int i = 0; i < (int) baked.clips.size(); ++i) {
+      clips[i] = {baked.clips[i].first_frame, baked.clips[i].frame_count};
+      clip_duration[i] = baked.clips[i].duration;
+    }
+
+    glUseProgram(herd_program);
+    glUniform1i(glGetUniformLocation(herd_program, "albedo"), 0);
+    glUniform1i(glGetUniformLocation(herd_program, "baked_bones"), 1);
+    glUniform1i(glGetUniformLocation(herd_program, "bone_count"), baked.bone_count);
+    glUniform1f(glGetUniformLocation(herd_program, "frame_rate"), baked.frame_rate);
+    glUniform2iv(glGetUniformLocation(herd_program, "clips"), clips.size(), reinterpret_cast<const GLint *>(clips.data()));
+    glUniform1fv(glGetUniformLocation(herd_program, "clip_duration"), clip_duration.size(), clip_duration.data());
+  }
+
   std::map<std::string, GLuint> textures;
   for (auto const &mesh : meshes) {
     if (!mesh.material.texture_path) continue;
@@ -285,6 +449,7 @@ int main() try {
 
   bool paused = false;
   bool running = true;
+  bool draw_herd = false;
 
   // TASK 3
   const auto &run_animation = input_model.animations.find("01_Run")->second;
@@ -292,6 +457,10 @@ int main() try {
   // TASK 5
   const auto &walk_animation = input_model.animations.find("02_walk")->second;
 
+  // Where every track was sampled last frame, so the next lookup starts from there
+  std::vector<gltf_model::bone_animation::cursor> run_cursors(input_model.bones.size());
+  std::vector<gltf_model::bone_animation::cursor> walk_cursors(input_model.bones.size());
+
   while (running) {
     for (SDL_Event event; SDL_PollEvent(&event);)
       switch (event.type) {
@@ -308,6 +477,8 @@ int main() try {
         case SDL_KEYDOWN:button_down[event.key.keysym.sym] = true;
           if (event.key.keysym.sym == SDLK_SPACE)
             paused = !paused;
+          if (event.key.keysym.sym == SDLK_h)
+            draw_herd = !draw_herd;
           break;
         case SDL_KEYUP:button_down[event.key.keysym.sym] = false;
           break;
@@ -373,16 +544,18 @@ int main() try {
 
     // TASK 3
     for (int i = 0; i < input_model.bones.size(); ++i) {
+      auto &run = run_cursors[i];
+      auto &walk = walk_cursors[i];
       auto cur_translation = glm::translate(glm::mat4(1.f),
-                                            glm::lerp(run_animation.bones[i].translation(frame_run),
-                                                      walk_animation.bones[i].translation(frame_walk),
+                                            glm::lerp(run_animation.bones[i].translation(frame_run, run.translation),
+                                                      walk_animation.bones[i].translation(frame_walk, walk.translation),
                                                       inter));
       auto cur_scale = glm::scale(glm::mat4(1.f),
-                                  glm::lerp(run_animation.bones[i].scale(frame_run),
-                                            walk_animation.bones[i].scale(frame_walk),
+                                  glm::lerp(run_animation.bones[i].scale(frame_run, run.scale),
+                                            walk_animation.bones[i].scale(frame_walk, walk.scale),
                                             inter));
-      auto cur_rotation = glm::toMat4(glm::slerp(run_animation.bones[i].rotation(frame_run),
-                                                 walk_animation.bones[i].rotation(frame_walk),
+      auto cur_rotation = glm::toMat4(glm::slerp(run_animation.bones[i].rotation(frame_run, run.rotation),
+                                                 walk_animation.bones[i].rotation(frame_walk, walk.rotation),
                                                  inter));
       auto cur_transform = cur_translation * cur_rotation * cur_scale;
       if (input_model.bones[i].parent != -1) {
@@ -402,6 +575,17 @@ int main() try {
     glUniformMatrix4fv(projection_location, 1, GL_FALSE, reinterpret_cast<float *>(&projection));
     glUniform3fv(light_direction_location, 1, reinterpret_cast<float *>(&light_direction));
 
+    if (draw_herd) {
+      glUseProgram(herd_program);
+      glUniformMatrix4fv(herd_view_location, 1, GL_FALSE, reinterpret_cast<float *>(&view));
+      glUniformMatrix4fv(herd_projection_location, 1, GL_FALSE, reinterpret_cast<float *>(&projection));
+      glUniform3fv(herd_light_direction_location, 1, reinterpret_cast<float *>(&light_direction));
+      glUniform1f(herd_time_location, time);
+      glActiveTexture(GL_TEXTURE1);
+      glBindTexture(GL_TEXTURE_BUFFER, baked_texture);
+      glActiveTexture(GL_TEXTURE0);
+    }
+
     auto draw_meshes = [&](bool transparent) {
       for (auto const &mesh : meshes) {
         if (mesh.material.transparent != transparent)
@@ -419,18 +603,26 @@ int main() try {
 
         if (mesh.material.texture_path) {
           glBindTexture(GL_TEXTURE_2D, textures[*mesh.material.texture_path]);
-          glUniform1i(use_texture_location, 1);
+          glUniform1i(draw_herd ? herd_use_texture_location : use_texture_location, 1);
         } else if (mesh.material.color) {
-          glUniform1i(use_texture_location, 0);
-          glUniform4fv(color_location, 1, reinterpret_cast<const float *>(&(*mesh.material.color)));
+          glUniform1i(draw_herd ? herd_use_texture_location : use_texture_location, 0);
+          glUniform4fv(draw_herd ? herd_color_location : color_location, 1,
+                       reinterpret_cast<const float *>(&(*mesh.material.color)));
         } else
           continue;
 
         glBindVertexArray(mesh.vao);
-        glDrawElements(GL_TRIANGLES,
-                       mesh.indices.count,
-                       mesh.indices.type,
-                       reinterpret_cast<void *>(mesh.indices.view.offset));
+        if (draw_herd)
+          glDrawElementsInstanced(GL_TRIANGLES,
+                                  mesh.indices.count,
+                                  mesh.indices.type,
+                                  reinterpret_cast<void *>(mesh.indices.view.offset),
+                                  herd.size());
+        else
+          glDrawElements(GL_TRIANGLES,
+                         mesh.indices.count,
+                         mesh.indices.type,
+                         reinterpret_cast<void *>(mesh.indices.view.offset));
       }
     };
 
@@ -0,0 +1,606 @@
+#include "meshopt_decoder.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MESHOPT_SSE 1
+#endif
+
+namespace
+{
+
+void check(bool condition, char const * what)
+{
+    if (!condition)
+        throw std::runtime_error(std::string("Malformed meshopt data: ") + what);
+}
+
+// Vertex codec: the stream is split into blocks of vertices, every byte of the vertex is encoded separately
+// as deltas from the same byte of the previous vertex, packed in groups of 16 with 0, 2, 4 or 8 bits per delta
+constexpr std::size_t byte_group_size = 16;
+constexpr std::size_t byte_group_decode_limit = 24;
+constexpr std::size_t tail_max_size = 32;
+constexpr std::size_t vertex_block_max_size = 256;
+constexpr std::size_t vertex_max_stride = 256;
+
+std::size_t vertex_block_size(std::size_t stride)
+{
+    std::size_t result = (8192 / stride) & ~(byte_group_size - 1);
+    return result < vertex_block_max_size ? result : vertex_block_max_size;
+}
+
+// 16 values of `bits` bits, most significant first; the all-ones value means "the real one is in the next byte"
+template <int bits>
+unsigned char const * decode_packed_group(unsigned char const * data, unsigned char * group)
+{
+    constexpr int per_byte = 8 / bits;
+    constexpr unsigned int escape = (1u << bits) - 1;
+    unsigned char const * extra = data + byte_group_size / per_byte;
+
+#ifdef MESHOPT_SSE
+    // Every byte is spread over the lanes of its values and shifted into place, escapes are rare and patched one by one
+    __m128i values;
+    if constexpr (bits == 2)
+    {
+        std::uint32_t packed;
+        std::memcpy(&packed, data, 4);
+        __m128i x = _mm_cvtsi32_si128(int(packed));
+        x = _mm_unpacklo_epi8(x, x);
+        x = _mm_unpacklo_epi16(x, x);
+        values = _mm_or_si128(
+            _mm_or_si128(_mm_and_si128(_mm_srli_epi16(x, 6), _mm_set1_epi32(0x00000003)),
+                _mm_and_si128(_mm_srli_epi16(x, 4), _mm_set1_epi32(0x00000300))),
+            _mm_or_si128(_mm_and_si128(_mm_srli_epi16(x, 2), _mm_set1_epi32(0x00030000)),
+                _mm_and_si128(x, _mm_set1_epi32(0x03000000))));
+    }
+    else
+    {
+        __m128i x = _mm_loadl_epi64(reinterpret_cast<__m128i const *>(data));
+        x = _mm_unpacklo_epi8(x, x);
+        values = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(x, 4), _mm_set1_epi16(0x000f)),
+            _mm_and_si128(x, _mm_set1_epi16(0x0f00)));
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(group), values);
+
+    for (unsigned int escapes = _mm_movemask_epi8(_mm_cmpeq_epi8(values, _mm_set1_epi8(char(escape)))); escapes; escapes &= escapes - 1)
+        group[std::countr_zero(escapes)] = *extra++;
+#else
+    for (std::size_t i = 0; i < byte_group_size; ++i)
+    {
+        unsigned int value = (data[i / per_byte] >> (8 - bits - (i % per_byte) * bits)) & escape;
+        bool const escaped = value == escape;
+        group[i] = escaped ? *extra : value;
+        extra += escaped;
+    }
+#endif
+    return extra;
+}
+
+unsigned char const * decode_bytes(unsigned char const * data, unsigned char const * end, unsigned char * bytes, std::size_t count)
+{
+    // 2 bits of the header per group select its bit width
+    std::size_t const header_size = (count / byte_group_size + 3) / 4;
+    check(std::size_t(end - data) >= header_size, "vertex block header");
+    unsigned char const * header = data;
+    data += header_size;
+
+    for (std::size_t i = 0; i < count; i += byte_group_size)
+    {
+        // the encoder leaves a tail after the last block, so a whole group can be read without further checks
+        check(std::size_t(end - data) >= byte_group_decode_limit, "vertex block data");
+
+        std::size_t const group = i / byte_group_size;
+        switch ((header[group / 4] >> ((group % 4) * 2)) & 3)
+        {
+        case 0:
+            std::memset(bytes + i, 0, byte_group_size);
+            break;
+        case 1:
+            data = decode_packed_group<2>(data, bytes + i);
+            break;
+        case 2:
+            data = decode_packed_group<4>(data, bytes + i);
+            break;
+        default:
+            std::memcpy(bytes + i, data, byte_group_size);
+            data += byte_group_size;
+            break;
+        }
+    }
+    return data;
+}
+
+#ifdef MESHOPT_SSE
+
+// 16 bytes of the rows become 16 bytes of the columns
+void transpose_16x16(__m128i * rows)
+{
+    __m128i a[16], b[16];
+    for (int i = 0; i < 8; ++i)
+    {
+        a[2 * i] = _mm_unpacklo_epi8(rows[2 * i], rows[2 * i + 1]);
+        a[2 * i + 1] = _mm_unpackhi_epi8(rows[2 * i], rows[2 * i + 1]);
+    }
+    for (int j = 0; j < 4; ++j)
+    {
+        b[4 * j] = _mm_unpacklo_epi16(a[4 * j], a[4 * j + 2]);
+        b[4 * j + 1] = _mm_unpackhi_epi16(a[4 * j], a[4 * j + 2]);
+        b[4 * j + 2] = _mm_unpacklo_epi16(a[4 * j + 1], a[4 * j + 3]);
+        b[4 * j + 3] = _mm_unpackhi_epi16(a[4 * j + 1], a[4 * j + 3]);
+    }
+    for (int m = 0; m < 2; ++m)
+        for (int q = 0; q < 4; ++q)
+        {
+            a[8 * m + 2 * q] = _mm_unpacklo_epi32(b[8 * m + q], b[8 * m + 4 + q]);
+            a[8 * m + 2 * q + 1] = _mm_unpackhi_epi32(b[8 * m + q], b[8 * m + 4 + q]);
+        }
+    for (int s = 0; s < 8; ++s)
+    {
+        rows[2 * s] = _mm_unpacklo_epi64(a[s], a[8 + s]);
+        rows[2 * s + 1] = _mm_unpackhi_epi64(a[s], a[8 + s]);
+    }
+}
+
+__m128i unzigzag(__m128i v)
+{
+    __m128i const one = _mm_set1_epi8(1);
+    __m128i const low_bits = _mm_set1_epi8(0x7f);
+    __m128i sign = _mm_sub_epi8(_mm_setzero_si128(), _mm_and_si128(v, one));
+    return _mm_xor_si128(sign, _mm_and_si128(_mm_srli_epi16(v, 1), low_bits));
+}
+
+#endif
+
+// Decoded deltas of a block in `deltas`: byte k of all vertices in row k, rows are `row_size` apart
+void accumulate_vertex_block(unsigned char const * deltas, std::size_t row_size, std::size_t count, std::size_t stride,
+    unsigned char * last_vertex, unsigned char * target)
+{
+#ifdef MESHOPT_SSE
+    // 16 bytes of 16 vertices at a time: transposed, the deltas of one vertex are a register,
+    // and the prefix sum over vertices is one add per vertex for all 16 bytes.
+    // A store may spill past the vertex into the lower bytes of the next one, so the bytes go from the last 16 down,
+    // and only the stores that would spill past the block are shortened
+    std::size_t const block_end = count * stride;
+    for (std::size_t k = (stride - 1) & ~std::size_t(15); k < stride; k -= 16)
+    {
+        __m128i previous = _mm_loadu_si128(reinterpret_cast<__m128i const *>(last_vertex + k));
+        for (std::size_t v = 0; v < count; v += 16)
+        {
+            __m128i rows[16];
+            for (std::size_t r = 0; r < 16; ++r)
+                rows[r] = unzigzag(_mm_loadu_si128(reinterpret_cast<__m128i const *>(deltas + (k + r) * row_size + v)));
+            transpose_16x16(rows);
+
+            std::size_t const group_count = count - v < 16 ? count - v : 16;
+            for (std::size_t i = 0; i < group_count; ++i)
+            {
+                previous = _mm_add_epi8(previous, rows[i]);
+                std::size_t const offset = (v + i) * stride + k;
+                if (offset + 16 <= block_end)
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(target + offset), previous);
+                else
+                {
+                    alignas(16) unsigned char bytes[16];
+                    _mm_store_si128(reinterpret_cast<__m128i *>(bytes), previous);
+                    std::memcpy(target + offset, bytes, std::min<std::size_t>(16, stride - k));
+                }
+            }
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(last_vertex + k), previous);
+        if (k == 0)
+            break;
+    }
+#else
+    for (std::size_t k = 0; k < stride; ++k)
+    {
+        unsigned char previous = last_vertex[k];
+        for (std::size_t v = 0; v < count; ++v)
+        {
+            unsigned char const delta = deltas[k * row_size + v];
+            previous += (unsigned char)(-(delta & 1) ^ (delta >> 1));
+            target[v * stride + k] = previous;
+        }
+        last_vertex[k] = previous;
+    }
+#endif
+}
+
+unsigned int decode_vbyte(unsigned char const * & data)
+{
+    unsigned int result = 0;
+    for (int shift = 0; shift < 35; shift += 7)
+    {
+        unsigned char const byte = *data++;
+        result |= (byte & 0x7fu) << shift;
+        if (byte < 0x80)
+            break;
+    }
+    return result;
+}
+
+unsigned int unzigzag(unsigned int v)
+{
+    return (v >> 1) ^ -int(v & 1);
+}
+
+void write_index(void * target, std::size_t i, std::size_t stride, unsigned int index)
+{
+    if (stride == 2)
+        static_cast<std::uint16_t *>(target)[i] = std::uint16_t(index);
+    else
+        static_cast<std::uint32_t *>(target)[i] = index;
+}
+
+template <typename T>
+T round_to(float value)
+{
+    return T(int(value + (value >= 0.f ? 0.5f : -0.5f)));
+}
+
+#ifdef MESHOPT_SSE
+
+// 4 elements of 4 shorts as 4 vectors of their components
+void load_elements(std::int16_t const * data, __m128 * components)
+{
+    __m128i const a = _mm_loadu_si128(reinterpret_cast<__m128i const *>(data));
+    __m128i const b = _mm_loadu_si128(reinterpret_cast<__m128i const *>(data + 8));
+    components[0] = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(a, a), 16));
+    components[1] = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(a, a), 16));
+    components[2] = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(b, b), 16));
+    components[3] = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(b, b), 16));
+    _MM_TRANSPOSE4_PS(components[0], components[1], components[2], components[3]);
+}
+
+void store_elements(std::int16_t * data, __m128i const * components)
+{
+    __m128 c0 = _mm_castsi128_ps(components[0]), c1 = _mm_castsi128_ps(components[1]);
+    __m128 c2 = _mm_castsi128_ps(components[2]), c3 = _mm_castsi128_ps(components[3]);
+    _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(data), _mm_packs_epi32(_mm_castps_si128(c0), _mm_castps_si128(c1)));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(data + 8), _mm_packs_epi32(_mm_castps_si128(c2), _mm_castps_si128(c3)));
+}
+
+// Same rounding as round_to: half away from zero
+__m128i round_to_int(__m128 value)
+{
+    __m128 const half = _mm_or_ps(_mm_set1_ps(0.5f), _mm_and_ps(value, _mm_set1_ps(-0.f)));
+    return _mm_cvttps_epi32(_mm_add_ps(value, half));
+}
+
+#endif
+
+template <typename T>
+void decode_octahedral(T * data, std::size_t count)
+{
+    float const max = float((1 << (sizeof(T) * 8 - 1)) - 1);
+    std::size_t i = 0;
+
+#ifdef MESHOPT_SSE
+    if constexpr (sizeof(T) == 2)
+    {
+        __m128 const sign = _mm_set1_ps(-0.f);
+        for (; i + 4 <= count; i += 4, data += 16)
+        {
+            __m128 c[4];
+            load_elements(data, c);
+            __m128 x = c[0], y = c[1];
+            __m128 const z = _mm_sub_ps(_mm_sub_ps(c[2], _mm_andnot_ps(sign, x)), _mm_andnot_ps(sign, y));
+            __m128 const t = _mm_min_ps(z, _mm_setzero_ps());
+            x = _mm_add_ps(x, _mm_xor_ps(t, _mm_and_ps(x, sign)));
+            y = _mm_add_ps(y, _mm_xor_ps(t, _mm_and_ps(y, sign)));
+
+            __m128 const length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+            __m128 const s = _mm_div_ps(_mm_set1_ps(max), length);
+            __m128i const result[4] = {round_to_int(_mm_mul_ps(x, s)), round_to_int(_mm_mul_ps(y, s)),
+                round_to_int(_mm_mul_ps(z, s)), _mm_cvttps_epi32(c[3])};
+            store_elements(data, result);
+        }
+    }
+#endif
+
+    for (; i < count; ++i, data += 4)
+    {
+        // z holds the encoded 1.0, so its length is the scale
+        float x = data[0], y = data[1];
+        float const z = float(data[2]) - std::abs(x) - std::abs(y);
+
+        // the lower hemisphere is folded over the diagonals
+        float const t = z >= 0.f ? 0.f : z;
+        x += x >= 0.f ? t : -t;
+        y += y >= 0.f ? t : -t;
+
+        float const s = max / std::sqrt(x * x + y * y + z * z);
+        data[0] = round_to<T>(x * s);
+        data[1] = round_to<T>(y * s);
+        data[2] = round_to<T>(z * s);
+    }
+}
+
+void decode_quaternion(std::int16_t * data, std::size_t count)
+{
+    float const range = 0.70710678f;
+    std::size_t i = 0;
+
+#ifdef MESHOPT_SSE
+    for (; i + 4 <= count; i += 4, data += 16)
+    {
+        __m128 c[4];
+        load_elements(data, c);
+        __m128i const packed = _mm_cvttps_epi32(c[3]);
+        __m128 const s = _mm_div_ps(_mm_set1_ps(range), _mm_cvtepi32_ps(_mm_or_si128(packed, _mm_set1_epi32(3))));
+
+        __m128 const x = _mm_mul_ps(c[0], s), y = _mm_mul_ps(c[1], s), z = _mm_mul_ps(c[2], s);
+        __m128 const ww = _mm_sub_ps(_mm_sub_ps(_mm_sub_ps(_mm_set1_ps(1.f), _mm_mul_ps(x, x)), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+        __m128 const w = _mm_sqrt_ps(_mm_max_ps(ww, _mm_setzero_ps()));
+
+        // the components go to different places in every element
+        __m128 const one = _mm_set1_ps(32767.f);
+        alignas(16) std::int32_t result[4][4], largest[4];
+        _mm_store_si128(reinterpret_cast<__m128i *>(result[0]), round_to_int(_mm_mul_ps(x, one)));
+        _mm_store_si128(reinterpret_cast<__m128i *>(result[1]), round_to_int(_mm_mul_ps(y, one)));
+        _mm_store_si128(reinterpret_cast<__m128i *>(result[2]), round_to_int(_mm_mul_ps(z, one)));
+        _mm_store_si128(reinterpret_cast<__m128i *>(result[3]), round_to_int(_mm_mul_ps(w, one)));
+        _mm_store_si128(reinterpret_cast<__m128i *>(largest), _mm_and_si128(packed, _mm_set1_epi32(3)));
+
+        for (int e = 0; e < 4; ++e)
+        {
+            std::int16_t * element = data + 4 * e;
+            element[(largest[e] + 1) & 3] = std::int16_t(result[0][e]);
+            element[(largest[e] + 2) & 3] = std::int16_t(result[1][e]);
+            element[(largest[e] + 3) & 3] = std::int16_t(result[2][e]);
+            element[largest[e]] = std::int16_t(result[3][e]);
+        }
+    }
+#endif
+
+    for (; i < count; ++i, data += 4)
+    {
+        // the 4th component: scale of the other three in the high bits, index of the largest one in the low 2 bits
+        int const scale = data[3] | 3;
+        int const largest = data[3] & 3;
+        float const s = range / float(scale);
+
+        float const x = data[0] * s, y = data[1] * s, z = data[2] * s;
+        float const w = std::sqrt(std::max(0.f, 1.f - x * x - y * y - z * z));
+
+        data[(largest + 1) & 3] = round_to<std::int16_t>(x * 32767.f);
+        data[(largest + 2) & 3] = round_to<std::int16_t>(y * 32767.f);
+        data[(largest + 3) & 3] = round_to<std::int16_t>(z * 32767.f);
+        data[largest] = round_to<std::int16_t>(w * 32767.f);
+    }
+}
+
+void decode_exponential(std::uint32_t * data, std::size_t count)
+{
+    std::size_t i = 0;
+#ifdef MESHOPT_SSE
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(data + i));
+        __m128i mantissa = _mm_srai_epi32(_mm_slli_epi32(v, 8), 8);
+        __m128i exponent = _mm_srai_epi32(v, 24);
+        __m128 scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(exponent, _mm_set1_epi32(127)), 23));
+        _mm_storeu_ps(reinterpret_cast<float *>(data + i), _mm_mul_ps(_mm_cvtepi32_ps(mantissa), scale));
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        int const mantissa = int(data[i] << 8) >> 8;
+        int const exponent = int(data[i]) >> 24;
+        std::uint32_t const scale_bits = std::uint32_t(exponent + 127) << 23;
+        float scale, value;
+        std::memcpy(&scale, &scale_bits, 4);
+        value = float(mantissa) * scale;
+        std::memcpy(data + i, &value, 4);
+    }
+}
+
+}
+
+void meshopt_decode_attributes(void * target, std::size_t count, std::size_t stride, unsigned char const * source, std::size_t size)
+{
+    check(stride > 0 && stride <= vertex_max_stride && stride % 4 == 0, "vertex stride");
+    std::size_t const tail_size = stride < tail_max_size ? tail_max_size : stride;
+    check(size >= 1 + tail_size, "vertex buffer size");
+    check((source[0] & 0xf0) == 0xa0 && (source[0] & 0x0f) == 0, "vertex buffer header");
+
+    unsigned char const * data = source + 1;
+    unsigned char const * const end = source + size;
+
+    // The first vertex is predicted from the one stored at the very end; +16 for the vector reads of the last byte group
+    unsigned char last_vertex[vertex_max_stride + 16] = {};
+    std::memcpy(last_vertex, end - stride, stride);
+
+    std::size_t const block_size = vertex_block_size(stride);
+    // 16 rows at least so that the SIMD path can read whole registers
+    thread_local std::vector<unsigned char> deltas;
+    deltas.resize(((stride + 15) & ~std::size_t(15)) * block_size);
+
+    auto output = static_cast<unsigned char *>(target);
+    for (std::size_t first = 0; first < count; first += block_size)
+    {
+        std::size_t const block_count = count - first < block_size ? count - first : block_size;
+        std::size_t const aligned_count = (block_count + byte_group_size - 1) & ~(byte_group_size - 1);
+
+        for (std::size_t k = 0; k < stride; ++k)
+            data = decode_bytes(data, end, deltas.data() + k * block_size, aligned_count);
+
+        accumulate_vertex_block(deltas.data(), block_size, block_count, stride, last_vertex, output + first * stride);
+    }
+
+    check(std::size_t(end - data) == tail_size, "vertex buffer tail");
+}
+
+void meshopt_decode_triangles(void * target, std::size_t count, std::size_t stride, unsigned char const * source, std::size_t size)
+{
+    check(count % 3 == 0 && (stride == 2 || stride == 4), "triangle index count or stride");
+    check(size >= 1 + count / 3 + 16, "triangle buffer size");
+    check((source[0] & 0xf0) == 0xe0 && (source[0] & 0x0f) <= 1, "triangle buffer header");
+    int const version = source[0] & 0x0f;
+
+    // Triangles reuse recent edges and vertices, the rest of the indices are mostly "next unseen vertex";
+    // one code byte per triangle, then the extra bytes, then a 16 byte table of common code extensions
+    unsigned int edges[16][2];
+    unsigned int vertices[16];
+    std::memset(edges, -1, sizeof(edges));
+    std::memset(vertices, -1, sizeof(vertices));
+    std::size_t edge_offset = 0, vertex_offset = 0;
+
+    unsigned int next = 0, last = 0;
+    int const fifo_max = version >= 1 ? 13 : 15;
+
+    unsigned char const * code = source + 1;
+    unsigned char const * data = code + count / 3;
+    unsigned char const * const data_end = source + size - 16;
+    unsigned char const * const aux_table = data_end;
+
+    auto push_edge = [&](unsigned int a, unsigned int b)
+    {
+        edges[edge_offset][0] = a;
+        edges[edge_offset][1] = b;
+        edge_offset = (edge_offset + 1) & 15;
+    };
+    auto push_vertex = [&](unsigned int v, bool condition = true)
+    {
+        vertices[vertex_offset] = v;
+        vertex_offset = (vertex_offset + condition) & 15;
+    };
+
+    for (std::size_t i = 0; i < count; i += 3)
+    {
+        // an index takes at most 5 bytes and the table is 16 bytes long, so there's room for a whole triangle
+        check(data <= data_end, "triangle buffer data");
+
+        unsigned char const triangle = *code++;
+        unsigned int a, b, c;
+
+        if (triangle < 0xf0)
+        {
+            // an edge from the fifo and a third vertex
+            unsigned int const * edge = edges[(edge_offset - 1 - (triangle >> 4)) & 15];
+            a = edge[0];
+            b = edge[1];
+
+            int const fc = triangle & 15;
+            if (fc < fifo_max)
+            {
+                c = fc == 0 ? next++ : vertices[(vertex_offset - 1 - fc) & 15];
+                push_vertex(c, fc == 0);
+            }
+            else
+            {
+                // 13 and 14 are last - 1 and last + 1, 15 is an explicit delta
+                c = last = fc != 15 ? last + (fc - (fc ^ 3)) : last + unzigzag(decode_vbyte(data));
+                push_vertex(c);
+            }
+
+            push_edge(c, b);
+            push_edge(a, c);
+        }
+        else
+        {
+            int fa, fb, fc;
+            if (triangle < 0xfe)
+            {
+                unsigned char const aux = aux_table[triangle & 15];
+                fa = 0;
+                fb = aux >> 4;
+                fc = aux & 15;
+            }
+            else
+            {
+                unsigned char const aux = *data++;
+                fa = triangle == 0xfe ? 0 : 15;
+                fb = aux >> 4;
+                fc = aux & 15;
+                // restart of the index numbering
+                if (aux == 0)
+                    next = 0;
+            }
+
+            auto fetch = [&](int f)
+            {
+                return f == 0 ? next++ : f == 15 ? 0 : vertices[(vertex_offset - f) & 15];
+            };
+            a = fetch(fa);
+            b = fetch(fb);
+            c = fetch(fc);
+
+            if (fa == 15)
+                last = a = last + unzigzag(decode_vbyte(data));
+            if (fb == 15)
+                last = b = last + unzigzag(decode_vbyte(data));
+            if (fc == 15)
+                last = c = last + unzigzag(decode_vbyte(data));
+
+            push_vertex(a);
+            push_vertex(b, fb == 0 || fb == 15);
+            push_vertex(c, fc == 0 || fc == 15);
+
+            push_edge(b, a);
+            push_edge(c, b);
+            push_edge(a, c);
+        }
+
+        write_index(target, i, stride, a);
+        write_index(target, i + 1, stride, b);
+        write_index(target, i + 2, stride, c);
+    }
+
+    check(data == data_end, "triangle buffer tail");
+}
+
+void meshopt_decode_indices(void * target, std::size_t count, std::size_t stride, unsigned char const * source, std::size_t size)
+{
+    check(stride == 2 || stride == 4, "index stride");
+    check(size >= 1 + count + 4, "index buffer size");
+    check((source[0] & 0xf0) == 0xd0 && (source[0] & 0x0f) <= 1, "index buffer header");
+
+    // Each index is a delta from one of the two previous ones, the lowest bit of the varint says which
+    unsigned char const * data = source + 1;
+    unsigned char const * const data_end = source + size - 4;
+    unsigned int last[2] = {0, 0};
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        check(data < data_end, "index buffer data");
+        unsigned int const v = decode_vbyte(data);
+        unsigned int const baseline = v & 1;
+        unsigned int const index = last[baseline] + unzigzag(v >> 1);
+        last[baseline] = index;
+        write_index(target, i, stride, index);
+    }
+
+    check(data == data_end, "index buffer tail");
+}
+
+void meshopt_apply_filter(void * data, std::size_t count, std::size_t stride, meshopt_filter filter)
+{
+    switch (filter)
+    {
+    case meshopt_filter::none:
+        break;
+    case meshopt_filter::octahedral:
+        check(stride == 4 || stride == 8, "octahedral filter stride");
+        if (stride == 4)
+            decode_octahedral(static_cast<std::int8_t *>(data), count);
+        else
+            decode_octahedral(static_cast<std::int16_t *>(data), count);
+        break;
+    case meshopt_filter::quaternion:
+        check(stride == 8, "quaternion filter stride");
+        decode_quaternion(static_cast<std::int16_t *>(data), count);
+        break;
+    case meshopt_filter::exponential:
+        check(stride % 4 == 0, "exponential filter stride");
+        decode_exponential(static_cast<std::uint32_t *>(data), count * stride / 4);
+        break;
+    }
+}
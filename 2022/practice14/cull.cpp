@@ -0,0 +1,217 @@
+#include "cull.hpp"
+
+#include <bit>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CULL_AVX2 1
+#define CULL_AVX2_TARGET __attribute__((target("avx2,fma,popcnt")))
+#elif defined(__AVX2__)
+#define CULL_AVX2 1
+#define CULL_AVX2_TARGET
+#endif
+
+#ifdef CULL_AVX2
+#include <immintrin.h>
+#endif
+
+void aabb_soa::clear()
+{
+	min_x.clear(); min_y.clear(); min_z.clear();
+	max_x.clear(); max_y.clear(); max_z.clear();
+}
+
+void aabb_soa::reserve(std::size_t count)
+{
+	min_x.reserve(count); min_y.reserve(count); min_z.reserve(count);
+	max_x.reserve(count); max_y.reserve(count); max_z.reserve(count);
+}
+
+void aabb_soa::push_back(glm::vec3 const & min, glm::vec3 const & max)
+{
+	min_x.push_back(min.x); min_y.push_back(min.y); min_z.push_back(min.z);
+	max_x.push_back(max.x); max_y.push_back(max.y); max_z.push_back(max.z);
+}
+
+void aabb_soa::erase_swap(std::size_t index)
+{
+	auto erase = [index](std::vector<float> & v)
+	{
+		v[index] = v.back();
+		v.pop_back();
+	};
+
+	erase(min_x); erase(min_y); erase(min_z);
+	erase(max_x); erase(max_y); erase(max_z);
+}
+
+frustum_planes::frustum_planes(glm::mat4 const & view_projection)
+{
+	auto row = [&](int i)
+	{
+		return glm::vec4(view_projection[0][i], view_projection[1][i], view_projection[2][i], view_projection[3][i]);
+	};
+
+	// Gribb-Hartmann: -w <= x, y, z <= w in OpenGL clip space
+	planes = {
+		row(3) + row(0),
+		row(3) - row(0),
+		row(3) + row(1),
+		row(3) - row(1),
+		row(3) + row(2),
+		row(3) - row(2),
+	};
+}
+
+namespace
+{
+
+// For each plane, the box corner furthest along the plane normal (the "positive vertex")
+// is picked once per plane, so the inner loop is branch-free
+struct plane_corner
+{
+	glm::vec4 plane;
+	float const * x;
+	float const * y;
+	float const * z;
+};
+
+std::array<plane_corner, 6> select_corners(frustum_planes const & frustum, aabb_soa const & boxes)
+{
+	std::array<plane_corner, 6> result;
+	for (std::size_t p = 0; p < 6; ++p)
+	{
+		auto const & plane = frustum.planes[p];
+		result[p].plane = plane;
+		result[p].x = (plane.x >= 0.f ? boxes.max_x : boxes.min_x).data();
+		result[p].y = (plane.y >= 0.f ? boxes.max_y : boxes.min_y).data();
+		result[p].z = (plane.z >= 0.f ? boxes.max_z : boxes.min_z).data();
+	}
+	return result;
+}
+
+std::size_t cull_range(std::array<plane_corner, 6> const & corners, std::size_t begin, std::size_t end, std::uint32_t * out)
+{
+	std::size_t written = 0;
+	for (std::size_t i = begin; i < end; ++i)
+	{
+		bool inside = true;
+		for (auto const & c : corners)
+		{
+			float distance = c.plane.x * c.x[i] + c.plane.y * c.y[i] + c.plane.z * c.z[i] + c.plane.w;
+			inside &= (distance >= 0.f);
+		}
+		out[written] = static_cast<std::uint32_t>(i);
+		written += inside ? 1 : 0;
+	}
+	return written;
+}
+
+#ifdef CULL_AVX2
+
+// compress_lut[mask] moves the lanes whose bits are set in `mask` to the front
+struct compress_lut_t
+{
+	alignas(32) std::uint32_t lanes[256][8];
+};
+
+constexpr compress_lut_t make_compress_lut()
+{
+	compress_lut_t lut{};
+	for (int mask = 0; mask < 256; ++mask)
+	{
+		int count = 0;
+		for (int lane = 0; lane < 8; ++lane)
+			if (mask & (1 << lane))
+				lut.lanes[mask][count++] = lane;
+		for (; count < 8; ++count)
+			lut.lanes[mask][count] = 0;
+	}
+	return lut;
+}
+
+constexpr compress_lut_t compress_lut = make_compress_lut();
+
+CULL_AVX2_TARGET
+std::size_t cull_avx2(std::array<plane_corner, 6> const & corners, std::size_t begin, std::size_t end, std::uint32_t * out)
+{
+	__m256 nx[6], ny[6], nz[6], nw[6];
+	for (std::size_t p = 0; p < 6; ++p)
+	{
+		nx[p] = _mm256_set1_ps(corners[p].plane.x);
+		ny[p] = _mm256_set1_ps(corners[p].plane.y);
+		nz[p] = _mm256_set1_ps(corners[p].plane.z);
+		nw[p] = _mm256_set1_ps(corners[p].plane.w);
+	}
+
+	__m256 const zero = _mm256_setzero_ps();
+	__m256i const step = _mm256_set1_epi32(8);
+	__m256i index = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(begin)), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+
+	std::size_t written = 0;
+	std::size_t i = begin;
+	for (; i + 8 <= end; i += 8)
+	{
+		__m256 outside = zero;
+		for (std::size_t p = 0; p < 6; ++p)
+		{
+			__m256 distance = _mm256_fmadd_ps(nx[p], _mm256_loadu_ps(corners[p].x + i), nw[p]);
+			distance = _mm256_fmadd_ps(ny[p], _mm256_loadu_ps(corners[p].y + i), distance);
+			distance = _mm256_fmadd_ps(nz[p], _mm256_loadu_ps(corners[p].z + i), distance);
+			outside = _mm256_or_ps(outside, _mm256_cmp_ps(distance, zero, _CMP_LT_OQ));
+		}
+
+		unsigned int const mask = ~static_cast<unsigned int>(_mm256_movemask_ps(outside)) & 0xffu;
+		__m256i const permutation = _mm256_load_si256(reinterpret_cast<__m256i const *>(compress_lut.lanes[mask]));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(out + written), _mm256_permutevar8x32_epi32(index, permutation));
+		written += std::popcount(mask);
+
+		index = _mm256_add_epi32(index, step);
+	}
+
+	return written + cull_range(corners, i, end, out + written);
+}
+
+#endif
+
+}
+
+bool cull_has_avx2()
+{
+#if defined(CULL_AVX2) && defined(__GNUC__)
+	static bool const result = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("popcnt");
+	return result;
+#elif defined(CULL_AVX2)
+	return true;
+#else
+	return false;
+#endif
+}
+
+std::size_t cull_scalar(frustum_planes const & frustum, aabb_soa const & boxes, std::vector<std::uint32_t> & visible)
+{
+	std::size_t const base = visible.size();
+	visible.resize(base + boxes.size());
+	std::size_t const written = cull_range(select_corners(frustum, boxes), 0, boxes.size(), visible.data() + base);
+	visible.resize(base + written);
+	return written;
+}
+
+std::size_t cull(frustum_planes const & frustum, aabb_soa const & boxes, std::size_t begin, std::size_t end, std::uint32_t * out)
+{
+	// Both kernels store past the last visible entry, the AVX2 one 8 lanes at a time,
+	// but never past out[end - begin - 1]: there are at most that many boxes left to write
+#ifdef CULL_AVX2
+	if (cull_has_avx2())
+		return cull_avx2(select_corners(frustum, boxes), begin, end, out);
+#endif
+	return cull_range(select_corners(frustum, boxes), begin, end, out);
+}
+
+std::size_t cull(frustum_planes const & frustum, aabb_soa const & boxes, std::vector<std::uint32_t> & visible)
+{
+	std::size_t const base = visible.size();
+	visible.resize(base + boxes.size());
+	std::size_t const written = cull(frustum, boxes, 0, boxes.size(), visible.data() + base);
+	visible.resize(base + written);
+	return written;
+}
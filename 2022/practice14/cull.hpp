@@ -0,0 +1,53 @@
+#pragma once
+
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Axis-aligned boxes stored as structure-of-arrays, so that
+// the culling kernel can load 8 boxes at once
+struct aabb_soa
+{
+	std::vector<float> min_x, min_y, min_z;
+	std::vector<float> max_x, max_y, max_z;
+
+	std::size_t size() const { return min_x.size(); }
+
+	void clear();
+	void reserve(std::size_t count);
+	void push_back(glm::vec3 const & min, glm::vec3 const & max);
+	// Moves the last box into `index` and shrinks by one
+	void erase_swap(std::size_t index);
+};
+
+// Frustum as 6 planes (left, right, bottom, top, near, far) extracted
+// from the view-projection matrix; a point p is inside a plane when
+// dot(plane.xyz, p) + plane.w >= 0
+struct frustum_planes
+{
+	std::array<glm::vec4, 6> planes;
+
+	frustum_planes(glm::mat4 const & view_projection);
+};
+
+// Appends indices of boxes that are not completely outside any of the planes
+// to `visible` and returns the number of appended indices. This is conservative:
+// a box near a frustum corner may pass even though the exact SAT `intersect()`
+// rejects it, but a box that intersects the frustum is never rejected.
+std::size_t cull(frustum_planes const & frustum, aabb_soa const & boxes, std::vector<std::uint32_t> & visible);
+
+// Same as `cull`, but only tests boxes with indices in [begin, end) and writes the indices
+// to `out`, which must have room for `end - begin` of them; entries past the returned
+// count are overwritten with garbage. Nothing is allocated, so a caller that culls every
+// frame can keep one buffer and only grow it
+std::size_t cull(frustum_planes const & frustum, aabb_soa const & boxes, std::size_t begin, std::size_t end, std::uint32_t * out);
+
+// Same as `cull`, but never uses the AVX2 path
+std::size_t cull_scalar(frustum_planes const & frustum, aabb_soa const & boxes, std::vector<std::uint32_t> & visible);
+
+bool cull_has_avx2();
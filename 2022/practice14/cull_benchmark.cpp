@@ -0,0 +1,124 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <cmath>
+
+#include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/ext/matrix_transform.hpp>
+#include <glm/ext/matrix_clip_space.hpp>
+#include <glm/ext/scalar_constants.hpp>
+
+#include "aabb.hpp"
+#include "frustum.hpp"
+#include "intersect.hpp"
+#include "cull.hpp"
+#include "instance_store.hpp"
+#include "job_system.hpp"
+
+// Compares the SAT `intersect(aabb, frustum)` used in main.cpp
+// with the plane-based batch culling from cull.hpp, then measures
+// the whole instance_store frame (LOD bucketing and culling) on a
+// million-instance grid with one thread and with all threads
+
+template <typename F>
+double measure_ms(int repeats, F && f)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int i = 0; i < repeats; ++i)
+		f();
+	auto end = std::chrono::high_resolution_clock::now();
+	return std::chrono::duration<double, std::milli>(end - start).count() / repeats;
+}
+
+int main()
+{
+	std::default_random_engine rng(42);
+
+	glm::mat4 view = glm::lookAt(glm::vec3(0.f, 1.5f, 3.f), glm::vec3(0.f, 0.f, -10.f), glm::vec3(0.f, 1.f, 0.f));
+	glm::mat4 projection = glm::perspective(glm::pi<float>() / 2.f, 4.f / 3.f, 0.1f, 100.f);
+	glm::mat4 view_projection = projection * view;
+
+	frustum const sat_frustum(view_projection);
+	frustum_planes const planes(view_projection);
+
+	std::cout << "avx2: " << (cull_has_avx2() ? "yes" : "no") << std::endl;
+
+	for (std::size_t count : {10000u, 100000u, 1000000u})
+	{
+		// Same layout as the practice14 grid: unit-sized instances spread around the camera
+		float const extent = std::sqrt(static_cast<float>(count)) / 2.f;
+		std::uniform_real_distribution<float> position(-extent, extent);
+
+		std::vector<glm::vec3> shifts(count);
+		for (auto & s : shifts)
+			s = glm::vec3(position(rng), 0.f, position(rng));
+
+		glm::vec3 const mesh_min(-0.5f, 0.f, -0.4f);
+		glm::vec3 const mesh_max(0.5f, 1.f, 0.4f);
+
+		aabb_soa boxes;
+		boxes.reserve(count);
+		for (auto const & s : shifts)
+			boxes.push_back(mesh_min + s, mesh_max + s);
+
+		int const repeats = count >= 1000000 ? 3 : 20;
+
+		std::size_t sat_visible = 0;
+		double sat_ms = measure_ms(repeats, [&]{
+			sat_visible = 0;
+			for (auto const & s : shifts)
+				if (intersect(aabb(mesh_min + s, mesh_max + s), sat_frustum))
+					++sat_visible;
+		});
+
+		std::vector<std::uint32_t> visible;
+		visible.reserve(count + 8);
+
+		std::size_t scalar_visible = 0;
+		double scalar_ms = measure_ms(repeats, [&]{
+			visible.clear();
+			scalar_visible = cull_scalar(planes, boxes, visible);
+		});
+
+		std::size_t simd_visible = 0;
+		double simd_ms = measure_ms(repeats, [&]{
+			visible.clear();
+			simd_visible = cull(planes, boxes, visible);
+		});
+
+		std::cout << count << " instances:" << std::endl;
+		std::cout << "  intersect(): " << sat_ms << " ms, " << sat_visible << " visible" << std::endl;
+		std::cout << "  cull_scalar: " << scalar_ms << " ms, " << scalar_visible << " visible" << std::endl;
+		std::cout << "  cull:        " << simd_ms << " ms, " << simd_visible << " visible" << std::endl;
+	}
+
+	int const grid_radius = 500;
+	for (std::size_t threads : {std::size_t(1), std::size_t(std::thread::hardware_concurrency())})
+	{
+		job_system jobs(threads);
+		instance_store instances(lod_hysteresis{.step = 4.f, .margin = 0.5f, .lod_count = 6}, 0.1f, jobs);
+		for (int lod = 0; lod < 6; ++lod)
+			instances.set_lod_bounds(lod, glm::vec3(-0.5f, 0.f, -0.4f), glm::vec3(0.5f, 1.f, 0.4f));
+		for (int dx = -grid_radius; dx < grid_radius; ++dx)
+			for (int dz = -grid_radius; dz < grid_radius; ++dz)
+				instances.add(glm::vec3(dx, 0.f, dz));
+
+		// Camera walks forward, so every frame re-evaluates LODs and re-culls
+		glm::vec3 camera_position(0.f, 1.5f, 3.f);
+		double frame_ms = measure_ms(20, [&]{
+			camera_position.z -= 0.2f;
+			glm::mat4 view = glm::translate(glm::mat4(1.f), -camera_position);
+			instances.update_lods(camera_position);
+			instances.cull(frustum_planes(projection * view));
+		});
+
+		std::size_t visible = 0;
+		for (int lod = 0; lod < 6; ++lod)
+			visible += instances.lod_bucket(lod).visible.size();
+
+		std::cout << instances.size() << " instances, " << jobs.thread_count() << " threads: "
+			<< frame_ms << " ms per frame, " << visible << " visible" << std::endl;
+	}
+}
@@ -1,11 +1,14 @@
 #pragma once
 
 #include <filesystem>
+#include <memory>
 #include <vector>
 #include <string>
 #include <optional>
 #include <unordered_map>
 #include <algorithm>
+#include <cstring>
+#include <stdexcept>
 
 #include <glm/vec3.hpp>
 #include <glm/mat4x4.hpp>
@@ -18,14 +21,54 @@ struct gltf_model
     {
         unsigned int offset;
         unsigned int size;
+        // Bytes between consecutive elements, 0 if they are tightly packed
+        unsigned int stride = 0;
     };
 
     struct accessor
     {
+        // The accessor's own byteOffset is already added to view.offset
         buffer_view view;
         unsigned int type;
         unsigned int size;
         unsigned int count;
+        bool normalized = false;
+
+        unsigned int component_size() const;
+        // Bytes between consecutive elements, also the right value for glVertexAttribPointer
+        unsigned int stride() const { return view.stride ? view.stride : size * component_size(); }
+    };
+
+    // The binary data of the model: a range of the memory-mapped .bin or .glb file,
+    // the mapping lives as long as any copy of the buffer
+    struct binary_buffer
+    {
+        std::shared_ptr<void const> owner;
+        char const * begin = nullptr;
+        std::size_t length = 0;
+
+        char const * data() const { return begin; }
+        std::size_t size() const { return length; }
+    };
+
+    // Elements of an accessor read in place from the buffer, one stride apart.
+    // std::span can't skip bytes between elements and the elements aren't necessarily aligned,
+    // so they are copied out one at a time
+    template <typename T>
+    struct strided_view
+    {
+        char const * begin = nullptr;
+        std::size_t stride = sizeof(T);
+        std::size_t count = 0;
+
+        std::size_t size() const { return count; }
+
+        T operator[](std::size_t i) const
+        {
+            T value;
+            std::memcpy(&value, begin + i * stride, sizeof(T));
+            return value;
+        }
     };
 
     struct material
@@ -47,12 +90,37 @@ struct gltf_model
         accessor normal;
         accessor texcoord;
 
+        // Bounds of the positions as stored, before the transform
         glm::vec3 min;
         glm::vec3 max;
+
+        // World transform of the mesh's node, identity for skinned meshes (glTF ignores it for them);
+        // with KHR_mesh_quantization it usually dequantizes the positions
+        glm::mat4 transform = glm::mat4(1.f);
     };
 
-    std::vector<char> buffer;
+    binary_buffer buffer;
     std::vector<mesh> meshes;
+
+    // The accessor's elements as T, which must have exactly their layout (e.g. glm::vec3 for a float VEC3)
+    template <typename T>
+    strided_view<T> view(accessor const & accessor) const;
+
+    // Element `index` of any accessor as floats: normalized integers are mapped to [0, 1] ([-1, 1] if signed),
+    // the components the accessor doesn't have are taken from `fallback`
+    glm::vec4 read(accessor const & accessor, std::size_t index, glm::vec4 fallback = glm::vec4(0.f, 0.f, 0.f, 1.f)) const;
 };
 
+// Loads both .gltf with a single external .bin buffer and binary .glb;
+// the buffer is memory-mapped and accessed in place, the JSON is parsed in situ
 gltf_model load_gltf(std::filesystem::path const & path);
+
+template <typename T>
+gltf_model::strided_view<T> gltf_model::view(gltf_model::accessor const & accessor) const
+{
+    if (sizeof(T) != accessor.size * accessor.component_size())
+        throw std::runtime_error("Accessor element doesn't match the requested type");
+    if (accessor.count > 0 && accessor.view.offset + (accessor.count - 1) * std::size_t(accessor.stride()) + sizeof(T) > buffer.size())
+        throw std::runtime_error("Accessor is out of the buffer");
+    return {buffer.data() + accessor.view.offset, accessor.stride(), accessor.count};
+}
@@ -0,0 +1,178 @@
+#include "instance_store.hpp"
+
+#include <glm/geometric.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+int lod_hysteresis::select(int current, float distance) const
+{
+	auto level = [this](float d)
+	{
+		return std::clamp(static_cast<int>(std::floor(d / step)), 0, lod_count - 1);
+	};
+
+	if (int further = level(distance - margin); further > current)
+		return further;
+	if (int closer = level(distance + margin); closer < current)
+		return closer;
+	return current;
+}
+
+instance_store::instance_store(lod_hysteresis const & lods, float min_camera_move, job_system & jobs)
+	: lods_(lods)
+	, min_camera_move_(min_camera_move)
+	, jobs_(jobs)
+	, lod_min_(lods.lod_count, glm::vec3(0.f))
+	, lod_max_(lods.lod_count, glm::vec3(0.f))
+	, buckets_(lods.lod_count)
+	, last_frustum_(glm::mat4(0.f))
+{}
+
+void instance_store::set_lod_bounds(int lod, glm::vec3 const & min, glm::vec3 const & max)
+{
+	lod_min_[lod] = min;
+	lod_max_[lod] = max;
+
+	auto & b = buckets_[lod];
+	b.boxes.clear();
+	for (auto slot : b.slots)
+	{
+		glm::vec3 position = positions_[slot];
+		b.boxes.push_back(min + position, max + position);
+	}
+	buckets_changed_ = true;
+}
+
+std::uint32_t instance_store::add(glm::vec3 const & position)
+{
+	auto const slot = static_cast<std::uint32_t>(positions_.size());
+	positions_.emplace_back(position, 1.f);
+	lod_.push_back(-1);
+	bucket_index_.push_back(0);
+
+	// Until the first evaluation every instance uses the coarsest level
+	insert(slot, lods_.lod_count - 1);
+	return slot;
+}
+
+void instance_store::insert(std::uint32_t slot, int lod)
+{
+	auto & b = buckets_[lod];
+	glm::vec3 position = positions_[slot];
+
+	lod_[slot] = lod;
+	bucket_index_[slot] = static_cast<std::uint32_t>(b.slots.size());
+	b.slots.push_back(slot);
+	b.boxes.push_back(lod_min_[lod] + position, lod_max_[lod] + position);
+	buckets_changed_ = true;
+}
+
+void instance_store::erase(std::uint32_t slot)
+{
+	auto & b = buckets_[lod_[slot]];
+	auto const index = bucket_index_[slot];
+
+	b.slots[index] = b.slots.back();
+	bucket_index_[b.slots[index]] = index;
+	b.slots.pop_back();
+	b.boxes.erase_swap(index);
+	buckets_changed_ = true;
+}
+
+std::size_t instance_store::update_lods(glm::vec3 const & camera_position)
+{
+	if (evaluated_ && glm::length(camera_position - last_camera_position_) < min_camera_move_)
+		return 0;
+
+	evaluated_ = true;
+	last_camera_position_ = camera_position;
+
+	lod_changes_.resize(job_system::chunk_count(positions_.size(), grain));
+	jobs_.parallel_for(positions_.size(), grain, [&](std::size_t chunk, std::size_t begin, std::size_t end)
+	{
+		auto & changes = lod_changes_[chunk];
+		changes.clear();
+		for (std::size_t slot = begin; slot < end; ++slot)
+		{
+			int const current = lod_[slot];
+			glm::vec3 center = glm::vec3(positions_[slot]) + (lod_min_[current] + lod_max_[current]) / 2.f;
+			int lod = lods_.select(current, glm::length(camera_position - center));
+			if (lod != current)
+				changes.emplace_back(static_cast<std::uint32_t>(slot), lod);
+		}
+	});
+
+	// Moving between buckets is proportional to the number of changes, so it stays serial
+	std::size_t changed = 0;
+	for (auto const & changes : lod_changes_)
+	{
+		for (auto [slot, lod] : changes)
+		{
+			erase(slot);
+			insert(slot, lod);
+		}
+		changed += changes.size();
+	}
+	return changed;
+}
+
+void instance_store::cull(frustum_planes const & frustum)
+{
+	if (!buckets_changed_ && frustum.planes == last_frustum_.planes)
+		return;
+
+	buckets_changed_ = false;
+	last_frustum_ = frustum;
+
+	cull_tasks_.clear();
+	for (int lod = 0; lod < lods_.lod_count; ++lod)
+	{
+		std::size_t const count = buckets_[lod].slots.size();
+		for (std::size_t begin = 0; begin < count; begin += grain)
+			cull_tasks_.push_back({lod, begin, std::min(count, begin + grain), 0, 0});
+	}
+
+	cull_outputs_.resize(cull_tasks_.size());
+	jobs_.parallel_for(cull_tasks_.size(), 1, [&](std::size_t, std::size_t begin, std::size_t end)
+	{
+		for (std::size_t t = begin; t < end; ++t)
+		{
+			auto & task = cull_tasks_[t];
+			auto const & b = buckets_[task.lod];
+			auto & output = cull_outputs_[t];
+
+			if (output.size() < task.end - task.begin)
+				output.resize(task.end - task.begin);
+			task.count = ::cull(frustum, b.boxes, task.begin, task.end, output.data());
+			for (std::size_t i = 0; i < task.count; ++i)
+				output[i] = b.slots[output[i]];
+		}
+	});
+
+	next_visible_.resize(lods_.lod_count);
+	cull_totals_.assign(lods_.lod_count, 0);
+	for (std::size_t t = 0; t < cull_tasks_.size(); ++t)
+	{
+		cull_tasks_[t].offset = cull_totals_[cull_tasks_[t].lod];
+		cull_totals_[cull_tasks_[t].lod] += cull_tasks_[t].count;
+	}
+	for (int lod = 0; lod < lods_.lod_count; ++lod)
+		next_visible_[lod].resize(cull_totals_[lod]);
+
+	jobs_.parallel_for(cull_tasks_.size(), 1, [&](std::size_t, std::size_t begin, std::size_t end)
+	{
+		for (std::size_t t = begin; t < end; ++t)
+			std::copy_n(cull_outputs_[t].begin(), cull_tasks_[t].count, next_visible_[cull_tasks_[t].lod].begin() + cull_tasks_[t].offset);
+	});
+
+	for (int lod = 0; lod < lods_.lod_count; ++lod)
+	{
+		auto & b = buckets_[lod];
+		if (next_visible_[lod] != b.visible)
+		{
+			b.visible.swap(next_visible_[lod]);
+			b.dirty = true;
+		}
+	}
+}
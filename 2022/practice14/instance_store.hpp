@@ -0,0 +1,112 @@
+#pragma once
+
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+#include "cull.hpp"
+#include "job_system.hpp"
+
+// LOD levels switch every `step` units of distance. An instance leaves its
+// current level only when it is at least `margin` past the switch distance,
+// so instances near a boundary don't flicker between two levels.
+struct lod_hysteresis
+{
+	float step = 4.f;
+	float margin = 0.5f;
+	int lod_count = 1;
+
+	int select(int current, float distance) const;
+};
+
+// Instances with stable slots: slot i keeps its position in `positions()`
+// for the whole lifetime of the store, so the positions can be uploaded once.
+// Every LOD level keeps a bucket of slots, updated incrementally when an
+// instance changes level, and the list of slots that passed frustum culling.
+// LOD evaluation and culling are split into jobs over chunks of instances;
+// each job writes to its own output list, and the lists are concatenated
+// at precomputed offsets, so no locks are taken on the way.
+class instance_store
+{
+public:
+	struct bucket
+	{
+		std::vector<std::uint32_t> slots;
+		// World-space bounds of `slots`, in the same order
+		aabb_soa boxes;
+		// Slots that passed the last `cull()`
+		std::vector<std::uint32_t> visible;
+		// `visible` changed since the last `mark_uploaded()`
+		bool dirty = true;
+	};
+
+	instance_store(lod_hysteresis const & lods, float min_camera_move, job_system & jobs);
+
+	void set_lod_bounds(int lod, glm::vec3 const & min, glm::vec3 const & max);
+
+	std::uint32_t add(glm::vec3 const & position);
+
+	// Re-evaluates LOD levels once the camera moved further than `min_camera_move`
+	// since the last evaluation; returns the number of instances that changed level
+	std::size_t update_lods(glm::vec3 const & camera_position);
+
+	// Rebuilds `visible` of every bucket, unless neither the frustum nor the buckets changed
+	void cull(frustum_planes const & frustum);
+
+	void mark_uploaded(int lod) { buckets_[lod].dirty = false; }
+
+	std::size_t size() const { return positions_.size(); }
+	int lod_count() const { return lods_.lod_count; }
+
+	// xyz is the position, w is unused; vec4 so that the array fits an RGBA32F texture buffer
+	std::vector<glm::vec4> const & positions() const { return positions_; }
+	bucket const & lod_bucket(int lod) const { return buckets_[lod]; }
+
+private:
+	// Instances per job
+	static constexpr std::size_t grain = 16384;
+
+	struct cull_task
+	{
+		int lod;
+		std::size_t begin;
+		std::size_t end;
+		std::size_t offset;
+		// Visible slots at the front of the task's `cull_outputs_` entry
+		std::size_t count;
+	};
+
+	lod_hysteresis lods_;
+	float min_camera_move_;
+	job_system & jobs_;
+
+	std::vector<glm::vec3> lod_min_;
+	std::vector<glm::vec3> lod_max_;
+
+	std::vector<glm::vec4> positions_;
+	std::vector<int> lod_;
+	// Index of the slot inside `buckets_[lod_[slot]].slots`
+	std::vector<std::uint32_t> bucket_index_;
+	std::vector<bucket> buckets_;
+
+	bool evaluated_ = false;
+	glm::vec3 last_camera_position_{0.f};
+
+	bool buckets_changed_ = true;
+	frustum_planes last_frustum_;
+
+	// Per-job outputs: (slot, new LOD) pairs and visible slots; the latter only grow
+	std::vector<std::vector<std::pair<std::uint32_t, int>>> lod_changes_;
+	std::vector<cull_task> cull_tasks_;
+	std::vector<std::vector<std::uint32_t>> cull_outputs_;
+	// Number of visible slots per LOD level, the sizes of `next_visible_`
+	std::vector<std::size_t> cull_totals_;
+	std::vector<std::vector<std::uint32_t>> next_visible_;
+
+	void insert(std::uint32_t slot, int lod);
+	void erase(std::uint32_t slot);
+};
@@ -0,0 +1,144 @@
+#include "job_system.hpp"
+
+#include <algorithm>
+
+namespace
+{
+
+// Queue of the current thread, if it is a worker of some job system
+thread_local job_system const * current_system = nullptr;
+thread_local std::size_t current_queue = 0;
+
+}
+
+job_system::job_system(std::size_t threads)
+{
+	std::size_t const worker_count = std::max<std::size_t>(threads, 1) - 1;
+
+	// The last queue receives jobs submitted from outside of the workers
+	for (std::size_t i = 0; i < worker_count + 1; ++i)
+		queues_.push_back(std::make_unique<queue>());
+
+	for (std::size_t i = 0; i < worker_count; ++i)
+		workers_.emplace_back([this, i]{ worker_loop(i); });
+}
+
+job_system::~job_system()
+{
+	{
+		std::lock_guard lock(sleep_mutex_);
+		stop_ = true;
+	}
+	wake_.notify_all();
+
+	for (auto & worker : workers_)
+		worker.join();
+}
+
+void job_system::submit(job j, counter & c)
+{
+	c.pending.fetch_add(1, std::memory_order_relaxed);
+
+	std::size_t target;
+	if (current_system == this)
+		target = current_queue;
+	else if (workers_.empty())
+		target = queues_.size() - 1;
+	else
+		target = next_queue_.fetch_add(1, std::memory_order_relaxed) % workers_.size();
+
+	{
+		std::lock_guard lock(queues_[target]->mutex);
+		queues_[target]->jobs.emplace_back(std::move(j), &c);
+	}
+
+	queued_.fetch_add(1, std::memory_order_release);
+	{
+		// Pairs with the predicate check in worker_loop, so that the wakeup is not lost
+		std::lock_guard lock(sleep_mutex_);
+	}
+	wake_.notify_one();
+}
+
+bool job_system::try_run(std::size_t home)
+{
+	std::pair<job, counter *> next;
+	bool found = false;
+
+	{
+		auto & own = *queues_[home];
+		std::lock_guard lock(own.mutex);
+		if (!own.jobs.empty())
+		{
+			next = std::move(own.jobs.back());
+			own.jobs.pop_back();
+			found = true;
+		}
+	}
+
+	for (std::size_t i = 1; !found && i < queues_.size(); ++i)
+	{
+		auto & victim = *queues_[(home + i) % queues_.size()];
+		std::lock_guard lock(victim.mutex);
+		if (!victim.jobs.empty())
+		{
+			next = std::move(victim.jobs.front());
+			victim.jobs.pop_front();
+			found = true;
+		}
+	}
+
+	if (!found)
+		return false;
+
+	queued_.fetch_sub(1, std::memory_order_relaxed);
+	next.first();
+	next.second->pending.fetch_sub(1, std::memory_order_release);
+	return true;
+}
+
+void job_system::wait(counter & c)
+{
+	std::size_t const home = (current_system == this) ? current_queue : queues_.size() - 1;
+
+	while (c.pending.load(std::memory_order_acquire) > 0)
+	{
+		if (!try_run(home))
+			std::this_thread::yield();
+	}
+}
+
+void job_system::parallel_for(std::size_t count, std::size_t grain, std::function<void(std::size_t, std::size_t, std::size_t)> const & f)
+{
+	grain = std::max<std::size_t>(grain, 1);
+	std::size_t const chunks = chunk_count(count, grain);
+
+	if (chunks <= 1 || workers_.empty())
+	{
+		for (std::size_t chunk = 0; chunk < chunks; ++chunk)
+			f(chunk, chunk * grain, std::min(count, (chunk + 1) * grain));
+		return;
+	}
+
+	counter c;
+	for (std::size_t chunk = 0; chunk < chunks; ++chunk)
+		submit([&f, chunk, grain, count]{ f(chunk, chunk * grain, std::min(count, (chunk + 1) * grain)); }, c);
+	wait(c);
+}
+
+void job_system::worker_loop(std::size_t index)
+{
+	current_system = this;
+	current_queue = index;
+
+	while (true)
+	{
+		if (try_run(index))
+			continue;
+
+		std::unique_lock lock(sleep_mutex_);
+		wake_.wait(lock, [this]{ return stop_ || queued_.load(std::memory_order_acquire) > 0; });
+		if (stop_ && queued_.load(std::memory_order_acquire) == 0)
+			return;
+	}
+}
@@ -18,6 +18,7 @@
 #include <random>
 #include <map>
 #include <cmath>
+#include <limits>
 
 #include <glm/vec3.hpp>
 #include <glm/mat4x4.hpp>
@@ -29,9 +30,9 @@
 
 #include "gltf_loader.hpp"
 #include "stb_image.h"
-#include "aabb.hpp"
-#include "frustum.hpp"
-#include "intersect.hpp"
+#include "cull.hpp"
+#include "instance_store.hpp"
+#include "job_system.hpp"
 
 std::string to_string(std::string_view str) {
   return std::string(str.begin(), str.end());
@@ -51,19 +52,25 @@ const char vertex_shader_source[] =
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
+// the mesh's node transform, dequantizes KHR_mesh_quantization positions
+uniform mat4 mesh_transform;
 
 layout (location = 0) in vec3 in_position;
 layout (location = 1) in vec3 in_normal;
 layout (location = 2) in vec2 in_texcoord;
-layout (location = 3) in vec3 shift;
+layout (location = 3) in uint slot;
+
+uniform samplerBuffer shifts;
 
 out vec3 normal;
 out vec2 texcoord;
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(in_position + shift, 1.0);
-    normal = mat3(model) * in_normal;
+    vec3 shift = texelFetch(shifts, int(slot)).xyz;
+    vec3 position = (mesh_transform * vec4(in_position, 1.0)).xyz;
+    gl_Position = projection * view * model * vec4(position + shift, 1.0);
+    normal = mat3(model) * mat3(mesh_transform) * in_normal;
     texcoord = in_texcoord;
 }
 )";
@@ -168,6 +175,7 @@ int main() try {
   auto program = create_program(vertex_shader, fragment_shader);
 
   GLuint model_location = glGetUniformLocation(program, "model");
+  GLuint mesh_transform_location = glGetUniformLocation(program, "mesh_transform");
   GLuint view_location = glGetUniformLocation(program, "view");
   GLuint projection_location = glGetUniformLocation(program, "projection");
   GLuint albedo_location = glGetUniformLocation(program, "albedo");
@@ -175,6 +183,7 @@ int main() try {
   GLuint use_texture_location = glGetUniformLocation(program, "use_texture");
   GLuint light_direction_location = glGetUniformLocation(program, "light_direction");
   GLuint bones_location = glGetUniformLocation(program, "bones");
+  GLuint shifts_location = glGetUniformLocation(program, "shifts");
 
   const std::string project_root = PROJECT_ROOT;
   const std::string model_path = project_root + "/bunny/bunny.gltf";
@@ -198,8 +207,8 @@ int main() try {
       glVertexAttribPointer(index,
                             accessor.size,
                             accessor.type,
-                            GL_FALSE,
-                            0,
+                            accessor.normalized ? GL_TRUE : GL_FALSE,
+                            accessor.stride(),
                             reinterpret_cast<void *>(accessor.view.offset));
     };
 
@@ -259,23 +268,55 @@ int main() try {
 
   // TASK 3
   const int LOD_CNT = 6;
-  std::vector<glm::vec3> shifts[LOD_CNT]{};
-
-  GLuint shifts_vbo;
-  glGenBuffers(1, &shifts_vbo);
-  glBindBuffer(GL_ARRAY_BUFFER, shifts_vbo);
-  //glBufferData(GL_ARRAY_BUFFER, shifts.size() * sizeof(glm::vec3), shifts.data(), GL_STATIC_DRAW);
-
-  for (const auto &vao : vaos) {
-    glBindVertexArray(vao);
+  const int GRID_RADIUS = 16;
+
+  // Every instance gets a stable slot in a texture buffer, uploaded once;
+  // per frame only the per-LOD lists of visible slots are uploaded, and only when they change
+  job_system jobs;
+  instance_store instances(lod_hysteresis{.step = 4.f, .margin = 0.5f, .lod_count = LOD_CNT}, 0.1f, jobs);
+  for (int lod = 0; lod < LOD_CNT; ++lod) {
+    // the bounds are in the stored (maybe quantized) coordinates, the box of their transformed corners
+    const auto &mesh = input_model.meshes[lod];
+    glm::vec3 min(std::numeric_limits<float>::infinity()), max(-std::numeric_limits<float>::infinity());
+    for (int corner = 0; corner < 8; ++corner) {
+      glm::vec3 p((corner & 1) ? mesh.max.x : mesh.min.x, (corner & 2) ? mesh.max.y : mesh.min.y,
+                  (corner & 4) ? mesh.max.z : mesh.min.z);
+      p = glm::vec3(mesh.transform * glm::vec4(p, 1.f));
+      min = glm::min(min, p);
+      max = glm::max(max, p);
+    }
+    instances.set_lod_bounds(lod, min, max);
+  }
+  for (int dx = -GRID_RADIUS; dx < GRID_RADIUS; ++dx)
+    for (int dz = -GRID_RADIUS; dz < GRID_RADIUS; ++dz)
+      instances.add(glm::vec3(dx, 0, dz));
+
+  GLuint shifts_buffer;
+  glGenBuffers(1, &shifts_buffer);
+  glBindBuffer(GL_TEXTURE_BUFFER, shifts_buffer);
+  glBufferData(GL_TEXTURE_BUFFER,
+               instances.positions().size() * sizeof(glm::vec4),
+               instances.positions().data(),
+               GL_STATIC_DRAW);
+
+  GLuint shifts_texture;
+  glGenTextures(1, &shifts_texture);
+  glBindTexture(GL_TEXTURE_BUFFER, shifts_texture);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, shifts_buffer);
+
+  GLuint slots_vbo[LOD_CNT];
+  std::size_t slots_capacity[LOD_CNT]{};
+  glGenBuffers(LOD_CNT, slots_vbo);
+
+  for (int lod = 0; lod < LOD_CNT; ++lod) {
+    glBindVertexArray(vaos[lod]);
     glEnableVertexAttribArray(3);
-    glBindBuffer(GL_ARRAY_BUFFER, shifts_vbo);
-    glVertexAttribPointer(3,
-                          3,
-                          GL_FLOAT,
-                          GL_FALSE,
-                          0,
-                          nullptr);
+    glBindBuffer(GL_ARRAY_BUFFER, slots_vbo[lod]);
+    glVertexAttribIPointer(3,
+                           1,
+                           GL_UNSIGNED_INT,
+                           0,
+                           nullptr);
     glVertexAttribDivisor(3, 1);
   }
 
@@ -355,7 +396,7 @@ int main() try {
     glm::vec3 light_direction = glm::normalize(glm::vec3(1.f, 2.f, 3.f));
     glm::mat4 model = glm::mat4(1.f);
 
-    auto frustum_ = frustum(projection * view);
+    auto frustum_ = frustum_planes(projection * view);
 
     glUseProgram(program);
     glUniformMatrix4fv(model_location, 1, GL_FALSE, reinterpret_cast<float *>(&model));
@@ -363,50 +404,44 @@ int main() try {
     glUniformMatrix4fv(projection_location, 1, GL_FALSE, reinterpret_cast<float *>(&projection));
     glUniform3fv(light_direction_location, 1, reinterpret_cast<float *>(&light_direction));
 
+    glUniform1i(albedo_location, 0);
+    glUniform1i(shifts_location, 1);
+
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_BUFFER, shifts_texture);
+    glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, texture);
 
     {
       //auto const &mesh = input_model.meshes[0];
       //glBindVertexArray(vaos[0]);
 
-      for (int i = 0; i < LOD_CNT; ++i)
-        shifts[i].clear();
       // TASK 4
-      for (int dx = -16; dx < 16; ++dx) {
-        for (int dz = -16; dz < 16; ++dz) {
-          auto shift = glm::vec3(dx, 0, dz);
-          auto shift_min = input_model.meshes[0].min + shift;
-          auto shift_max = input_model.meshes[0].max + shift;
-          auto center = (shift_min + shift_max) / 2.f;
-          auto length = glm::length(camera_position - center);
-          auto C = 4.f;
-          auto lod = std::min(LOD_CNT - 1, (int) floor(length / C));
-          shifts[lod].emplace_back(shift);
-        }
-      }
+      instances.update_lods(camera_position);
+      instances.cull(frustum_);
 
       for (int lod = 0; lod < LOD_CNT; ++lod) {
-        std::vector<glm::vec3> cur_shifts;
         const auto &mesh = input_model.meshes[lod];
+        const auto &bucket = instances.lod_bucket(lod);
 
-        for (auto shift : shifts[lod]) {
-          aabb aabb_ = aabb(mesh.min + shift, mesh.max + shift);
-          if (intersect(aabb_, frustum_)) {
-            cur_shifts.emplace_back(shift);
+        glBindVertexArray(vaos[lod]);
+        if (bucket.dirty) {
+          glBindBuffer(GL_ARRAY_BUFFER, slots_vbo[lod]);
+          if (bucket.visible.size() > slots_capacity[lod]) {
+            slots_capacity[lod] = std::max(bucket.visible.size(), 2 * slots_capacity[lod]);
+            glBufferData(GL_ARRAY_BUFFER, slots_capacity[lod] * sizeof(std::uint32_t), nullptr, GL_DYNAMIC_DRAW);
           }
+          glBufferSubData(GL_ARRAY_BUFFER, 0, bucket.visible.size() * sizeof(std::uint32_t), bucket.visible.data());
+          instances.mark_uploaded(lod);
+          LOG(bucket.visible.size());
         }
 
-        glBindVertexArray(vaos[lod]);
-        glBindBuffer(GL_ARRAY_BUFFER, shifts_vbo);
-        glBufferData(GL_ARRAY_BUFFER, cur_shifts.size() * sizeof(glm::vec3), cur_shifts.data(), GL_STATIC_DRAW);
-        LOG(cur_shifts.size());
-
+        glUniformMatrix4fv(mesh_transform_location, 1, GL_FALSE, reinterpret_cast<const float *>(&mesh.transform));
         glDrawElementsInstanced(GL_TRIANGLES,
                                 mesh.indices.count,
                                 mesh.indices.type,
                                 reinterpret_cast<void *>(mesh.indices.view.offset),
-                                cur_shifts.size());
-
+                                bucket.visible.size());
       }
       //LOG(shifts.size());
 